@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#import <AVFoundation/AVFoundation.h>
+
+#import <SFBAudioEngine/SFBDSDDecoding.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Analysis results for one channel of a block of DSD audio
+///
+/// Levels are expressed as a fraction of full modulation, where a stream of all one bits has a level of \c 1
+NS_SWIFT_NAME(DSDAnalyzer.ChannelAnalysis) @interface SFBDSDChannelAnalysis : NSObject
+
++ (instancetype)new NS_UNAVAILABLE;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// The fraction of samples that are one bits, from \c 0 to \c 1
+@property (nonatomic, readonly) double onesDensity;
+/// The DC offset, from \c -1 to \c 1
+@property (nonatomic, readonly) double dcOffset;
+/// The estimated peak level of the audio band
+@property (nonatomic, readonly) double peak;
+/// The number of times the short-term modulation exceeded the analyzer's \c overloadThreshold
+@property (nonatomic, readonly) NSUInteger overloadCount;
+/// The level of the ultrasonic noise in dB relative to full modulation
+@property (nonatomic, readonly) double ultrasonicNoiseLevel;
+
+@end
+
+/// Analysis results for a block of DSD audio
+NS_SWIFT_NAME(DSDAnalyzer.BlockAnalysis) @interface SFBDSDBlockAnalysis : NSObject
+
++ (instancetype)new NS_UNAVAILABLE;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// The position of the first DSD sample in the block
+@property (nonatomic, readonly) AVAudioFramePosition framePosition;
+/// The number of DSD samples in the block
+@property (nonatomic, readonly) AVAudioFramePosition frameLength;
+/// The analysis results for each channel
+@property (nonatomic, readonly) NSArray<SFBDSDChannelAnalysis *> *channels;
+
+@end
+
+/// A block invoked with the analysis results for each block of audio
+/// @param blockAnalysis The analysis results
+/// @param stop A pointer to a \c BOOL which may be set to \c YES to stop analysis
+typedef void (^SFBDSDAnalyzerBlockHandler)(SFBDSDBlockAnalysis *blockAnalysis, BOOL *stop) NS_SWIFT_NAME(DSDAnalyzer.BlockHandler);
+
+/// A class that measures DSD audio without conversion to PCM
+///
+/// The one bit stream is measured using population counts: the ones density over short windows gives the
+/// modulation, from which the DC offset, peak level, modulator overloads, and ultrasonic noise are estimated.
+/// The location of the largest modulation in each decoded buffer is then refined using the dsd2pcm lowpass filter.
+/// Because the filter is only evaluated around candidate peaks, analysis runs many times faster than real time.
+NS_SWIFT_NAME(DSDAnalyzer) @interface SFBDSDAnalyzer : NSObject
+
+/// The duration of each analysis block in seconds, defaults to \c 1
+@property (nonatomic) NSTimeInterval blockDuration;
+
+/// The short-term modulation above which the modulator is considered to be overloaded, defaults to \c 0.5
+///
+/// The Super Audio CD specification limits modulation to 50%
+@property (nonatomic) double overloadThreshold;
+
+/// Analyze the DSD audio at \c url
+/// @param url The URL to analyze
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return The analysis results for each block, or \c nil on error
+- (nullable NSArray<SFBDSDBlockAnalysis *> *)analyzeURL:(NSURL *)url error:(NSError **)error NS_SWIFT_NAME(analyze(_:));
+
+/// Analyze the DSD audio at \c url
+/// @param url The URL to analyze
+/// @param handler A block invoked with the analysis results for each block
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return \c YES on success, \c NO on error
+- (BOOL)analyzeURL:(NSURL *)url blockHandler:(NS_NOESCAPE SFBDSDAnalyzerBlockHandler)handler error:(NSError **)error NS_SWIFT_NAME(analyze(_:blockHandler:));
+
+/// Analyze the audio provided by \c decoder
+///
+/// If \c decoder is not open it will be opened and closed when analysis completes; otherwise analysis begins
+/// at the decoder's current position
+/// @param decoder The decoder providing the DSD audio
+/// @param handler A block invoked with the analysis results for each block
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return \c YES on success, \c NO on error
+- (BOOL)analyzeDecoder:(id <SFBDSDDecoding>)decoder blockHandler:(NS_NOESCAPE SFBDSDAnalyzerBlockHandler)handler error:(NSError **)error NS_SWIFT_NAME(analyze(_:blockHandler:));
+
+@end
+
+/// The \c NSErrorDomain used by \c SFBDSDAnalyzer
+extern NSErrorDomain const SFBDSDAnalyzerErrorDomain NS_SWIFT_NAME(DSDAnalyzer.ErrorDomain);
+
+/// Possible \c NSError error codes used by \c SFBDSDAnalyzer
+typedef NS_ERROR_ENUM(SFBDSDAnalyzerErrorDomain, SFBDSDAnalyzerErrorCode) {
+	/// File format not supported
+	SFBDSDAnalyzerErrorCodeFileFormatNotSupported		= 0,
+} NS_SWIFT_NAME(DSDAnalyzer.ErrorCode);
+
+NS_ASSUME_NONNULL_END
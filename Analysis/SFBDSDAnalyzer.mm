@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#import "SFBDSDAnalyzer.h"
+
+#import "DXD.h"
+#import "NSError+SFBURLPresentation.h"
+#import "SFBDSDDecoder.h"
+
+#define BUFFER_SIZE_PACKETS 16384
+
+// NSError domain for SFBDSDAnalyzer
+NSErrorDomain const SFBDSDAnalyzerErrorDomain = @"org.sbooth.AudioEngine.DSDAnalyzer";
+
+namespace {
+
+	// The number of DSD bytes used by dsd2pcm to warm up its filter
+	const size_t kDXDFilterBytes = 24;
+
+	// An overload ends when the modulation falls below this fraction of the threshold
+	const double kOverloadReleaseRatio = 0.8;
+
+	// Count the one bits in buf
+	uint64_t PopCount(const uint8_t *buf, size_t len)
+	{
+		uint64_t count = 0;
+		while(len >= 8) {
+			uint64_t word;
+			std::memcpy(&word, buf, 8);
+			count += (uint64_t)__builtin_popcountll(word);
+			buf += 8;
+			len -= 8;
+		}
+		while(len--)
+			count += (uint64_t)__builtin_popcount(*buf++);
+		return count;
+	}
+
+	// Measures a single channel of DSD audio
+	//
+	// The modulation is estimated at each byte position using a triangular window formed from two
+	// cascaded boxcar windows of W bytes, computed from prefix sums of byte population counts.
+	// At DSD64 W is 4 bytes (32 samples), giving a lowpass response with its first null at about 88 kHz.
+	// The ultrasonic noise is the difference between the modulation over a short window of W/4 bytes
+	// and the triangular window, which roughly isolates the band from 30 kHz to 150 kHz at DSD64.
+	// Window lengths are scaled with the sample rate so the analysis bands are fixed in frequency.
+	class ChannelAnalyzer
+	{
+	public:
+		explicit ChannelAnalyzer(size_t windowBytes)
+			: mWindowBytes(windowBytes), mShortWindowBytes(std::max(windowBytes / 4, (size_t)1)), mOverloaded(false)
+		{
+			ResetBlock();
+		}
+
+		// Reset the per-block measurements, preserving the history needed for continuity
+		void ResetBlock()
+		{
+			mOnes = 0;
+			mBits = 0;
+			mPeak = 0;
+			mOverloadCount = 0;
+			mUltrasonicEnergy = 0;
+			mUltrasonicCount = 0;
+		}
+
+		void Process(const uint8_t *src, ptrdiff_t stride, size_t count, bool lsbitfirst, double overloadThreshold)
+		{
+			const size_t W = mWindowBytes;
+			const size_t Ws = mShortWindowBytes;
+
+			// Append the new bytes to the retained history
+			auto history = mBytes.size();
+			mBytes.resize(history + count);
+			uint8_t *dst = mBytes.data() + history;
+			if(stride == 1)
+				std::memcpy(dst, src, count);
+			else {
+				for(size_t i = 0; i < count; ++i, src += stride)
+					dst[i] = *src;
+			}
+
+			mOnes += PopCount(dst, count);
+			mBits += 8 * count;
+
+			// Prefix sums of the byte population counts and of the boxcar sums
+			auto n = mBytes.size();
+			mPrefix.resize(n + 1);
+			mBoxcarPrefix.resize(n + 1);
+			mPrefix[0] = 0;
+			mBoxcarPrefix[0] = 0;
+			for(size_t j = 0; j < n; ++j) {
+				mPrefix[j + 1] = mPrefix[j] + (uint32_t)__builtin_popcount(mBytes[j]);
+				mBoxcarPrefix[j + 1] = mBoxcarPrefix[j] + (j + 1 >= W ? mPrefix[j + 1] - mPrefix[j + 1 - W] : 0);
+			}
+
+			const double triangleScale = 2.0 / (8.0 * W * W);
+			const double shortScale = 2.0 / (8.0 * Ws);
+
+			double bufferPeak = -1;
+			size_t bufferPeakCenter = 0;
+
+			for(size_t j = std::max(history, 2 * W - 2); j < n; ++j) {
+				// The triangular window ending at j is centered at j - (W - 1)
+				auto triangle = mBoxcarPrefix[j + 1] - mBoxcarPrefix[j + 1 - W];
+				double modulation = triangle * triangleScale - 1;
+
+				auto center = j - (W - 1);
+				auto shortStart = center - Ws / 2;
+				auto shortWindow = mPrefix[shortStart + Ws] - mPrefix[shortStart];
+				double difference = (shortWindow * shortScale - 1) - modulation;
+				mUltrasonicEnergy += difference * difference;
+				++mUltrasonicCount;
+
+				double magnitude = std::fabs(modulation);
+				if(magnitude > bufferPeak) {
+					bufferPeak = magnitude;
+					bufferPeakCenter = center;
+				}
+
+				// Use hysteresis so noise near the threshold isn't counted as multiple overloads
+				if(!mOverloaded && magnitude > overloadThreshold) {
+					mOverloaded = true;
+					++mOverloadCount;
+				}
+				else if(mOverloaded && magnitude < kOverloadReleaseRatio * overloadThreshold)
+					mOverloaded = false;
+			}
+
+			// Refine the peak using the dsd2pcm filter around the largest modulation
+			if(bufferPeak >= 0) {
+				auto start = bufferPeakCenter > W + kDXDFilterBytes ? bufferPeakCenter - W - kDXDFilterBytes : 0;
+				auto end = std::min(bufferPeakCenter + W + kDXDFilterBytes, n);
+				mPCM.resize(end - start);
+
+				mDXD.Reset();
+				mDXD.Translate(end - start, mBytes.data() + start, 1, lsbitfirst, mPCM.data(), 1);
+
+				if(mPCM.size() > kDXDFilterBytes) {
+					bufferPeak = 0;
+					for(auto i = mPCM.begin() + kDXDFilterBytes; i != mPCM.end(); ++i)
+						bufferPeak = std::max(bufferPeak, (double)std::fabs(*i));
+				}
+
+				mPeak = std::max(mPeak, bufferPeak);
+			}
+
+			// Retain enough history for the windows and the filter
+			auto retain = 2 * W + kDXDFilterBytes;
+			if(n > retain)
+				mBytes.erase(mBytes.begin(), mBytes.end() - (ptrdiff_t)retain);
+		}
+
+		uint64_t mOnes;
+		uint64_t mBits;
+		double mPeak;
+		NSUInteger mOverloadCount;
+		double mUltrasonicEnergy;
+		uint64_t mUltrasonicCount;
+
+	private:
+		size_t mWindowBytes;
+		size_t mShortWindowBytes;
+		bool mOverloaded;
+
+		std::vector<uint8_t> mBytes;
+		std::vector<uint32_t> mPrefix;
+		std::vector<uint64_t> mBoxcarPrefix;
+
+		SFB::DXD mDXD;
+		std::vector<float> mPCM;
+	};
+
+}
+
+@interface SFBDSDChannelAnalysis ()
+- (instancetype)initWithOnesDensity:(double)onesDensity peak:(double)peak overloadCount:(NSUInteger)overloadCount ultrasonicNoiseLevel:(double)ultrasonicNoiseLevel;
+@end
+
+@implementation SFBDSDChannelAnalysis
+
+- (instancetype)initWithOnesDensity:(double)onesDensity peak:(double)peak overloadCount:(NSUInteger)overloadCount ultrasonicNoiseLevel:(double)ultrasonicNoiseLevel
+{
+	if((self = [super init])) {
+		_onesDensity = onesDensity;
+		_dcOffset = 2 * onesDensity - 1;
+		_peak = peak;
+		_overloadCount = overloadCount;
+		_ultrasonicNoiseLevel = ultrasonicNoiseLevel;
+	}
+	return self;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@ %p: ones density %.4f, DC offset %.4f, peak %.4f, %lu overloads, ultrasonic noise %.1f dB>", [self class], self, _onesDensity, _dcOffset, _peak, (unsigned long)_overloadCount, _ultrasonicNoiseLevel];
+}
+
+@end
+
+@interface SFBDSDBlockAnalysis ()
+- (instancetype)initWithFramePosition:(AVAudioFramePosition)framePosition frameLength:(AVAudioFramePosition)frameLength channels:(NSArray<SFBDSDChannelAnalysis *> *)channels;
+@end
+
+@implementation SFBDSDBlockAnalysis
+
+- (instancetype)initWithFramePosition:(AVAudioFramePosition)framePosition frameLength:(AVAudioFramePosition)frameLength channels:(NSArray<SFBDSDChannelAnalysis *> *)channels
+{
+	if((self = [super init])) {
+		_framePosition = framePosition;
+		_frameLength = frameLength;
+		_channels = channels;
+	}
+	return self;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@ %p: frames [%lld, %lld), %@>", [self class], self, _framePosition, _framePosition + _frameLength, _channels];
+}
+
+@end
+
+@implementation SFBDSDAnalyzer
+
+- (instancetype)init
+{
+	if((self = [super init])) {
+		_blockDuration = 1;
+		_overloadThreshold = 0.5;
+	}
+	return self;
+}
+
+- (NSArray<SFBDSDBlockAnalysis *> *)analyzeURL:(NSURL *)url error:(NSError **)error
+{
+	NSMutableArray *blocks = [NSMutableArray array];
+	if(![self analyzeURL:url blockHandler:^(SFBDSDBlockAnalysis *blockAnalysis, BOOL *stop) {
+		[blocks addObject:blockAnalysis];
+	} error:error])
+		return nil;
+	return blocks;
+}
+
+- (BOOL)analyzeURL:(NSURL *)url blockHandler:(SFBDSDAnalyzerBlockHandler)handler error:(NSError **)error
+{
+	NSParameterAssert(url != nil);
+
+	SFBDSDDecoder *decoder = [[SFBDSDDecoder alloc] initWithURL:url error:error];
+	if(!decoder)
+		return NO;
+	return [self analyzeDecoder:decoder blockHandler:handler error:error];
+}
+
+- (BOOL)analyzeDecoder:(id<SFBDSDDecoding>)decoder blockHandler:(SFBDSDAnalyzerBlockHandler)handler error:(NSError **)error
+{
+	NSParameterAssert(decoder != nil);
+	NSParameterAssert(handler != nil);
+
+	BOOL closeDecoder = NO;
+	if(!decoder.isOpen) {
+		// Each channel is processed separately so avoid interleaving if possible
+		decoder.prefersNonInterleavedPackets = YES;
+		if(![decoder openReturningError:error])
+			return NO;
+		closeDecoder = YES;
+	}
+
+	BOOL result = YES;
+
+	const AudioStreamBasicDescription *asbd = decoder.processingFormat.streamDescription;
+	if(asbd->mFormatID != SFBAudioFormatIDDirectStreamDigital) {
+		if(error)
+			*error = [NSError SFB_errorWithDomain:SFBDSDAnalyzerErrorDomain
+											 code:SFBDSDAnalyzerErrorCodeFileFormatNotSupported
+					descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid DSD file.", @"")
+											  url:decoder.inputSource.url
+									failureReason:NSLocalizedString(@"Not a DSD file", @"")
+							   recoverySuggestion:NSLocalizedString(@"The file's format is not supported for DSD analysis.", @"")];
+		result = NO;
+	}
+	else {
+		AVAudioChannelCount channelCount = decoder.processingFormat.channelCount;
+		bool isNonInterleaved = asbd->mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+		bool lsbitfirst = !(asbd->mFormatFlags & kAudioFormatFlagIsBigEndian);
+
+		// Scale the windows so the analysis bands don't depend on the sample rate
+		size_t rateMultiple = std::max((size_t)std::lround(asbd->mSampleRate / SFBDSDSampleRateDSD64), (size_t)1);
+
+		std::vector<ChannelAnalyzer> channels;
+		channels.reserve(channelCount);
+		for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+			channels.emplace_back(4 * rateMultiple);
+
+		AVAudioPacketCount packetsPerBlock = (AVAudioPacketCount)std::max(std::lround(_blockDuration * asbd->mSampleRate / SFB_PCM_FRAMES_PER_DSD_PACKET), 1l);
+		AVAudioCompressedBuffer *buffer = [[AVAudioCompressedBuffer alloc] initWithFormat:decoder.processingFormat packetCapacity:BUFFER_SIZE_PACKETS maximumPacketSize:(SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * channelCount)];
+
+		AVAudioFramePosition blockPacketPosition = decoder.packetPosition;
+		AVAudioPacketCount blockPacketCount = 0;
+		BOOL stop = NO;
+
+		for(;;) {
+			// Buffers are not allowed to span blocks
+			AVAudioPacketCount packetsToDecode = std::min(buffer.packetCapacity, packetsPerBlock - blockPacketCount);
+			if(![decoder decodeIntoBuffer:buffer packetCount:packetsToDecode error:error]) {
+				result = NO;
+				break;
+			}
+
+			AVAudioPacketCount packetCount = buffer.packetCount;
+			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
+				const uint8_t *input = (const uint8_t *)buffer.data + (isNonInterleaved ? channel * packetCount : channel);
+				channels[channel].Process(input, isNonInterleaved ? 1 : channelCount, packetCount, lsbitfirst, _overloadThreshold);
+			}
+
+			blockPacketCount += packetCount;
+
+			if(blockPacketCount > 0 && (blockPacketCount == packetsPerBlock || packetCount == 0)) {
+				NSMutableArray *channelAnalyses = [NSMutableArray arrayWithCapacity:channelCount];
+				for(auto& channel : channels) {
+					double onesDensity = channel.mBits ? (double)channel.mOnes / channel.mBits : 0.5;
+					double ultrasonicNoiseLevel = channel.mUltrasonicCount ? 10 * std::log10(channel.mUltrasonicEnergy / channel.mUltrasonicCount) : -INFINITY;
+					[channelAnalyses addObject:[[SFBDSDChannelAnalysis alloc] initWithOnesDensity:onesDensity peak:channel.mPeak overloadCount:channel.mOverloadCount ultrasonicNoiseLevel:ultrasonicNoiseLevel]];
+					channel.ResetBlock();
+				}
+
+				handler([[SFBDSDBlockAnalysis alloc] initWithFramePosition:(blockPacketPosition * SFB_PCM_FRAMES_PER_DSD_PACKET) frameLength:(blockPacketCount * SFB_PCM_FRAMES_PER_DSD_PACKET) channels:channelAnalyses], &stop);
+
+				blockPacketPosition += blockPacketCount;
+				blockPacketCount = 0;
+			}
+
+			if(packetCount == 0 || stop)
+				break;
+		}
+	}
+
+	if(closeDecoder && ![decoder closeReturningError:result ? error : nil])
+		result = NO;
+
+	return result;
+}
+
+@end
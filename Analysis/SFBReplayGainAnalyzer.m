@@ -386,6 +386,7 @@ static float AnalyzeResult(uint32_t *array, size_t len)
 	NSParameterAssert(url != nil);
 
 	SFBAudioDecoder *decoder = [[SFBAudioDecoder alloc] initWithURL:url error:error];
+	decoder.decodesInBulk = YES;
 	if(!decoder || ![decoder openReturningError:error])
 		return nil;
 
@@ -9,6 +9,7 @@
 
 #import "NSError+SFBURLPresentation.h"
 #import "SFBAudioDecoder.h"
+#import "SFBAudioDecoder+Internal.h"
 #import "AVAudioFormat+SFBFormatTransformation.h"
 
 // NSError domain for SFBAudioExporter
@@ -26,6 +27,7 @@ NSErrorDomain const SFBAudioExporterErrorDomain = @"org.sbooth.AudioEngine.Audio
 	SFBAudioDecoder *decoder = [[SFBAudioDecoder alloc] initWithURL:sourceURL error:error];
 	if(!decoder)
 		return NO;
+	decoder.decodesInBulk = YES;
 	return [self exportDecoder:decoder toURL:targetURL error:error];
 }
 
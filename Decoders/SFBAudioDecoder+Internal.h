@@ -18,18 +18,36 @@ extern os_log_t gSFBAudioDecoderLog;
 @protected
 	AVAudioFormat *_sourceFormat;
 	AVAudioFormat *_processingFormat;
+@private
+	// Audio lent by the default implementation of -borrowBufferList:frameLength:maximumFrameLength:error:
+	AVAudioPCMBuffer *_borrowedBuffer;
 }
+// Set before opening to indicate audio will be decoded sequentially as quickly as possible,
+// as when converting or analyzing, so decoders may trade memory and open latency for throughput
+@property (nonatomic) BOOL decodesInBulk;
 @end
 
+// Skips frames by seeking if supported and by decoding and discarding otherwise
+FOUNDATION_EXTERN BOOL SFBPCMDecoderSkipFrames(id <SFBPCMDecoding> decoder, AVAudioFramePosition frameLength, NSError **error);
+// Skips frames by decoding and discarding
+FOUNDATION_EXTERN BOOL SFBPCMDecoderDiscardFrames(id <SFBPCMDecoding> decoder, AVAudioFramePosition frameLength, NSError **error);
+
 @interface SFBAudioDecoderSubclassInfo : NSObject
 @property (nonatomic) Class klass;
 @property (nonatomic) int priority;
 @end
 
 @interface SFBAudioDecoder (SFBAudioDecoderSubclassLookup)
+// Returns the subclass for inputSource using mimeType, the path extension, and the file's contents
++ (nullable Class)subclassForInputSource:(SFBInputSource *)inputSource mimeType:(nullable NSString *)mimeType error:(NSError **)error;
 + (nullable Class)subclassForURL:(NSURL *)url;
 + (nullable Class)subclassForPathExtension:(NSString *)extension;
 + (nullable Class)subclassForMIMEType:(NSString *)mimeType;
+// Returns the registered subclass with the highest nonzero score for prefix, preferring higher priority subclasses for equal scores
++ (nullable Class)subclassForPrefix:(NSData *)prefix score:(nullable SFBAudioDecoderProbeScore *)score;
 @end
 
+// Returns the first bytes of inputSource following any ID3v2 tag, or nil if inputSource can't be examined without consuming it
+FOUNDATION_EXTERN NSData * _Nullable SFBAudioDecoderReadProbePrefix(SFBInputSource *inputSource);
+
 NS_ASSUME_NONNULL_END
@@ -40,16 +40,46 @@ NS_SWIFT_NAME(AudioDecoder) @interface SFBAudioDecoder : NSObject <SFBPCMDecodin
 - (BOOL)openReturningError:(NSError **)error NS_REQUIRES_SUPER;
 - (BOOL)closeReturningError:(NSError **)error NS_REQUIRES_SUPER;
 
+/// Closes the decoder and opens it for a new input source
+///
+/// Where the underlying library allows it, codec state and buffers are reused instead of being recreated,
+/// which reduces the cost of decoding many files of the same type in succession.
+/// @param inputSource The input source to decode, which must be in a format supported by the receiver's class
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return \c YES on success, \c NO otherwise
+- (BOOL)reopenWithInputSource:(SFBInputSource *)inputSource error:(NSError **)error NS_SWIFT_NAME(reopen(inputSource:));
+
 @end
 
 #pragma mark - Subclass Registration
 
+/// How closely the beginning of a file matches a decoder's format
+typedef NS_ENUM(NSInteger, SFBAudioDecoderProbeScore) {
+	/// The file is not in a supported format
+	SFBAudioDecoderProbeScoreNone		= 0,
+	/// The file may be in a supported format, but another decoder is likely better suited
+	SFBAudioDecoderProbeScorePossible	= 25,
+	/// The file is likely in a supported format
+	SFBAudioDecoderProbeScoreLikely		= 50,
+	/// The file is in a supported format
+	SFBAudioDecoderProbeScoreCertain	= 100
+} NS_SWIFT_NAME(AudioDecoder.ProbeScore);
+
 @interface SFBAudioDecoder (SFBAudioDecoderSubclassRegistration)
 /// Register a subclass with the default priority (\c 0)
 + (void)registerSubclass:(Class)subclass;
 
 /// Register a subclass with the specified priority
 + (void)registerSubclass:(Class)subclass priority:(int)priority;
+
+/// Returns how closely \c prefix matches the subclass's format
+///
+/// When the input source supports seeking, decoders are chosen by comparing the scores of all registered
+/// subclasses for the first bytes of the file, so a missing or incorrect path extension doesn't prevent decoding.
+/// The default implementation returns \c SFBAudioDecoderProbeScoreNone.
+/// @param prefix The first bytes of the file following any ID3v2 tag, which may be shorter than the file's headers
+/// @return The score for \c prefix
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix;
 @end
 
 #pragma mark - Error Information
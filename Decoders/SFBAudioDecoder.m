@@ -114,48 +114,16 @@ static NSMutableArray *_registeredSubclasses = nil;
 {
 	NSParameterAssert(inputSource != nil);
 
-	// The MIME type takes precedence over the file extension
-	if(mimeType) {
-		Class subclass = [SFBAudioDecoder subclassForMIMEType:mimeType.lowercaseString];
-		if(subclass && (self = [[subclass alloc] init])) {
+	// A registered subclass decodes the input source itself instead of looking up a decoder
+	if([self class] != [SFBAudioDecoder class]) {
+		if((self = [super init]))
 			_inputSource = inputSource;
-			return self;
-		}
-		os_log_debug(gSFBAudioDecoderLog, "SFBAudioDecoder unsupported MIME type: %{public}@", mimeType);
+		return self;
 	}
 
-	// If no MIME type was specified, use the extension-based resolvers
-
-	// TODO: Some extensions (.oga for example) support multiple audio codecs (Vorbis, FLAC, Speex)
-	// and if openDecoder is false the wrong decoder type may be returned, since the file isn't analyzed
-	// until Open() is called
-
-	NSString *pathExtension = inputSource.url.pathExtension;
-	if(!pathExtension) {
-		if(error)
-			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
-											 code:SFBAudioDecoderErrorCodeInputOutput
-					descriptionFormatStringForURL:NSLocalizedString(@"The type of the file “%@” could not be determined.", @"")
-											  url:inputSource.url
-									failureReason:NSLocalizedString(@"Unknown file type", @"")
-							   recoverySuggestion:NSLocalizedString(@"The file's extension may be missing or may not match the file's type.", @"")];
-		return nil;
-	}
-
-	Class subclass = [SFBAudioDecoder subclassForPathExtension:pathExtension.lowercaseString];
-	if(!subclass) {
-		os_log_debug(gSFBAudioDecoderLog, "SFBAudioDecoder unsupported path extension: %{public}@", pathExtension);
-
-		if(error)
-			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
-											 code:SFBAudioDecoderErrorCodeInputOutput
-					descriptionFormatStringForURL:NSLocalizedString(@"The type of the file “%@” is not supported.", @"")
-											  url:inputSource.url
-									failureReason:NSLocalizedString(@"Unsupported file type", @"")
-							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
-
+	Class subclass = [SFBAudioDecoder subclassForInputSource:inputSource mimeType:mimeType error:error];
+	if(!subclass)
 		return nil;
-	}
 
 	if((self = [[subclass alloc] init]))
 		_inputSource = inputSource;
@@ -178,12 +146,28 @@ static NSMutableArray *_registeredSubclasses = nil;
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+	_borrowedBuffer = nil;
+
 	if(_inputSource.isOpen)
 		return [_inputSource closeReturningError:error];
 
 	return YES;
 }
 
+- (BOOL)reopenWithInputSource:(SFBInputSource *)inputSource error:(NSError **)error
+{
+	NSParameterAssert(inputSource != nil);
+
+	// A failure closing the previous input source doesn't affect the new one
+	// Decoders that were never opened are not closed since subclasses may not expect it
+	NSError *closeError = nil;
+	if(self.isOpen && ![self closeReturningError:&closeError])
+		os_log_info(gSFBAudioDecoderLog, "Error closing %{public}@: %{public}@", _inputSource.url, closeError);
+
+	_inputSource = inputSource;
+	return [self openReturningError:error];
+}
+
 - (BOOL)isOpen
 {
 	[self doesNotRecognizeSelector:_cmd];
@@ -214,8 +198,91 @@ static NSMutableArray *_registeredSubclasses = nil;
 	__builtin_unreachable();
 }
 
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	return SFBPCMDecoderSkipFrames(self, frameLength, error);
+}
+
+- (BOOL)borrowBufferList:(const AudioBufferList **)bufferList frameLength:(AVAudioFrameCount *)frameLength maximumFrameLength:(AVAudioFrameCount)maximumFrameLength error:(NSError **)error
+{
+	NSParameterAssert(bufferList != NULL);
+	NSParameterAssert(frameLength != NULL);
+	NSParameterAssert(maximumFrameLength > 0);
+
+	// Subclasses that don't lend their own memory decode into a buffer owned by the decoder
+	if(!_borrowedBuffer || _borrowedBuffer.frameCapacity < maximumFrameLength || ![_borrowedBuffer.format isEqual:_processingFormat]) {
+		_borrowedBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:maximumFrameLength];
+		if(!_borrowedBuffer) {
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return NO;
+		}
+	}
+
+	if(![self decodeIntoBuffer:_borrowedBuffer frameLength:maximumFrameLength error:error])
+		return NO;
+
+	*bufferList = _borrowedBuffer.audioBufferList;
+	*frameLength = _borrowedBuffer.frameLength;
+
+	return YES;
+}
+
 @end
 
+#define DISCARD_BUFFER_SIZE_FRAMES 4096
+
+BOOL SFBPCMDecoderSkipFrames(id <SFBPCMDecoding> decoder, AVAudioFramePosition frameLength, NSError **error)
+{
+	NSCParameterAssert(decoder != nil);
+	NSCParameterAssert(frameLength >= 0);
+
+	AVAudioFramePosition framePosition = decoder.framePosition;
+	if(!decoder.supportsSeeking || framePosition == SFBUnknownFramePosition)
+		return SFBPCMDecoderDiscardFrames(decoder, frameLength, error);
+
+	AVAudioFramePosition frame = framePosition + frameLength;
+	AVAudioFramePosition totalFrames = decoder.frameLength;
+
+	// Many decoders can't seek to the end of the audio, so seek to the last frame and discard it
+	if(totalFrames != SFBUnknownFrameLength && frame >= totalFrames) {
+		if(framePosition >= totalFrames)
+			return YES;
+		return [decoder seekToFrame:(totalFrames - 1) error:error] && SFBPCMDecoderDiscardFrames(decoder, 1, error);
+	}
+
+	return [decoder seekToFrame:frame error:error];
+}
+
+BOOL SFBPCMDecoderDiscardFrames(id <SFBPCMDecoding> decoder, AVAudioFramePosition frameLength, NSError **error)
+{
+	NSCParameterAssert(decoder != nil);
+	NSCParameterAssert(frameLength >= 0);
+
+	if(frameLength == 0)
+		return YES;
+
+	AVAudioPCMBuffer *buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:decoder.processingFormat frameCapacity:(AVAudioFrameCount)MIN(frameLength, DISCARD_BUFFER_SIZE_FRAMES)];
+	if(!buffer) {
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return NO;
+	}
+
+	while(frameLength > 0) {
+		if(![decoder decodeIntoBuffer:buffer frameLength:(AVAudioFrameCount)MIN(frameLength, buffer.frameCapacity) error:error])
+			return NO;
+
+		// EOS
+		if(buffer.frameLength == 0)
+			break;
+
+		frameLength -= buffer.frameLength;
+	}
+
+	return YES;
+}
+
 @implementation SFBAudioDecoderSubclassInfo
 @end
 
@@ -245,10 +312,60 @@ static NSMutableArray *_registeredSubclasses = nil;
 	}];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+#pragma unused(prefix)
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 @end
 
 @implementation SFBAudioDecoder (SFBAudioDecoderSubclassLookup)
 
++ (Class)subclassForInputSource:(SFBInputSource *)inputSource mimeType:(NSString *)mimeType error:(NSError **)error
+{
+	NSParameterAssert(inputSource != nil);
+
+	// The MIME type takes precedence over the file extension
+	if(mimeType) {
+		Class subclass = [self subclassForMIMEType:mimeType.lowercaseString];
+		if(subclass)
+			return subclass;
+		os_log_debug(gSFBAudioDecoderLog, "SFBAudioDecoder unsupported MIME type: %{public}@", mimeType);
+	}
+
+	// If no MIME type was specified, use the extension-based resolvers
+	NSString *pathExtension = inputSource.url.pathExtension.lowercaseString;
+	Class subclass = pathExtension.length ? [self subclassForPathExtension:pathExtension] : nil;
+
+	// Examine the file's contents when possible since the extension may be missing or incorrect,
+	// and some extensions (.oga for example) are used for multiple audio codecs (Vorbis, FLAC, Speex)
+	NSData *prefix = SFBAudioDecoderReadProbePrefix(inputSource);
+	if(prefix) {
+		SFBAudioDecoderProbeScore score;
+		Class probedSubclass = [self subclassForPrefix:prefix score:&score];
+		// The extension breaks ties
+		if(probedSubclass && probedSubclass != subclass && (!subclass || [subclass probeScoreForPrefix:prefix] < score)) {
+			os_log_debug(gSFBAudioDecoderLog, "Using %{public}@ for %{public}@ based on its contents", NSStringFromClass(probedSubclass), inputSource.url);
+			subclass = probedSubclass;
+		}
+	}
+
+	if(!subclass) {
+		os_log_debug(gSFBAudioDecoderLog, "SFBAudioDecoder unsupported file type: %{public}@", inputSource.url);
+
+		if(error)
+			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+											 code:SFBAudioDecoderErrorCodeInputOutput
+					descriptionFormatStringForURL:NSLocalizedString(@"The type of the file “%@” is not supported.", @"")
+											  url:inputSource.url
+									failureReason:NSLocalizedString(@"Unsupported file type", @"")
+							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+	}
+
+	return subclass;
+}
+
 + (Class)subclassForURL:(NSURL *)url
 {
 	// TODO: Handle MIME types?
@@ -280,4 +397,71 @@ static NSMutableArray *_registeredSubclasses = nil;
 	return nil;
 }
 
++ (Class)subclassForPrefix:(NSData *)prefix score:(SFBAudioDecoderProbeScore *)score
+{
+	Class bestSubclass = nil;
+	SFBAudioDecoderProbeScore bestScore = SFBAudioDecoderProbeScoreNone;
+
+	// Subclasses are sorted by priority so only a strictly higher score replaces the best match
+	for(SFBAudioDecoderSubclassInfo *subclassInfo in _registeredSubclasses) {
+		SFBAudioDecoderProbeScore subclassScore = [subclassInfo.klass probeScoreForPrefix:prefix];
+		if(subclassScore > bestScore) {
+			bestSubclass = subclassInfo.klass;
+			bestScore = subclassScore;
+			if(bestScore >= SFBAudioDecoderProbeScoreCertain)
+				break;
+		}
+	}
+
+	if(score)
+		*score = bestScore;
+
+	return bestSubclass;
+}
+
 @end
+
+#define PROBE_PREFIX_SIZE 4096
+
+NSData * SFBAudioDecoderReadProbePrefix(SFBInputSource *inputSource)
+{
+	NSCParameterAssert(inputSource != nil);
+
+	BOOL wasOpen = inputSource.isOpen;
+	if(!wasOpen && ![inputSource openReturningError:nil])
+		return nil;
+
+	NSData *prefix = nil;
+
+	// The prefix can only be read if the input source can be returned to its current position
+	NSInteger offset;
+	if(inputSource.supportsSeeking && [inputSource getOffset:&offset error:nil] && [inputSource seekToOffset:0 error:nil]) {
+		NSMutableData *data = [NSMutableData dataWithLength:PROBE_PREFIX_SIZE];
+		uint8_t *bytes = data.mutableBytes;
+
+		NSInteger bytesRead;
+		if([inputSource readBytes:bytes length:PROBE_PREFIX_SIZE bytesRead:&bytesRead error:nil]) {
+			// Skip an ID3v2 tag
+			if(bytesRead >= 10 && !memcmp(bytes, "ID3", 3)) {
+				NSInteger tagSize = 10 + (((NSInteger)bytes[6] & 0x7f) << 21 | ((NSInteger)bytes[7] & 0x7f) << 14 | ((NSInteger)bytes[8] & 0x7f) << 7 | ((NSInteger)bytes[9] & 0x7f));
+				// Footer present
+				if(bytes[5] & 0x10)
+					tagSize += 10;
+
+				if(![inputSource seekToOffset:tagSize error:nil] || ![inputSource readBytes:bytes length:PROBE_PREFIX_SIZE bytesRead:&bytesRead error:nil])
+					bytesRead = 0;
+			}
+
+			data.length = (NSUInteger)bytesRead;
+			prefix = data;
+		}
+
+		if(![inputSource seekToOffset:offset error:nil])
+			prefix = nil;
+	}
+
+	if(!wasOpen)
+		[inputSource closeReturningError:nil];
+
+	return prefix;
+}
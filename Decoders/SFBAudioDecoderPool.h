@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#import <SFBAudioEngine/SFBAudioDecoder.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// A collection of idle decoders that are reopened for new input sources instead of being created for each file
+///
+/// Idle decoders are kept separately for each decoder class, and a decoder is reused only for input sources
+/// that would otherwise be decoded by a new instance of its class. A pool may be used from multiple threads.
+NS_SWIFT_NAME(AudioDecoderPool) @interface SFBAudioDecoderPool : NSObject
+
+/// The maximum number of idle decoders kept for each decoder class (default \c 4)
+@property NSUInteger maximumIdleDecodersPerClass;
+
+/// Returns an open decoder for \c url
+/// @param url The URL to decode
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return An open decoder or \c nil on error
+- (nullable SFBAudioDecoder *)decoderForURL:(NSURL *)url error:(NSError **)error NS_SWIFT_NAME(decoder(url:));
+
+/// Returns an open decoder for \c inputSource
+/// @param inputSource The input source to decode
+/// @param mimeType An optional MIME type used to select the decoder class
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return An open decoder or \c nil on error
+- (nullable SFBAudioDecoder *)decoderForInputSource:(SFBInputSource *)inputSource mimeType:(nullable NSString *)mimeType error:(NSError **)error NS_SWIFT_NAME(decoder(inputSource:mimeType:));
+
+/// Closes \c decoder and makes it available for reuse
+///
+/// The decoder must not be used after it is recycled.
+/// @param decoder The decoder to recycle
+- (void)recycleDecoder:(SFBAudioDecoder *)decoder NS_SWIFT_NAME(recycle(_:));
+
+/// Releases all idle decoders
+- (void)removeAllIdleDecoders;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+@import os.lock;
+@import os.log;
+
+#import "SFBAudioDecoderPool.h"
+
+#import "SFBAudioDecoder+Internal.h"
+
+#define DEFAULT_MAXIMUM_IDLE_DECODERS_PER_CLASS 4
+
+@interface SFBAudioDecoderPool ()
+{
+@private
+	os_unfair_lock _lock;
+	// Idle decoders keyed by class, protected by _lock
+	NSMutableDictionary *_idleDecoders;
+	// Protected by _lock
+	NSUInteger _maximumIdleDecodersPerClass;
+}
+@end
+
+@implementation SFBAudioDecoderPool
+
+- (instancetype)init
+{
+	if((self = [super init])) {
+		_lock = OS_UNFAIR_LOCK_INIT;
+		_idleDecoders = [NSMutableDictionary dictionary];
+		_maximumIdleDecodersPerClass = DEFAULT_MAXIMUM_IDLE_DECODERS_PER_CLASS;
+	}
+	return self;
+}
+
+- (NSUInteger)maximumIdleDecodersPerClass
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger maximumIdleDecodersPerClass = _maximumIdleDecodersPerClass;
+	os_unfair_lock_unlock(&_lock);
+	return maximumIdleDecodersPerClass;
+}
+
+- (void)setMaximumIdleDecodersPerClass:(NSUInteger)maximumIdleDecodersPerClass
+{
+	os_unfair_lock_lock(&_lock);
+	_maximumIdleDecodersPerClass = maximumIdleDecodersPerClass;
+	os_unfair_lock_unlock(&_lock);
+}
+
+- (SFBAudioDecoder *)decoderForURL:(NSURL *)url error:(NSError **)error
+{
+	NSParameterAssert(url != nil);
+
+	SFBInputSource *inputSource = [SFBInputSource inputSourceForURL:url flags:0 error:error];
+	if(!inputSource)
+		return nil;
+	return [self decoderForInputSource:inputSource mimeType:nil error:error];
+}
+
+- (SFBAudioDecoder *)decoderForInputSource:(SFBInputSource *)inputSource mimeType:(NSString *)mimeType error:(NSError **)error
+{
+	NSParameterAssert(inputSource != nil);
+
+	Class subclass = [SFBAudioDecoder subclassForInputSource:inputSource mimeType:mimeType error:error];
+	if(!subclass)
+		return nil;
+
+	os_unfair_lock_lock(&_lock);
+	SFBAudioDecoder *decoder = _idleDecoders[subclass].lastObject;
+	if(decoder)
+		[_idleDecoders[subclass] removeLastObject];
+	os_unfair_lock_unlock(&_lock);
+
+	// A new decoder is opened the same way as a reused one
+	if(!decoder)
+		decoder = [[subclass alloc] init];
+
+	if(![decoder reopenWithInputSource:inputSource error:error])
+		return nil;
+
+	return decoder;
+}
+
+- (void)recycleDecoder:(SFBAudioDecoder *)decoder
+{
+	NSParameterAssert(decoder != nil);
+
+	NSError *error = nil;
+	if(![decoder closeReturningError:&error])
+		os_log_info(gSFBAudioDecoderLog, "Error closing %{public}@: %{public}@", decoder.inputSource.url, error);
+
+	decoder.decodesInBulk = NO;
+
+	Class subclass = [decoder class];
+
+	os_unfair_lock_lock(&_lock);
+	NSMutableArray *decoders = _idleDecoders[subclass];
+	if(!decoders) {
+		decoders = [NSMutableArray array];
+		_idleDecoders[(id <NSCopying>)subclass] = decoders;
+	}
+	if(decoders.count < _maximumIdleDecodersPerClass)
+		[decoders addObject:decoder];
+	os_unfair_lock_unlock(&_lock);
+}
+
+- (void)removeAllIdleDecoders
+{
+	// The decoders are released outside the lock since deallocation frees codec state
+	NSMutableDictionary *idleDecoders = [NSMutableDictionary dictionary];
+	os_unfair_lock_lock(&_lock);
+	NSMutableDictionary *previousIdleDecoders = _idleDecoders;
+	_idleDecoders = idleDecoders;
+	os_unfair_lock_unlock(&_lock);
+	[previousIdleDecoders removeAllObjects];
+}
+
+@end
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#import <SFBAudioEngine/SFBPCMDecoding.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// A size-limited cache of fully decoded audio used by \c SFBCachedPCMDecoder
+///
+/// Entries are keyed by URL, modification date, and format, and are evicted in least recently used order.
+/// Cached audio is immutable and shared by every decoder reading it, so an evicted entry's memory is freed
+/// once the last decoder using it is released. A cache may be used from multiple threads.
+NS_SWIFT_NAME(PCMDecoderCache) @interface SFBPCMDecoderCache : NSObject
+
+/// Returns the shared cache
+@property (class, nonatomic, readonly) SFBPCMDecoderCache *sharedCache;
+
+/// Returns an initialized \c SFBPCMDecoderCache object with a maximum size of 32 MiB
+- (instancetype)init;
+
+/// Returns an initialized \c SFBPCMDecoderCache object
+/// @param maximumSize The maximum size of the cached audio, in bytes
+- (instancetype)initWithMaximumSize:(NSUInteger)maximumSize NS_DESIGNATED_INITIALIZER;
+
+/// The maximum size of the cached audio, in bytes
+///
+/// Audio larger than this is decoded but not cached. Reducing the maximum size evicts entries as required.
+@property (nonatomic) NSUInteger maximumSize;
+
+/// The size of the cached audio, in bytes
+@property (nonatomic, readonly) NSUInteger size;
+
+/// The number of cached entries
+@property (nonatomic, readonly) NSUInteger entryCount;
+
+/// The number of decoders opened using cached audio
+@property (nonatomic, readonly) NSUInteger hitCount;
+
+/// The number of decoders that decoded their audio
+@property (nonatomic, readonly) NSUInteger missCount;
+
+/// The number of entries removed to make room for others
+@property (nonatomic, readonly) NSUInteger evictionCount;
+
+/// Removes all cached entries
+- (void)removeAllEntries;
+
+/// Sets \c hitCount, \c missCount, and \c evictionCount to \c 0
+- (void)resetStatistics;
+
+@end
+
+/// A decoder supplying audio from an \c SFBPCMDecoderCache
+///
+/// When opened the audio for the URL is taken from the cache if present, and otherwise decoded in its entirety
+/// and added to the cache. Decoding copies from the cached audio and borrowed decoding lends it directly.
+NS_SWIFT_NAME(CachedPCMDecoder) @interface SFBCachedPCMDecoder : NSObject <SFBPCMDecoding>
+
++ (instancetype)new NS_UNAVAILABLE;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Returns an initialized \c SFBCachedPCMDecoder object using the shared cache or \c nil on error
+/// @param url The URL to decode
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return An initialized \c SFBCachedPCMDecoder object or \c nil on error
+- (nullable instancetype)initWithURL:(NSURL *)url error:(NSError **)error;
+
+/// Returns an initialized \c SFBCachedPCMDecoder object or \c nil on error
+/// @param url The URL to decode
+/// @param processingFormat The format of decoded audio or \c nil for the processing format of the URL's decoder
+/// @param cache The cache to use
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return An initialized \c SFBCachedPCMDecoder object or \c nil on error
+- (nullable instancetype)initWithURL:(NSURL *)url processingFormat:(nullable AVAudioFormat *)processingFormat cache:(SFBPCMDecoderCache *)cache error:(NSError **)error NS_DESIGNATED_INITIALIZER;
+
+/// The cache supplying audio
+@property (nonatomic, readonly) SFBPCMDecoderCache *cache;
+
+@end
+
+NS_ASSUME_NONNULL_END
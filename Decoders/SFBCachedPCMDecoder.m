@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+@import os.lock;
+@import os.log;
+
+#import "SFBCachedPCMDecoder.h"
+
+#import "AVAudioPCMBuffer+SFBBufferUtilities.h"
+#import "NSError+SFBURLPresentation.h"
+#import "SFBAudioDecoder+Internal.h"
+
+#define DEFAULT_MAXIMUM_CACHE_SIZE (32 * 1024 * 1024)
+#define BUFFER_SIZE_FRAMES 16384
+
+static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b) { return a < b ? a : b; }
+
+// Returns the key for the audio in url decoded to format, or to the native processing format if format is nil
+static NSString * SFBPCMDecoderCacheKey(NSURL *url, NSDate *modificationDate, AVAudioFormat *format)
+{
+	if(!format)
+		return [NSString stringWithFormat:@"%@ %f", url.absoluteString, modificationDate.timeIntervalSinceReferenceDate];
+
+	const AudioStreamBasicDescription *asbd = format.streamDescription;
+	return [NSString stringWithFormat:@"%@ %f %u %u %g %u %u %u", url.absoluteString, modificationDate.timeIntervalSinceReferenceDate, asbd->mFormatID, asbd->mFormatFlags, asbd->mSampleRate, asbd->mChannelsPerFrame, asbd->mBitsPerChannel, format.channelLayout.layoutTag];
+}
+
+// Decodes all audio from decoder, converting it to format if required
+static AVAudioPCMBuffer * SFBDecodeAllAudio(id <SFBPCMDecoding> decoder, AVAudioFormat *format, NSError **error)
+{
+	AVAudioConverter *converter = nil;
+	AVAudioPCMBuffer *decodeBuffer = nil;
+	if(![format isEqual:decoder.processingFormat]) {
+		converter = [[AVAudioConverter alloc] initFromFormat:decoder.processingFormat toFormat:format];
+		if(!converter) {
+			if(error)
+				*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+												 code:SFBAudioDecoderErrorCodeInputOutput
+						descriptionFormatStringForURL:NSLocalizedString(@"The format of the file “%@” is not supported.", @"")
+												  url:decoder.inputSource.url
+										failureReason:NSLocalizedString(@"Unsupported file format", @"")
+								   recoverySuggestion:NSLocalizedString(@"The file's format can't be converted to the requested format.", @"")];
+			return nil;
+		}
+
+		decodeBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:decoder.processingFormat frameCapacity:BUFFER_SIZE_FRAMES];
+		if(!decodeBuffer) {
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return nil;
+		}
+	}
+
+	// The length of the audio isn't always known in advance so it is decoded in chunks
+	NSMutableArray<AVAudioPCMBuffer *> *chunks = [NSMutableArray array];
+	AVAudioFramePosition frameLength = 0;
+
+	for(;;) {
+		AVAudioPCMBuffer *chunk = [[AVAudioPCMBuffer alloc] initWithPCMFormat:format frameCapacity:BUFFER_SIZE_FRAMES];
+		if(!chunk) {
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return nil;
+		}
+
+		BOOL endOfStream = NO;
+		if(converter) {
+			__block NSError *err = nil;
+			__block BOOL decodeFailed = NO;
+			AVAudioConverterOutputStatus status = [converter convertToBuffer:chunk error:&err withInputFromBlock:^AVAudioBuffer * _Nullable(AVAudioPacketCount inNumberOfPackets, AVAudioConverterInputStatus * _Nonnull outStatus) {
+				if(![decoder decodeIntoBuffer:decodeBuffer frameLength:inNumberOfPackets error:&err]) {
+					os_log_error(gSFBAudioDecoderLog, "Error decoding audio: %{public}@", err);
+					decodeFailed = YES;
+					*outStatus = AVAudioConverterInputStatus_NoDataNow;
+					return nil;
+				}
+
+				*outStatus = decodeBuffer.frameLength == 0 ? AVAudioConverterInputStatus_EndOfStream : AVAudioConverterInputStatus_HaveData;
+				return decodeBuffer;
+			}];
+
+			// Truncated audio is not cached
+			if(decodeFailed || status == AVAudioConverterOutputStatus_Error) {
+				if(error)
+					*error = err;
+				return nil;
+			}
+
+			endOfStream = status == AVAudioConverterOutputStatus_EndOfStream;
+		}
+		else if(![decoder decodeIntoBuffer:chunk frameLength:chunk.frameCapacity error:error])
+			return nil;
+
+		if(chunk.frameLength == 0)
+			break;
+
+		[chunks addObject:chunk];
+		frameLength += chunk.frameLength;
+
+		if(endOfStream)
+			break;
+	}
+
+	if(frameLength > UINT32_MAX) {
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EFBIG userInfo:nil];
+		return nil;
+	}
+
+	AVAudioPCMBuffer *buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:format frameCapacity:(AVAudioFrameCount)MAX(frameLength, 1)];
+	if(!buffer) {
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return nil;
+	}
+
+	for(AVAudioPCMBuffer *chunk in chunks)
+		[buffer appendContentsOfBuffer:chunk];
+
+	return buffer;
+}
+
+// Returns the number of bytes of audio in buffer
+static NSUInteger SFBAudioSize(AVAudioPCMBuffer *buffer)
+{
+	const AudioBufferList *bufferList = buffer.audioBufferList;
+	NSUInteger size = 0;
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		size += bufferList->mBuffers[i].mDataByteSize;
+	return size;
+}
+
+// An immutable cached audio buffer
+@interface SFBPCMDecoderCacheEntry : NSObject
+@property (nonatomic) AVAudioPCMBuffer *buffer;
+@property (nonatomic) AVAudioFormat *sourceFormat;
+@property (nonatomic) NSUInteger size;
+@end
+
+@implementation SFBPCMDecoderCacheEntry
+@end
+
+@interface SFBPCMDecoderCache ()
+{
+@private
+	os_unfair_lock _lock;
+	// The following are protected by _lock
+	NSUInteger _maximumSize;
+	NSUInteger _size;
+	NSUInteger _hitCount;
+	NSUInteger _missCount;
+	NSUInteger _evictionCount;
+	// Cached entries, protected by _lock
+	NSMutableDictionary<NSString *, SFBPCMDecoderCacheEntry *> *_entries;
+	// Keys in _entries from least to most recently used, protected by _lock
+	NSMutableOrderedSet<NSString *> *_recentlyUsedKeys;
+}
+// Returns the cached entry for url, decoding and caching the audio if not present
+- (nullable SFBPCMDecoderCacheEntry *)entryForURL:(NSURL *)url processingFormat:(nullable AVAudioFormat *)processingFormat error:(NSError **)error;
+// Removes least recently used entries until size bytes are available and returns the removed entries; _lock must be held
+- (NSArray *)evictEntriesForSize:(NSUInteger)size;
+@end
+
+@implementation SFBPCMDecoderCache
+
++ (SFBPCMDecoderCache *)sharedCache
+{
+	static SFBPCMDecoderCache *sharedCache = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedCache = [[SFBPCMDecoderCache alloc] init];
+	});
+	return sharedCache;
+}
+
+- (instancetype)init
+{
+	return [self initWithMaximumSize:DEFAULT_MAXIMUM_CACHE_SIZE];
+}
+
+- (instancetype)initWithMaximumSize:(NSUInteger)maximumSize
+{
+	if((self = [super init])) {
+		_lock = OS_UNFAIR_LOCK_INIT;
+		_entries = [NSMutableDictionary dictionary];
+		_recentlyUsedKeys = [NSMutableOrderedSet orderedSet];
+		_maximumSize = maximumSize;
+	}
+	return self;
+}
+
+- (NSUInteger)maximumSize
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger maximumSize = _maximumSize;
+	os_unfair_lock_unlock(&_lock);
+	return maximumSize;
+}
+
+- (void)setMaximumSize:(NSUInteger)maximumSize
+{
+	os_unfair_lock_lock(&_lock);
+	_maximumSize = maximumSize;
+	// The evicted audio is released outside the lock
+	NSArray *evictedEntries = [self evictEntriesForSize:0];
+	os_unfair_lock_unlock(&_lock);
+	[evictedEntries self];
+}
+
+- (NSUInteger)size
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger size = _size;
+	os_unfair_lock_unlock(&_lock);
+	return size;
+}
+
+- (NSUInteger)entryCount
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger entryCount = _entries.count;
+	os_unfair_lock_unlock(&_lock);
+	return entryCount;
+}
+
+- (NSUInteger)hitCount
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger hitCount = _hitCount;
+	os_unfair_lock_unlock(&_lock);
+	return hitCount;
+}
+
+- (NSUInteger)missCount
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger missCount = _missCount;
+	os_unfair_lock_unlock(&_lock);
+	return missCount;
+}
+
+- (NSUInteger)evictionCount
+{
+	os_unfair_lock_lock(&_lock);
+	NSUInteger evictionCount = _evictionCount;
+	os_unfair_lock_unlock(&_lock);
+	return evictionCount;
+}
+
+- (void)removeAllEntries
+{
+	// The audio is released outside the lock
+	NSMutableDictionary *entries = [NSMutableDictionary dictionary];
+	os_unfair_lock_lock(&_lock);
+	NSMutableDictionary *previousEntries = _entries;
+	_entries = entries;
+	[_recentlyUsedKeys removeAllObjects];
+	_size = 0;
+	os_unfair_lock_unlock(&_lock);
+	[previousEntries removeAllObjects];
+}
+
+- (void)resetStatistics
+{
+	os_unfair_lock_lock(&_lock);
+	_hitCount = 0;
+	_missCount = 0;
+	_evictionCount = 0;
+	os_unfair_lock_unlock(&_lock);
+}
+
+- (SFBPCMDecoderCacheEntry *)entryForURL:(NSURL *)url processingFormat:(AVAudioFormat *)processingFormat error:(NSError **)error
+{
+	NSParameterAssert(url != nil);
+
+	NSDate *modificationDate = nil;
+	if(url.isFileURL && ![url getResourceValue:&modificationDate forKey:NSURLContentModificationDateKey error:error])
+		return nil;
+
+	NSString *key = SFBPCMDecoderCacheKey(url, modificationDate, processingFormat);
+
+	os_unfair_lock_lock(&_lock);
+	SFBPCMDecoderCacheEntry *entry = _entries[key];
+	if(entry) {
+		[_recentlyUsedKeys removeObject:key];
+		[_recentlyUsedKeys addObject:key];
+		++_hitCount;
+	}
+	else
+		++_missCount;
+	os_unfair_lock_unlock(&_lock);
+
+	if(entry)
+		return entry;
+
+	// Decoding is performed outside the lock so other entries remain available
+	SFBAudioDecoder *decoder = [[SFBAudioDecoder alloc] initWithURL:url error:error];
+	if(!decoder)
+		return nil;
+
+	decoder.decodesInBulk = YES;
+	if(![decoder openReturningError:error])
+		return nil;
+
+	AVAudioPCMBuffer *buffer = SFBDecodeAllAudio(decoder, processingFormat ?: decoder.processingFormat, error);
+
+	NSError *closeError = nil;
+	if(![decoder closeReturningError:&closeError])
+		os_log_info(gSFBAudioDecoderLog, "Error closing %{public}@: %{public}@", url, closeError);
+
+	if(!buffer)
+		return nil;
+
+	entry = [[SFBPCMDecoderCacheEntry alloc] init];
+	entry.buffer = buffer;
+	entry.sourceFormat = decoder.sourceFormat;
+	entry.size = SFBAudioSize(buffer);
+
+	os_unfair_lock_lock(&_lock);
+	NSArray *evictedEntries = nil;
+	if(entry.size <= _maximumSize) {
+		// Another decoder may have cached the same audio while this one was decoding
+		SFBPCMDecoderCacheEntry *existingEntry = _entries[key];
+		if(existingEntry) {
+			_size -= existingEntry.size;
+			[_recentlyUsedKeys removeObject:key];
+		}
+
+		evictedEntries = [self evictEntriesForSize:entry.size];
+
+		_entries[key] = entry;
+		[_recentlyUsedKeys addObject:key];
+		_size += entry.size;
+	}
+	os_unfair_lock_unlock(&_lock);
+	// The evicted audio is released outside the lock
+	[evictedEntries self];
+
+	return entry;
+}
+
+- (NSArray *)evictEntriesForSize:(NSUInteger)size
+{
+	NSMutableArray *evictedEntries = [NSMutableArray array];
+	while(_recentlyUsedKeys.count > 0 && _size + size > _maximumSize) {
+		NSString *key = _recentlyUsedKeys.firstObject;
+		SFBPCMDecoderCacheEntry *entry = _entries[key];
+		[evictedEntries addObject:entry];
+		[_entries removeObjectForKey:key];
+		[_recentlyUsedKeys removeObjectAtIndex:0];
+		_size -= entry.size;
+		++_evictionCount;
+	}
+	return evictedEntries;
+}
+
+@end
+
+@interface SFBCachedPCMDecoder ()
+{
+@private
+	SFBInputSource *_inputSource;
+	AVAudioFormat *_requestedProcessingFormat;
+	SFBPCMDecoderCacheEntry *_entry;
+	AVAudioFramePosition _framePosition;
+	// Refers to the cached audio for borrowed decoding
+	AudioBufferList *_borrowedBufferList;
+}
+@end
+
+@implementation SFBCachedPCMDecoder
+
+- (instancetype)initWithURL:(NSURL *)url error:(NSError **)error
+{
+	return [self initWithURL:url processingFormat:nil cache:SFBPCMDecoderCache.sharedCache error:error];
+}
+
+- (instancetype)initWithURL:(NSURL *)url processingFormat:(AVAudioFormat *)processingFormat cache:(SFBPCMDecoderCache *)cache error:(NSError **)error
+{
+	NSParameterAssert(url != nil);
+	NSParameterAssert(cache != nil);
+
+	SFBInputSource *inputSource = [SFBInputSource inputSourceForURL:url flags:0 error:error];
+	if(!inputSource)
+		return nil;
+
+	if((self = [super init])) {
+		_inputSource = inputSource;
+		_requestedProcessingFormat = processingFormat;
+		_cache = cache;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_borrowedBufferList);
+}
+
+- (SFBInputSource *)inputSource
+{
+	return _inputSource;
+}
+
+- (AVAudioFormat *)sourceFormat
+{
+	return _entry.sourceFormat;
+}
+
+- (AVAudioFormat *)processingFormat
+{
+	return _entry ? _entry.buffer.format : _requestedProcessingFormat;
+}
+
+- (BOOL)openReturningError:(NSError **)error
+{
+	SFBPCMDecoderCacheEntry *entry = [_cache entryForURL:_inputSource.url processingFormat:_requestedProcessingFormat error:error];
+	if(!entry)
+		return NO;
+
+	const AudioBufferList *bufferList = entry.buffer.audioBufferList;
+
+	free(_borrowedBufferList);
+	_borrowedBufferList = calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * bufferList->mNumberBuffers));
+	if(!_borrowedBufferList) {
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return NO;
+	}
+
+	_borrowedBufferList->mNumberBuffers = bufferList->mNumberBuffers;
+	for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+		_borrowedBufferList->mBuffers[i].mNumberChannels = bufferList->mBuffers[i].mNumberChannels;
+
+	_entry = entry;
+	_framePosition = 0;
+
+	return YES;
+}
+
+- (BOOL)closeReturningError:(NSError **)error
+{
+	free(_borrowedBufferList);
+	_borrowedBufferList = NULL;
+
+	_entry = nil;
+
+	return YES;
+}
+
+- (BOOL)isOpen
+{
+	return _entry != nil;
+}
+
+- (AVAudioFramePosition)framePosition
+{
+	return _entry ? _framePosition : SFBUnknownFramePosition;
+}
+
+- (AVAudioFramePosition)frameLength
+{
+	return _entry ? _entry.buffer.frameLength : SFBUnknownFrameLength;
+}
+
+- (BOOL)decodeIntoBuffer:(AVAudioBuffer *)buffer error:(NSError **)error
+{
+	if(![buffer isKindOfClass:[AVAudioPCMBuffer class]])
+		return NO;
+	return [self decodeIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:((AVAudioPCMBuffer *)buffer).frameCapacity error:error];
+}
+
+- (BOOL)decodeIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength error:(NSError **)error
+{
+	NSParameterAssert(buffer != nil);
+
+	// Reset output buffer data size
+	buffer.frameLength = 0;
+
+	AVAudioPCMBuffer *audio = _entry.buffer;
+	if(![buffer.format isEqual:audio.format]) {
+		os_log_debug(gSFBAudioDecoderLog, "-decodeAudio:frameLength:error: called with invalid parameters");
+		return NO;
+	}
+
+	if(frameLength > buffer.frameCapacity)
+		frameLength = buffer.frameCapacity;
+
+	AVAudioFrameCount framesToCopy = SFB_min(frameLength, (AVAudioFrameCount)(audio.frameLength - _framePosition));
+	if(framesToCopy > 0)
+		_framePosition += [buffer appendContentsOfBuffer:audio readOffset:(AVAudioFrameCount)_framePosition frameLength:framesToCopy];
+
+	return YES;
+}
+
+- (BOOL)borrowBufferList:(const AudioBufferList **)bufferList frameLength:(AVAudioFrameCount *)frameLength maximumFrameLength:(AVAudioFrameCount)maximumFrameLength error:(NSError **)error
+{
+	NSParameterAssert(bufferList != NULL);
+	NSParameterAssert(frameLength != NULL);
+	NSParameterAssert(maximumFrameLength > 0);
+
+	// The cached audio is lent directly
+	AVAudioPCMBuffer *audio = _entry.buffer;
+	AVAudioFrameCount framesToLend = SFB_min(maximumFrameLength, (AVAudioFrameCount)(audio.frameLength - _framePosition));
+	UInt32 bytesPerFrame = audio.format.streamDescription->mBytesPerFrame;
+
+	const AudioBufferList *audioBufferList = audio.audioBufferList;
+	for(UInt32 i = 0; i < _borrowedBufferList->mNumberBuffers; ++i) {
+		_borrowedBufferList->mBuffers[i].mData = (uint8_t *)audioBufferList->mBuffers[i].mData + ((size_t)_framePosition * bytesPerFrame);
+		_borrowedBufferList->mBuffers[i].mDataByteSize = framesToLend * bytesPerFrame;
+	}
+
+	*bufferList = _borrowedBufferList;
+	*frameLength = framesToLend;
+
+	_framePosition += framesToLend;
+
+	return YES;
+}
+
+- (BOOL)supportsSeeking
+{
+	return YES;
+}
+
+- (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
+{
+	NSParameterAssert(frame >= 0);
+
+	if(frame >= self.frameLength) {
+		if(error)
+			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+											 code:SFBAudioDecoderErrorCodeInputOutput
+					descriptionFormatStringForURL:NSLocalizedString(@"The requested position in the file “%@” could not be located.", @"")
+											  url:_inputSource.url
+									failureReason:NSLocalizedString(@"Position beyond the end of the audio", @"")
+							   recoverySuggestion:NSLocalizedString(@"The requested position must be less than the length of the audio.", @"")];
+		return NO;
+	}
+
+	_framePosition = frame;
+	return YES;
+}
+
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+
+	_framePosition = MIN(_framePosition + frameLength, self.frameLength);
+	return YES;
+}
+
+@end
@@ -96,6 +96,31 @@ static SInt64 get_size_callback(void *inClientData)
 	return [NSSet setWithArray:(__bridge_transfer NSArray *)supportedMIMETypes];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// Containers shared with other decoders
+	if(length >= 12 && ((!memcmp(bytes, "RIFF", 4) && !memcmp(bytes + 8, "WAVE", 4)) || (!memcmp(bytes, "FORM", 4) && (!memcmp(bytes + 8, "AIFF", 4) || !memcmp(bytes + 8, "AIFC", 4)))))
+		return SFBAudioDecoderProbeScoreLikely;
+	if(length >= 4 && !memcmp(bytes, "caff", 4))
+		return SFBAudioDecoderProbeScoreLikely;
+
+	// MPEG-4
+	if(length >= 8 && !memcmp(bytes + 4, "ftyp", 4))
+		return SFBAudioDecoderProbeScoreLikely;
+
+	// AAC in ADTS
+	if(length >= 2 && bytes[0] == 0xff && (bytes[1] & 0xf6) == 0xf0)
+		return SFBAudioDecoderProbeScoreLikely;
+
+	if(length >= 6 && !memcmp(bytes, "#!AMR", 5))
+		return SFBAudioDecoderProbeScoreLikely;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
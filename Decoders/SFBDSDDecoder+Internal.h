@@ -16,6 +16,7 @@ extern os_log_t gSFBDSDDecoderLog;
 @protected
 	AVAudioFormat *_sourceFormat;
 	AVAudioFormat *_processingFormat;
+	BOOL _prefersNonInterleavedPackets;
 }
 @end
 
@@ -34,6 +34,7 @@ static void SFBCreateDSDDecoderLog()
 @synthesize inputSource = _inputSource;
 @synthesize processingFormat = _processingFormat;
 @synthesize sourceFormat = _sourceFormat;
+@synthesize prefersNonInterleavedPackets = _prefersNonInterleavedPackets;
 
 @dynamic packetPosition;
 @dynamic packetCount;
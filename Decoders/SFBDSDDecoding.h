@@ -62,6 +62,17 @@ NS_SWIFT_NAME(DSDDecoding) @protocol SFBDSDDecoding <SFBAudioDecoding>
 /// Returns the decoder's length in packets or \c SFBUnknownPacketCount if unknown
 @property (nonatomic, readonly) AVAudioFramePosition packetCount NS_SWIFT_NAME(count);
 
+#pragma mark - Packet Layout
+
+/// Set to \c YES before opening the decoder to request non-interleaved (channel-planar) packets
+///
+/// Interleaved packets are clustered frames containing one channel byte per channel. For non-interleaved packets
+/// the processing format's \c mFormatFlags contains \c kAudioFormatFlagIsNonInterleaved and a buffer holding
+/// \c n packets contains \c n channel bytes for the first channel, followed by \c n channel bytes for the second
+/// channel, and so on.
+/// @note This is a request and may be ignored; the processing format of the open decoder determines the packet layout
+@property (nonatomic) BOOL prefersNonInterleavedPackets;
+
 #pragma mark - Decoding
 
 /// Decodes audio
@@ -5,7 +5,8 @@
 
 #import <os/log.h>
 
-#include <map>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <vector>
@@ -13,11 +14,18 @@
 #import "SFBDSDIFFDecoder.h"
 
 #import "AVAudioChannelLayout+SFBChannelLabels.h"
+#import "ByteStream.h"
+#import "DSTDecoder.h"
 #import "NSError+SFBURLPresentation.h"
 #import "SFBCStringForOSType.h"
 
 namespace {
 
+	// The largest 'DSTI' chunk read, sufficient for more than 20 hours of audio
+	constexpr uint64_t kMaximumDSTSoundIndexChunkDataSize 	= 64 * 1024 * 1024;
+	// The read size used when building a DST frame index
+	constexpr size_t kDSTFrameIndexBlockSize 				= 1024 * 1024;
+
 	// Convert a four byte chunk ID to a uint32_t
 	inline uint32_t BytesToID(char bytes [4])
 	{
@@ -84,64 +92,55 @@ namespace {
 
 #pragma mark DSDIFF chunks
 
-	// Base class for DSDIFF chunks
-	struct DSDIFFChunk : std::enable_shared_from_this<DSDIFFChunk>
+	// A chunk's location in the file
+	struct DSDIFFChunk
 	{
-		using shared_ptr = std::shared_ptr<DSDIFFChunk>;
-		using chunk_map = std::map<uint32_t, shared_ptr>;
-
-		// Shared pointer support
-		shared_ptr getptr()					{ return shared_from_this(); }
+		static const size_t kNoParent = SIZE_MAX;
 
 		uint32_t mChunkID;
 		uint64_t mDataSize;
 
 		int64_t mDataOffset;
-	};
 
-	// 'FRM8'
-	struct FormDSDChunk : public DSDIFFChunk
-	{
-		uint32_t mFormType;
-		chunk_map mLocalChunks;
+		// The index of the containing chunk
+		size_t mParent;
 	};
 
 	// 'FVER' in 'FRM8'
-	struct FormatVersionChunk : public DSDIFFChunk
+	struct FormatVersionChunk
 	{
 		static const uint32_t kSupportedFormatVersion = 0x01050000;
 		uint32_t mFormatVersion;
 	};
 
 	// 'PROP' in 'FRM8'
-	struct PropertyChunk : public DSDIFFChunk
+	struct PropertyChunk
 	{
 		uint32_t mPropertyType;
-		chunk_map mLocalChunks;
 	};
 
 	// 'FS  ' in 'PROP'
-	struct SampleRateChunk : public DSDIFFChunk
+	struct SampleRateChunk
 	{
 		uint32_t mSampleRate;
 	};
 
 	// 'CHNL' in 'PROP'
-	struct ChannelsChunk : public DSDIFFChunk
+	struct ChannelsChunk
 	{
 		uint16_t mNumberChannels;
 		std::vector<uint32_t> mChannelIDs;
 	};
 
 	// 'CMPR' in 'PROP'
-	struct CompressionTypeChunk : public DSDIFFChunk
+	struct CompressionTypeChunk
 	{
 		uint32_t mCompressionType;
 		std::string mCompressionName;
 	};
 
 	// 'ABSS' in 'PROP'
-	struct AbsoluteStartTimeChunk : public DSDIFFChunk
+	struct AbsoluteStartTimeChunk
 	{
 		uint16_t mHours;
 		uint8_t mMinutes;
@@ -150,64 +149,62 @@ namespace {
 	};
 
 	// 'LSCO' in 'PROP'
-	struct LoudspeakerConfigurationChunk : public DSDIFFChunk
+	struct LoudspeakerConfigurationChunk
 	{
 		uint16_t mLoudspeakerConfiguration;
 	};
 
-	// 'DSD ' in 'FRM8'
-	struct DSDSoundDataChunk : public DSDIFFChunk
-	{};
-
-	// 'DST ', 'DSTI', 'COMT', 'DIIN', 'MANF' are not handled
-
-//	// 'DST ' in 'FRM8'
-//	class DSTSoundDataChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'FRTE' in 'DST '
-//	class DSTFrameInformationChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'FRTE' in 'DST '
-//	class DSTFrameDataChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'FRTE' in 'DST '
-//	class DSTFrameCRCChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'DSTI' in 'FRM8'
-//	class DSTSoundIndexChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'COMT' in 'FRM8'
-//	class CommentsChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'DIIN' in 'FRM8'
-//	class EditedMasterInformationChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'EMID' in 'DIIN'
-//	class EditedMasterIDChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'MARK' in 'DIIN'
-//	class MarkerChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'DIAR' in 'DIIN'
-//	class ArtistChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'DITI' in 'DIIN'
-//	class TitleChunk : public DSDIFFChunk
-//	{};
-//
-//	// 'MANF' in 'FRM8'
-//	class ManufacturerSpecificChunk : public DSDIFFChunk
-//	{};
+	// 'DSD ' in 'FRM8' has no fields; the sound data is located using its DSDIFFChunk
+
+	// 'FRTE' in 'DST '
+	// The 'DSTF' (frame data) and 'DSTC' (frame CRC) chunks following 'FRTE' are read while decoding
+	struct DSTFrameInformationChunk
+	{
+		uint32_t mNumberFrames;
+		uint16_t mFrameRate;
+		// The offset of the chunk following 'FRTE'
+		int64_t mFrameDataOffset;
+	};
+
+	// 'DSTI' in 'FRM8'
+	struct DSTSoundIndexChunk
+	{
+		struct Entry
+		{
+			uint64_t mOffset;
+			uint32_t mLength;
+		};
+		std::vector<Entry> mEntries;
+	};
+
+	// 'COMT', 'DIIN', 'MANF' are not handled
+
+	// The chunks in a DSDIFF file
+	// Every chunk encountered is stored in a flat array; the contents of recognized chunks are stored by value
+	struct DSDIFFFile
+	{
+		// Returns the first chunk with the specified ID contained in a chunk with ID parentID
+		const DSDIFFChunk * FindChunk(uint32_t chunkID, uint32_t parentID = 'FRM8') const
+		{
+			for(const auto& chunk : mChunks) {
+				if(chunk.mChunkID == chunkID && chunk.mParent != DSDIFFChunk::kNoParent && mChunks[chunk.mParent].mChunkID == parentID)
+					return &chunk;
+			}
+			return nullptr;
+		}
+
+		std::vector<DSDIFFChunk> mChunks;
+
+		FormatVersionChunk mFormatVersion;
+		PropertyChunk mProperty;
+		SampleRateChunk mSampleRate;
+		ChannelsChunk mChannels;
+		CompressionTypeChunk mCompressionType;
+		AbsoluteStartTimeChunk mAbsoluteStartTime;
+		LoudspeakerConfigurationChunk mLoudspeakerConfiguration;
+		DSTFrameInformationChunk mDSTFrameInformation;
+		DSTSoundIndexChunk mDSTSoundIndex;
+	};
 
 #pragma mark DSDIFF parsing
 
@@ -224,448 +221,496 @@ namespace {
 		return true;
 	}
 
-	std::shared_ptr<FormatVersionChunk> ParseFormatVersionChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	// Read an ID as a uint32_t, performing validation
+	bool ReadID(SFB::ByteStream& stream, uint32_t& chunkID)
 	{
-		if(chunkID != 'FVER') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'FVER' chunk");
-			return nullptr;
+		char chunkIDBytes [4];
+		if(stream.Read(chunkIDBytes, 4) != 4) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read chunk ID");
+			return false;
 		}
 
-		auto result = std::make_shared<FormatVersionChunk>();
-
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+		chunkID = BytesToID(chunkIDBytes);
+		if(0 == chunkID) {
+			os_log_error(gSFBDSDDecoderLog, "Illegal chunk ID");
+			return false;
 		}
-		result->mDataOffset = offset;
 
-		if(![inputSource readUInt32BigEndian:&result->mFormatVersion error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Unable to read format version in 'FVER' chunk");
-			return nullptr;
-		}
+		return true;
+	}
 
-		if(result->mFormatVersion > FormatVersionChunk::kSupportedFormatVersion) {
-			os_log_error(gSFBDSDDecoderLog, "Unsupported format version in 'FVER': %u", result->mFormatVersion);
-			return nullptr;
+	bool ReadChunkIDAndDataSize(SFB::ByteStream& stream, uint32_t& chunkID, uint64_t& chunkDataSize)
+	{
+		if(!ReadID(stream, chunkID))
+			return false;
+
+		if(!stream.ReadBE(chunkDataSize)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read chunk data size");
+			return false;
 		}
 
-		return result;
+		return true;
 	}
 
-	std::shared_ptr<SampleRateChunk> ParseSampleRateChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	// Chunks always have an even length
+	inline uint64_t PaddedChunkDataSize(uint64_t chunkDataSize)
 	{
-		if(chunkID != 'FS  ') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'FS  ' chunk");
-			return nullptr;
-		}
+		return chunkDataSize + (chunkDataSize & 1);
+	}
 
-		auto result = std::make_shared<SampleRateChunk>();
+	// Reads the input in large blocks so chunk headers and small chunks may be parsed from memory
+	class ChunkReader
+	{
+	public:
+		static const size_t kBlockSize = 4096;
 
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+		explicit ChunkReader(SFBInputSource *inputSource, size_t blockSize = kBlockSize)
+			: mInputSource(inputSource), mBlockSize(blockSize), mBufferOffset(0), mBufferLength(0)
+		{}
+
+		// Ensures the bytes [offset, offset + length) are buffered
+		bool Load(int64_t offset, size_t length)
+		{
+			if(offset >= mBufferOffset && offset + (int64_t)length <= mBufferOffset + (int64_t)mBufferLength)
+				return true;
+
+			auto bytesToRead = std::max(length, mBlockSize);
+			if(mBuffer.size() < bytesToRead)
+				mBuffer.resize(bytesToRead);
+
+			mBufferOffset = offset;
+			mBufferLength = 0;
+
+			NSInteger bytesRead;
+			if(![mInputSource seekToOffset:offset error:nil] || ![mInputSource readBytes:mBuffer.data() length:(NSInteger)bytesToRead bytesRead:&bytesRead error:nil])
+				return false;
+
+			mBufferLength = (size_t)bytesRead;
+			return mBufferLength >= length;
 		}
-		result->mDataOffset = offset;
 
-		if(![inputSource readUInt32BigEndian:&result->mSampleRate error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Unable to read sample rate in 'FS  ' chunk");
-			return nullptr;
+		// Returns a stream over the bytes [offset, offset + length), which must have been loaded
+		SFB::ByteStream Stream(int64_t offset, size_t length) const
+		{
+			return SFB::ByteStream(mBuffer.data() + (offset - mBufferOffset), length);
 		}
 
-		return result;
-	}
+	private:
+		SFBInputSource *mInputSource;
+		size_t mBlockSize;
+		std::vector<uint8_t> mBuffer;
+		int64_t mBufferOffset;
+		size_t mBufferLength;
+	};
 
-	std::shared_ptr<ChannelsChunk> ParseChannelsChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	bool ParseFormatVersionChunk(SFB::ByteStream& chunkData, FormatVersionChunk& chunk)
 	{
-		if(chunkID != 'CHNL') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'CHNL' chunk");
-			return nullptr;
+		if(!chunkData.ReadBE(chunk.mFormatVersion)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read format version in 'FVER' chunk");
+			return false;
 		}
 
-		auto result = std::make_shared<ChannelsChunk>();
+		if(chunk.mFormatVersion > FormatVersionChunk::kSupportedFormatVersion) {
+			os_log_error(gSFBDSDDecoderLog, "Unsupported format version in 'FVER': %u", chunk.mFormatVersion);
+			return false;
+		}
 
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+		return true;
+	}
+
+	bool ParseSampleRateChunk(SFB::ByteStream& chunkData, SampleRateChunk& chunk)
+	{
+		if(!chunkData.ReadBE(chunk.mSampleRate)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read sample rate in 'FS  ' chunk");
+			return false;
 		}
-		result->mDataOffset = offset;
 
-		if(![inputSource readUInt16BigEndian:&result->mNumberChannels error:nil]) {
+		return true;
+	}
+
+	bool ParseChannelsChunk(SFB::ByteStream& chunkData, ChannelsChunk& chunk)
+	{
+		if(!chunkData.ReadBE(chunk.mNumberChannels)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read number channels in 'CHNL' chunk");
-			return nullptr;
+			return false;
 		}
 
-		for(uint16_t i = 0; i < result->mNumberChannels; ++i) {
+		chunk.mChannelIDs.clear();
+		chunk.mChannelIDs.reserve(chunk.mNumberChannels);
+		for(uint16_t i = 0; i < chunk.mNumberChannels; ++i) {
 			uint32_t channelID;
-			if(!ReadID(inputSource, channelID)) {
+			if(!ReadID(chunkData, channelID)) {
 				os_log_error(gSFBDSDDecoderLog, "Unable to read channel ID in 'CHNL' chunk");
-				return nullptr;
+				return false;
 			}
-			result->mChannelIDs.push_back(channelID);
+			chunk.mChannelIDs.push_back(channelID);
 		}
 
-		return result;
+		return true;
 	}
 
-	std::shared_ptr<CompressionTypeChunk> ParseCompressionTypeChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	bool ParseCompressionTypeChunk(SFB::ByteStream& chunkData, CompressionTypeChunk& chunk)
 	{
-		if(chunkID != 'CMPR') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'CMPR' chunk");
-			return nullptr;
-		}
-
-		auto result = std::make_shared<CompressionTypeChunk>();
-
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
-		}
-		result->mDataOffset = offset;
-
-		if(!ReadID(inputSource, result->mCompressionType)) {
+		if(!ReadID(chunkData, chunk.mCompressionType)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read compression type in 'CMPR' chunk");
-			return nullptr;
+			return false;
 		}
 
 		uint8_t count;
-		if(![inputSource readUInt8:&count error:nil]) {
+		if(!chunkData.Read(count)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read count in 'CMPR' chunk");
-			return nullptr;
+			return false;
 		}
 
-		char compressionName [count];
-		NSInteger bytesRead;
-		if(![inputSource readBytes:compressionName length:count bytesRead:&bytesRead error:nil] || bytesRead != count) {
+		char compressionName [UINT8_MAX];
+		if(chunkData.Read(compressionName, count) != count) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read compressionName in 'CMPR' chunk");
-			return nullptr;
-		}
-
-		result->mCompressionName = std::string(compressionName, count);
-
-		// Chunks always have an even length
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+			return false;
 		}
 
-		if(offset % 2) {
-			uint8_t unused;
-			if(![inputSource readUInt8:&unused error:nil]) {
-				os_log_error(gSFBDSDDecoderLog, "Unable to read dummy byte in 'CMPR' chunk");
-				return nullptr;
-			}
+		chunk.mCompressionName = std::string(compressionName, count);
 
-		}
-
-		return result;
+		return true;
 	}
 
-	std::shared_ptr<AbsoluteStartTimeChunk> ParseAbsoluteStartTimeChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	bool ParseAbsoluteStartTimeChunk(SFB::ByteStream& chunkData, AbsoluteStartTimeChunk& chunk)
 	{
-		if(chunkID != 'ABSS') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'ABSS' chunk");
-			return nullptr;
-		}
-
-		auto result = std::make_shared<AbsoluteStartTimeChunk>();
-
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
-		}
-		result->mDataOffset = offset;
-
-		if(![inputSource readUInt16BigEndian:&result->mHours error:nil]) {
+		if(!chunkData.ReadBE(chunk.mHours)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read hours in 'ABSS' chunk");
-			return nullptr;
+			return false;
 		}
 
-		if(![inputSource readUInt8:&result->mMinutes error:nil]) {
+		if(!chunkData.Read(chunk.mMinutes)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read minutes in 'ABSS' chunk");
-			return nullptr;
+			return false;
 		}
 
-		if(![inputSource readUInt8:&result->mSeconds error:nil]) {
+		if(!chunkData.Read(chunk.mSeconds)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read seconds in 'ABSS' chunk");
-			return nullptr;
+			return false;
 		}
 
-		if(![inputSource readUInt32BigEndian:&result->mSamples error:nil]) {
+		if(!chunkData.ReadBE(chunk.mSamples)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read samples in 'ABSS' chunk");
-			return nullptr;
+			return false;
 		}
 
-		return result;
+		return true;
 	}
 
-	std::shared_ptr<LoudspeakerConfigurationChunk> ParseLoudspeakerConfigurationChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	bool ParseLoudspeakerConfigurationChunk(SFB::ByteStream& chunkData, LoudspeakerConfigurationChunk& chunk)
 	{
-		if(chunkID != 'LSCO') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'LSCO' chunk");
-			return nullptr;
+		if(!chunkData.ReadBE(chunk.mLoudspeakerConfiguration)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read loudspeaker configuration in 'LSCO' chunk");
+			return false;
 		}
 
-		auto result = std::make_shared<LoudspeakerConfigurationChunk>();
+		return true;
+	}
 
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+	bool ParseDSTFrameInformationChunk(SFB::ByteStream& chunkData, DSTFrameInformationChunk& chunk)
+	{
+		if(!chunkData.ReadBE(chunk.mNumberFrames)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read number frames in 'FRTE' chunk");
+			return false;
 		}
-		result->mDataOffset = offset;
 
-		if(![inputSource readUInt16BigEndian:&result->mLoudspeakerConfiguration error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Unable to read loudspeaker configuration in 'LSCO' chunk");
-			return nullptr;
+		if(!chunkData.ReadBE(chunk.mFrameRate)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read frame rate in 'FRTE' chunk");
+			return false;
 		}
 
-		return result;
+		return true;
 	}
 
-	std::shared_ptr<PropertyChunk> ParsePropertyChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	bool ParseDSTSoundIndexChunk(SFB::ByteStream& chunkData, DSTSoundIndexChunk& chunk)
 	{
-		if(chunkID != 'PROP') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'PROP' chunk");
-			return nullptr;
+		auto entryCount = chunkData.Remaining() / 12;
+
+		chunk.mEntries.clear();
+		chunk.mEntries.reserve(entryCount);
+		for(size_t i = 0; i < entryCount; ++i) {
+			DSTSoundIndexChunk::Entry entry;
+			if(!chunkData.ReadBE(entry.mOffset) || !chunkData.ReadBE(entry.mLength)) {
+				os_log_error(gSFBDSDDecoderLog, "Unable to read index entry in 'DSTI' chunk");
+				return false;
+			}
+			chunk.mEntries.push_back(entry);
 		}
 
-		auto result = std::make_shared<PropertyChunk>();
+		return true;
+	}
 
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
-		}
-		result->mDataOffset = offset;
+	bool ParsePropertyChunk(ChunkReader& reader, const DSDIFFChunk& propertyChunk, size_t propertyChunkIndex, DSDIFFFile& file)
+	{
+		auto chunkData = reader.Stream(propertyChunk.mDataOffset, (size_t)propertyChunk.mDataSize);
 
-		if(!ReadID(inputSource, result->mPropertyType)) {
+		if(!ReadID(chunkData, file.mProperty.mPropertyType)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read property type in 'PROP' chunk");
-			return nullptr;
+			return false;
 		}
 
-		if(result->mPropertyType != 'SND ') {
-			os_log_error(gSFBDSDDecoderLog, "Unexpected property type in 'PROP' chunk: %u", result->mPropertyType);
-			return nullptr;
+		if(file.mProperty.mPropertyType != 'SND ') {
+			os_log_error(gSFBDSDDecoderLog, "Unexpected property type in 'PROP' chunk: %u", file.mProperty.mPropertyType);
+			return false;
 		}
 
 		// Parse the local chunks
-		auto chunkDataSizeRemaining = result->mDataSize - 4; // adjust for mPropertyType
-		while(chunkDataSizeRemaining) {
-
+		while(chunkData.Remaining() >= 12) {
 			uint32_t localChunkID;
 			uint64_t localChunkDataSize;
+			if(!ReadChunkIDAndDataSize(chunkData, localChunkID, localChunkDataSize) || localChunkDataSize > chunkData.Remaining()) {
+				os_log_error(gSFBDSDDecoderLog, "Error reading local chunk in 'PROP' chunk");
+				return false;
+			}
 
-			if(ReadChunkIDAndDataSize(inputSource, localChunkID, localChunkDataSize)) {
-				switch(localChunkID) {
-					case 'FS  ':
-					{
-						auto chunk = ParseSampleRateChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
-					}
-
-					case 'CHNL':
-					{
-						auto chunk = ParseChannelsChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
-					}
-
-					case 'CMPR':
-					{
-						auto chunk = ParseCompressionTypeChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
-					}
-
-					case 'ABSS':
-					{
-						auto chunk = ParseAbsoluteStartTimeChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
-					}
-
-					case 'LSCO':
-					{
-						auto chunk = ParseLoudspeakerConfigurationChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
-					}
-
-						// Skip unrecognized or ignored chunks
-					default:
-						if(![inputSource getOffset:&offset error:nil]) {
-							os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-							return nullptr;
-						}
+			DSDIFFChunk chunk{localChunkID, localChunkDataSize, propertyChunk.mDataOffset + (int64_t)chunkData.Position(), propertyChunkIndex};
+			auto localChunkData = reader.Stream(chunk.mDataOffset, (size_t)localChunkDataSize);
+
+			bool parsed = true;
+			switch(localChunkID) {
+				case 'FS  ':	parsed = ParseSampleRateChunk(localChunkData, file.mSampleRate);						break;
+				case 'CHNL':	parsed = ParseChannelsChunk(localChunkData, file.mChannels);							break;
+				case 'CMPR':	parsed = ParseCompressionTypeChunk(localChunkData, file.mCompressionType);				break;
+				case 'ABSS':	parsed = ParseAbsoluteStartTimeChunk(localChunkData, file.mAbsoluteStartTime);			break;
+				case 'LSCO':	parsed = ParseLoudspeakerConfigurationChunk(localChunkData, file.mLoudspeakerConfiguration);	break;
+				// Unrecognized or ignored chunks are skipped
+			}
 
-						if(![inputSource seekToOffset:(offset + (NSInteger)localChunkDataSize) error:nil]) {
-							os_log_error(gSFBDSDDecoderLog, "Error skipping chunk data");
-							return nullptr;
-						}
+			if(parsed)
+				file.mChunks.push_back(chunk);
 
-						break;
-				}
-
-				chunkDataSizeRemaining -= 12;
-				chunkDataSizeRemaining -= localChunkDataSize;
-			}
-			else {
-				os_log_error(gSFBDSDDecoderLog, "Error reading local chunk in 'PROP' chunk");
-				return nullptr;
-			}
+			chunkData.Skip((size_t)PaddedChunkDataSize(localChunkDataSize));
 		}
 
-		return result;
+		return true;
 	}
 
-	std::shared_ptr<DSDSoundDataChunk> ParseDSDSoundDataChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
+	// Parse the chunks in a DSDIFF file
+	// The chunk headers and small chunks are read in a few bulk reads; the sound data is not read
+	bool ParseDSDIFF(SFBInputSource *inputSource, DSDIFFFile& file)
 	{
-		if(chunkID != 'DSD ') {
-			os_log_error(gSFBDSDDecoderLog, "Invalid chunk ID for 'DSD ' chunk");
-			return nullptr;
-		}
-
-		auto result = std::make_shared<DSDSoundDataChunk>();
+		ChunkReader reader(inputSource);
 
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
 		NSInteger offset;
 		if(![inputSource getOffset:&offset error:nil]) {
 			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+			return false;
 		}
-		result->mDataOffset = offset;
 
-		// Skip the data
-		if(![inputSource seekToOffset:(offset + (NSInteger)chunkDataSize) error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error skipping chunk data");
-			return nullptr;
+		if(!reader.Load(offset, 16)) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to read 'FRM8' chunk");
+			return false;
 		}
 
-		return result;
-	}
+		auto header = reader.Stream(offset, 16);
+
+		uint32_t chunkID;
+		uint64_t chunkDataSize;
+		if(!ReadChunkIDAndDataSize(header, chunkID, chunkDataSize))
+			return false;
 
-	std::unique_ptr<FormDSDChunk> ParseFormDSDChunk(SFBInputSource *inputSource, const uint32_t chunkID, const uint64_t chunkDataSize)
-	{
 		if(chunkID != 'FRM8') {
 			os_log_error(gSFBDSDDecoderLog, "Missing 'FRM8' chunk");
-			return nullptr;
-		}
-
-		auto result = std::make_unique<FormDSDChunk>();
-
-		result->mChunkID = chunkID;
-		result->mDataSize = chunkDataSize;
-		NSInteger offset;
-		if(![inputSource getOffset:&offset error:nil]) {
-			os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-			return nullptr;
+			return false;
 		}
-		result->mDataOffset = offset;
 
-		if(!ReadID(inputSource, result->mFormType)) {
+		uint32_t formType;
+		if(!ReadID(header, formType)) {
 			os_log_error(gSFBDSDDecoderLog, "Unable to read formType in 'FRM8' chunk");
-			return nullptr;
+			return false;
 		}
 
-		if(result->mFormType != 'DSD ') {
-			os_log_error(gSFBDSDDecoderLog, "Unexpected formType in 'FRM8' chunk: '%{public}.4s'", SFBCStringForOSType(result->mFormType));
-			return nullptr;
+		if(formType != 'DSD ') {
+			os_log_error(gSFBDSDDecoderLog, "Unexpected formType in 'FRM8' chunk: '%{public}.4s'", SFBCStringForOSType(formType));
+			return false;
 		}
 
+		file.mChunks.clear();
+		file.mChunks.push_back({chunkID, chunkDataSize, offset + 12, DSDIFFChunk::kNoParent});
+
 		// Parse the local chunks
-		auto chunkDataSizeRemaining = result->mDataSize - 4; // adjust for mFormType
-		while(chunkDataSizeRemaining) {
+		auto chunkOffset = (int64_t)offset + 16;
+		auto endOffset = (int64_t)offset + 12 + (int64_t)chunkDataSize;
+		while(chunkOffset + 12 <= endOffset) {
+			if(!reader.Load(chunkOffset, 12)) {
+				// Tolerate truncated files as long as the sound data is present
+				if(file.FindChunk('DSD ') || file.FindChunk('DST '))
+					break;
+				os_log_error(gSFBDSDDecoderLog, "Error reading local chunk in 'FRM8' chunk");
+				return false;
+			}
+
+			auto localChunkHeader = reader.Stream(chunkOffset, 12);
 
 			uint32_t localChunkID;
 			uint64_t localChunkDataSize;
+			if(!ReadChunkIDAndDataSize(localChunkHeader, localChunkID, localChunkDataSize)) {
+				os_log_error(gSFBDSDDecoderLog, "Error reading local chunk in 'FRM8' chunk");
+				return false;
+			}
 
-			if(ReadChunkIDAndDataSize(inputSource, localChunkID, localChunkDataSize)) {
-				switch(localChunkID) {
-					case 'FVER':
-					{
-						auto chunk = ParseFormatVersionChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
+			DSDIFFChunk chunk{localChunkID, localChunkDataSize, chunkOffset + 12, 0};
+			auto chunkIndex = file.mChunks.size();
+
+			bool parsed = true;
+			switch(localChunkID) {
+				case 'FVER':
+					if((parsed = reader.Load(chunk.mDataOffset, (size_t)std::min(localChunkDataSize, (uint64_t)4)))) {
+						auto chunkData = reader.Stream(chunk.mDataOffset, (size_t)std::min(localChunkDataSize, (uint64_t)4));
+						parsed = ParseFormatVersionChunk(chunkData, file.mFormatVersion);
 					}
+					break;
 
-					case 'PROP':
-					{
-						auto chunk = ParsePropertyChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
-						break;
+				case 'PROP':
+					// The property chunk contains only a few small chunks
+					if(localChunkDataSize > ChunkReader::kBlockSize * 16 || !reader.Load(chunk.mDataOffset, (size_t)localChunkDataSize)) {
+						os_log_error(gSFBDSDDecoderLog, "Unable to read 'PROP' chunk");
+						return false;
+					}
+					file.mChunks.push_back(chunk);
+					if(!ParsePropertyChunk(reader, chunk, chunkIndex, file))
+						return false;
+					// Already added
+					parsed = false;
+					break;
+
+				case 'DSD ':
+					break;
+
+				case 'DST ':
+				{
+					// 'FRTE' is required to be the first local chunk
+					uint32_t frameInformationChunkID;
+					uint64_t frameInformationChunkDataSize;
+					if((parsed = localChunkDataSize >= 18 && reader.Load(chunk.mDataOffset, 18))) {
+						auto chunkData = reader.Stream(chunk.mDataOffset, 18);
+						parsed = ReadChunkIDAndDataSize(chunkData, frameInformationChunkID, frameInformationChunkDataSize) && frameInformationChunkID == 'FRTE' && frameInformationChunkDataSize >= 6 && ParseDSTFrameInformationChunk(chunkData, file.mDSTFrameInformation);
 					}
 
-					case 'DSD ':
-					{
-						auto chunk = ParseDSDSoundDataChunk(inputSource, localChunkID, localChunkDataSize);
-						if(chunk)
-							result->mLocalChunks[chunk->mChunkID] = chunk;
+					if(!parsed) {
+						os_log_error(gSFBDSDDecoderLog, "Missing or invalid 'FRTE' chunk in 'DST ' chunk");
 						break;
 					}
 
-						// Skip unrecognized or ignored chunks
-					default:
-						if(![inputSource getOffset:&offset error:nil]) {
-							os_log_error(gSFBDSDDecoderLog, "Error getting chunk data offset");
-							return nullptr;
-						}
-
-						if(![inputSource seekToOffset:(offset + (NSInteger)localChunkDataSize) error:nil]) {
-							os_log_error(gSFBDSDDecoderLog, "Error skipping chunk data");
-							return nullptr;
-						}
+					file.mChunks.push_back(chunk);
+					file.mChunks.push_back({frameInformationChunkID, frameInformationChunkDataSize, chunk.mDataOffset + 12, chunkIndex});
+					file.mDSTFrameInformation.mFrameDataOffset = chunk.mDataOffset + 12 + (int64_t)PaddedChunkDataSize(frameInformationChunkDataSize);
+					// Already added
+					parsed = false;
+					break;
+				}
 
+				case 'DSTI':
+				{
+					// The index holds one 12-byte entry per DST frame, 75 frames per second,
+					// so anything larger than the file or the maximum is corrupt
+					NSInteger inputLength;
+					if(!(parsed = localChunkDataSize <= kMaximumDSTSoundIndexChunkDataSize && [inputSource getLength:&inputLength error:nil] && chunk.mDataOffset + (int64_t)localChunkDataSize <= inputLength)) {
+						os_log_error(gSFBDSDDecoderLog, "Invalid 'DSTI' chunk data size %llu", localChunkDataSize);
 						break;
+					}
+
+					try {
+						parsed = reader.Load(chunk.mDataOffset, (size_t)localChunkDataSize);
+					}
+					catch(const std::exception& e) {
+						os_log_error(gSFBDSDDecoderLog, "Unable to allocate memory for 'DSTI' chunk: %{public}s", e.what());
+						parsed = false;
+					}
+
+					if(parsed) {
+						auto chunkData = reader.Stream(chunk.mDataOffset, (size_t)localChunkDataSize);
+						parsed = ParseDSTSoundIndexChunk(chunkData, file.mDSTSoundIndex);
+					}
+					else
+						os_log_error(gSFBDSDDecoderLog, "Unable to read 'DSTI' chunk");
+					break;
 				}
 
-				chunkDataSizeRemaining -= 12;
-				chunkDataSizeRemaining -= localChunkDataSize;
+				// Unrecognized or ignored chunks are skipped
 			}
-			else {
-				os_log_error(gSFBDSDDecoderLog, "Error reading local chunk in 'FRM8' chunk");
-				return nullptr;
+
+			if(parsed)
+				file.mChunks.push_back(chunk);
+
+			chunkOffset = chunk.mDataOffset + (int64_t)PaddedChunkDataSize(localChunkDataSize);
+		}
+
+		return true;
+	}
+
+#pragma mark DST frame access
+
+	// Read the next 'DSTF' chunk's data, skipping 'DSTC' and any other chunks
+	bool ReadDSTFrame(SFBInputSource *inputSource, int64_t endOffset, std::vector<uint8_t>& frame)
+	{
+		for(;;) {
+			NSInteger offset;
+			if(![inputSource getOffset:&offset error:nil] || offset + 12 > endOffset)
+				return false;
+
+			uint32_t chunkID;
+			uint64_t chunkDataSize;
+			if(!ReadChunkIDAndDataSize(inputSource, chunkID, chunkDataSize))
+				return false;
+
+			// Chunks always have an even length
+			auto nextOffset = offset + 12 + (NSInteger)chunkDataSize + (NSInteger)(chunkDataSize % 2);
+
+			if(chunkID == 'DSTF' && chunkDataSize > 0) {
+				frame.resize((size_t)chunkDataSize);
+				NSInteger bytesRead;
+				if(![inputSource readBytes:frame.data() length:(NSInteger)chunkDataSize bytesRead:&bytesRead error:nil] || bytesRead != (NSInteger)chunkDataSize) {
+					os_log_error(gSFBDSDDecoderLog, "Unable to read 'DSTF' chunk data");
+					return false;
+				}
+
+				if(chunkDataSize % 2 && nextOffset < endOffset && ![inputSource seekToOffset:nextOffset error:nil])
+					return false;
+
+				return true;
 			}
+
+			if(![inputSource seekToOffset:nextOffset error:nil])
+				return false;
+		}
+	}
+
+	// Determine the offset of each 'DSTF' chunk by walking the chunk headers in the 'DST ' chunk
+	// The chunk is read sequentially in large blocks and the headers parsed from memory
+	bool BuildDSTFrameIndex(SFBInputSource *inputSource, int64_t startOffset, int64_t endOffset, std::vector<int64_t>& frameOffsets)
+	{
+		frameOffsets.clear();
+
+		ChunkReader reader(inputSource, kDSTFrameIndexBlockSize);
+
+		int64_t offset = startOffset;
+		while(offset + 12 <= endOffset) {
+			if(!reader.Load(offset, 12))
+				return false;
+
+			auto chunkHeader = reader.Stream(offset, 12);
+
+			uint32_t chunkID;
+			uint64_t chunkDataSize;
+			if(!ReadChunkIDAndDataSize(chunkHeader, chunkID, chunkDataSize))
+				return false;
+
+			if(chunkID == 'DSTF')
+				frameOffsets.push_back(offset);
+
+			offset += 12 + (int64_t)chunkDataSize + (int64_t)(chunkDataSize % 2);
 		}
 
-		return result;
+		return true;
 	}
 
-	std::unique_ptr<FormDSDChunk> ParseDSDIFF(SFBInputSource *inputSource)
+	// Returns true if a 'DSTF' chunk begins at offset
+	bool IsDSTFrameChunkAtOffset(SFBInputSource *inputSource, int64_t offset)
 	{
 		uint32_t chunkID;
-		uint64_t chunkDataSize;
-		if(!ReadChunkIDAndDataSize(inputSource, chunkID, chunkDataSize))
-			return nullptr;
-
-		return ParseFormDSDChunk(inputSource, chunkID, chunkDataSize);
+		return offset >= 0 && [inputSource seekToOffset:offset error:nil] && ReadID(inputSource, chunkID) && chunkID == 'DSTF';
 	}
 
 	static NSError * CreateInvalidDSDIFFFileError(NSURL * url)
@@ -678,6 +723,26 @@ namespace {
 						 recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
 	}
 
+	static NSError * CreateDSTSeekError(NSURL * url)
+	{
+		return [NSError SFB_errorWithDomain:SFBDSDDecoderErrorDomain
+									   code:SFBDSDDecoderErrorCodeInputOutput
+			  descriptionFormatStringForURL:NSLocalizedString(@"The requested position in the file “%@” could not be located.", @"")
+										url:url
+							  failureReason:NSLocalizedString(@"Invalid DST frame data", @"")
+						 recoverySuggestion:NSLocalizedString(@"The file may be damaged or truncated.", @"")];
+	}
+
+	static NSError * CreateUnsupportedDSDIFFFileError(NSURL * url)
+	{
+		return [NSError SFB_errorWithDomain:SFBDSDDecoderErrorDomain
+									   code:SFBDSDDecoderErrorCodeInputOutput
+			  descriptionFormatStringForURL:NSLocalizedString(@"The format of the file “%@” is not supported.", @"")
+										url:url
+							  failureReason:NSLocalizedString(@"Unsupported DSDIFF format", @"")
+						 recoverySuggestion:NSLocalizedString(@"The file's format is not supported.", @"")];
+	}
+
 }
 
 
@@ -688,8 +753,23 @@ namespace {
 	AVAudioFramePosition _packetPosition;
 	AVAudioFramePosition _packetCount;
 	int64_t _audioOffset;
-	AVAudioCompressedBuffer *_buffer;
+	// DST state
+	BOOL _isDST;
+	AVAudioPacketCount _dstPacketsPerFrame;
+	int64_t _dstFrameCount;
+	int64_t _dstEndOffset;
+	std::vector<int64_t> _dstFrameOffsets;
+	std::vector<SFB::DSTDecoder::unique_ptr> _dstDecoders;
+	std::vector<std::vector<uint8_t>> _dstFrames;
+	std::vector<uint8_t> _dstFrameBuffer;
+	int64_t _dstNextFrame;
+	int64_t _dstBufferFirstFrame;
+	NSInteger _dstFramesBuffered;
+	AVAudioPacketCount _dstBufferPacketOffset;
 }
+- (BOOL)decodeDSTFramesReturningError:(NSError **)error;
+- (BOOL)decodeDSTIntoBuffer:(AVAudioCompressedBuffer *)buffer packetCount:(AVAudioPacketCount)packetCount error:(NSError **)error;
+- (BOOL)seekToDSTPacket:(AVAudioFramePosition)packet error:(NSError **)error;
 @end
 
 @implementation SFBDSDIFFDecoder
@@ -714,25 +794,24 @@ namespace {
 	if(![super openReturningError:error])
 		return NO;
 
-	auto chunks = ParseDSDIFF(_inputSource);
-	if(!chunks) {
+	DSDIFFFile file;
+	if(!ParseDSDIFF(_inputSource, file)) {
 		os_log_error(gSFBDSDDecoderLog, "Error parsing file");
 		if(error)
 			*error = CreateInvalidDSDIFFFileError(_inputSource.url);
 		return NO;
 	}
 
-	auto propertyChunk = std::static_pointer_cast<PropertyChunk>(chunks->mLocalChunks['PROP']);
-	auto sampleRateChunk = std::static_pointer_cast<SampleRateChunk>(propertyChunk->mLocalChunks['FS  ']);
-	auto channelsChunk = std::static_pointer_cast<ChannelsChunk>(propertyChunk->mLocalChunks['CHNL']);
-
-	if(!propertyChunk || !sampleRateChunk || !channelsChunk) {
+	if(!file.FindChunk('PROP') || !file.FindChunk('FS  ', 'PROP') || !file.FindChunk('CHNL', 'PROP')) {
 		os_log_error(gSFBDSDDecoderLog, "Missing chunk in file");
 		if(error)
 			*error = CreateInvalidDSDIFFFileError(_inputSource.url);
 		return NO;
 	}
 
+	const auto sampleRateChunk = &file.mSampleRate;
+	const auto channelsChunk = &file.mChannels;
+
 	// Channel layouts are defined in the DSDIFF file format specification
 	AVAudioChannelLayout *channelLayout = nil;
 	if(channelsChunk->mChannelIDs.size() == 2 && channelsChunk->mChannelIDs[0] == 'SLFT' && channelsChunk->mChannelIDs[1] == 'SRGT')
@@ -748,11 +827,18 @@ namespace {
 		channelLayout = [AVAudioChannelLayout layoutWithChannelLabels:&labels[0] count:(AVAudioChannelCount)labels.size()];
 	}
 
+	const auto compressionTypeChunk = file.FindChunk('CMPR', 'PROP') ? &file.mCompressionType : nullptr;
+	bool isDST = compressionTypeChunk && compressionTypeChunk->mCompressionType == 'DST ';
+
 	AudioStreamBasicDescription processingStreamDescription{};
 
 	// The output format is raw DSD
 	processingStreamDescription.mFormatID			= SFBAudioFormatIDDirectStreamDigital;
 	processingStreamDescription.mFormatFlags		= kAudioFormatFlagIsBigEndian;
+	// Uncompressed sound data is stored as clustered frames so non-interleaved packets are only provided for DST,
+	// which decodes to non-interleaved channel data
+	if(_prefersNonInterleavedPackets && isDST)
+		processingStreamDescription.mFormatFlags	|= kAudioFormatFlagIsNonInterleaved;
 
 	processingStreamDescription.mSampleRate			= (Float64)sampleRateChunk->mSampleRate;
 	processingStreamDescription.mChannelsPerFrame	= channelsChunk->mNumberChannels;
@@ -774,7 +860,79 @@ namespace {
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
-	auto soundDataChunk = std::static_pointer_cast<DSDSoundDataChunk>(chunks->mLocalChunks['DSD ']);
+	if(isDST) {
+		const auto dstSoundDataChunk = file.FindChunk('DST ');
+		const auto frameInformationChunk = file.FindChunk('FRTE', 'DST ') ? &file.mDSTFrameInformation : nullptr;
+		if(!dstSoundDataChunk || !frameInformationChunk) {
+			os_log_error(gSFBDSDDecoderLog, "Missing chunk in file");
+			if(error)
+				*error = CreateInvalidDSDIFFFileError(_inputSource.url);
+			return NO;
+		}
+
+		if(channelsChunk->mNumberChannels == 0 || channelsChunk->mNumberChannels > 6 || sampleRateChunk->mSampleRate == 0 || sampleRateChunk->mSampleRate % 44100) {
+			os_log_error(gSFBDSDDecoderLog, "Unsupported DST format: %u channels at %u Hz", channelsChunk->mNumberChannels, sampleRateChunk->mSampleRate);
+			if(error)
+				*error = CreateUnsupportedDSDIFFFileError(_inputSource.url);
+			return NO;
+		}
+
+		// DST frames are decoded in batches, one frame per decoder, with the frames in a batch decoded concurrently
+		NSUInteger batchSize = std::min(std::max(NSProcessInfo.processInfo.activeProcessorCount, (NSUInteger)1), (NSUInteger)8);
+		try {
+			for(NSUInteger i = 0; i < batchSize; ++i)
+				_dstDecoders.push_back(std::make_unique<SFB::DSTDecoder>(channelsChunk->mNumberChannels, sampleRateChunk->mSampleRate));
+			_dstFrames.resize(batchSize);
+			_dstFrameBuffer.resize(batchSize * _dstDecoders[0]->FrameBytes());
+		}
+		catch(const std::exception& e) {
+			os_log_error(gSFBDSDDecoderLog, "Unable to allocate DST decoders: %{public}s", e.what());
+			_dstDecoders.clear();
+			_dstFrames.clear();
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return NO;
+		}
+
+		_isDST = YES;
+		_dstPacketsPerFrame = (AVAudioPacketCount)_dstDecoders[0]->FrameBytesPerChannel();
+		_dstFrameCount = frameInformationChunk->mNumberFrames;
+		_dstEndOffset = dstSoundDataChunk->mDataOffset + (int64_t)dstSoundDataChunk->mDataSize;
+		_audioOffset = frameInformationChunk->mFrameDataOffset;
+		_packetCount = _dstFrameCount * _dstPacketsPerFrame;
+
+		// Use the sound index, if present and plausible, for seeking
+		// Some writers store the offset of the frame data rather than the offset of the 'DSTF' chunk
+		const auto soundIndexChunk = file.FindChunk('DSTI') ? &file.mDSTSoundIndex : nullptr;
+		if(soundIndexChunk && !soundIndexChunk->mEntries.empty() && (int64_t)soundIndexChunk->mEntries.size() >= _dstFrameCount) {
+			const auto& entries = soundIndexChunk->mEntries;
+			for(int64_t adjustment : {0, -12}) {
+				if(IsDSTFrameChunkAtOffset(_inputSource, (int64_t)entries.front().mOffset + adjustment) && IsDSTFrameChunkAtOffset(_inputSource, (int64_t)entries.back().mOffset + adjustment)) {
+					_dstFrameOffsets.reserve(entries.size());
+					for(const auto& entry : entries)
+						_dstFrameOffsets.push_back((int64_t)entry.mOffset + adjustment);
+					break;
+				}
+			}
+			if(_dstFrameOffsets.empty())
+				os_log_info(gSFBDSDDecoderLog, "Ignoring invalid 'DSTI' chunk");
+		}
+
+		if(![_inputSource seekToOffset:_audioOffset error:error])
+			return NO;
+
+		_isOpen = YES;
+
+		return YES;
+	}
+	else if(compressionTypeChunk && compressionTypeChunk->mCompressionType != 'DSD ') {
+		os_log_error(gSFBDSDDecoderLog, "Unsupported compression type '%{public}.4s'", SFBCStringForOSType(compressionTypeChunk->mCompressionType));
+		if(error)
+			*error = CreateUnsupportedDSDIFFFileError(_inputSource.url);
+		return NO;
+	}
+
+	const auto soundDataChunk = file.FindChunk('DSD ');
 	if(!soundDataChunk) {
 		os_log_error(gSFBDSDDecoderLog, "Missing chunk in file");
 		if(error)
@@ -795,6 +953,17 @@ namespace {
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+
+	_isDST = NO;
+	_dstFrameOffsets.clear();
+	_dstDecoders.clear();
+	_dstFrames.clear();
+	_dstFrameBuffer.clear();
+	_dstNextFrame = 0;
+	_dstBufferFirstFrame = 0;
+	_dstFramesBuffered = 0;
+	_dstBufferPacketOffset = 0;
+
 	_isOpen = NO;
 	return [super closeReturningError:error];
 }
@@ -830,40 +999,32 @@ namespace {
 	if(packetCount > buffer.packetCapacity)
 		packetCount = buffer.packetCapacity;
 
+	if(_isDST)
+		return [self decodeDSTIntoBuffer:buffer packetCount:packetCount error:error];
+
 	AVAudioPacketCount packetsRemaining = (AVAudioPacketCount)(_packetCount - _packetPosition);
 	AVAudioPacketCount packetsToRead = std::min(packetCount, packetsRemaining);
-	AVAudioPacketCount packetsRead = 0;
+	if(packetsToRead == 0)
+		return YES;
 
 	uint32_t packetSize = SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * _processingFormat.channelCount;
 
-	for(;;) {
-		// Read interleaved input, grouped as 8 one bit samples per frame (a single channel byte) into
-		// a clustered frame (one channel byte per channel)
-
-		uint8_t *buf = (uint8_t *)buffer.data + buffer.byteLength;
-		NSInteger bytesToRead = std::min(packetsToRead * packetSize, buffer.byteCapacity - buffer.byteLength);
-
-		NSInteger bytesRead;
-		if(![_inputSource readBytes:buf length:bytesToRead bytesRead:&bytesRead error:error] || bytesRead != bytesToRead) {
-			os_log_debug(gSFBDSDDecoderLog, "Error reading audio: requested %ld bytes, got %ld", (long)bytesToRead, bytesRead);
-			break;
-		}
-
-		// Decoding is finished
-		if(bytesRead == 0)
-			break;
-
-		packetsRead += (bytesRead / packetSize);
+	// Read interleaved input, grouped as 8 one bit samples per frame (a single channel byte) into
+	// a clustered frame (one channel byte per channel), directly into the output buffer
+	NSInteger bytesToRead = packetsToRead * packetSize;
+	NSInteger bytesRead = 0;
+	if(![_inputSource readBytes:buffer.data length:bytesToRead bytesRead:&bytesRead error:error] || bytesRead != bytesToRead)
+		os_log_debug(gSFBDSDDecoderLog, "Error reading audio: requested %ld bytes, got %ld", (long)bytesToRead, bytesRead);
 
-		buffer.packetCount += (AVAudioPacketCount)(bytesRead / packetSize);
-		buffer.byteLength += (uint32_t)bytesRead;
+	// Return the complete packets that were read
+	AVAudioPacketCount packetsRead = (AVAudioPacketCount)(bytesRead / packetSize);
 
-		// All requested frames were read
-		if(packetsRead == packetCount)
-			break;
+	// Leave a partial packet to be read again
+	if(bytesRead % packetSize && ![_inputSource seekToOffset:(_audioOffset + (_packetPosition + packetsRead) * packetSize) error:nil])
+		os_log_debug(gSFBDSDDecoderLog, "Unable to seek to the start of a partial packet");
 
-		packetsToRead -= packetsRead;
-	}
+	buffer.packetCount = packetsRead;
+	buffer.byteLength = packetsRead * packetSize;
 
 	_packetPosition += packetsRead;
 
@@ -874,6 +1035,9 @@ namespace {
 {
 	NSParameterAssert(packet >= 0);
 
+	if(_isDST)
+		return [self seekToDSTPacket:packet error:error];
+
 	NSInteger packetOffset = packet * SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * _processingFormat.channelCount;
 	if(![_inputSource seekToOffset:(_audioOffset + packetOffset) error:error]) {
 		os_log_debug(gSFBDSDDecoderLog, "-seekToPacket:error: failed seeking to input offset: %lld", _audioOffset + packetOffset);
@@ -884,4 +1048,157 @@ namespace {
 	return YES;
 }
 
+#pragma mark DST
+
+- (BOOL)decodeDSTFramesReturningError:(NSError **)error
+{
+	_dstBufferFirstFrame = _dstNextFrame;
+	_dstFramesBuffered = 0;
+	_dstBufferPacketOffset = 0;
+
+	// Read the compressed frames sequentially
+	NSInteger frameCount = 0;
+	while(frameCount < (NSInteger)_dstDecoders.size() && _dstNextFrame + frameCount < _dstFrameCount) {
+		if(!ReadDSTFrame(_inputSource, _dstEndOffset, _dstFrames[(size_t)frameCount]))
+			break;
+		++frameCount;
+	}
+
+	if(frameCount == 0) {
+		os_log_debug(gSFBDSDDecoderLog, "Unable to read DST frame %lld", _dstNextFrame);
+		return YES;
+	}
+
+	// Decode the frames concurrently
+	SFB::DSTDecoder::unique_ptr *decoders = _dstDecoders.data();
+	const std::vector<uint8_t> *frames = _dstFrames.data();
+	uint8_t *output = _dstFrameBuffer.data();
+	size_t frameBytes = _dstDecoders[0]->FrameBytes();
+	int64_t firstFrame = _dstNextFrame;
+
+	void (^decodeFrame)(size_t) = ^(size_t i) {
+		uint8_t *dst = output + i * frameBytes;
+		if(!decoders[i]->DecodeFrame(frames[i].data(), frames[i].size(), dst)) {
+			os_log_error(gSFBDSDDecoderLog, "Error decoding DST frame %lld", firstFrame + (int64_t)i);
+			// Substitute digital silence
+			std::memset(dst, 0x69, frameBytes);
+		}
+	};
+
+	if(frameCount == 1)
+		decodeFrame(0);
+	else
+		dispatch_apply((size_t)frameCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), decodeFrame);
+
+	_dstFramesBuffered = frameCount;
+	_dstNextFrame += frameCount;
+
+	return YES;
+}
+
+- (BOOL)decodeDSTIntoBuffer:(AVAudioCompressedBuffer *)buffer packetCount:(AVAudioPacketCount)packetCount error:(NSError **)error
+{
+	AVAudioPacketCount packetsRemaining = (AVAudioPacketCount)(_packetCount - _packetPosition);
+	AVAudioPacketCount packetsToRead = std::min(packetCount, packetsRemaining);
+	if(packetsToRead == 0)
+		return YES;
+
+	AVAudioChannelCount channelCount = _processingFormat.channelCount;
+	bool nonInterleaved = _processingFormat.streamDescription->mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+	size_t frameBytes = _dstDecoders[0]->FrameBytes();
+	uint8_t *dst = (uint8_t *)buffer.data;
+
+	AVAudioPacketCount packetsProcessed = 0;
+	while(packetsProcessed < packetsToRead) {
+		// Decode the next batch of frames if all buffered frames have been consumed
+		if(_dstBufferPacketOffset == _dstFramesBuffered * _dstPacketsPerFrame) {
+			if(![self decodeDSTFramesReturningError:error])
+				return NO;
+			if(_dstFramesBuffered == 0)
+				break;
+		}
+
+		AVAudioPacketCount frameOffset = _dstBufferPacketOffset % _dstPacketsPerFrame;
+		AVAudioPacketCount packetsToCopy = std::min(_dstPacketsPerFrame - frameOffset, packetsToRead - packetsProcessed);
+
+		// Decoded frames are non-interleaved
+		const uint8_t *frame = _dstFrameBuffer.data() + (_dstBufferPacketOffset / _dstPacketsPerFrame) * frameBytes + frameOffset;
+		if(nonInterleaved) {
+			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+				std::memcpy(dst + channel * packetsToRead + packetsProcessed, frame + channel * _dstPacketsPerFrame, packetsToCopy);
+		}
+		else {
+			uint8_t *out = dst + packetsProcessed * channelCount;
+			for(AVAudioPacketCount packet = 0; packet < packetsToCopy; ++packet) {
+				for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+					*out++ = frame[channel * _dstPacketsPerFrame + packet];
+			}
+		}
+
+		packetsProcessed += packetsToCopy;
+		_dstBufferPacketOffset += packetsToCopy;
+	}
+
+	// Close the gaps between channels if fewer packets than expected were available
+	if(nonInterleaved && packetsProcessed < packetsToRead) {
+		for(AVAudioChannelCount channel = 1; channel < channelCount; ++channel)
+			std::memmove(dst + channel * packetsProcessed, dst + channel * packetsToRead, packetsProcessed);
+	}
+
+	buffer.packetCount = packetsProcessed;
+	buffer.byteLength = packetsProcessed * channelCount;
+
+	_packetPosition += packetsProcessed;
+
+	return YES;
+}
+
+- (BOOL)seekToDSTPacket:(AVAudioFramePosition)packet error:(NSError **)error
+{
+	int64_t frame = packet / _dstPacketsPerFrame;
+	if(frame >= _dstFrameCount) {
+		os_log_debug(gSFBDSDDecoderLog, "-seekToPacket:error: packet %lld out of range", packet);
+		if(error)
+			*error = CreateDSTSeekError(_inputSource.url);
+		return NO;
+	}
+
+	// Seeks within the buffered frames require no I/O
+	if(frame < _dstBufferFirstFrame || frame >= _dstBufferFirstFrame + _dstFramesBuffered) {
+		// Build an index of frame offsets if the file didn't contain a usable one
+		if(_dstFrameOffsets.empty() && !BuildDSTFrameIndex(_inputSource, _audioOffset, _dstEndOffset, _dstFrameOffsets)) {
+			os_log_error(gSFBDSDDecoderLog, "Error building DST frame index");
+			_dstFrameOffsets.clear();
+			if(error)
+				*error = CreateDSTSeekError(_inputSource.url);
+			return NO;
+		}
+
+		if(frame >= (int64_t)_dstFrameOffsets.size()) {
+			os_log_debug(gSFBDSDDecoderLog, "-seekToPacket:error: DST frame %lld not found", frame);
+			if(error)
+				*error = CreateDSTSeekError(_inputSource.url);
+			return NO;
+		}
+
+		if(![_inputSource seekToOffset:_dstFrameOffsets[(size_t)frame] error:error]) {
+			os_log_debug(gSFBDSDDecoderLog, "-seekToPacket:error: failed seeking to input offset: %lld", _dstFrameOffsets[(size_t)frame]);
+			return NO;
+		}
+
+		_dstNextFrame = frame;
+		if(![self decodeDSTFramesReturningError:error])
+			return NO;
+		if(_dstFramesBuffered == 0) {
+			if(error)
+				*error = CreateDSTSeekError(_inputSource.url);
+			return NO;
+		}
+	}
+
+	_dstBufferPacketOffset = (AVAudioPacketCount)((frame - _dstBufferFirstFrame) * _dstPacketsPerFrame + packet % _dstPacketsPerFrame);
+	_packetPosition = packet;
+	return YES;
+}
+
 @end
@@ -5,10 +5,17 @@
 
 @import os.log;
 
+#if defined(__ARM_NEON)
+#import <arm_neon.h>
+#elif defined(__SSE2__)
+#import <emmintrin.h>
+#endif
+
 #import "SFBDSFDecoder.h"
 
 #import "NSError+SFBURLPresentation.h"
 #import "SFBCStringForOSType.h"
+#import "SFBDataInputSource.h"
 
 #define DSF_BLOCK_SIZE_BYTES_PER_CHANNEL 4096
 
@@ -40,24 +47,65 @@ static NSError * CreateInvalidDSFFileError(NSURL * url)
 					 recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
 }
 
-// For the size of matrices this class deals with the naive approach is adequate
-static void MatrixTransposeNaive(const uint8_t * restrict A, uint8_t * restrict B, NSInteger rows, NSInteger columns)
+// Copy packetCount clustered frames starting at packetOffset out of a DSF block set into dst
+// The DSF block set forms a matrix with one row per channel and one column per channel byte,
+// so this is a transposition of the columns [packetOffset, packetOffset + packetCount).
+// Rows are read sequentially and the output is written sequentially; for the channel counts
+// permitted by DSF (at most 6) the row streams stay resident in cache.
+static void TransposeDSFBlock(const uint8_t * restrict block, AVAudioChannelCount channelCount, AVAudioPacketCount packetOffset, AVAudioPacketCount packetCount, uint8_t * restrict dst)
 {
-	for(NSInteger i = 0; i < rows; ++i) {
-		for(NSInteger j = 0; j < columns; ++j)
-			B[j * rows + i] = A[i * columns + j];
+	const uint8_t *src = block + packetOffset;
+
+	if(channelCount == 1) {
+		memcpy(dst, src, packetCount);
+		return;
+	}
+
+	AVAudioPacketCount i = 0;
+
+	if(channelCount == 2) {
+		const uint8_t *left = src;
+		const uint8_t *right = src + DSF_BLOCK_SIZE_BYTES_PER_CHANNEL;
+#if defined(__ARM_NEON)
+		for(; i + 16 <= packetCount; i += 16) {
+			uint8x16x2_t lr = { vld1q_u8(left + i), vld1q_u8(right + i) };
+			vst2q_u8(dst + 2 * i, lr);
+		}
+#elif defined(__SSE2__)
+		for(; i + 16 <= packetCount; i += 16) {
+			__m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+			__m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+			_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(l, r));
+			_mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(l, r));
+		}
+#endif
+		for(; i < packetCount; ++i) {
+			dst[2 * i] = left[i];
+			dst[2 * i + 1] = right[i];
+		}
+		return;
+	}
+
+	for(; i < packetCount; ++i) {
+		for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+			*dst++ = src[channel * DSF_BLOCK_SIZE_BYTES_PER_CHANNEL + i];
 	}
 }
 
 @interface SFBDSFDecoder ()
 {
 @private
+	BOOL _isOpen;
 	AVAudioFramePosition _packetPosition;
 	AVAudioFramePosition _packetCount;
 	int64_t _audioOffset;
-	AVAudioCompressedBuffer *_buffer;
+	// The current DSF block set, which is either _blockBuffer or memory owned by _inputSource
+	const uint8_t *_block;
+	uint8_t *_blockBuffer;
+	AVAudioPacketCount _blockPacketOffset;
+	AVAudioPacketCount _blockPacketCount;
 }
-- (BOOL)readAndInterleaveDSFBlockReturningError:(NSError **)error;
+- (BOOL)readDSFBlockReturningError:(NSError **)error;
 @end
 
 @implementation SFBDSFDecoder
@@ -238,6 +286,9 @@ static void MatrixTransposeNaive(const uint8_t * restrict A, uint8_t * restrict
 	// The output format is raw DSD
 	processingStreamDescription.mFormatID			= SFBAudioFormatIDDirectStreamDigital;
 	processingStreamDescription.mFormatFlags		= bitsPerSample == 8 ? kAudioFormatFlagIsBigEndian : 0;
+	// DSF stores audio non-interleaved so no conversion is required
+	if(_prefersNonInterleavedPackets)
+		processingStreamDescription.mFormatFlags	|= kAudioFormatFlagIsNonInterleaved;
 
 	processingStreamDescription.mSampleRate			= (Float64)samplingFrequency;
 	processingStreamDescription.mChannelsPerFrame	= (UInt32)channelNum;
@@ -261,21 +312,39 @@ static void MatrixTransposeNaive(const uint8_t * restrict A, uint8_t * restrict
 
 	// Metadata chunk is ignored
 
-	_buffer = [[AVAudioCompressedBuffer alloc] initWithFormat:_processingFormat packetCapacity:(DSF_BLOCK_SIZE_BYTES_PER_CHANNEL / SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL) maximumPacketSize:(SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * channelNum)];
-	_buffer.packetCount = 0;
+	// Memory-backed input sources provide the block set directly
+	if(![_inputSource isKindOfClass:[SFBDataInputSource class]]) {
+		_blockBuffer = malloc(DSF_BLOCK_SIZE_BYTES_PER_CHANNEL * channelNum);
+		if(!_blockBuffer) {
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return NO;
+		}
+	}
+
+	_block = NULL;
+	_blockPacketOffset = 0;
+	_blockPacketCount = 0;
+
+	_isOpen = YES;
 
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
-	_buffer = nil;
+	_block = NULL;
+	free(_blockBuffer);
+	_blockBuffer = NULL;
+	_blockPacketOffset = 0;
+	_blockPacketCount = 0;
+	_isOpen = NO;
 	return [super closeReturningError:error];
 }
 
 - (BOOL)isOpen
 {
-	return _buffer != nil;
+	return _isOpen;
 }
 
 - (AVAudioFramePosition)packetPosition
@@ -306,40 +375,46 @@ static void MatrixTransposeNaive(const uint8_t * restrict A, uint8_t * restrict
 
 	AVAudioPacketCount packetsProcessed = 0;
 
-	uint32_t packetSize = SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * _processingFormat.channelCount;
+	AVAudioChannelCount channelCount = _processingFormat.channelCount;
+	uint32_t packetSize = SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * channelCount;
+
+	// The final block is padded so clamp to the number of packets in the file
+	AVAudioFramePosition packetsAvailable = _packetCount - _packetPosition;
+	if(packetsAvailable < packetCount)
+		packetCount = (AVAudioPacketCount)MAX(packetsAvailable, 0);
+
+	BOOL nonInterleaved = (_processingFormat.streamDescription->mFormatFlags & kAudioFormatFlagIsNonInterleaved) == kAudioFormatFlagIsNonInterleaved;
+	uint8_t *dst = (uint8_t *)buffer.data;
 
-	for(;;) {
-		AVAudioPacketCount packetsRemaining = packetCount - packetsProcessed;
-		AVAudioPacketCount packetsToSkip = buffer.packetCount;
-		AVAudioPacketCount packetsInBuffer = _buffer.packetCount;
-		AVAudioPacketCount packetsToCopy = SFB_min(packetsInBuffer, packetsRemaining);
+	while(packetsProcessed < packetCount) {
+		// Read the next block if the current one is exhausted
+		if(_blockPacketOffset == _blockPacketCount && ![self readDSFBlockReturningError:error])
+			break;
 
-		// Copy data from the internal buffer to output
-		uint32_t copySize = packetsToCopy * packetSize;
-		memcpy((uint8_t *)buffer.data + (packetsToSkip * packetSize), _buffer.data, copySize);
-		buffer.packetCount += packetsToCopy;
-		buffer.byteLength += copySize;
+		AVAudioPacketCount packetsToCopy = SFB_min(_blockPacketCount - _blockPacketOffset, packetCount - packetsProcessed);
 
-		// Move remaining data in buffer to beginning
-		if(packetsToCopy != packetsInBuffer) {
-			uint8_t *dst = (uint8_t *)_buffer.data;
-			memmove(dst, dst + copySize, (packetsInBuffer - packetsToCopy) * packetSize);
+		if(nonInterleaved) {
+			// Copy each channel's bytes directly from the block set into the output
+			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+				memcpy(dst + (channel * packetCount) + packetsProcessed, _block + (channel * DSF_BLOCK_SIZE_BYTES_PER_CHANNEL) + _blockPacketOffset, packetsToCopy * SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL);
 		}
+		else
+			// Interleave directly from the block set into the output
+			TransposeDSFBlock(_block, channelCount, _blockPacketOffset, packetsToCopy, dst + (packetsProcessed * packetSize));
 
-		_buffer.packetCount -= packetsToCopy;
-		_buffer.byteLength -= copySize;
-
+		_blockPacketOffset += packetsToCopy;
 		packetsProcessed += packetsToCopy;
+	}
 
-		// All requested packets were read
-		if(packetsProcessed == packetCount)
-			break;
-
-		// Read  the next block
-		if(![self readAndInterleaveDSFBlockReturningError:error])
-			break;
+	// Close the gaps between channels if fewer packets than expected were read
+	if(nonInterleaved && packetsProcessed < packetCount) {
+		for(AVAudioChannelCount channel = 1; channel < channelCount; ++channel)
+			memmove(dst + (channel * packetsProcessed), dst + (channel * packetCount), packetsProcessed * SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL);
 	}
 
+	buffer.packetCount = packetsProcessed;
+	buffer.byteLength = packetsProcessed * packetSize;
+
 	_packetPosition += packetsProcessed;
 
 	return YES;
@@ -363,54 +438,43 @@ static void MatrixTransposeNaive(const uint8_t * restrict A, uint8_t * restrict
 		return NO;
 	}
 
-	if(![self readAndInterleaveDSFBlockReturningError:error])
+	if(![self readDSFBlockReturningError:error])
 		return NO;
 
-	// Skip ahead in the interleaved audio to the specified packet
-	AVAudioPacketCount packetsInBuffer = _buffer.packetCount;
-	AVAudioPacketCount packetsToSkip = packet % packetsInBuffer;
-	AVAudioPacketCount packetsToMove = packetsInBuffer - packetsToSkip;
-
-	// Move data
-	uint32_t packetSize = SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * _processingFormat.channelCount;
-	uint8_t *dst = (uint8_t *)_buffer.data;
-	const uint8_t *src = (uint8_t *)_buffer.data + (packetsToSkip * packetSize);
-	memmove(dst, src, packetsToMove * packetSize);
-
-	_buffer.packetCount = packetsToMove;
-	_buffer.byteLength = packetsToMove * packetSize;
-
+	// Skip ahead in the block set to the specified packet
+	_blockPacketOffset = (AVAudioPacketCount)(packet % _blockPacketCount);
 	_packetPosition = packet;
 
 	return YES;
 }
 
 // Read input, grouped in DSF as 8 one-bit samples per frame (a single channel byte) in a block
-// of the specified block size (4096 bytes per channel for DSF version 1) for each channel,
-// then interleave the channel bytes into clustered frames.
-// The DSF blocks form a matrix with one row per channel and one column per channel byte.
-// For stereo, the data is arranged as 4096 L channel bytes followed by 4096 R channel bytes,
-// a 2 x 4096 matrix.
-// Interleaving is accomplished by matrix transposition.
-- (BOOL)readAndInterleaveDSFBlockReturningError:(NSError **)error
+// of the specified block size (4096 bytes per channel for DSF version 1) for each channel.
+// For stereo, the data is arranged as 4096 L channel bytes followed by 4096 R channel bytes.
+// The block set is left as-is and interleaved into clustered frames as it is consumed.
+- (BOOL)readDSFBlockReturningError:(NSError **)error
 {
-	uint8_t *buf = (uint8_t *)_buffer.data;
-	uint32_t bufsize = _buffer.byteCapacity;
+	NSInteger blockSize = DSF_BLOCK_SIZE_BYTES_PER_CHANNEL * _processingFormat.channelCount;
 
 	NSInteger bytesRead;
-	if(![_inputSource readBytes:buf length:bufsize bytesRead:&bytesRead error:error] || bytesRead != bufsize) {
-		os_log_debug(gSFBDSDDecoderLog, "Error reading audio block: requested %u bytes, got %ld", bufsize, bytesRead);
+	if(_blockBuffer) {
+		if(![_inputSource readBytes:_blockBuffer length:blockSize bytesRead:&bytesRead error:error])
+			bytesRead = 0;
+		_block = _blockBuffer;
+	}
+	else
+		_block = [(SFBDataInputSource *)_inputSource readBytesNoCopyWithLength:blockSize bytesRead:&bytesRead];
+
+	if(!_block || bytesRead != blockSize) {
+		os_log_debug(gSFBDSDDecoderLog, "Error reading audio block: requested %ld bytes, got %ld", (long)blockSize, (long)bytesRead);
+		_block = NULL;
+		_blockPacketOffset = 0;
+		_blockPacketCount = 0;
 		return NO;
 	}
 
-	// Deinterleave the blocks and interleave the samples into clustered frames
-	AVAudioChannelCount channelCount = _processingFormat.channelCount;
-	uint8_t tmp [bufsize];
-	MatrixTransposeNaive(buf, tmp, channelCount, DSF_BLOCK_SIZE_BYTES_PER_CHANNEL);
-	memcpy(buf, tmp, bufsize);
-
-	_buffer.packetCount = (AVAudioPacketCount)(bytesRead / (SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL * channelCount));
-	_buffer.byteLength = (uint32_t)bytesRead;
+	_blockPacketOffset = 0;
+	_blockPacketCount = DSF_BLOCK_SIZE_BYTES_PER_CHANNEL / SFB_BYTES_PER_DSD_PACKET_PER_CHANNEL;
 
 	return YES;
 }
@@ -11,21 +11,13 @@
 #import "NSError+SFBURLPresentation.h"
 #import "SFBAudioDecoder+Internal.h"
 #import "SFBDSDDecoder.h"
+#import "SFBSampleFormatKernels.h"
 
 #define DSD_PACKETS_PER_DOP_FRAME (16 / SFB_PCM_FRAMES_PER_DSD_PACKET)
 #define BUFFER_SIZE_PACKETS 4096
 
 static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b) { return a < b ? a : b; }
 
-// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
-static const uint8_t sBitReverseTable256 [256] =
-{
-#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
-#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
-#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
-	R6(0), R6(2), R6(1), R6(3)
-};
-
 // Support DSD64, DSD128, and DSD256 (64x, 128x, and 256x the CD sample rate of 44.1 KHz)
 // as well as the 48.0 KHz variants 6.144 MHz and 12.288 MHz
 static BOOL IsSupportedDoPSampleRate(Float64 sampleRate)
@@ -103,8 +95,12 @@ static BOOL IsSupportedDoPSampleRate(Float64 sampleRate)
 
 - (BOOL)openReturningError:(NSError **)error
 {
-	if(!_decoder.isOpen && ![_decoder openReturningError:error])
-		return NO;
+	if(!_decoder.isOpen) {
+		// Each channel is processed separately so avoid interleaving if possible
+		_decoder.prefersNonInterleavedPackets = YES;
+		if(![_decoder openReturningError:error])
+			return NO;
+	}
 
 	const AudioStreamBasicDescription *asbd = _decoder.processingFormat.streamDescription;
 
@@ -214,30 +210,20 @@ static BOOL IsSupportedDoPSampleRate(Float64 sampleRate)
 			break;
 
 		// Convert to DoP
-		// NB: Currently DSDIFFDecoder and DSFDecoder only produce interleaved output
 
 		AVAudioFrameCount framesDecoded = dsdPacketsDecoded / DSD_PACKETS_PER_DOP_FRAME;
 
 		uint8_t marker = _marker;
 		AVAudioChannelCount channelCount = _processingFormat.channelCount;
+		BOOL isNonInterleaved = (_buffer.format.streamDescription->mFormatFlags & kAudioFormatFlagIsNonInterleaved) == kAudioFormatFlagIsNonInterleaved;
+		NSInteger stride = isNonInterleaved ? 1 : channelCount;
 		for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-			const uint8_t *input = (uint8_t *)_buffer.data + channel;
+			const uint8_t *input = (uint8_t *)_buffer.data + (isNonInterleaved ? channel * dsdPacketsDecoded : channel);
 			uint8_t *output = (uint8_t *)buffer.audioBufferList->mBuffers[channel].mData + buffer.audioBufferList->mBuffers[channel].mDataByteSize;
 
 			// The DoP marker should match across channels
 			marker = _marker;
-			for(AVAudioFrameCount i = 0; i < framesDecoded; ++i) {
-				// Insert the DoP marker
-				*output++ = marker;
-
-				// Copy the DSD bits
-				*output++ = _reverseBits ? sBitReverseTable256[*input] : *input;
-				input += channelCount;
-				*output++ = _reverseBits ? sBitReverseTable256[*input] : *input;
-				input += channelCount;
-
-				marker = marker == (uint8_t)0x05 ? (uint8_t)0xfa : (uint8_t)0x05;
-			}
+			SFBPackDoP(input, stride, output, framesDecoded, &marker, _reverseBits);
 		}
 
 		_marker = marker;
@@ -271,4 +257,10 @@ static BOOL IsSupportedDoPSampleRate(Float64 sampleRate)
 	return YES;
 }
 
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+	return SFBPCMDecoderSkipFrames(self, frameLength, error);
+}
+
 @end
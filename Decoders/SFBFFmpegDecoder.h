@@ -8,7 +8,14 @@
 NS_ASSUME_NONNULL_BEGIN
 
 // An SFBAudioDecoder subclass supporting formats handled by FFmpeg or Libav
+//
+// Codecs decode using FFmpeg's frame and slice threading where supported, and packets
+// may be demuxed ahead of decoding on a separate thread
 @interface SFBFFmpegDecoder : SFBAudioDecoder
+
+// The maximum number of packets demuxed ahead of decoding, or 0 to demux on the decoding thread (default 32)
+@property (class) NSUInteger packetQueueDepth;
+
 @end
 
 NS_ASSUME_NONNULL_END
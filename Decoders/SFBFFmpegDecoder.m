@@ -5,6 +5,8 @@
 
 @import OSLog;
 
+#import <stdatomic.h>
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
 #pragma clang diagnostic ignored "-Wdocumentation"
@@ -18,11 +20,15 @@
 
 #import "SFBFFmpegDecoder.h"
 
-#import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "NSError+SFBURLPresentation.h"
 
 #define BUF_SIZE 4096
+#define BULK_BUF_SIZE (256 * 1024)
 #define ERRBUF_SIZE 512
+#define DEMUX_RETRY_INTERVAL 0.01
+
+// The packet queue depth may be set from any thread
+static _Atomic(NSUInteger) sPacketQueueDepth = 32;
 
 #pragma mark Initialization
 
@@ -100,10 +106,25 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	AVCodecContext *_codecContext;
 	int _streamIndex;
 	AVAudioFramePosition _framePosition;
-	AVAudioPCMBuffer *_buffer;
+	// The number of frames in _frame already copied out
+	int _frameOffset;
+	// Packets demuxed ahead of decoding, protected by _packetQueueCondition
+	NSCondition *_packetQueueCondition;
+	AVPacket **_packetQueue;
+	NSUInteger _packetQueueCapacity;
+	NSUInteger _packetQueueHead;
+	NSUInteger _packetQueueCount;
+	int _demuxResult;
+	BOOL _stopDemuxing;
+	dispatch_queue_t _demuxQueue;
+	dispatch_group_t _demuxGroup;
 }
+- (void)startDemuxing;
+- (void)stopDemuxing;
+- (int)readPacket:(AVPacket **)packet;
 - (int)readFrame;
 - (int)decodeFrame;
+- (AVAudioFrameCount)copyFramesIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength;
 @end
 
 @implementation SFBFFmpegDecoder
@@ -145,12 +166,40 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	return mimeTypes;
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	// av_probe_input_format() requires zeroed padding following the data
+	NSMutableData *data = [NSMutableData dataWithLength:prefix.length + AVPROBE_PADDING_SIZE];
+	memcpy(data.mutableBytes, prefix.bytes, prefix.length);
+
+	AVProbeData probeData = { .filename = "", .buf = data.mutableBytes, .buf_size = (int)prefix.length };
+	if(av_probe_input_format(&probeData, 1))
+		return SFBAudioDecoderProbeScorePossible;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
++ (NSUInteger)packetQueueDepth
+{
+	return atomic_load(&sPacketQueueDepth);
+}
+
++ (void)setPacketQueueDepth:(NSUInteger)packetQueueDepth
+{
+	atomic_store(&sPacketQueueDepth, packetQueueDepth);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
-	unsigned char *buf = (unsigned char *)av_malloc(BUF_SIZE);
+	_framePosition = 0;
+	_frameOffset = 0;
+
+	// Larger reads are more efficient when decoding sequentially
+	int bufSize = self.decodesInBulk ? BULK_BUF_SIZE : BUF_SIZE;
+	unsigned char *buf = (unsigned char *)av_malloc((size_t)bufSize);
 	if(!buf) {
 		os_log_error(gSFBAudioDecoderLog, "av_malloc failed");
 		if(error)
@@ -158,7 +207,7 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 		return NO;
 	}
 
-	_ioContext = avio_alloc_context(buf, BUF_SIZE, 0, (__bridge void *)self, my_read_packet, NULL, my_seek);
+	_ioContext = avio_alloc_context(buf, bufSize, 0, (__bridge void *)self, my_read_packet, NULL, my_seek);
 	if(!_ioContext) {
 		os_log_error(gSFBAudioDecoderLog, "avio_alloc_context failed");
 		av_free(buf);
@@ -266,6 +315,10 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	if(result)
 		os_log_error(gSFBAudioDecoderLog, "avcodec_parameters_to_context failed");
 
+	// Use as many threads as the codec supports
+	_codecContext->thread_count = 0;
+	_codecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
 	result = avcodec_open2(_codecContext, codec, NULL);
 	if(result) {
 		char errbuf [ERRBUF_SIZE];
@@ -409,10 +462,6 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	format.mChannelsPerFrame	= _processingFormat.streamDescription->mChannelsPerFrame;
 	format.mBitsPerChannel		= _processingFormat.streamDescription->mBitsPerChannel;
 
-	// TODO: Determine max frame size
-	_buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:4096];
-	_buffer.frameLength = 0;
-
 	_frame = av_frame_alloc();
 	if(!_frame) {
 		os_log_error(gSFBAudioDecoderLog, "av_frame_alloc failed");
@@ -427,11 +476,42 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 		return NO;
 	}
 
+	_packetQueueCapacity = SFBFFmpegDecoder.packetQueueDepth;
+	if(_packetQueueCapacity > 0) {
+		_packetQueue = (AVPacket **)calloc(_packetQueueCapacity, sizeof(AVPacket *));
+		if(!_packetQueue) {
+			av_frame_free(&_frame);
+			avcodec_free_context(&_codecContext);
+			avformat_free_context(_formatContext);
+			avio_context_free(&_ioContext);
+
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+
+			return NO;
+		}
+
+		_packetQueueCondition = [[NSCondition alloc] init];
+		_demuxQueue = dispatch_queue_create("org.sbooth.AudioEngine.FFmpegDemuxer", DISPATCH_QUEUE_SERIAL);
+		_demuxGroup = dispatch_group_create();
+
+		[self startDemuxing];
+	}
+
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+	if(_packetQueue) {
+		[self stopDemuxing];
+		free(_packetQueue);
+		_packetQueue = NULL;
+		_packetQueueCondition = nil;
+		_demuxQueue = nil;
+		_demuxGroup = nil;
+	}
+
 	if(_ioContext)
 		avio_context_free(&_ioContext);
 
@@ -484,17 +564,12 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	if(frameLength > buffer.frameCapacity)
 		frameLength = buffer.frameCapacity;
 
-	AVAudioFrameCount framesProcessed = 0;
-
 	for(;;) {
-		AVAudioFrameCount framesRemaining = frameLength - framesProcessed;
-		AVAudioFrameCount framesCopied = [buffer appendContentsOfBuffer:_buffer readOffset:0 frameLength:framesRemaining];
-		[_buffer trimAtOffset:0 frameLength:framesCopied];
-
-		framesProcessed += framesCopied;
+		// Copy any audio remaining in the current frame
+		[self copyFramesIntoBuffer:buffer frameLength:(frameLength - buffer.frameLength)];
 
 		// All requested frames were read
-		if(framesProcessed == frameLength)
+		if(buffer.frameLength == frameLength)
 			break;
 
 		// Decode some audio
@@ -507,11 +582,13 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 		else if(result == AVERROR(EAGAIN)) {
 			result = [self readFrame];
 
+			// Enter draining mode so the codec returns any frames it has buffered
 			if(result == AVERROR_EOF) {
-				if(_codecContext->codec->capabilities & AV_CODEC_CAP_DELAY) {
-					// TODO: Flush buffer
+				result = avcodec_send_packet(_codecContext, NULL);
+				if(result < 0) {
+					os_log_error(gSFBAudioDecoderLog, "avcodec_send_packet failed: %d", result);
+					break;
 				}
-				break;
 			}
 			else if(result == AVERROR(EAGAIN)) {
 			}
@@ -520,9 +597,11 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 				break;
 			}
 		}
+		else if(result < 0)
+			break;
 	}
 
-	_framePosition += framesProcessed;
+	_framePosition += buffer.frameLength;
 
 	return YES;
 }
@@ -531,8 +610,16 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 {
 	NSParameterAssert(frame >= 0);
 
+	// The demuxer must be idle while the format context is repositioned
+	if(_packetQueue)
+		[self stopDemuxing];
+
 	int64_t timestamp = av_rescale(frame / (SInt64)_processingFormat.sampleRate, _formatContext->streams[_streamIndex]->time_base.den, _formatContext->streams[_streamIndex]->time_base.num);
 	int result = av_seek_frame(_formatContext, _streamIndex, timestamp, 0);
+
+	if(_packetQueue)
+		[self startDemuxing];
+
 	if(result < 0) {
 		char errbuf [ERRBUF_SIZE];
 		if(0 == av_strerror(result, errbuf, ERRBUF_SIZE))
@@ -545,19 +632,161 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 
 	avcodec_flush_buffers(_codecContext);
 
+	av_frame_unref(_frame);
+	_frameOffset = 0;
+
 	_framePosition = frame;
 
 	return YES;
 }
 
-- (int)readFrame
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+
+	// av_seek_frame() positions the demuxer at a keyframe so seeking forward isn't sample-accurate
+	return SFBPCMDecoderDiscardFrames(self, frameLength, error);
+}
+
+- (AVAudioFrameCount)copyFramesIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength
+{
+	AVAudioFrameCount framesToCopy = MIN(frameLength, (AVAudioFrameCount)(_frame->nb_samples - _frameOffset));
+	if(framesToCopy == 0)
+		return 0;
+
+	// Copy directly from the frame's planes to the end of buffer
+	AudioBufferList *bufferList = buffer.mutableAudioBufferList;
+	size_t bytesPerFrame = _processingFormat.streamDescription->mBytesPerFrame;
+	size_t byteOffset = (size_t)_frameOffset * bytesPerFrame;
+	size_t byteCount = framesToCopy * bytesPerFrame;
+
+	// Planar formats are not interleaved
+	if(av_sample_fmt_is_planar((enum AVSampleFormat)_frame->format)) {
+		for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
+			memcpy((unsigned char *)bufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize, _frame->extended_data[i] + byteOffset, byteCount);
+	}
+	else
+		memcpy((unsigned char *)bufferList->mBuffers[0].mData + bufferList->mBuffers[0].mDataByteSize, _frame->extended_data[0] + byteOffset, byteCount);
+
+	buffer.frameLength += framesToCopy;
+	_frameOffset += (int)framesToCopy;
+
+	return framesToCopy;
+}
+
+- (void)startDemuxing
 {
-	AVPacket packet;
-	av_init_packet(&packet);
-	packet.data = NULL;
-	packet.size = 0;
+	_demuxResult = 0;
+	_stopDemuxing = NO;
+
+	dispatch_group_async(_demuxGroup, _demuxQueue, ^{
+		[self->_packetQueueCondition lock];
 
-	int result = av_read_frame(_formatContext, &packet);
+		for(;;) {
+			while(self->_packetQueueCount == self->_packetQueueCapacity && !self->_stopDemuxing)
+				[self->_packetQueueCondition wait];
+			if(self->_stopDemuxing)
+				break;
+
+			[self->_packetQueueCondition unlock];
+
+			AVPacket *packet = av_packet_alloc();
+			int result = packet ? av_read_frame(self->_formatContext, packet) : AVERROR(ENOMEM);
+
+			[self->_packetQueueCondition lock];
+
+			// Input that is temporarily unavailable is retried after a short wait; only EOF and errors end demuxing
+			if(result == AVERROR(EAGAIN)) {
+				av_packet_free(&packet);
+				if(!self->_stopDemuxing)
+					[self->_packetQueueCondition waitUntilDate:[NSDate dateWithTimeIntervalSinceNow:DEMUX_RETRY_INTERVAL]];
+				continue;
+			}
+
+			if(result < 0) {
+				av_packet_free(&packet);
+				self->_demuxResult = result;
+				[self->_packetQueueCondition broadcast];
+				break;
+			}
+
+			// Only packets for the decoded stream are queued
+			if(self->_stopDemuxing || packet->stream_index != self->_streamIndex) {
+				av_packet_free(&packet);
+				continue;
+			}
+
+			self->_packetQueue[(self->_packetQueueHead + self->_packetQueueCount) % self->_packetQueueCapacity] = packet;
+			++self->_packetQueueCount;
+			[self->_packetQueueCondition broadcast];
+		}
+
+		[self->_packetQueueCondition unlock];
+	});
+}
+
+- (void)stopDemuxing
+{
+	[_packetQueueCondition lock];
+	_stopDemuxing = YES;
+	[_packetQueueCondition broadcast];
+	[_packetQueueCondition unlock];
+
+	dispatch_group_wait(_demuxGroup, DISPATCH_TIME_FOREVER);
+
+	// Discard queued packets
+	while(_packetQueueCount > 0) {
+		av_packet_free(&_packetQueue[_packetQueueHead]);
+		_packetQueueHead = (_packetQueueHead + 1) % _packetQueueCapacity;
+		--_packetQueueCount;
+	}
+	_packetQueueHead = 0;
+}
+
+- (int)readPacket:(AVPacket **)packet
+{
+	// Read directly from the format context if the demuxer isn't running
+	if(!_packetQueue) {
+		*packet = av_packet_alloc();
+		if(!*packet)
+			return AVERROR(ENOMEM);
+
+		// Only packets for the decoded stream are returned
+		for(;;) {
+			int result = av_read_frame(_formatContext, *packet);
+			if(result < 0 || (*packet)->stream_index == _streamIndex)
+				return result;
+			av_packet_unref(*packet);
+		}
+	}
+
+	[_packetQueueCondition lock];
+
+	while(_packetQueueCount == 0 && _demuxResult == 0)
+		[_packetQueueCondition wait];
+
+	// The demuxer stops at EOF or an error once the queue is drained
+	if(_packetQueueCount == 0) {
+		int result = _demuxResult;
+		[_packetQueueCondition unlock];
+		return result;
+	}
+
+	*packet = _packetQueue[_packetQueueHead];
+	_packetQueue[_packetQueueHead] = NULL;
+	_packetQueueHead = (_packetQueueHead + 1) % _packetQueueCapacity;
+	--_packetQueueCount;
+
+	[_packetQueueCondition broadcast];
+	[_packetQueueCondition unlock];
+
+	return 0;
+}
+
+- (int)readFrame
+{
+	AVPacket *packet = NULL;
+	int result = [self readPacket:&packet];
 
 	// EOF reached?
 	if(result == AVERROR_EOF) {
@@ -572,7 +801,7 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	}
 	// Send the packet with the compressed data to the decoder
 	else {
-		result = avcodec_send_packet(_codecContext, &packet);
+		result = avcodec_send_packet(_codecContext, packet);
 
 		// Decoder has been flushed
 		if(result == AVERROR_EOF) {
@@ -590,7 +819,7 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 		}
 	}
 
-	av_packet_unref(&packet);
+	av_packet_free(&packet);
 
 	return result;
 }
@@ -599,6 +828,7 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 {
 	// Attempt to read decoded audio
 	int result = avcodec_receive_frame(_codecContext, _frame);
+	_frameOffset = 0;
 
 	// EOF reached?
 	if(result == AVERROR_EOF) {
@@ -607,34 +837,12 @@ static int64_t my_seek(void *opaque, int64_t offset, int whence)
 	else if(result == AVERROR(EAGAIN)) {
 	}
 	// Other error encountered
-	else if(result > 0) {
+	else if(result < 0) {
 		char errbuf [ERRBUF_SIZE];
 		if(av_strerror(result, errbuf, ERRBUF_SIZE) == 0)
 			os_log_error(gSFBAudioDecoderLog, "avcodec_receive_frame failed: %{public}s", errbuf);
 		else
 			os_log_error(gSFBAudioDecoderLog, "avcodec_receive_frame failed: %d", result);
-
-		return result;
-	}
-	// Copy received audio to mBufferList
-	else {
-		UInt32 bytesPerFrame = _processingFormat.streamDescription->mBytesPerFrame;
-		size_t spaceRemaining = (_buffer.frameCapacity - _buffer.frameLength) * bytesPerFrame;
-		if(spaceRemaining < (UInt32)_frame->linesize[0]) {
-			os_log_error(gSFBAudioDecoderLog, "Insufficient space in buffer for decoded frame: %lu available, need %d", spaceRemaining, _frame->linesize[0]);
-			return AVERROR(ENOMEM);
-		}
-
-		// Planar formats are not interleaved
-		const AudioBufferList * bufferList = _buffer.audioBufferList;
-		if(av_sample_fmt_is_planar(_codecContext->sample_fmt)) {
-			for(UInt32 i = 0; i < bufferList->mNumberBuffers; ++i)
-				memcpy((unsigned char *)bufferList->mBuffers[i].mData + bufferList->mBuffers[i].mDataByteSize, _frame->extended_data[i], (size_t)_frame->linesize[0]);
-		}
-		else
-			memcpy((unsigned char *)bufferList->mBuffers[0].mData + bufferList->mBuffers[0].mDataByteSize, _frame->extended_data[0], (size_t)_frame->linesize[0]);
-
-		_buffer.frameLength += (AVAudioFrameCount)_frame->linesize[0] / bytesPerFrame;
 	}
 
 	return result;
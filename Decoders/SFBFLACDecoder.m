@@ -12,6 +12,38 @@
 
 #import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "NSError+SFBURLPresentation.h"
+#import "SFBSampleFormatKernels.h"
+
+// The minimum number of samples decoded by each task in bulk decoding
+#define BULK_RANGE_SAMPLES (1 << 18)
+// The approximate maximum size of the decoded audio held by the bulk decoding lookahead
+#define BULK_LOOKAHEAD_BYTES (64 * 1024 * 1024)
+
+// The location of a FLAC frame
+struct SFBFLACFrameIndexEntry {
+	size_t offset;
+	uint64_t sample;
+};
+
+// A range of FLAC frames decoded by one task in bulk decoding
+@interface SFBFLACDecodedRange : NSObject
+@property (nonatomic) NSData *header;
+@property (nonatomic) NSData *data;
+@property (nonatomic) NSRange byteRange;
+@property (nonatomic) NSUInteger readPosition;
+@property (nonatomic) AVAudioFrameCount frameCount;
+@property (nonatomic) SFBPCMStagingBuffer *buffer;
+@property (nonatomic) AVAudioFrameCount framesToSkip;
+@property (nonatomic) dispatch_semaphore_t semaphore;
+@property (nonatomic) BOOL complete;
+// Set by the decoding task
+@property (atomic) BOOL failed;
+// Set by the decoder when the range is discarded
+@property (atomic) BOOL cancelled;
+@end
+
+@implementation SFBFLACDecodedRange
+@end
 
 @interface SFBFLACDecoder ()
 {
@@ -19,7 +51,16 @@
 	FLAC__StreamDecoder *_flac;
 	FLAC__StreamMetadata_StreamInfo _streamInfo;
 	AVAudioFramePosition _framePosition;
-	AVAudioPCMBuffer *_frameBuffer; // For converting push to pull
+	SFBPCMStagingBuffer *_frameBuffer; // For converting push to pull
+	// Bulk decoding
+	NSData *_bulkData;
+	NSData *_bulkHeader;
+	struct SFBFLACFrameIndexEntry *_frameIndex;
+	size_t _frameIndexCount;
+	size_t _nextRangeFrame;
+	NSUInteger _lookaheadDepth;
+	NSMutableArray<SFBFLACDecodedRange *> *_lookahead;
+	dispatch_group_t _bulkGroup;
 }
 - (FLAC__StreamDecoderWriteStatus)handleFLACWrite:(const FLAC__StreamDecoder *)decoder frame:(const FLAC__Frame *)frame buffer:(const FLAC__int32 * const [])buffer;
 - (void)handleFLACMetadata:(const FLAC__StreamDecoder *)decoder metadata:(const FLAC__StreamMetadata *)metadata;
@@ -129,6 +170,360 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 	[flacDecoder handleFLACError:decoder status:status];
 }
 
+#pragma mark Sample Conversion
+
+// Converts the samples in a FLAC frame to the processing format and writes them to pcmBuffer at offset
+static BOOL CopyFLACFrame(const FLAC__Frame *frame, const FLAC__int32 * const buffer[], AVAudioPCMBuffer *pcmBuffer, AVAudioFrameCount offset)
+{
+	const AudioBufferList *abl = pcmBuffer.audioBufferList;
+	if(abl->mNumberBuffers != frame->header.channels || frame->header.blocksize > pcmBuffer.frameCapacity - offset)
+		return NO;
+
+	// FLAC hands us 32-bit signed integers with the samples low-aligned
+	uint32_t bytesPerFrame = (frame->header.bits_per_sample + 7) / 8;
+	if(bytesPerFrame != pcmBuffer.format.streamDescription->mBytesPerFrame)
+		return NO;
+
+	// Samples that don't fill the frame are aligned high in the processing format
+	unsigned int shift = (8 * bytesPerFrame) - frame->header.bits_per_sample;
+
+	for(uint32_t channel = 0; channel < frame->header.channels; ++channel) {
+		void *dst = (uint8_t *)abl->mBuffers[channel].mData + (offset * bytesPerFrame);
+		switch(bytesPerFrame) {
+			case 1:
+				SFBNarrowInt32ToInt8(buffer[channel], (int8_t *)dst, frame->header.blocksize, shift);
+				break;
+			case 2:
+				SFBNarrowInt32ToInt16(buffer[channel], (int16_t *)dst, frame->header.blocksize, shift);
+				break;
+			case 3:
+				SFBPackInt32ToInt24(buffer[channel], (uint8_t *)dst, frame->header.blocksize, shift);
+				break;
+			case 4:
+				SFBShiftInt32(buffer[channel], (int32_t *)dst, frame->header.blocksize, shift);
+				break;
+		}
+	}
+
+	pcmBuffer.frameLength = offset + frame->header.blocksize;
+
+	return YES;
+}
+
+#pragma mark Frame Index
+
+static uint8_t sCRC8Table [256];
+static uint16_t sCRC16Table [256];
+
+static void SFBFLACInitializeCRCTables(void)
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		for(unsigned i = 0; i < 256; ++i) {
+			uint8_t crc8 = (uint8_t)i;
+			uint16_t crc16 = (uint16_t)(i << 8);
+			for(int bit = 0; bit < 8; ++bit) {
+				crc8 = (crc8 & 0x80) ? (uint8_t)((crc8 << 1) ^ 0x07) : (uint8_t)(crc8 << 1);
+				crc16 = (crc16 & 0x8000) ? (uint16_t)((crc16 << 1) ^ 0x8005) : (uint16_t)(crc16 << 1);
+			}
+			sCRC8Table[i] = crc8;
+			sCRC16Table[i] = crc16;
+		}
+	});
+}
+
+static uint8_t SFBFLACCRC8(const uint8_t *p, size_t len)
+{
+	uint8_t crc = 0;
+	while(len--)
+		crc = sCRC8Table[crc ^ *p++];
+	return crc;
+}
+
+static uint16_t SFBFLACCRC16(const uint8_t *p, size_t len)
+{
+	uint16_t crc = 0;
+	while(len--)
+		crc = (uint16_t)((crc << 8) ^ sCRC16Table[(crc >> 8) ^ *p++]);
+	return crc;
+}
+
+// Returns the offset of the first frame and copies the STREAMINFO block including its header, or returns 0 if the metadata is invalid
+static size_t SFBFLACParseMetadata(const uint8_t *p, size_t len, uint8_t *streamInfoBlock)
+{
+	size_t i = 0;
+
+	// Skip an ID3v2 tag
+	if(len >= 10 && !memcmp(p, "ID3", 3)) {
+		i = 10 + (((size_t)(p[6] & 0x7f) << 21) | ((size_t)(p[7] & 0x7f) << 14) | ((size_t)(p[8] & 0x7f) << 7) | (size_t)(p[9] & 0x7f));
+		if(p[5] & 0x10)
+			i += 10;
+	}
+
+	if(i > len || len - i < 4 + 38 || memcmp(p + i, "fLaC", 4))
+		return 0;
+	i += 4;
+
+	// STREAMINFO is required to be the first metadata block
+	if((p[i] & 0x7f) != 0 || ((p[i + 1] << 16) | (p[i + 2] << 8) | p[i + 3]) != 34)
+		return 0;
+	memcpy(streamInfoBlock, p + i, 38);
+
+	for(;;) {
+		if(len - i < 4)
+			return 0;
+		BOOL last = (p[i] & 0x80) != 0;
+		size_t blockLength = (size_t)((p[i + 1] << 16) | (p[i + 2] << 8) | p[i + 3]);
+		i += 4 + blockLength;
+		if(i > len)
+			return 0;
+		if(last)
+			break;
+	}
+
+	return i;
+}
+
+// Parses the frame header at p, returning its length or 0 if p is not a valid frame header for the stream
+static size_t SFBFLACParseFrameHeader(const uint8_t *p, size_t len, const FLAC__StreamMetadata_StreamInfo *streamInfo, BOOL *variableBlocksize, uint64_t *number, uint32_t *blocksize)
+{
+	if(len < 6 || p[0] != 0xff || (p[1] & 0xfe) != 0xf8)
+		return 0;
+
+	unsigned blocksizeCode = p[2] >> 4;
+	unsigned sampleRateCode = p[2] & 0x0f;
+	unsigned channelAssignment = p[3] >> 4;
+	unsigned sampleSizeCode = (p[3] >> 1) & 0x07;
+	if(blocksizeCode == 0 || sampleRateCode == 0x0f || channelAssignment > 10 || sampleSizeCode == 3 || (p[3] & 0x01))
+		return 0;
+
+	unsigned channels = channelAssignment < 8 ? channelAssignment + 1 : 2;
+	if(channels != streamInfo->channels)
+		return 0;
+
+	static const unsigned sampleSizes [8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+	if(sampleSizeCode != 0 && sampleSizes[sampleSizeCode] != streamInfo->bits_per_sample)
+		return 0;
+
+	// The frame or sample number is UTF-8 coded
+	size_t i = 4;
+	uint64_t value = p[i++];
+	if(value & 0x80) {
+		unsigned extraBytes = 0;
+		uint64_t mask = 0x40;
+		while(value & mask) {
+			++extraBytes;
+			mask >>= 1;
+		}
+		if(extraBytes == 0 || extraBytes > 6 || len < i + extraBytes)
+			return 0;
+		value &= mask - 1;
+		for(unsigned j = 0; j < extraBytes; ++j, ++i) {
+			if((p[i] & 0xc0) != 0x80)
+				return 0;
+			value = (value << 6) | (p[i] & 0x3f);
+		}
+	}
+
+	*variableBlocksize = (p[1] & 0x01) != 0;
+	*number = value;
+
+	if(blocksizeCode == 6) {
+		if(len < i + 1)
+			return 0;
+		*blocksize = p[i] + 1u;
+		i += 1;
+	}
+	else if(blocksizeCode == 7) {
+		if(len < i + 2)
+			return 0;
+		*blocksize = (unsigned)((p[i] << 8) | p[i + 1]) + 1u;
+		i += 2;
+	}
+	else if(blocksizeCode == 1)
+		*blocksize = 192;
+	else if(blocksizeCode <= 5)
+		*blocksize = 576u << (blocksizeCode - 2);
+	else
+		*blocksize = 256u << (blocksizeCode - 8);
+
+	if(streamInfo->max_blocksize && *blocksize > streamInfo->max_blocksize)
+		return 0;
+
+	if(sampleRateCode == 12)
+		i += 1;
+	else if(sampleRateCode == 13 || sampleRateCode == 14)
+		i += 2;
+
+	if(len < i + 1 || SFBFLACCRC8(p, i) != p[i])
+		return 0;
+
+	return i + 1;
+}
+
+// Locates the frames in the stream using frame sync codes
+//
+// A candidate frame is accepted only if its header CRC-8 is valid, its frame or sample number follows the
+// previous frame, and the CRC-16 of the previous frame ends immediately before it. The CRC-16 of the last frame
+// is checked against the end of the stream.
+static BOOL SFBFLACBuildFrameIndex(const uint8_t *p, size_t len, size_t firstFrameOffset, const FLAC__StreamMetadata_StreamInfo *streamInfo, struct SFBFLACFrameIndexEntry **frameIndex, size_t *frameIndexCount)
+{
+	SFBFLACInitializeCRCTables();
+
+	BOOL variableBlocksize;
+	uint64_t number;
+	uint32_t blocksize;
+	size_t headerLength = SFBFLACParseFrameHeader(p + firstFrameOffset, len - firstFrameOffset, streamInfo, &variableBlocksize, &number, &blocksize);
+	if(!headerLength || number != 0)
+		return NO;
+
+	BOOL streamVariableBlocksize = variableBlocksize;
+
+	size_t capacity = 1024;
+	size_t count = 0;
+	struct SFBFLACFrameIndexEntry *entries = malloc(capacity * sizeof(struct SFBFLACFrameIndexEntry));
+	if(!entries)
+		return NO;
+
+	size_t frameOffset = firstFrameOffset;
+	uint64_t frameNumber = 0;
+	uint64_t frameSample = 0;
+	uint32_t frameBlocksize = blocksize;
+	entries[count++] = (struct SFBFLACFrameIndexEntry){ frameOffset, frameSample };
+
+	size_t position = frameOffset + headerLength;
+	size_t lastFrameDataOffset = position;
+	for(;;) {
+		const uint8_t *sync = memchr(p + position, 0xff, len - position);
+		if(!sync)
+			break;
+		position = (size_t)(sync - p);
+
+		headerLength = SFBFLACParseFrameHeader(p + position, len - position, streamInfo, &variableBlocksize, &number, &blocksize);
+		if(headerLength && variableBlocksize == streamVariableBlocksize && number == (streamVariableBlocksize ? frameSample + frameBlocksize : frameNumber + 1)) {
+			uint16_t crc = (uint16_t)((p[position - 2] << 8) | p[position - 1]);
+			if(SFBFLACCRC16(p + frameOffset, position - frameOffset - 2) == crc) {
+				if(count == capacity) {
+					capacity *= 2;
+					struct SFBFLACFrameIndexEntry *reallocated = realloc(entries, capacity * sizeof(struct SFBFLACFrameIndexEntry));
+					if(!reallocated) {
+						free(entries);
+						return NO;
+					}
+					entries = reallocated;
+				}
+
+				frameOffset = position;
+				frameSample += frameBlocksize;
+				frameNumber += 1;
+				frameBlocksize = blocksize;
+				entries[count++] = (struct SFBFLACFrameIndexEntry){ frameOffset, frameSample };
+
+				position += headerLength;
+				lastFrameDataOffset = position;
+				continue;
+			}
+		}
+
+		++position;
+	}
+
+	// The last frame is followed by the end of the stream or trailing data such as an ID3v1 tag,
+	// so its CRC-16 is valid if the CRC of the frame including its footer is zero at some position
+	BOOL lastFrameValid = NO;
+	uint16_t crc = 0;
+	for(size_t i = frameOffset; i < len; ++i) {
+		crc = (uint16_t)((crc << 8) ^ sCRC16Table[(crc >> 8) ^ p[i]]);
+		if(crc == 0 && i + 1 >= lastFrameDataOffset + 2) {
+			lastFrameValid = YES;
+			break;
+		}
+	}
+
+	// A missed frame would leave the sample count short
+	if(!lastFrameValid || frameSample + frameBlocksize != streamInfo->total_samples) {
+		free(entries);
+		return NO;
+	}
+
+	*frameIndex = entries;
+	*frameIndexCount = count;
+
+	return YES;
+}
+
+#pragma mark Bulk Decoding Callbacks
+
+static FLAC__StreamDecoderReadStatus range_read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+#pragma unused(decoder)
+	NSCParameterAssert(client_data != NULL);
+
+	SFBFLACDecodedRange *range = (__bridge SFBFLACDecodedRange *)client_data;
+
+	// The stream consists of the header followed by the frames in the range
+	NSUInteger headerLength = range.header.length;
+	NSUInteger streamLength = headerLength + range.byteRange.length;
+	if(range.readPosition >= streamLength) {
+		*bytes = 0;
+		return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+	}
+
+	size_t count = MIN(*bytes, streamLength - range.readPosition);
+	size_t copied = 0;
+	if(range.readPosition < headerLength) {
+		copied = MIN(count, headerLength - range.readPosition);
+		memcpy(buffer, (const uint8_t *)range.header.bytes + range.readPosition, copied);
+	}
+	if(copied < count)
+		memcpy(buffer + copied, (const uint8_t *)range.data.bytes + range.byteRange.location + (range.readPosition + copied - headerLength), count - copied);
+
+	range.readPosition += count;
+	*bytes = count;
+
+	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static FLAC__StreamDecoderWriteStatus range_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+#pragma unused(decoder)
+	NSCParameterAssert(client_data != NULL);
+
+	SFBFLACDecodedRange *range = (__bridge SFBFLACDecodedRange *)client_data;
+	if(range.cancelled)
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+	AVAudioPCMBuffer *pcmBuffer = range.buffer.buffer;
+	if(!CopyFLACFrame(frame, buffer, pcmBuffer, pcmBuffer.frameLength))
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void range_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+#pragma unused(decoder)
+#pragma unused(client_data)
+	os_log_debug(gSFBAudioDecoderLog, "FLAC error in bulk decoding: %{public}s", FLAC__StreamDecoderErrorStatusString[status]);
+}
+
+// Decodes the frames in range, returning YES if all samples were decoded
+static BOOL SFBFLACDecodeRange(SFBFLACDecodedRange *range)
+{
+	FLAC__StreamDecoder *flac = FLAC__stream_decoder_new();
+	if(!flac)
+		return NO;
+
+	FLAC__bool result = false;
+	if(FLAC__stream_decoder_init_stream(flac, range_read_callback, NULL, NULL, NULL, NULL, range_write_callback, NULL, range_error_callback, (__bridge void *)range) == FLAC__STREAM_DECODER_INIT_STATUS_OK)
+		result = FLAC__stream_decoder_process_until_end_of_stream(flac);
+
+	FLAC__stream_decoder_finish(flac);
+	FLAC__stream_decoder_delete(flac);
+
+	return result && range.buffer.buffer.frameLength == range.frameCount;
+}
+
 @implementation SFBFLACDecoder
 
 + (void)load
@@ -146,27 +541,57 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 	return [NSSet setWithArray:@[@"audio/flac", @"audio/ogg"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	if(length >= 4 && !memcmp(bytes, "fLaC", 4))
+		return SFBAudioDecoderProbeScoreCertain;
+
+	// The identification header is the first packet of an Ogg stream
+	if(length >= 27 && !memcmp(bytes, "OggS", 4)) {
+		NSUInteger packetOffset = 27 + bytes[26];
+		if(length >= packetOffset + 5 && !memcmp(bytes + packetOffset, "\x7f" "FLAC", 5))
+			return SFBAudioDecoderProbeScoreCertain;
+	}
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
+- (void)dealloc
+{
+	[self closeReturningError:nil];
+	if(_flac)
+		FLAC__stream_decoder_delete(_flac);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
-	// Create FLAC decoder
-	_flac = FLAC__stream_decoder_new();
+	// Create FLAC decoder, which is reused if the decoder is reopened
 	if(!_flac) {
-		if(error)
-			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
-		return NO;
+		_flac = FLAC__stream_decoder_new();
+		if(!_flac) {
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return NO;
+		}
 	}
 
+	_framePosition = 0;
+
 	// Initialize decoder
 	FLAC__StreamDecoderInitStatus status = FLAC__STREAM_DECODER_INIT_STATUS_ERROR_OPENING_FILE;
 
-	// Attempt to create a stream decoder based on the file's extension
-	NSString *extension = _inputSource.url.pathExtension.lowercaseString;
-	if([extension isEqualToString:@"flac"])
+	// Attempt to create a stream decoder based on the file's contents, falling back to its extension
+	NSData *prefix = SFBAudioDecoderReadProbePrefix(_inputSource);
+	BOOL isOgg = prefix ? (prefix.length >= 4 && !memcmp(prefix.bytes, "OggS", 4)) : [_inputSource.url.pathExtension.lowercaseString isEqualToString:@"oga"];
+	if(!isOgg)
 		status = FLAC__stream_decoder_init_stream(_flac, read_callback, seek_callback, tell_callback, length_callback, eof_callback, write_callback, metadata_callback, error_callback, (__bridge void *)self);
-	else if([extension isEqualToString:@"oga"])
+	else
 		status = FLAC__stream_decoder_init_ogg_stream(_flac, read_callback, seek_callback, tell_callback, length_callback, eof_callback, write_callback, metadata_callback, error_callback, (__bridge void *)self);
 
 	if(status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
@@ -175,9 +600,6 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 		if(!FLAC__stream_decoder_finish(_flac))
 			os_log_info(gSFBAudioDecoderLog, "FLAC__stream_decoder_finish failed: %{public}s", FLAC__stream_decoder_get_resolved_state_string(_flac));
 
-		FLAC__stream_decoder_delete(_flac);
-		_flac = NULL;
-
 		if(error)
 			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
 											 code:SFBAudioDecoderErrorCodeInputOutput
@@ -196,9 +618,6 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 		if(!FLAC__stream_decoder_finish(_flac))
 			os_log_info(gSFBAudioDecoderLog, "FLAC__stream_decoder_finish failed: %{public}s", FLAC__stream_decoder_get_resolved_state_string(_flac));
 
-		FLAC__stream_decoder_delete(_flac);
-		_flac = NULL;
-
 		if(error)
 			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
 											 code:SFBAudioDecoderErrorCodeInputOutput
@@ -247,9 +666,6 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 			if(!FLAC__stream_decoder_finish(_flac))
 				os_log_info(gSFBAudioDecoderLog, "FLAC__stream_decoder_finish failed: %{public}s", FLAC__stream_decoder_get_resolved_state_string(_flac));
 
-			FLAC__stream_decoder_delete(_flac);
-			_flac = NULL;
-
 			if(error)
 				*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
 												 code:SFBAudioDecoderErrorCodeInputOutput
@@ -290,20 +706,22 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
 	// Allocate the buffer list (which will convert from FLAC's push model to Core Audio's pull model)
-	_frameBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:_streamInfo.max_blocksize];
-	_frameBuffer.frameLength = 0;
+	_frameBuffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:_streamInfo.max_blocksize];
+
+	if(self.decodesInBulk && !isOgg)
+		[self setUpBulkDecoding];
 
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
-	if(_flac) {
+	[self tearDownBulkDecoding];
+
+	// The stream decoder is deleted in -dealloc so it may be reinitialized if the decoder is reopened
+	if(_flac && FLAC__stream_decoder_get_state(_flac) != FLAC__STREAM_DECODER_UNINITIALIZED) {
 		if(!FLAC__stream_decoder_finish(_flac))
 			os_log_info(gSFBAudioDecoderLog, "FLAC__stream_decoder_finish failed: %{public}s", FLAC__stream_decoder_get_resolved_state_string(_flac));
-
-		FLAC__stream_decoder_delete(_flac);
-		_flac = NULL;
 	}
 
 	_frameBuffer = nil;
@@ -314,7 +732,7 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 
 - (BOOL)isOpen
 {
-	return _flac != NULL;
+	return _frameBuffer != nil;
 }
 
 - (AVAudioFramePosition)framePosition
@@ -344,10 +762,13 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 
 	AVAudioFrameCount framesProcessed = 0;
 
-	for(;;) {
+	if(_lookahead)
+		framesProcessed = [self decodeInBulkIntoBuffer:buffer frameLength:frameLength];
+
+	// Bulk decoding falls back to sequential decoding on error
+	while(!_lookahead) {
 		AVAudioFrameCount framesRemaining = frameLength - framesProcessed;
-		AVAudioFrameCount framesCopied = [buffer appendContentsOfBuffer:_frameBuffer readOffset:0 frameLength:framesRemaining];
-		[_frameBuffer trimAtOffset:0 frameLength:framesCopied];
+		AVAudioFrameCount framesCopied = [_frameBuffer readIntoBuffer:buffer frameLength:framesRemaining];
 
 		framesProcessed += framesCopied;
 
@@ -365,11 +786,42 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 	return YES;
 }
 
+- (BOOL)borrowBufferList:(const AudioBufferList **)bufferList frameLength:(AVAudioFrameCount *)frameLength maximumFrameLength:(AVAudioFrameCount)maximumFrameLength error:(NSError **)error
+{
+	NSParameterAssert(bufferList != NULL);
+	NSParameterAssert(frameLength != NULL);
+	NSParameterAssert(maximumFrameLength > 0);
+
+	// Decoded ranges are released once consumed so bulk decoding can't lend them
+	if(_lookahead)
+		return [super borrowBufferList:bufferList frameLength:frameLength maximumFrameLength:maximumFrameLength error:error];
+
+	// Lend the audio converted by the write callback directly
+	while(_frameBuffer.isEmpty && FLAC__stream_decoder_get_state(_flac) != FLAC__STREAM_DECODER_END_OF_STREAM) {
+		if(!FLAC__stream_decoder_process_single(_flac)) {
+			os_log_error(gSFBAudioDecoderLog, "FLAC__stream_decoder_process_single failed: %{public}s", FLAC__stream_decoder_get_resolved_state_string(_flac));
+			break;
+		}
+	}
+
+	*frameLength = [_frameBuffer borrowBufferList:bufferList frameLength:maximumFrameLength];
+	_framePosition += *frameLength;
+
+	return YES;
+}
+
 - (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
 {
 	NSParameterAssert(frame >= 0);
 //	NSParameterAssert(frame <= _totalFrames);
 
+	if(_lookahead) {
+		[self cancelLookahead];
+		[self resetLookaheadAtFrame:frame];
+		_framePosition = frame;
+		return YES;
+	}
+
 	FLAC__bool result = FLAC__stream_decoder_seek_absolute(_flac, (FLAC__uint64)frame);
 
 	// Attempt to re-sync the stream if necessary
@@ -378,76 +830,180 @@ static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecod
 
 	if(result) {
 		_framePosition = frame;
-		_frameBuffer.frameLength = 0;
+		[_frameBuffer reset];
 	}
 
 	return result != 0;
 }
 
-- (FLAC__StreamDecoderWriteStatus)handleFLACWrite:(const FLAC__StreamDecoder *)decoder frame:(const FLAC__Frame *)frame buffer:(const FLAC__int32 * const [])buffer
+#pragma mark Bulk Decoding
+
+- (void)setUpBulkDecoding
 {
-	NSParameterAssert(decoder != NULL);
-	NSParameterAssert(frame != NULL);
+	NSURL *url = _inputSource.url;
+	if(!url.isFileURL || _streamInfo.total_samples == 0)
+		return;
+
+	NSError *error = nil;
+	NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:&error];
+	if(!data) {
+		os_log_info(gSFBAudioDecoderLog, "Bulk decoding disabled: error mapping %{public}@: %{public}@", url, error);
+		return;
+	}
 
-	const AudioBufferList *abl = _frameBuffer.audioBufferList;
-	if(abl->mNumberBuffers != frame->header.channels)
-		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	uint8_t streamInfoBlock [38];
+	size_t firstFrameOffset = SFBFLACParseMetadata(data.bytes, data.length, streamInfoBlock);
+	if(!firstFrameOffset || !SFBFLACBuildFrameIndex(data.bytes, data.length, firstFrameOffset, &_streamInfo, &_frameIndex, &_frameIndexCount)) {
+		os_log_info(gSFBAudioDecoderLog, "Bulk decoding disabled: unable to index FLAC frames in %{public}@", url);
+		return;
+	}
 
-	// FLAC hands us 32-bit signed integers with the samples low-aligned
-	uint32_t bytesPerFrame = (frame->header.bits_per_sample + 7) / 8;
-	if(bytesPerFrame != _frameBuffer.format.streamDescription->mBytesPerFrame)
-		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	// Each range is decoded as a stream consisting of STREAMINFO followed by the range's frames
+	streamInfoBlock[0] |= 0x80;
+	NSMutableData *header = [NSMutableData dataWithBytes:"fLaC" length:4];
+	[header appendBytes:streamInfoBlock length:sizeof streamInfoBlock];
 
-	switch(bytesPerFrame) {
-		case 1: {
-			for(uint32_t channel = 0; channel < frame->header.channels; ++channel) {
-				int8_t *dst = (int8_t *)abl->mBuffers[channel].mData;
-				for(uint32_t sample = 0; sample < frame->header.blocksize; ++sample)
-					*dst++ = (int8_t)buffer[channel][sample];
-			}
+	_bulkData = data;
+	_bulkHeader = header;
+	// Keep every processor busy without letting wide or long ranges consume unbounded memory
+	NSUInteger rangeBytes = (NSUInteger)(BULK_RANGE_SAMPLES + _streamInfo.max_blocksize) * _processingFormat.channelCount * _processingFormat.streamDescription->mBytesPerFrame;
+	_lookaheadDepth = MAX(1, MIN(2 * [NSProcessInfo processInfo].activeProcessorCount, BULK_LOOKAHEAD_BYTES / rangeBytes));
+	_lookahead = [NSMutableArray arrayWithCapacity:_lookaheadDepth];
+	_bulkGroup = dispatch_group_create();
 
-			_frameBuffer.frameLength = frame->header.blocksize;
-			break;
-		}
+	[self resetLookaheadAtFrame:0];
+}
 
-		case 2: {
-			for(uint32_t channel = 0; channel < frame->header.channels; ++channel) {
-				int16_t *dst = (int16_t *)abl->mBuffers[channel].mData;
-				for(uint32_t sample = 0; sample < frame->header.blocksize; ++sample)
-					*dst++ = (int16_t)buffer[channel][sample];
-			}
+- (void)tearDownBulkDecoding
+{
+	if(!_lookahead)
+		return;
+
+	[self cancelLookahead];
+	dispatch_group_wait(_bulkGroup, DISPATCH_TIME_FOREVER);
+
+	_lookahead = nil;
+	_bulkGroup = nil;
+	_bulkData = nil;
+	_bulkHeader = nil;
 
-			_frameBuffer.frameLength = frame->header.blocksize;
+	free(_frameIndex);
+	_frameIndex = NULL;
+	_frameIndexCount = 0;
+}
+
+- (AVAudioFrameCount)decodeInBulkIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength
+{
+	AVAudioFrameCount framesProcessed = 0;
+
+	while(framesProcessed < frameLength) {
+		SFBFLACDecodedRange *range = _lookahead.firstObject;
+		// EOS
+		if(!range)
 			break;
-		}
 
-		case 3: {
-			for(uint32_t channel = 0; channel < frame->header.channels; ++channel) {
-				uint8_t *dst = (uint8_t *)abl->mBuffers[channel].mData;
-				for(uint32_t sample = 0; sample < frame->header.blocksize; ++sample) {
-					uint32_t value = OSSwapHostToLittleInt32(buffer[channel][sample]);
-					*dst++ = (uint8_t)(value & 0xff);
-					*dst++ = (uint8_t)((value >> 8) & 0xff);
-					*dst++ = (uint8_t)((value >> 16) & 0xff);
-				}
+		if(!range.complete) {
+			dispatch_semaphore_wait(range.semaphore, DISPATCH_TIME_FOREVER);
+			range.complete = YES;
+
+			if(range.failed) {
+				AVAudioFramePosition framePosition = _framePosition + framesProcessed;
+				os_log_error(gSFBAudioDecoderLog, "Bulk decoding failed at frame %lld; continuing sequentially", framePosition);
+				[self tearDownBulkDecoding];
+				[_frameBuffer reset];
+				if(!FLAC__stream_decoder_seek_absolute(_flac, (FLAC__uint64)framePosition))
+					os_log_error(gSFBAudioDecoderLog, "FLAC__stream_decoder_seek_absolute failed: %{public}s", FLAC__stream_decoder_get_resolved_state_string(_flac));
+				break;
 			}
 
-			_frameBuffer.frameLength = frame->header.blocksize;
-			break;
+			[range.buffer skipFrames:range.framesToSkip];
 		}
 
-		case 4: {
-			for(uint32_t channel = 0; channel < frame->header.channels; ++channel) {
-				int32_t *dst = (int32_t *)abl->mBuffers[channel].mData;
-				for(uint32_t sample = 0; sample < frame->header.blocksize; ++sample)
-					*dst++ = (int32_t)buffer[channel][sample];
-			}
+		framesProcessed += [range.buffer readIntoBuffer:buffer frameLength:(frameLength - framesProcessed)];
 
-			_frameBuffer.frameLength = frame->header.blocksize;
-			break;
+		// Replace the consumed range with the next range
+		if(range.buffer.isEmpty) {
+			[_lookahead removeObjectAtIndex:0];
+			[self scheduleNextRange];
 		}
 	}
 
+	return framesProcessed;
+}
+
+- (void)resetLookaheadAtFrame:(AVAudioFramePosition)frame
+{
+	// Locate the last FLAC frame starting at or before frame
+	size_t low = 0, high = _frameIndexCount;
+	while(high - low > 1) {
+		size_t mid = low + ((high - low) / 2);
+		if(_frameIndex[mid].sample <= (uint64_t)frame)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	_nextRangeFrame = low;
+	for(NSUInteger i = 0; i < _lookaheadDepth; ++i)
+		[self scheduleNextRange];
+
+	SFBFLACDecodedRange *range = _lookahead.firstObject;
+	if(range)
+		range.framesToSkip = (AVAudioFrameCount)((uint64_t)frame - _frameIndex[low].sample);
+}
+
+- (void)cancelLookahead
+{
+	for(SFBFLACDecodedRange *range in _lookahead)
+		range.cancelled = YES;
+	[_lookahead removeAllObjects];
+}
+
+- (void)scheduleNextRange
+{
+	if(_nextRangeFrame >= _frameIndexCount)
+		return;
+
+	// Group frames until the range contains at least BULK_RANGE_SAMPLES samples
+	size_t firstFrame = _nextRangeFrame;
+	size_t endFrame = firstFrame + 1;
+	uint64_t firstSample = _frameIndex[firstFrame].sample;
+	while(endFrame < _frameIndexCount && _frameIndex[endFrame].sample - firstSample < BULK_RANGE_SAMPLES)
+		++endFrame;
+	_nextRangeFrame = endFrame;
+
+	size_t startOffset = _frameIndex[firstFrame].offset;
+	size_t endOffset = endFrame < _frameIndexCount ? _frameIndex[endFrame].offset : _bulkData.length;
+	uint64_t endSample = endFrame < _frameIndexCount ? _frameIndex[endFrame].sample : _streamInfo.total_samples;
+
+	SFBFLACDecodedRange *range = [[SFBFLACDecodedRange alloc] init];
+	range.header = _bulkHeader;
+	range.data = _bulkData;
+	range.byteRange = NSMakeRange(startOffset, endOffset - startOffset);
+	range.frameCount = (AVAudioFrameCount)(endSample - firstSample);
+	range.buffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:range.frameCount];
+	range.semaphore = dispatch_semaphore_create(0);
+
+	[_lookahead addObject:range];
+
+	dispatch_group_async(_bulkGroup, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+		range.failed = range.cancelled || !SFBFLACDecodeRange(range);
+		dispatch_semaphore_signal(range.semaphore);
+	});
+}
+
+#pragma mark Callbacks
+
+- (FLAC__StreamDecoderWriteStatus)handleFLACWrite:(const FLAC__StreamDecoder *)decoder frame:(const FLAC__Frame *)frame buffer:(const FLAC__int32 * const [])buffer
+{
+	NSParameterAssert(decoder != NULL);
+	NSParameterAssert(frame != NULL);
+
+	[_frameBuffer reset];
+
+	if(!CopyFLACFrame(frame, buffer, _frameBuffer.buffer, 0))
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
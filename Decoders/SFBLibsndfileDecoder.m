@@ -152,6 +152,24 @@ static sf_count_t my_sf_vio_tell(void *user_data)
 	return [NSSet set];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// Containers shared with other decoders
+	if(length >= 12 && (((!memcmp(bytes, "RIFF", 4) || !memcmp(bytes, "RF64", 4)) && !memcmp(bytes + 8, "WAVE", 4)) || (!memcmp(bytes, "FORM", 4) && (!memcmp(bytes + 8, "AIFF", 4) || !memcmp(bytes + 8, "AIFC", 4) || !memcmp(bytes + 8, "8SVX", 4)))))
+		return SFBAudioDecoderProbeScoreLikely;
+	if(length >= 4 && (!memcmp(bytes, "caff", 4) || !memcmp(bytes, ".snd", 4) || !memcmp(bytes, "dns.", 4)))
+		return SFBAudioDecoderProbeScoreLikely;
+
+	// Formats with dedicated decoders
+	if(length >= 4 && (!memcmp(bytes, "fLaC", 4) || !memcmp(bytes, "OggS", 4)))
+		return SFBAudioDecoderProbeScorePossible;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
@@ -22,6 +22,21 @@ NS_SWIFT_NAME(LoopableRegionDecoder) @interface SFBLoopableRegionDecoder : NSObj
 - (nullable instancetype)initWithDecoder:(id <SFBPCMDecoding>)decoder framePosition:(AVAudioFramePosition)framePosition frameLength:(AVAudioFramePosition)frameLength error:(NSError **)error;
 - (nullable instancetype)initWithDecoder:(id <SFBPCMDecoding>)decoder framePosition:(AVAudioFramePosition)framePosition frameLength:(AVAudioFramePosition)frameLength repeatCount:(NSInteger)repeatCount error:(NSError **)error NS_DESIGNATED_INITIALIZER;
 
+/// The number of frames at the start of the region kept in memory (default \c 4096)
+///
+/// The frames are decoded when the decoder is opened and each pass begins with them. The underlying decoder's
+/// seek to the frame following them is deferred until they have been returned, so a loop seam doesn't wait on a seek.
+/// If the region doesn't repeat the frames are kept only when this property has been set.
+/// @note This property must be set before the decoder is opened
+@property (nonatomic) AVAudioFrameCount seamFrameLength;
+
+/// The number of frames over which the end of the region is crossfaded with its start when repeating (default \c 0)
+///
+/// Each pass after the first begins following the crossfaded frames so is shorter by this amount.
+/// Crossfading is performed only for deinterleaved 32-bit floating-point audio.
+/// @note This property must be set before the decoder is opened
+@property (nonatomic) AVAudioFrameCount crossfadeFrameLength;
+
 @end
 
 NS_ASSUME_NONNULL_END
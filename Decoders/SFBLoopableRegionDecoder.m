@@ -10,6 +10,8 @@
 #import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "SFBAudioDecoder+Internal.h"
 
+#define DEFAULT_SEAM_FRAME_LENGTH 4096
+
 static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b) { return a < b ? a : b; }
 
 @interface SFBLoopableRegionDecoder ()
@@ -21,9 +23,20 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 	AVAudioFramePosition _frameLength;
 	NSInteger _repeatCount;
 	AVAudioFramePosition _framesDecoded;
+	// YES if seamFrameLength was set explicitly
+	BOOL _seamFrameLengthIsExplicit;
+	// The frames at the start of the region
+	AVAudioPCMBuffer *_seamBuffer;
+	// The crossfade length in use, which is 0 if crossfading isn't possible
+	AVAudioFrameCount _crossfadeLength;
+	// The offset in the region of _decoder's frame position
+	AVAudioFramePosition _decoderOffset;
 }
 - (BOOL)resetReturningError:(NSError **)error;
 - (BOOL)setupDecoderForcingReset:(BOOL)forceReset error:(NSError **)error;
+- (BOOL)fillSeamBufferReturningError:(NSError **)error;
+- (NSInteger)passForFrame:(AVAudioFramePosition)frame regionOffset:(AVAudioFramePosition *)regionOffset;
+- (void)crossfadeBuffer:(AVAudioPCMBuffer *)buffer writeOffset:(AVAudioFrameCount)writeOffset regionOffset:(AVAudioFramePosition)regionOffset frameLength:(AVAudioFrameCount)frameLength;
 @end
 
 @implementation SFBLoopableRegionDecoder
@@ -75,10 +88,17 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 		_framePosition = framePosition;
 		_frameLength = frameLength;
 		_repeatCount = repeatCount;
+		_seamFrameLength = DEFAULT_SEAM_FRAME_LENGTH;
 	}
 	return self;
 }
 
+- (void)setSeamFrameLength:(AVAudioFrameCount)seamFrameLength
+{
+	_seamFrameLength = seamFrameLength;
+	_seamFrameLengthIsExplicit = YES;
+}
+
 - (SFBInputSource *)inputSource
 {
 	return _decoder.inputSource;
@@ -99,19 +119,35 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 	if(!_decoder.isOpen && ![_decoder openReturningError:error])
 		return NO;
 
-	if(!_decoder.supportsSeeking || ![self setupDecoderForcingReset:NO error:error]) {
+	if(!_decoder.supportsSeeking || ![self setupDecoderForcingReset:(_decoder.framePosition != _framePosition) error:error]) {
 		[_decoder closeReturningError:error];
 		return NO;
 	}
 
 	_buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_decoder.processingFormat frameCapacity:512];
 
+	_crossfadeLength = 0;
+	if(_crossfadeFrameLength > 0 && _repeatCount > 0) {
+		AVAudioFormat *format = _decoder.processingFormat;
+		if(format.commonFormat == AVAudioPCMFormatFloat32 && !format.isInterleaved)
+			_crossfadeLength = (AVAudioFrameCount)MIN(_crossfadeFrameLength, _frameLength / 2);
+		else
+			os_log_info(gSFBAudioDecoderLog, "Crossfading is not supported for %{public}@", format);
+	}
+
+	if(![self fillSeamBufferReturningError:error]) {
+		_buffer = nil;
+		[_decoder closeReturningError:nil];
+		return NO;
+	}
+
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
 	_buffer = nil;
+	_seamBuffer = nil;
 	return [_decoder closeReturningError:error];
 }
 
@@ -127,7 +163,7 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 
 - (AVAudioFramePosition)frameLength
 {
-	return _frameLength * (_repeatCount + 1);
+	return _frameLength + _repeatCount * (_frameLength - _crossfadeLength);
 }
 
 - (BOOL)decodeIntoBuffer:(AVAudioBuffer *)buffer error:(NSError **)error {
@@ -148,45 +184,59 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 		return NO;
 	}
 
-	if(_repeatCount && (_framesDecoded / _frameLength) == (_repeatCount + 1))
+	AVAudioFramePosition totalFrameLength = self.frameLength;
+	if(_framesDecoded >= totalFrameLength)
 		return YES;
 
 	if(frameLength > buffer.frameCapacity)
 		frameLength = buffer.frameCapacity;
 
+	AVAudioFrameCount seamLength = _seamBuffer.frameLength;
 	AVAudioFrameCount framesRemaining = frameLength;
 
-	_buffer.frameLength = 0;
+	while(framesRemaining > 0 && _framesDecoded < totalFrameLength) {
+		AVAudioFramePosition regionOffset;
+		NSInteger pass = [self passForFrame:_framesDecoded regionOffset:&regionOffset];
+		AVAudioFrameCount writeOffset = buffer.frameLength;
+		AVAudioFrameCount framesAppended;
+
+		// The start of the region is served from memory
+		if(regionOffset < seamLength) {
+			AVAudioFrameCount framesToCopy = SFB_min(framesRemaining, (AVAudioFrameCount)(seamLength - regionOffset));
+			framesAppended = [buffer appendContentsOfBuffer:_seamBuffer readOffset:(AVAudioFrameCount)regionOffset frameLength:framesToCopy];
+		}
+		else {
+			if(_decoderOffset != regionOffset) {
+				// Return the audio already in the buffer, such as the seam, before seeking
+				// so the seek overlaps its playback instead of delaying it
+				if(buffer.frameLength > 0)
+					break;
+				if(![_decoder seekToFrame:(_framePosition + regionOffset) error:error])
+					return NO;
+				_decoderOffset = regionOffset;
+			}
 
-	while(framesRemaining > 0) {
-		AVAudioFrameCount framesRemainingInCurrentPass = (AVAudioFrameCount)(_framePosition + _frameLength - _decoder.framePosition);
-		AVAudioFrameCount framesToDecode = SFB_min(SFB_min(framesRemaining, framesRemainingInCurrentPass), _buffer.frameCapacity);
+			AVAudioFrameCount framesToDecode = SFB_min(SFB_min(framesRemaining, (AVAudioFrameCount)(_frameLength - regionOffset)), _buffer.frameCapacity);
 
-		// Nothing left to read
-		if(framesToDecode == 0)
-			break;
+			// Decode audio into our internal buffer and append it to output
+			if(![_decoder decodeIntoBuffer:_buffer frameLength:framesToDecode error:error])
+				return NO;
 
-		// Zero the internal buffer in preparation for decoding
-		_buffer.frameLength = 0;
+			// The region extends beyond the end of the audio
+			if(_buffer.frameLength == 0)
+				break;
 
-		// Decode audio into our internal buffer and append it to output
-		if(![_decoder decodeIntoBuffer:_buffer frameLength:framesToDecode error:error])
-			return NO;
+			framesAppended = [buffer appendContentsOfBuffer:_buffer];
+			_decoderOffset += _buffer.frameLength;
+		}
 
-		[buffer appendContentsOfBuffer:_buffer];
+		// Crossfade the end of the region with its start if another pass follows
+		if(_crossfadeLength && pass < _repeatCount)
+			[self crossfadeBuffer:buffer writeOffset:writeOffset regionOffset:regionOffset frameLength:framesAppended];
 
 		// Housekeeping
-		_framesDecoded += _buffer.frameLength;
-		framesRemaining -= _buffer.frameLength;
-
-		// If this pass is finished, seek to the beginning of the region in preparation for the next read
-		if(_repeatCount && _frameLength == (_framesDecoded / _frameLength)) {
-			// Only seek to the beginning of the region if more passes remain
-			if((_framesDecoded / _frameLength) < (_repeatCount + 1)) {
-				if(![_decoder seekToFrame:_framePosition error:error])
-					return NO;
-			}
-		}
+		_framesDecoded += framesAppended;
+		framesRemaining -= framesAppended;
 	}
 
 	return YES;
@@ -204,13 +254,32 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 	if(frame >= self.frameLength)
 		return NO;
 
+	AVAudioFramePosition regionOffset;
+	[self passForFrame:frame regionOffset:&regionOffset];
+
 	_framesDecoded = frame;
-	return [_decoder seekToFrame:(_framePosition + (frame % _frameLength)) error:error];
+
+	// The decoder is repositioned after the seam has been returned
+	if(regionOffset < _seamBuffer.frameLength)
+		return YES;
+
+	if(![_decoder seekToFrame:(_framePosition + regionOffset) error:error])
+		return NO;
+
+	_decoderOffset = regionOffset;
+	return YES;
+}
+
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+	return SFBPCMDecoderSkipFrames(self, frameLength, error);
 }
 
 - (BOOL)resetReturningError:(NSError **)error
 {
 	_framesDecoded = 0;
+	_decoderOffset = 0;
 
 	if(_framePosition == _decoder.framePosition)
 		return YES;
@@ -229,7 +298,89 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 	if(forceReset || _framePosition != 0)
 		return [self resetReturningError:error];
 
+	_framesDecoded = 0;
+	_decoderOffset = 0;
+
+	return YES;
+}
+
+- (BOOL)fillSeamBufferReturningError:(NSError **)error
+{
+	_seamBuffer = nil;
+
+	// Without a repeat there is no seam, so don't decode the start of the region up front unless asked to
+	if(_repeatCount == 0 && !_seamFrameLengthIsExplicit)
+		return YES;
+
+	AVAudioFrameCount seamLength = (AVAudioFrameCount)MIN(MAX(_seamFrameLength, _crossfadeLength), _frameLength);
+	if(seamLength == 0)
+		return YES;
+
+	AVAudioPCMBuffer *seamBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_decoder.processingFormat frameCapacity:seamLength];
+	if(!seamBuffer) {
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return NO;
+	}
+
+	// The decoder is positioned at the start of the region
+	while(seamBuffer.frameLength < seamLength) {
+		if(![_decoder decodeIntoBuffer:_buffer frameLength:SFB_min(seamLength - seamBuffer.frameLength, _buffer.frameCapacity) error:error])
+			return NO;
+		if(_buffer.frameLength == 0)
+			break;
+		[seamBuffer appendContentsOfBuffer:_buffer];
+	}
+
+	_decoderOffset = seamBuffer.frameLength;
+
+	// The crossfade mixes in the start of the region so it can't be longer than the seam
+	if(_crossfadeLength > seamBuffer.frameLength)
+		_crossfadeLength = seamBuffer.frameLength;
+
+	_seamBuffer = seamBuffer;
+
 	return YES;
 }
 
+- (NSInteger)passForFrame:(AVAudioFramePosition)frame regionOffset:(AVAudioFramePosition *)regionOffset
+{
+	NSParameterAssert(regionOffset != NULL);
+
+	if(frame < _frameLength) {
+		*regionOffset = frame;
+		return 0;
+	}
+
+	// Passes after the first begin following the crossfaded frames
+	AVAudioFramePosition passLength = _frameLength - _crossfadeLength;
+	frame -= _frameLength;
+	*regionOffset = _crossfadeLength + (frame % passLength);
+	return 1 + (NSInteger)(frame / passLength);
+}
+
+- (void)crossfadeBuffer:(AVAudioPCMBuffer *)buffer writeOffset:(AVAudioFrameCount)writeOffset regionOffset:(AVAudioFramePosition)regionOffset frameLength:(AVAudioFrameCount)frameLength
+{
+	AVAudioFramePosition crossfadeStart = _frameLength - _crossfadeLength;
+	AVAudioFramePosition start = MAX(regionOffset, crossfadeStart);
+	AVAudioFramePosition end = regionOffset + frameLength;
+	if(start >= end)
+		return;
+
+	AVAudioChannelCount channelCount = buffer.format.channelCount;
+	float * const *tail = buffer.floatChannelData;
+	float * const *head = _seamBuffer.floatChannelData;
+
+	// Equal-power crossfade from the end of the region to its start
+	for(AVAudioFramePosition offset = start; offset < end; ++offset) {
+		AVAudioFramePosition headOffset = offset - crossfadeStart;
+		AVAudioFramePosition tailOffset = writeOffset + (offset - regionOffset);
+		float t = ((float)headOffset + 0.5f) / (float)_crossfadeLength;
+		float fadeOut = cosf(t * (float)M_PI_2);
+		float fadeIn = sinf(t * (float)M_PI_2);
+		for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+			tail[channel][tailOffset] = (tail[channel][tailOffset] * fadeOut) + (head[channel][headOffset] * fadeIn);
+	}
+}
+
 @end
@@ -8,7 +8,17 @@
 NS_ASSUME_NONNULL_BEGIN
 
 // An SFBAudioDecoder subclass supporting MPEG1
+//
+// Opening doesn't read the entire file. The length comes from the Xing, Info, or VBRI header when present
+// and is otherwise estimated until a scan builds the frame index, which is cached for local files
 @interface SFBMPEGDecoder : SFBAudioDecoder
+
+// Whether local files without a frame count in a VBR header are scanned in the background when opened for an exact length and frame index (default YES)
+@property (class) BOOL prescansForFrameIndex;
+
+// The directory used to cache frame indexes, or nil to disable caching (defaults to a subdirectory of the user's caches directory)
+@property (class, nullable, copy) NSURL *frameIndexCacheDirectory;
+
 @end
 
 NS_ASSUME_NONNULL_END
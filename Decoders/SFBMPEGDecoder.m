@@ -5,12 +5,17 @@
 
 @import os.log;
 
+#import <os/lock.h>
+#import <stdatomic.h>
+
 #import <mpg123/mpg123.h>
 
 #import "SFBMPEGDecoder.h"
 
 #import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "NSError+SFBURLPresentation.h"
+#import "SFBIndexCache.h"
+#import "SFBSampleFormatKernels.h"
 
 // ========================================
 // Initialization
@@ -29,6 +34,166 @@ static void Teardownmpg123()
 	mpg123_exit();
 }
 
+#define FRAME_INDEX_CACHE_MAGIC			'MPGI'
+#define FRAME_INDEX_CACHE_VERSION		1
+#define FRAME_INDEX_CACHE_HEADER_SIZE	24
+
+#define VBR_HEADER_PROBE_SIZE			2048
+
+// The class properties may be set from any thread
+static atomic_bool sPrescansForFrameIndex = true;
+static os_unfair_lock sFrameIndexCacheDirectoryLock = OS_UNFAIR_LOCK_INIT;
+static NSURL *sFrameIndexCacheDirectory = nil;
+
+// ========================================
+// VBR headers
+static uint32_t SFBReadBE32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/// Returns \c YES if the first Layer III frame in \c buf contains an Xing, Info, or VBRI header with a frame count
+static BOOL SFBMPEGHasFrameCountHeader(const uint8_t *buf, size_t len)
+{
+	for(size_t i = 0; i + 4 <= len; ++i) {
+		if(buf[i] != 0xff || (buf[i + 1] & 0xe0) != 0xe0)
+			continue;
+
+		unsigned version = (buf[i + 1] >> 3) & 0x3;
+		unsigned layer = (buf[i + 1] >> 1) & 0x3;
+		unsigned bitrateIndex = buf[i + 2] >> 4;
+		unsigned sampleRateIndex = (buf[i + 2] >> 2) & 0x3;
+		if(version == 1 || layer == 0 || bitrateIndex == 0xf || sampleRateIndex == 0x3)
+			continue;
+
+		// Only Layer III files carry VBR headers
+		if(layer != 1)
+			return NO;
+
+		// The Xing and Info headers follow the side information
+		BOOL mono = (buf[i + 3] >> 6) == 0x3;
+		size_t sideInfoSize = version == 3 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+
+		const uint8_t *xing = buf + i + 4 + sideInfoSize;
+		if(xing + 12 <= buf + len && (!memcmp(xing, "Xing", 4) || !memcmp(xing, "Info", 4)))
+			return (SFBReadBE32(xing + 4) & 0x1) && SFBReadBE32(xing + 8) > 0;
+
+		// The VBRI header is at a fixed offset
+		const uint8_t *vbri = buf + i + 36;
+		if(vbri + 18 <= buf + len && !memcmp(vbri, "VBRI", 4))
+			return SFBReadBE32(vbri + 14) > 0;
+
+		return NO;
+	}
+
+	return NO;
+}
+
+/// Returns \c YES if the audio in \c inputSource starts with an Xing, Info, or VBRI header with a frame count
+static BOOL SFBInputSourceHasFrameCountHeader(SFBInputSource *inputSource)
+{
+	uint8_t buf [VBR_HEADER_PROBE_SIZE];
+	NSInteger bytesRead;
+
+	// Skip an ID3v2 tag
+	NSInteger offset = 0;
+	if([inputSource readBytes:buf length:10 bytesRead:&bytesRead error:nil] && bytesRead == 10 && !memcmp(buf, "ID3", 3)) {
+		offset = 10 + (((NSInteger)buf[6] & 0x7f) << 21 | ((NSInteger)buf[7] & 0x7f) << 14 | ((NSInteger)buf[8] & 0x7f) << 7 | ((NSInteger)buf[9] & 0x7f));
+		// Footer present
+		if(buf[5] & 0x10)
+			offset += 10;
+	}
+
+	return [inputSource seekToOffset:offset error:nil] && [inputSource readBytes:buf length:sizeof buf bytesRead:&bytesRead error:nil] && SFBMPEGHasFrameCountHeader(buf, (size_t)bytesRead);
+}
+
+// ========================================
+// Frame index caching
+
+static void SFBAppendLE64(NSMutableData *data, uint64_t value)
+{
+	value = OSSwapHostToLittleInt64(value);
+	[data appendBytes:&value length:sizeof value];
+}
+
+/// Writes the frame index for \c url to \c cacheURL
+static BOOL SFBWriteFrameIndex(NSURL *cacheURL, NSURL *url, AVAudioFramePosition frameLength, off_t step, NSData *offsets)
+{
+	size_t count = offsets.length / sizeof(off_t);
+	const off_t *offset = offsets.bytes;
+
+	NSMutableData *payload = [NSMutableData dataWithCapacity:FRAME_INDEX_CACHE_HEADER_SIZE + count * 8];
+	SFBAppendLE64(payload, (uint64_t)frameLength);
+	SFBAppendLE64(payload, (uint64_t)step);
+	SFBAppendLE64(payload, (uint64_t)count);
+	for(size_t i = 0; i < count; ++i)
+		SFBAppendLE64(payload, (uint64_t)offset[i]);
+
+	NSError *error = nil;
+	if(!SFBWriteIndexCache(cacheURL, url, FRAME_INDEX_CACHE_MAGIC, FRAME_INDEX_CACHE_VERSION, payload, &error)) {
+		os_log_error(gSFBAudioDecoderLog, "Error writing MP3 frame index cache: %{public}@", error);
+		return NO;
+	}
+
+	return YES;
+}
+
+/// Reads the frame index for \c url from \c cacheURL
+static BOOL SFBReadFrameIndex(NSURL *cacheURL, NSURL *url, AVAudioFramePosition *frameLength, off_t *step, NSData **offsets)
+{
+	NSData *payload = SFBReadIndexCache(cacheURL, url, FRAME_INDEX_CACHE_MAGIC, FRAME_INDEX_CACHE_VERSION);
+	if(payload.length < FRAME_INDEX_CACHE_HEADER_SIZE)
+		return NO;
+
+	uint64_t fileSize = [[url resourceValuesForKeys:@[NSURLFileSizeKey] error:nil][NSURLFileSizeKey] unsignedLongLongValue];
+
+	const uint8_t *bytes = payload.bytes;
+	uint64_t length = OSReadLittleInt64(bytes, 0);
+	uint64_t indexStep = OSReadLittleInt64(bytes, 8);
+	uint64_t count = OSReadLittleInt64(bytes, 16);
+	if(length == 0 || indexStep == 0 || count == 0 || count > (payload.length - FRAME_INDEX_CACHE_HEADER_SIZE) / 8)
+		return NO;
+
+	NSMutableData *indexOffsets = [NSMutableData dataWithLength:(NSUInteger)count * sizeof(off_t)];
+	off_t *offset = indexOffsets.mutableBytes;
+	for(uint64_t i = 0; i < count; ++i) {
+		offset[i] = (off_t)OSReadLittleInt64(bytes, FRAME_INDEX_CACHE_HEADER_SIZE + 8 * i);
+		if(offset[i] < 0 || offset[i] >= (off_t)fileSize || (i > 0 && offset[i] <= offset[i - 1]))
+			return NO;
+	}
+
+	*frameLength = (AVAudioFramePosition)length;
+	*step = (off_t)indexStep;
+	*offsets = indexOffsets;
+
+	return YES;
+}
+
+@interface SFBMPEGDecoder ()
+{
+@package
+	__unsafe_unretained SFBMPEGDecoder *_scanOwner;
+	atomic_bool _cancelScan;
+@private
+	mpg123_handle *_mpg123;
+	BOOL _isOpen;
+	AVAudioFramePosition _framePosition;
+	SFBPCMStagingBuffer *_buffer;
+	NSURL *_frameIndexCacheURL;
+	dispatch_group_t _scanGroup;
+	// A complete frame index produced by a scan, applied to _mpg123 by the decoding thread
+	os_unfair_lock _scanLock;
+	// Guarded by _scanLock since a scan may update it
+	AVAudioFramePosition _frameLength;
+	NSData *_scannedOffsets;
+	off_t _scannedStep;
+}
+- (BOOL)setUpFrameIndex;
+- (void)applyFrameIndexWithOffsets:(NSData *)offsets step:(off_t)step frameLength:(AVAudioFramePosition)frameLength;
+- (void)applyScannedFrameIndex;
+- (void)scanForFrameIndex;
+@end
+
 // ========================================
 // Callbacks
 static ssize_t read_callback(void *iohandle, void *ptr, size_t size)
@@ -37,6 +202,10 @@ static ssize_t read_callback(void *iohandle, void *ptr, size_t size)
 
 	SFBMPEGDecoder *decoder = (__bridge SFBMPEGDecoder *)iohandle;
 
+	// A cancelled scan stops at the next read
+	if(decoder->_scanOwner && atomic_load(&decoder->_scanOwner->_cancelScan))
+		return -1;
+
 	NSInteger bytesRead;
 	if(![decoder->_inputSource readBytes:ptr length:(NSInteger)size bytesRead:&bytesRead error:nil])
 		return -1;
@@ -77,15 +246,6 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 	return offset;
 }
 
-@interface SFBMPEGDecoder ()
-{
-@private
-	mpg123_handle *_mpg123;
-	AVAudioFramePosition _framePosition;
-	AVAudioPCMBuffer *_buffer;
-}
-@end
-
 @implementation SFBMPEGDecoder
 
 + (void)load
@@ -103,48 +263,112 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 	return [NSSet setWithObject:@"audio/mpeg"];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// MPEG audio has no signature, so check for a valid frame header
+	if(length >= 4 && bytes[0] == 0xff && (bytes[1] & 0xe0) == 0xe0) {
+		unsigned version = (bytes[1] >> 3) & 0x3;
+		unsigned layer = (bytes[1] >> 1) & 0x3;
+		unsigned bitrateIndex = bytes[2] >> 4;
+		unsigned sampleRateIndex = (bytes[2] >> 2) & 0x3;
+		if(version != 1 && layer != 0 && bitrateIndex != 0 && bitrateIndex != 0xf && sampleRateIndex != 0x3)
+			return SFBAudioDecoderProbeScoreLikely;
+	}
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
++ (BOOL)prescansForFrameIndex
+{
+	return atomic_load(&sPrescansForFrameIndex);
+}
+
++ (void)setPrescansForFrameIndex:(BOOL)prescansForFrameIndex
+{
+	atomic_store(&sPrescansForFrameIndex, prescansForFrameIndex);
+}
+
++ (NSURL *)frameIndexCacheDirectory
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		NSURL *cachesDirectory = [[NSFileManager defaultManager] URLForDirectory:NSCachesDirectory inDomain:NSUserDomainMask appropriateForURL:nil create:NO error:nil];
+		NSURL *defaultDirectory = [cachesDirectory URLByAppendingPathComponent:@"org.sbooth.AudioEngine/MPEGFrameIndex" isDirectory:YES];
+		os_unfair_lock_lock(&sFrameIndexCacheDirectoryLock);
+		sFrameIndexCacheDirectory = defaultDirectory;
+		os_unfair_lock_unlock(&sFrameIndexCacheDirectoryLock);
+	});
+
+	os_unfair_lock_lock(&sFrameIndexCacheDirectoryLock);
+	NSURL *frameIndexCacheDirectory = sFrameIndexCacheDirectory;
+	os_unfair_lock_unlock(&sFrameIndexCacheDirectoryLock);
+	return frameIndexCacheDirectory;
+}
+
++ (void)setFrameIndexCacheDirectory:(NSURL *)frameIndexCacheDirectory
+{
+	// Ensure the default is not applied later
+	[self frameIndexCacheDirectory];
+	NSURL *directory = [frameIndexCacheDirectory copy];
+	os_unfair_lock_lock(&sFrameIndexCacheDirectoryLock);
+	sFrameIndexCacheDirectory = directory;
+	os_unfair_lock_unlock(&sFrameIndexCacheDirectoryLock);
+}
+
+- (void)dealloc
+{
+	[self closeReturningError:nil];
+	if(_mpg123)
+		mpg123_delete(_mpg123);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
-	_mpg123 = mpg123_new(NULL, NULL);
-
+	// Create the mpg123 handle, which is reused if the decoder is reopened
 	if(!_mpg123) {
-		if(error)
-			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
-											 code:SFBAudioDecoderErrorCodeInputOutput
-					descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid MP3 file.", @"")
-											  url:_inputSource.url
-									failureReason:NSLocalizedString(@"Not a valid MP3 file", @"")
-							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+		_mpg123 = mpg123_new(NULL, NULL);
+
+		if(!_mpg123) {
+			if(error)
+				*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+												 code:SFBAudioDecoderErrorCodeInputOutput
+						descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid MP3 file.", @"")
+												  url:_inputSource.url
+										failureReason:NSLocalizedString(@"Not a valid MP3 file", @"")
+								   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+
+			return NO;
+		}
 
-		return NO;
+		if(mpg123_replace_reader_handle(_mpg123, read_callback, lseek_callback, NULL) != MPG123_OK) {
+			mpg123_delete(_mpg123);
+			_mpg123 = NULL;
+
+			if(error)
+				*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+												 code:SFBAudioDecoderErrorCodeInputOutput
+						descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid MP3 file.", @"")
+												  url:_inputSource.url
+										failureReason:NSLocalizedString(@"Not a valid MP3 file", @"")
+								   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+
+			return NO;
+		}
 	}
 
+	_framePosition = 0;
+
 	// Force decode to floating point instead of 16-bit signed integer
 	mpg123_param(_mpg123, MPG123_FLAGS, MPG123_FORCE_FLOAT | MPG123_SKIP_ID3V2 | MPG123_GAPLESS | MPG123_QUIET, 0);
 	mpg123_param(_mpg123, MPG123_RESYNC_LIMIT, 2048, 0);
 
-	if(mpg123_replace_reader_handle(_mpg123, read_callback, lseek_callback, NULL) != MPG123_OK) {
-		mpg123_delete(_mpg123);
-		_mpg123 = NULL;
-
-		if(error)
-			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
-											 code:SFBAudioDecoderErrorCodeInputOutput
-					descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid MP3 file.", @"")
-											  url:_inputSource.url
-									failureReason:NSLocalizedString(@"Not a valid MP3 file", @"")
-							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
-
-		return NO;
-	}
-
 	if(mpg123_open_handle(_mpg123, (__bridge void *)self) != MPG123_OK) {
-		mpg123_delete(_mpg123);
-		_mpg123 = NULL;
-
 		if(error)
 			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
 											 code:SFBAudioDecoderErrorCodeInputOutput
@@ -160,8 +384,6 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 	int channels, encoding;
 	if(mpg123_getformat(_mpg123, &rate, &channels, &encoding) != MPG123_OK || encoding != MPG123_ENC_FLOAT_32 || channels <= 0) {
 		mpg123_close(_mpg123);
-		mpg123_delete(_mpg123);
-		_mpg123 = NULL;
 
 		if(error)
 			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
@@ -200,34 +422,50 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
-	if(mpg123_scan(_mpg123) != MPG123_OK) {
-		mpg123_close(_mpg123);
-		mpg123_delete(_mpg123);
-		_mpg123 = NULL;
+	// A scanner only needs the frame index it builds itself
+	if(_scanOwner) {
+		if(mpg123_scan(_mpg123) != MPG123_OK) {
+			mpg123_close(_mpg123);
 
-		if(error)
-			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
-											 code:SFBAudioDecoderErrorCodeInputOutput
-					descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid MP3 file.", @"")
-											  url:_inputSource.url
-									failureReason:NSLocalizedString(@"Not a valid MP3 file", @"")
-							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+			if(error)
+				*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+												 code:SFBAudioDecoderErrorCodeInputOutput
+						descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid MP3 file.", @"")
+												  url:_inputSource.url
+										failureReason:NSLocalizedString(@"Not a valid MP3 file", @"")
+								   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
 
-		return NO;
+			return NO;
+		}
+
+		_isOpen = YES;
+		return YES;
 	}
 
-	_buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:framesPerMPEGFrame];
-	_buffer.frameLength = 0;
+	if(![self setUpFrameIndex])
+		[self scanForFrameIndex];
+
+	_buffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:framesPerMPEGFrame];
 
+	_isOpen = YES;
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
-	if(_mpg123) {
+	if(_scanGroup) {
+		atomic_store(&_cancelScan, true);
+		dispatch_group_wait(_scanGroup, DISPATCH_TIME_FOREVER);
+		_scanGroup = nil;
+	}
+
+	_scannedOffsets = nil;
+	_frameIndexCacheURL = nil;
+
+	// The handle is deleted in -dealloc so it may be reused if the decoder is reopened
+	if(_isOpen) {
 		mpg123_close(_mpg123);
-		mpg123_delete(_mpg123);
-		_mpg123 = NULL;
+		_isOpen = NO;
 	}
 
 	return [super closeReturningError:error];
@@ -235,7 +473,7 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 
 - (BOOL)isOpen
 {
-	return _mpg123 != NULL;
+	return _isOpen;
 }
 
 - (AVAudioFramePosition)framePosition
@@ -245,7 +483,11 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 
 - (AVAudioFramePosition)frameLength
 {
-	return mpg123_length(_mpg123);
+	// A scan may update the length from another thread
+	os_unfair_lock_lock(&_scanLock);
+	AVAudioFramePosition frameLength = _frameLength;
+	os_unfair_lock_unlock(&_scanLock);
+	return frameLength;
 }
 
 - (BOOL)decodeIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength error:(NSError **)error
@@ -263,12 +505,13 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 	if(frameLength > buffer.frameCapacity)
 		frameLength = buffer.frameCapacity;
 
+	[self applyScannedFrameIndex];
+
 	AVAudioFrameCount framesProcessed = 0;
 
 	for(;;) {
 		AVAudioFrameCount framesRemaining = frameLength - framesProcessed;
-		AVAudioFrameCount framesCopied = [buffer appendContentsOfBuffer:_buffer readOffset:0 frameLength:framesRemaining];
-		[_buffer trimAtOffset:0 frameLength:framesCopied];
+		AVAudioFrameCount framesCopied = [_buffer readIntoBuffer:buffer frameLength:framesRemaining];
 
 		framesProcessed += framesCopied;
 
@@ -290,20 +533,11 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 		}
 
 		// Deinterleave the samples
-		AVAudioFrameCount framesDecoded = (AVAudioFrameCount)(bytesDecoded / (sizeof(float) * _buffer.format.channelCount));
-
-		float * const *floatChannelData = _buffer.floatChannelData;
-		AVAudioChannelCount channelCount = _buffer.format.channelCount;
-		for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-			const float *input = (float *)audioData + channel;
-			float *output = floatChannelData[channel];
-			for(AVAudioFrameCount frame = 0; frame < framesDecoded; ++frame) {
-				*output++ = *input;
-				input += channelCount;
-			}
-		}
+		AVAudioFrameCount framesDecoded = (AVAudioFrameCount)(bytesDecoded / (sizeof(float) * _processingFormat.channelCount));
+
+		SFBDeinterleaveFloat32((const float *)audioData, _buffer.buffer.floatChannelData, _processingFormat.channelCount, framesDecoded);
 
-		_buffer.frameLength = framesDecoded;
+		_buffer.buffer.frameLength = framesDecoded;
 	}
 
 	_framePosition += framesProcessed;
@@ -314,10 +548,130 @@ static off_t lseek_callback(void *iohandle, off_t offset, int whence)
 - (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
 {
 	NSParameterAssert(frame >= 0);
+
+	[self applyScannedFrameIndex];
+
 	off_t offset = mpg123_seek(_mpg123, frame, SEEK_SET);
-	if(offset >= 0)
+	if(offset >= 0) {
 		_framePosition = offset;
+		[_buffer reset];
+	}
 	return offset >= 0;
 }
 
+/// Determines the length and frame index without reading the entire file if possible
+/// @return \c NO if the length is an estimate that a scan could make exact
+- (BOOL)setUpFrameIndex
+{
+	// Without a cached frame index, mpg123 estimates the length from the file size unless the
+	// Xing, Info, or VBRI header provides the frame count
+	os_unfair_lock_lock(&_scanLock);
+	_frameLength = mpg123_length(_mpg123);
+	os_unfair_lock_unlock(&_scanLock);
+
+	// Seeking beyond the portion of the stream already indexed reads every intervening frame,
+	// so for input that isn't local use the TOC in the VBR header to approximate the position instead
+	if(!_inputSource.url.isFileURL) {
+		mpg123_param(_mpg123, MPG123_ADD_FLAGS, MPG123_FUZZY, 0);
+		return YES;
+	}
+
+	_frameIndexCacheURL = SFBIndexCacheURL([SFBMPEGDecoder frameIndexCacheDirectory], _inputSource.url, @"mp3idx");
+	if(_frameIndexCacheURL) {
+		AVAudioFramePosition frameLength;
+		off_t step;
+		NSData *offsets;
+		if(SFBReadFrameIndex(_frameIndexCacheURL, _inputSource.url, &frameLength, &step, &offsets)) {
+			[self applyFrameIndexWithOffsets:offsets step:step frameLength:frameLength];
+			return YES;
+		}
+	}
+
+	// The length is exact if the VBR header provides the frame count
+	NSInteger offset;
+	if(!_inputSource.supportsSeeking || ![_inputSource getOffset:&offset error:nil])
+		return NO;
+	BOOL hasFrameCountHeader = SFBInputSourceHasFrameCountHeader(_inputSource);
+	if(![_inputSource seekToOffset:offset error:nil])
+		os_log_error(gSFBAudioDecoderLog, "Error restoring input source offset after reading MP3 VBR header");
+
+	return hasFrameCountHeader;
+}
+
+- (void)applyFrameIndexWithOffsets:(NSData *)offsets step:(off_t)step frameLength:(AVAudioFramePosition)frameLength
+{
+	int result = mpg123_set_index(_mpg123, (off_t *)offsets.bytes, step, offsets.length / sizeof(off_t));
+	if(result != MPG123_OK) {
+		os_log_error(gSFBAudioDecoderLog, "mpg123_set_index failed: %s", mpg123_plain_strerror(result));
+		return;
+	}
+
+	os_unfair_lock_lock(&_scanLock);
+	_frameLength = frameLength;
+	os_unfair_lock_unlock(&_scanLock);
+}
+
+- (void)applyScannedFrameIndex
+{
+	os_unfair_lock_lock(&_scanLock);
+	NSData *offsets = _scannedOffsets;
+	off_t step = _scannedStep;
+	AVAudioFramePosition frameLength = _frameLength;
+	_scannedOffsets = nil;
+	os_unfair_lock_unlock(&_scanLock);
+
+	if(offsets)
+		[self applyFrameIndexWithOffsets:offsets step:step frameLength:frameLength];
+}
+
+- (void)scanForFrameIndex
+{
+	NSURL *url = _inputSource.url;
+	if(!SFBMPEGDecoder.prescansForFrameIndex || !url)
+		return;
+
+	atomic_store(&_cancelScan, false);
+	_scanGroup = dispatch_group_create();
+	dispatch_group_async(_scanGroup, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+		NSError *error = nil;
+		SFBInputSource *inputSource = [SFBInputSource inputSourceForURL:url flags:0 error:&error];
+		if(!inputSource) {
+			os_log_error(gSFBAudioDecoderLog, "Error creating input source for MP3 frame index scan: %{public}@", error);
+			return;
+		}
+
+		SFBMPEGDecoder *scanner = [[SFBMPEGDecoder alloc] initWithInputSource:inputSource error:&error];
+		if(!scanner) {
+			os_log_error(gSFBAudioDecoderLog, "Error creating decoder for MP3 frame index scan: %{public}@", error);
+			return;
+		}
+
+		scanner->_scanOwner = self;
+		if(![scanner openReturningError:&error]) {
+			if(!atomic_load(&self->_cancelScan))
+				os_log_error(gSFBAudioDecoderLog, "Error scanning MP3 file for frame index: %{public}@", error);
+			return;
+		}
+
+		off_t *offsets = NULL;
+		off_t step = 0;
+		size_t fill = 0;
+		if(mpg123_index(scanner->_mpg123, &offsets, &step, &fill) == MPG123_OK && fill > 0) {
+			NSData *indexOffsets = [NSData dataWithBytes:offsets length:fill * sizeof(off_t)];
+			AVAudioFramePosition frameLength = mpg123_length(scanner->_mpg123);
+
+			os_unfair_lock_lock(&self->_scanLock);
+			self->_scannedOffsets = indexOffsets;
+			self->_scannedStep = step;
+			self->_frameLength = frameLength;
+			os_unfair_lock_unlock(&self->_scanLock);
+
+			if(self->_frameIndexCacheURL)
+				SFBWriteFrameIndex(self->_frameIndexCacheURL, url, frameLength, step, indexOffsets);
+		}
+
+		[scanner closeReturningError:nil];
+	});
+}
+
 @end
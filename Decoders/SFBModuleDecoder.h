@@ -8,7 +8,14 @@
 NS_ASSUME_NONNULL_BEGIN
 
 // An SFBAudioDecoder subclass supporting various kinds of Modules (MODs)
+//
+// Modules are synthesized directly as float at the rendering sample rate, so setting it
+// to the output rate avoids sample rate conversion during playback and export
 @interface SFBModuleDecoder : SFBAudioDecoder
+
+// The sample rate at which modules are rendered (default 44100)
+@property (class) double renderingSampleRate;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -4,6 +4,9 @@
  */
 
 @import os.log;
+@import Accelerate;
+
+#import <stdatomic.h>
 
 #include <dumb/dumb.h>
 
@@ -11,9 +14,60 @@
 
 #import "NSError+SFBURLPresentation.h"
 
-#define DUMB_SAMPLE_RATE	65536
+// DUMB positions and lengths are in units of 1/65536 second
+#define DUMB_TIME_BASE		65536
 #define DUMB_CHANNELS		2
-#define DUMB_BIT_DEPTH		16
+#define BUFFER_SIZE_FRAMES	4096
+
+// While loading, DUMB records the renderer state every 30 seconds so a renderer
+// started at an arbitrary position only needs to render forward from the preceding checkpoint
+#define DUMB_CHECKPOINT_INTERVAL_SECONDS	30
+
+// The rendering sample rate may be set from any thread
+static _Atomic(double) sRenderingSampleRate = 44100;
+
+typedef NS_ENUM(NSInteger, SFBModuleType) {
+	SFBModuleTypeUnknown,
+	SFBModuleTypeIT,
+	SFBModuleTypeXM,
+	SFBModuleTypeS3M,
+	SFBModuleTypeMOD
+};
+
+static SFBModuleType SFBModuleTypeForPathExtension(NSString *pathExtension)
+{
+	if([pathExtension isEqualToString:@"it"])
+		return SFBModuleTypeIT;
+	else if([pathExtension isEqualToString:@"xm"])
+		return SFBModuleTypeXM;
+	else if([pathExtension isEqualToString:@"s3m"])
+		return SFBModuleTypeS3M;
+	else if([pathExtension isEqualToString:@"mod"])
+		return SFBModuleTypeMOD;
+	else
+		return SFBModuleTypeUnknown;
+}
+
+static SFBModuleType SFBModuleTypeForPrefix(const uint8_t *bytes, NSUInteger length)
+{
+	if(length >= 4 && !memcmp(bytes, "IMPM", 4))
+		return SFBModuleTypeIT;
+	else if(length >= 17 && !memcmp(bytes, "Extended Module: ", 17))
+		return SFBModuleTypeXM;
+	else if(length >= 48 && !memcmp(bytes + 44, "SCRM", 4))
+		return SFBModuleTypeS3M;
+	else if(length >= 1084) {
+		// The signature follows the song title and 31 sample headers
+		const uint8_t *tag = bytes + 1080;
+		if(!memcmp(tag, "M.K.", 4) || !memcmp(tag, "M!K!", 4) || !memcmp(tag, "FLT4", 4) || !memcmp(tag, "FLT8", 4))
+			return SFBModuleTypeMOD;
+		// xCHN and xxCH
+		if((isdigit(tag[0]) && !memcmp(tag + 1, "CHN", 3)) || (isdigit(tag[0]) && isdigit(tag[1]) && !memcmp(tag + 2, "CH", 2)))
+			return SFBModuleTypeMOD;
+	}
+
+	return SFBModuleTypeUnknown;
+}
 
 static int skip_callback(void *f, long n)
 {
@@ -64,11 +118,14 @@ static void close_callback(void *f)
 	DUMBFILE *_df;
 	DUH *_duh;
 	DUH_SIGRENDERER *_dsr;
+	sample_t **_samples;
+	float _delta;
 	AVAudioFramePosition _framePosition;
 	AVAudioFramePosition _frameLength;
 }
 - (BOOL)openDecoderReturningError:(NSError **)error;
 - (void)closeDecoder;
+- (BOOL)restartRendererAtFrame:(AVAudioFramePosition)frame error:(NSError **)error;
 @end
 
 @implementation SFBModuleDecoder
@@ -88,21 +145,41 @@ static void close_callback(void *f)
 	return [NSSet setWithArray:@[@"audio/it", @"audio/xm", @"audio/s3m", @"audio/mod", @"audio/x-mod"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	if(SFBModuleTypeForPrefix(prefix.bytes, prefix.length) != SFBModuleTypeUnknown)
+		return SFBAudioDecoderProbeScoreCertain;
+	return SFBAudioDecoderProbeScoreNone;
+}
+
++ (double)renderingSampleRate
+{
+	return atomic_load(&sRenderingSampleRate);
+}
+
++ (void)setRenderingSampleRate:(double)renderingSampleRate
+{
+	NSParameterAssert(renderingSampleRate > 0);
+	atomic_store(&sRenderingSampleRate, renderingSampleRate);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
-	// Generate interleaved 2-channel 16-bit output
+	double sampleRate = SFBModuleDecoder.renderingSampleRate;
+
+	// Generate non-interleaved 2-channel float output, which DUMB can render at any sample rate
 	AVAudioChannelLayout *layout = [[AVAudioChannelLayout alloc] initWithLayoutTag:kAudioChannelLayoutTag_Stereo];
-	_processingFormat = [[AVAudioFormat alloc] initWithCommonFormat:AVAudioPCMFormatInt16 sampleRate:DUMB_SAMPLE_RATE interleaved:YES channelLayout:layout];
+	_processingFormat = [[AVAudioFormat alloc] initStandardFormatWithSampleRate:sampleRate channelLayout:layout];
 
 	// Set up the source format
 	AudioStreamBasicDescription sourceStreamDescription = {0};
 
 	sourceStreamDescription.mFormatID			= SFBAudioFormatIDModule;
 
-	sourceStreamDescription.mSampleRate			= DUMB_SAMPLE_RATE;
+	sourceStreamDescription.mSampleRate			= sampleRate;
 	sourceStreamDescription.mChannelsPerFrame	= DUMB_CHANNELS;
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
@@ -147,13 +224,40 @@ static void close_callback(void *f)
 		frameLength = buffer.frameCapacity;
 
 	// EOF reached
-	if(duh_sigrenderer_get_position(_dsr) > _frameLength)
+	if(duh_sigrenderer_get_position(_dsr) > duh_get_length(_duh))
 		return YES;
 
-	long framesRendered = duh_render(_dsr, DUMB_BIT_DEPTH, 0, 1, 65536.0f / DUMB_SAMPLE_RATE, frameLength, buffer.int16ChannelData[0]);
+	// DUMB's samples are 24-bit
+	const float scale = 1.0f / (1 << 23);
+	float * const *floatChannelData = buffer.floatChannelData;
+
+	AVAudioFrameCount framesProcessed = 0;
 
-	_framePosition += framesRendered;
-	buffer.frameLength = (AVAudioFrameCount)framesRendered;
+	while(framesProcessed < frameLength) {
+		long framesToRender = MIN(frameLength - framesProcessed, BUFFER_SIZE_FRAMES);
+
+		// DUMB mixes into the sample buffer
+		dumb_silence(_samples[0], DUMB_CHANNELS * framesToRender);
+		long framesRendered = duh_sigrenderer_generate_samples(_dsr, 1, _delta, framesToRender, _samples);
+		if(framesRendered <= 0)
+			break;
+
+		// Deinterleave and convert to float
+		for(AVAudioChannelCount channel = 0; channel < DUMB_CHANNELS; ++channel) {
+			float *output = floatChannelData[channel] + framesProcessed;
+			vDSP_vflt32(_samples[0] + channel, DUMB_CHANNELS, output, 1, (vDSP_Length)framesRendered);
+			vDSP_vsmul(output, 1, &scale, output, 1, (vDSP_Length)framesRendered);
+		}
+
+		framesProcessed += framesRendered;
+
+		// EOF reached
+		if(framesRendered < framesToRender)
+			break;
+	}
+
+	_framePosition += framesProcessed;
+	buffer.frameLength = framesProcessed;
 
 	return YES;
 }
@@ -162,21 +266,27 @@ static void close_callback(void *f)
 {
 	NSParameterAssert(frame >= 0);
 
-	// DUMB cannot seek backwards, so the decoder must be reset
-	if(frame < _framePosition) {
-		[self closeDecoder];
-		if(![_inputSource seekToOffset:0 error:error] || ![self openDecoderReturningError:error])
-			return NO;
-		_framePosition = 0;
-	}
+	// DUMB renderers only move forward, so for backward seeks and distant forward seeks
+	// start a new renderer from the checkpoint preceding the target
+	if(frame < _framePosition || frame - _framePosition > DUMB_CHECKPOINT_INTERVAL_SECONDS * _processingFormat.sampleRate)
+		return [self restartRendererAtFrame:frame error:error];
 
 	AVAudioFramePosition framesToSkip = frame - _framePosition;
-	duh_sigrenderer_generate_samples(_dsr, 1, 65536.0f / DUMB_SAMPLE_RATE, framesToSkip, NULL);
+	duh_sigrenderer_generate_samples(_dsr, 1, _delta, framesToSkip, NULL);
 	_framePosition += framesToSkip;
 
 	return YES;
 }
 
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+
+	// Seeking renders without output, restarting from a checkpoint if that is faster
+	AVAudioFramePosition framesToSkip = MIN(frameLength, MAX(_frameLength - _framePosition, 0));
+	return [self seekToFrame:(_framePosition + framesToSkip) error:error];
+}
+
 - (BOOL)openDecoderReturningError:(NSError **)error
 {
 	_dfs.open = NULL;
@@ -185,23 +295,26 @@ static void close_callback(void *f)
 	_dfs.getnc = getnc_callback;
 	_dfs.close = close_callback;
 
+	// Attempt to create the appropriate decoder based on the file's extension, falling back to its contents
+	SFBModuleType type = SFBModuleTypeForPathExtension(_inputSource.url.pathExtension.lowercaseString);
+	if(type == SFBModuleTypeUnknown) {
+		NSData *prefix = SFBAudioDecoderReadProbePrefix(_inputSource);
+		type = SFBModuleTypeForPrefix(prefix.bytes, prefix.length);
+	}
+
 	_df = dumbfile_open_ex((__bridge void *)self, &_dfs);
 	if(!_df) {
 		os_log_error(gSFBAudioDecoderLog, "dumbfile_open_ex failed");
 		return NO;
 	}
 
-	NSString *pathExtension = _inputSource.url.pathExtension.lowercaseString;
-
-	// Attempt to create the appropriate decoder based on the file's extension
-	if([pathExtension isEqualToString:@"it"])
-		_duh = dumb_read_it(_df);
-	else if([pathExtension isEqualToString:@"xm"])
-		_duh = dumb_read_xm(_df);
-	else if([pathExtension isEqualToString:@"s3m"])
-		_duh = dumb_read_s3m(_df);
-	else if([pathExtension isEqualToString:@"mod"])
-		_duh = dumb_read_mod(_df);
+	switch(type) {
+		case SFBModuleTypeIT:		_duh = dumb_read_it(_df);	break;
+		case SFBModuleTypeXM:		_duh = dumb_read_xm(_df);	break;
+		case SFBModuleTypeS3M:		_duh = dumb_read_s3m(_df);	break;
+		case SFBModuleTypeMOD:		_duh = dumb_read_mod(_df);	break;
+		case SFBModuleTypeUnknown:								break;
+	}
 
 	if(!_duh) {
 		dumbfile_close(_df);
@@ -218,8 +331,9 @@ static void close_callback(void *f)
 		return NO;
 	}
 
-	// NB: This must change if the sample rate changes because it is based on 65536 Hz
-	_frameLength = duh_get_length(_duh);
+	double sampleRate = _processingFormat.sampleRate;
+	_delta = (float)(DUMB_TIME_BASE / sampleRate);
+	_frameLength = (AVAudioFramePosition)(duh_get_length(_duh) * sampleRate / DUMB_TIME_BASE);
 
 	// Generate 2-channel audio
 	_dsr = duh_start_sigrenderer(_duh, 0, DUMB_CHANNELS, 0);
@@ -243,11 +357,49 @@ static void close_callback(void *f)
 		return NO;
 	}
 
+	_samples = allocate_sample_buffer(DUMB_CHANNELS, BUFFER_SIZE_FRAMES);
+	if(!_samples) {
+		[self closeDecoder];
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return NO;
+	}
+
+	return YES;
+}
+
+- (BOOL)restartRendererAtFrame:(AVAudioFramePosition)frame error:(NSError **)error
+{
+	long position = (long)(frame * DUMB_TIME_BASE / _processingFormat.sampleRate);
+	DUH_SIGRENDERER *dsr = duh_start_sigrenderer(_duh, 0, DUMB_CHANNELS, position);
+	if(!dsr) {
+		os_log_error(gSFBAudioDecoderLog, "duh_start_sigrenderer failed");
+
+		if(error)
+			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+											 code:SFBAudioDecoderErrorCodeInputOutput
+					descriptionFormatStringForURL:NSLocalizedString(@"The requested position in the file “%@” could not be located.", @"")
+											  url:_inputSource.url
+									failureReason:NSLocalizedString(@"Unable to restart Module rendering", @"")
+							   recoverySuggestion:NSLocalizedString(@"The file may be damaged.", @"")];
+
+		return NO;
+	}
+
+	duh_end_sigrenderer(_dsr);
+	_dsr = dsr;
+	_framePosition = frame;
+
 	return YES;
 }
 
 - (void)closeDecoder
 {
+	if(_samples) {
+		destroy_sample_buffer(_samples);
+		_samples = NULL;
+	}
+
 	if(_dsr) {
 		duh_end_sigrenderer(_dsr);
 		_dsr = NULL;
@@ -8,7 +8,14 @@
 NS_ASSUME_NONNULL_BEGIN
 
 // An SFBAudioDecoder subclass supporting Monkey's Audio
+//
+// APE frames are independent, so when more than one decoding thread is requested the frames following
+// the current frame are decoded concurrently, each worker using its own view of the input source
 @interface SFBMonkeysAudioDecoder : SFBAudioDecoder
+
+// The number of threads used to decode seekable input, or 0 for one per active processor (default 1)
+@property (class) NSUInteger decodingThreadCount;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -5,7 +5,13 @@
 
 #import <os/log.h>
 
+#import <algorithm>
+#import <atomic>
+#import <condition_variable>
+#import <deque>
 #import <memory>
+#import <mutex>
+#import <vector>
 
 #define PLATFORM_APPLE
 
@@ -22,11 +28,14 @@
 namespace {
 
 	// The I/O interface for MAC
+	//
+	// When constructed with a lock the interface is a view of the input source with its own position,
+	// allowing several decompressors to share one input source
 	class APEIOInterface : public APE::CIO
 	{
 	public:
-		explicit APEIOInterface(SFBInputSource *inputSource)
-			: mInputSource(inputSource)
+		explicit APEIOInterface(SFBInputSource *inputSource, std::mutex *inputSourceLock = nullptr)
+			: mInputSource(inputSource), mInputSourceLock(inputSourceLock), mPosition(0)
 		{}
 
 		inline virtual int Open(const wchar_t * pName, bool bOpenReadOnly)
@@ -44,6 +53,18 @@ namespace {
 
 		virtual int Read(void * pBuffer, unsigned int nBytesToRead, unsigned int * pBytesRead)
 		{
+			if(mInputSourceLock) {
+				std::lock_guard<std::mutex> lock(*mInputSourceLock);
+				NSInteger bytesRead;
+				if(![mInputSource seekToOffset:mPosition error:nil] || ![mInputSource readBytes:pBuffer length:nBytesToRead bytesRead:&bytesRead error:nil])
+					return ERROR_IO_READ;
+
+				mPosition += bytesRead;
+				*pBytesRead = (unsigned int)bytesRead;
+
+				return ERROR_SUCCESS;
+			}
+
 			NSInteger bytesRead;
 			if(![mInputSource readBytes:pBuffer length:nBytesToRead bytesRead:&bytesRead error:nil])
 				return ERROR_IO_READ;
@@ -74,11 +95,17 @@ namespace {
 					break;
 				case SEEK_CUR: {
 					NSInteger inputSourceOffset;
-					if([mInputSource getOffset:&inputSourceOffset error:nil])
+					if(mInputSourceLock)
+						offset += mPosition;
+					else if([mInputSource getOffset:&inputSourceOffset error:nil])
 						offset += inputSourceOffset;
 					break;
 				}
 				case SEEK_END: {
+					std::unique_lock<std::mutex> lock;
+					if(mInputSourceLock)
+						lock = std::unique_lock<std::mutex>(*mInputSourceLock);
+
 					NSInteger inputSourceLength;
 					if([mInputSource getLength:&inputSourceLength error:nil])
 						offset += inputSourceLength;
@@ -86,6 +113,13 @@ namespace {
 				}
 			}
 
+			if(mInputSourceLock) {
+				if(offset < 0)
+					return ERROR_IO_READ;
+				mPosition = offset;
+				return ERROR_SUCCESS;
+			}
+
 			return ![mInputSource seekToOffset:offset error:nil];
 		}
 
@@ -107,6 +141,9 @@ namespace {
 
 		inline virtual APE::int64 GetPosition()
 		{
+			if(mInputSourceLock)
+				return mPosition;
+
 			NSInteger offset;
 			if(![mInputSource getOffset:&offset error:nil])
 				return -1;
@@ -115,6 +152,10 @@ namespace {
 
 		inline virtual APE::int64 GetSize()
 		{
+			std::unique_lock<std::mutex> lock;
+			if(mInputSourceLock)
+				lock = std::unique_lock<std::mutex>(*mInputSourceLock);
+
 			NSInteger length;
 			if(![mInputSource getLength:&length error:nil])
 				return -1;
@@ -130,6 +171,32 @@ namespace {
 	private:
 
 		SFBInputSource *mInputSource;
+		std::mutex *mInputSourceLock;
+		NSInteger mPosition;
+	};
+
+	// Audio decoded from one APE frame by a worker
+	struct DecodedFrame
+	{
+		explicit DecodedFrame(int64_t frameIndex)
+			: mFrameIndex(frameIndex), mBlocks(0), mComplete(false), mFailed(false), mCancelled(false)
+		{}
+
+		const int64_t mFrameIndex;
+		std::vector<char> mData;
+		int64_t mBlocks;
+		// Protected by the lookahead lock
+		bool mComplete;
+		bool mFailed;
+		std::atomic_bool mCancelled;
+	};
+
+	// A decompressor with its own view of the input source
+	struct DecodingWorker
+	{
+		dispatch_queue_t mQueue;
+		std::unique_ptr<APEIOInterface> mIOInterface;
+		std::unique_ptr<APE::IAPEDecompress> mDecompressor;
 	};
 
 }
@@ -139,9 +206,25 @@ namespace {
 @private
 	std::unique_ptr<APEIOInterface> _ioInterface;
 	std::unique_ptr<APE::IAPEDecompress> _decompressor;
+	AVAudioFramePosition _framePosition;
+	AVAudioFramePosition _frameLength;
+	// Parallel decoding
+	std::mutex _inputSourceLock;
+	std::vector<std::shared_ptr<DecodingWorker>> _workers;
+	dispatch_group_t _workerGroup;
+	int64_t _blocksPerFrame;
+	int64_t _totalFrames;
+	// The end of the APE frame decoded by _decompressor; subsequent frames are decoded by the workers
+	AVAudioFramePosition _serialDecodeEnd;
+	std::mutex _lookaheadLock;
+	std::condition_variable _lookaheadCondition;
+	std::deque<std::shared_ptr<DecodedFrame>> _lookahead;
+	int64_t _nextFrameToSchedule;
 }
 @end
 
+static std::atomic<NSUInteger> sDecodingThreadCount{1};
+
 @implementation SFBMonkeysAudioDecoder
 
 + (void)load
@@ -159,12 +242,37 @@ namespace {
 	return [NSSet setWithArray:@[@"audio/monkeys-audio", @"audio/x-monkeys-audio"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	if(length >= 4 && !memcmp(bytes, "MAC ", 4))
+		return SFBAudioDecoderProbeScoreCertain;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
++ (NSUInteger)decodingThreadCount
+{
+	return sDecodingThreadCount.load();
+}
+
++ (void)setDecodingThreadCount:(NSUInteger)decodingThreadCount
+{
+	sDecodingThreadCount.store(decodingThreadCount > 0 ? decodingThreadCount : [NSProcessInfo processInfo].activeProcessorCount);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
-	auto ioInterface = 	std::make_unique<APEIOInterface>(_inputSource);
+	// Parallel decoding requires independent views of the input source
+	NSUInteger workerCount = SFBMonkeysAudioDecoder.decodingThreadCount;
+	BOOL decodeInParallel = workerCount > 1 && _inputSource.supportsSeeking;
+
+	auto ioInterface = std::make_unique<APEIOInterface>(_inputSource, decodeInParallel ? &_inputSourceLock : nullptr);
 	auto decompressor = std::unique_ptr<APE::IAPEDecompress>(CreateIAPEDecompressEx(ioInterface.get(), nullptr));
 	if(!decompressor) {
 		if(error)
@@ -220,11 +328,35 @@ namespace {
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
+	_framePosition = 0;
+	_frameLength = _decompressor->GetInfo(APE::APE_DECOMPRESS_TOTAL_BLOCKS);
+
+	_blocksPerFrame = _decompressor->GetInfo(APE::APE_INFO_BLOCKS_PER_FRAME);
+	_totalFrames = _decompressor->GetInfo(APE::APE_INFO_TOTAL_FRAMES);
+
+	if(decodeInParallel && _blocksPerFrame > 0 && _totalFrames > 1) {
+		_workerGroup = dispatch_group_create();
+		dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, 0);
+		for(NSUInteger i = 0; i < workerCount; ++i) {
+			auto worker = std::make_shared<DecodingWorker>();
+			worker->mQueue = dispatch_queue_create("org.sbooth.AudioEngine.MonkeysAudioDecoder.Worker", attr);
+			_workers.push_back(worker);
+		}
+		[self resetLookaheadAtFrame:0];
+	}
+
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+	if(!_workers.empty()) {
+		[self cancelLookahead];
+		dispatch_group_wait(_workerGroup, DISPATCH_TIME_FOREVER);
+		_workers.clear();
+		_workerGroup = nil;
+	}
+
 	_ioInterface.reset();
 	_decompressor.reset();
 
@@ -238,12 +370,12 @@ namespace {
 
 - (AVAudioFramePosition)framePosition
 {
-	return _decompressor->GetInfo(APE::APE_DECOMPRESS_CURRENT_BLOCK);
+	return _framePosition;
 }
 
 - (AVAudioFramePosition)frameLength
 {
-	return _decompressor->GetInfo(APE::APE_DECOMPRESS_TOTAL_BLOCKS);
+	return _frameLength;
 }
 
 - (BOOL)decodeIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength error:(NSError **)error
@@ -261,6 +393,9 @@ namespace {
 	if(frameLength > buffer.frameCapacity)
 		frameLength = buffer.frameCapacity;
 
+	if(!_workers.empty())
+		return [self decodeInParallelIntoBuffer:buffer frameLength:frameLength];
+
 	int64_t blocksRead = 0;
 	if(_decompressor->GetData((char *)buffer.audioBufferList->mBuffers[0].mData, (int64_t)frameLength, &blocksRead)) {
 		os_log_error(gSFBAudioDecoderLog, "Monkey's Audio invalid checksum");
@@ -268,6 +403,7 @@ namespace {
 	}
 
 	buffer.frameLength = (AVAudioFrameCount)blocksRead;
+	_framePosition += blocksRead;
 
 	return YES;
 }
@@ -275,7 +411,152 @@ namespace {
 - (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
 {
 	NSParameterAssert(frame >= 0);
-	return _decompressor->Seek(frame) == ERROR_SUCCESS;
+
+	if(!_workers.empty())
+		[self cancelLookahead];
+
+	if(_decompressor->Seek(frame) != ERROR_SUCCESS)
+		return NO;
+
+	_framePosition = frame;
+
+	if(!_workers.empty())
+		[self resetLookaheadAtFrame:frame];
+
+	return YES;
+}
+
+#pragma mark Parallel Decoding
+
+- (BOOL)decodeInParallelIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength
+{
+	UInt32 bytesPerFrame = _processingFormat.streamDescription->mBytesPerFrame;
+	auto output = static_cast<char *>(buffer.audioBufferList->mBuffers[0].mData);
+
+	AVAudioFrameCount framesProcessed = 0;
+
+	while(framesProcessed < frameLength && _framePosition < _frameLength) {
+		// The remainder of the APE frame containing the initial position is decoded serially
+		if(_framePosition < _serialDecodeEnd) {
+			auto blocksToRead = std::min((int64_t)(frameLength - framesProcessed), _serialDecodeEnd - _framePosition);
+			int64_t blocksRead = 0;
+			if(_decompressor->GetData(output + (framesProcessed * bytesPerFrame), blocksToRead, &blocksRead)) {
+				os_log_error(gSFBAudioDecoderLog, "Monkey's Audio invalid checksum");
+				return NO;
+			}
+
+			// EOS
+			if(blocksRead == 0)
+				break;
+
+			framesProcessed += (AVAudioFrameCount)blocksRead;
+			_framePosition += blocksRead;
+			continue;
+		}
+
+		std::shared_ptr<DecodedFrame> decodedFrame;
+		{
+			std::unique_lock<std::mutex> lock(_lookaheadLock);
+			if(_lookahead.empty())
+				break;
+			decodedFrame = _lookahead.front();
+			_lookaheadCondition.wait(lock, [&decodedFrame] { return decodedFrame->mComplete; });
+		}
+
+		if(decodedFrame->mFailed) {
+			os_log_error(gSFBAudioDecoderLog, "Error decoding Monkey's Audio frame %lld", decodedFrame->mFrameIndex);
+			return NO;
+		}
+
+		auto frameOffset = _framePosition - (decodedFrame->mFrameIndex * _blocksPerFrame);
+		auto blocksToCopy = std::min((int64_t)(frameLength - framesProcessed), decodedFrame->mBlocks - frameOffset);
+		if(blocksToCopy > 0) {
+			memcpy(output + (framesProcessed * bytesPerFrame), decodedFrame->mData.data() + (frameOffset * bytesPerFrame), (size_t)blocksToCopy * bytesPerFrame);
+			framesProcessed += (AVAudioFrameCount)blocksToCopy;
+			_framePosition += blocksToCopy;
+		}
+
+		// Replace the consumed frame with the next frame
+		if(frameOffset + blocksToCopy >= decodedFrame->mBlocks) {
+			{
+				std::lock_guard<std::mutex> lock(_lookaheadLock);
+				_lookahead.pop_front();
+			}
+			[self scheduleNextFrame];
+		}
+	}
+
+	buffer.frameLength = framesProcessed;
+
+	return YES;
+}
+
+- (void)resetLookaheadAtFrame:(AVAudioFramePosition)frame
+{
+	auto frameIndex = frame / _blocksPerFrame;
+	_serialDecodeEnd = std::min((frameIndex + 1) * _blocksPerFrame, _frameLength);
+	_nextFrameToSchedule = frameIndex + 1;
+
+	// Keep each worker busy with one frame
+	for(size_t i = 0; i < _workers.size(); ++i)
+		[self scheduleNextFrame];
+}
+
+- (void)cancelLookahead
+{
+	std::lock_guard<std::mutex> lock(_lookaheadLock);
+	for(const auto& decodedFrame : _lookahead)
+		decodedFrame->mCancelled = true;
+	_lookahead.clear();
+}
+
+- (void)scheduleNextFrame
+{
+	if(_nextFrameToSchedule >= _totalFrames)
+		return;
+
+	auto frameIndex = _nextFrameToSchedule++;
+	auto decodedFrame = std::make_shared<DecodedFrame>(frameIndex);
+	auto worker = _workers[(size_t)frameIndex % _workers.size()];
+
+	{
+		std::lock_guard<std::mutex> lock(_lookaheadLock);
+		_lookahead.push_back(decodedFrame);
+	}
+
+	SFBInputSource *inputSource = _inputSource;
+	int64_t firstBlock = frameIndex * _blocksPerFrame;
+	int64_t blockCount = std::min(_blocksPerFrame, _frameLength - firstBlock);
+	UInt32 bytesPerFrame = _processingFormat.streamDescription->mBytesPerFrame;
+	std::mutex *inputSourceLock = &_inputSourceLock;
+
+	dispatch_group_async(_workerGroup, worker->mQueue, ^{
+		if(decodedFrame->mCancelled)
+			return;
+
+		bool success = false;
+		if(!worker->mDecompressor) {
+			worker->mIOInterface = std::make_unique<APEIOInterface>(inputSource, inputSourceLock);
+			worker->mDecompressor = std::unique_ptr<APE::IAPEDecompress>(CreateIAPEDecompressEx(worker->mIOInterface.get(), nullptr));
+		}
+
+		if(worker->mDecompressor && worker->mDecompressor->Seek(firstBlock) == ERROR_SUCCESS) {
+			decodedFrame->mData.resize((size_t)blockCount * bytesPerFrame);
+			int64_t blocksRead = 0;
+			// Every frame except the last contains exactly _blocksPerFrame blocks
+			if(!worker->mDecompressor->GetData(decodedFrame->mData.data(), blockCount, &blocksRead) && blocksRead == blockCount) {
+				decodedFrame->mBlocks = blocksRead;
+				success = true;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(self->_lookaheadLock);
+			decodedFrame->mComplete = true;
+			decodedFrame->mFailed = !success;
+		}
+		self->_lookaheadCondition.notify_all();
+	});
 }
 
 @end
@@ -18,6 +18,7 @@
 
 #import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "NSError+SFBURLPresentation.h"
+#import "SFBSampleFormatKernels.h"
 
 static mpc_int32_t read_callback(mpc_reader *p_reader, void *ptr, mpc_int32_t size)
 {
@@ -76,7 +77,7 @@ static mpc_bool_t canseek_callback(mpc_reader *p_reader)
 	mpc_demux *_demux;
 	AVAudioFramePosition _framePosition;
 	AVAudioFramePosition _frameLength;
-	AVAudioPCMBuffer *_buffer;
+	SFBPCMStagingBuffer *_buffer;
 }
 @end
 
@@ -97,11 +98,29 @@ static mpc_bool_t canseek_callback(mpc_reader *p_reader)
 	return [NSSet setWithArray:@[@"audio/musepack", @"audio/x-musepack"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// SV8
+	if(length >= 4 && !memcmp(bytes, "MPCK", 4))
+		return SFBAudioDecoderProbeScoreCertain;
+
+	// SV7
+	if(length >= 4 && !memcmp(bytes, "MP+", 3) && (bytes[3] & 0x0f) == 7)
+		return SFBAudioDecoderProbeScoreCertain;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
+	_framePosition = 0;
+
 	_reader.read = read_callback;
 	_reader.seek = seek_callback;
 	_reader.tell = tell_callback;
@@ -154,8 +173,7 @@ static mpc_bool_t canseek_callback(mpc_reader *p_reader)
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
-	_buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:MPC_FRAME_LENGTH];
-	_buffer.frameLength = 0;
+	_buffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:MPC_FRAME_LENGTH];
 
 	return YES;
 }
@@ -206,8 +224,7 @@ static mpc_bool_t canseek_callback(mpc_reader *p_reader)
 
 	for(;;) {
 		AVAudioFrameCount framesRemaining = frameLength - framesProcessed;
-		AVAudioFrameCount framesCopied = [buffer appendContentsOfBuffer:_buffer readOffset:0 frameLength:framesRemaining];
-		[_buffer trimAtOffset:0 frameLength:framesCopied];
+		AVAudioFrameCount framesCopied = [_buffer readIntoBuffer:buffer frameLength:framesRemaining];
 
 		framesProcessed += framesCopied;
 
@@ -236,21 +253,13 @@ static mpc_bool_t canseek_callback(mpc_reader *p_reader)
 		float minValue = -1.f;
 		float maxValue = 8388607.f / 8388608.f;
 
-		AVAudioChannelCount channelCount = _buffer.format.channelCount;
+		AVAudioChannelCount channelCount = _buffer.buffer.format.channelCount;
 		vDSP_vclip((float *)frame.buffer, 1, &minValue, &maxValue, (float *)frame.buffer, 1, frame.samples * channelCount);
 
 		// Deinterleave the normalized samples
-		float * const *floatChannelData = _buffer.floatChannelData;
-		for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-			const float *input = (float *)frame.buffer + channel;
-			float *output = floatChannelData[channel] + _buffer.frameLength;
-			for(uint32_t sample = 0; sample < frame.samples; ++sample) {
-				*output++ = *input;
-				input += channelCount;
-			}
-		}
+		SFBDeinterleaveFloat32((const float *)frame.buffer, _buffer.buffer.floatChannelData, channelCount, frame.samples);
 
-		_buffer.frameLength = frame.samples;
+		_buffer.buffer.frameLength = frame.samples;
 #endif /* MPC_FIXED_POINT */
 	}
 
@@ -266,6 +275,7 @@ static mpc_bool_t canseek_callback(mpc_reader *p_reader)
 	if(mpc_demux_seek_sample(_demux, (mpc_uint64_t)frame))
 		return NO;
 	_framePosition = frame;
+	[_buffer reset];
 	return YES;
 }
 
@@ -7,8 +7,39 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+// The gain applied to decoded Opus audio
+typedef NS_ENUM(NSInteger, SFBOggOpusGainType) {
+	// The output gain from the Opus header plus the gain offset
+	SFBOggOpusGainTypeHeader	= 0,
+	// The header gain, album gain from the R128_ALBUM_GAIN tag, and gain offset
+	SFBOggOpusGainTypeAlbum		= 1,
+	// The header gain, track gain from the R128_TRACK_GAIN tag, and gain offset
+	SFBOggOpusGainTypeTrack		= 2,
+	// Only the gain offset, ignoring the header gain
+	SFBOggOpusGainTypeAbsolute	= 3
+};
+
 // An SFBAudioDecoder subclass supporting Ogg Opus
+//
+// Opus is always decoded at 48 KHz; when a different output sample rate is requested the audio is
+// resampled by the decoder so a single conversion occurs
 @interface SFBOggOpusDecoder : SFBAudioDecoder
+
+// The gain applied by opusfile (default SFBOggOpusGainTypeHeader)
+@property (class) SFBOggOpusGainType gainType;
+
+// The gain offset in dB added to the gain selected by gainType (default 0)
+@property (class) double gainOffset;
+
+// Whether multichannel audio is downmixed to stereo by opusfile (default NO)
+@property (class) BOOL downmixesToStereo;
+
+// The sample rate of decoded audio, or 0 for the native rate of 48 KHz (default 0)
+@property (class) double outputSampleRate;
+
+// Whether the mastering quality sample rate converter is used when resampling instead of a faster lower quality one (default YES)
+@property (class) BOOL usesHighQualityResampling;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -5,14 +5,25 @@
 
 @import os.log;
 
+#import <stdatomic.h>
+
 #include <opus/opusfile.h>
 
 #import "SFBOggOpusDecoder.h"
 
 #import "AVAudioChannelLayout+SFBChannelLabels.h"
+#import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "NSError+SFBURLPresentation.h"
 
 #define OPUS_SAMPLE_RATE 48000
+#define BUFFER_SIZE_FRAMES 4096
+
+// The class properties may be set from any thread
+static _Atomic(SFBOggOpusGainType) sGainType = SFBOggOpusGainTypeHeader;
+static _Atomic(double) sGainOffset = 0;
+static atomic_bool sDownmixesToStereo = false;
+static _Atomic(double) sOutputSampleRate = 0;
+static atomic_bool sUsesHighQualityResampling = true;
 
 static int read_callback(void *stream, unsigned char *ptr, int nbytes)
 {
@@ -69,7 +80,15 @@ static 	opus_int64 tell_callback(void *stream)
 {
 @private
 	OggOpusFile *_opusFile;
+	BOOL _downmixesToStereo;
+	// Resampling from OPUS_SAMPLE_RATE to the output sample rate
+	AVAudioConverter *_converter;
+	AVAudioPCMBuffer *_decodeBuffer;
+	SFBPCMStagingBuffer *_resampledBuffer;
+	AVAudioFramePosition _framePosition;
 }
+- (BOOL)readIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength;
+- (BOOL)resampleIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength error:(NSError **)error;
 @end
 
 @implementation SFBOggOpusDecoder
@@ -89,6 +108,72 @@ static 	opus_int64 tell_callback(void *stream)
 	return [NSSet setWithArray:@[@"audio/opus", @"audio/ogg"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// The identification header is the first packet of an Ogg stream
+	if(length >= 27 && !memcmp(bytes, "OggS", 4)) {
+		NSUInteger packetOffset = 27 + bytes[26];
+		if(length >= packetOffset + 8 && !memcmp(bytes + packetOffset, "OpusHead", 8))
+			return SFBAudioDecoderProbeScoreCertain;
+	}
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
++ (SFBOggOpusGainType)gainType
+{
+	return atomic_load(&sGainType);
+}
+
++ (void)setGainType:(SFBOggOpusGainType)gainType
+{
+	atomic_store(&sGainType, gainType);
+}
+
++ (double)gainOffset
+{
+	return atomic_load(&sGainOffset);
+}
+
++ (void)setGainOffset:(double)gainOffset
+{
+	atomic_store(&sGainOffset, gainOffset);
+}
+
++ (BOOL)downmixesToStereo
+{
+	return atomic_load(&sDownmixesToStereo);
+}
+
++ (void)setDownmixesToStereo:(BOOL)downmixesToStereo
+{
+	atomic_store(&sDownmixesToStereo, downmixesToStereo);
+}
+
++ (double)outputSampleRate
+{
+	return atomic_load(&sOutputSampleRate);
+}
+
++ (void)setOutputSampleRate:(double)outputSampleRate
+{
+	NSParameterAssert(outputSampleRate >= 0);
+	atomic_store(&sOutputSampleRate, outputSampleRate);
+}
+
++ (BOOL)usesHighQualityResampling
+{
+	return atomic_load(&sUsesHighQualityResampling);
+}
+
++ (void)setUsesHighQualityResampling:(BOOL)usesHighQualityResampling
+{
+	atomic_store(&sUsesHighQualityResampling, usesHighQualityResampling);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
@@ -117,13 +202,38 @@ static 	opus_int64 tell_callback(void *stream)
 	if(op_test_open(_opusFile)) {
 		os_log_error(gSFBAudioDecoderLog, "op_test_open failed");
 		op_free(_opusFile);
+		_opusFile = NULL;
+
+		if(error)
+			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+											 code:SFBAudioDecoderErrorCodeInputOutput
+					descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid Ogg Opus file.", @"")
+											  url:_inputSource.url
+									failureReason:NSLocalizedString(@"Not an Ogg Opus file", @"")
+							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+
 		return NO;
 	}
 
+	// Gain is specified in Q7.8 dB
+	int gainType = OP_HEADER_GAIN;
+	switch(SFBOggOpusDecoder.gainType) {
+		case SFBOggOpusGainTypeHeader:		gainType = OP_HEADER_GAIN;		break;
+		case SFBOggOpusGainTypeAlbum:		gainType = OP_ALBUM_GAIN;		break;
+		case SFBOggOpusGainTypeTrack:		gainType = OP_TRACK_GAIN;		break;
+		case SFBOggOpusGainTypeAbsolute:	gainType = OP_ABSOLUTE_GAIN;	break;
+	}
+	if(op_set_gain_offset(_opusFile, gainType, (opus_int32)lround(SFBOggOpusDecoder.gainOffset * 256)))
+		os_log_error(gSFBAudioDecoderLog, "op_set_gain_offset failed");
+
 	const OpusHead *header = op_head(_opusFile, 0);
 
+	_framePosition = 0;
+	_downmixesToStereo = SFBOggOpusDecoder.downmixesToStereo && header->channel_count > 2;
+	int channelCount = _downmixesToStereo ? 2 : header->channel_count;
+
 	AVAudioChannelLayout *channelLayout = nil;
-	switch(header->channel_count) {
+	switch(channelCount) {
 			// Default channel layouts from Vorbis I specification section 4.3.9
 			// http://www.xiph.org/vorbis/doc/Vorbis_I_spec.html#x1-800004.3.9
 		case 1:		channelLayout = [AVAudioChannelLayout layoutWithLayoutTag:kAudioChannelLayoutTag_Mono];				break;
@@ -145,11 +255,43 @@ static 	opus_int64 tell_callback(void *stream)
 							 kAudioChannelLabel_LFEScreen];
 			break;
 		default:
-			channelLayout = [AVAudioChannelLayout layoutWithLayoutTag:(kAudioChannelLayoutTag_Unknown | (UInt32)header->channel_count)];
+			channelLayout = [AVAudioChannelLayout layoutWithLayoutTag:(kAudioChannelLayoutTag_Unknown | (UInt32)channelCount)];
 			break;
 	}
 
-	_processingFormat = [[AVAudioFormat alloc] initWithCommonFormat:AVAudioPCMFormatFloat32 sampleRate:OPUS_SAMPLE_RATE interleaved:NO channelLayout:channelLayout];
+	// opusfile produces interleaved float samples which are decoded directly into the output buffer
+	AVAudioFormat *decodingFormat = [[AVAudioFormat alloc] initWithCommonFormat:AVAudioPCMFormatFloat32 sampleRate:OPUS_SAMPLE_RATE interleaved:YES channelLayout:channelLayout];
+
+	double outputSampleRate = SFBOggOpusDecoder.outputSampleRate;
+	if(outputSampleRate > 0 && outputSampleRate != OPUS_SAMPLE_RATE) {
+		_processingFormat = [[AVAudioFormat alloc] initWithCommonFormat:AVAudioPCMFormatFloat32 sampleRate:outputSampleRate interleaved:YES channelLayout:channelLayout];
+
+		_converter = [[AVAudioConverter alloc] initFromFormat:decodingFormat toFormat:_processingFormat];
+		_decodeBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:decodingFormat frameCapacity:BUFFER_SIZE_FRAMES];
+		_resampledBuffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:BUFFER_SIZE_FRAMES];
+		if(!_converter || !_decodeBuffer || !_resampledBuffer) {
+			_converter = nil;
+			_decodeBuffer = nil;
+			_resampledBuffer = nil;
+			op_free(_opusFile);
+			_opusFile = NULL;
+
+			if(error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+			return NO;
+		}
+
+		if(SFBOggOpusDecoder.usesHighQualityResampling) {
+			_converter.sampleRateConverterAlgorithm = AVSampleRateConverterAlgorithm_Mastering;
+			_converter.sampleRateConverterQuality = AVAudioQualityMax;
+		}
+		else {
+			_converter.sampleRateConverterAlgorithm = AVSampleRateConverterAlgorithm_Normal;
+			_converter.sampleRateConverterQuality = AVAudioQualityMin;
+		}
+	}
+	else
+		_processingFormat = decodingFormat;
 
 	// Set up the source format
 	AudioStreamBasicDescription sourceStreamDescription = {0};
@@ -166,6 +308,10 @@ static 	opus_int64 tell_callback(void *stream)
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+	_converter = nil;
+	_decodeBuffer = nil;
+	_resampledBuffer = nil;
+
 	if(_opusFile) {
 		op_free(_opusFile);
 		_opusFile = NULL;
@@ -181,6 +327,9 @@ static 	opus_int64 tell_callback(void *stream)
 
 - (AVAudioFramePosition)framePosition
 {
+	if(_converter)
+		return _framePosition;
+
 	ogg_int64_t framePosition = op_pcm_tell(_opusFile);
 	if(framePosition == OP_EINVAL)
 		return SFB_UNKNOWN_FRAME_POSITION;
@@ -192,6 +341,8 @@ static 	opus_int64 tell_callback(void *stream)
 	ogg_int64_t frameLength = op_pcm_total(_opusFile, -1);
 	if(frameLength == OP_EINVAL)
 		return SFB_UNKNOWN_FRAME_LENGTH;
+	if(_converter)
+		return (AVAudioFramePosition)llround(frameLength * (_processingFormat.sampleRate / OPUS_SAMPLE_RATE));
 	return frameLength;
 }
 
@@ -210,15 +361,51 @@ static 	opus_int64 tell_callback(void *stream)
 	if(frameLength > buffer.frameCapacity)
 		frameLength = buffer.frameCapacity;
 
+	if(_converter)
+		return [self resampleIntoBuffer:buffer frameLength:frameLength error:error];
+
+	if(![self readIntoBuffer:buffer frameLength:frameLength]) {
+		os_log_error(gSFBAudioDecoderLog, "Ogg Opus decoding error");
+		return NO;
+	}
+
+	return YES;
+}
+
+- (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
+{
+	NSParameterAssert(frame >= 0);
+
+	ogg_int64_t opusFrame = frame;
+	if(_converter)
+		opusFrame = (ogg_int64_t)llround(frame * (OPUS_SAMPLE_RATE / _processingFormat.sampleRate));
+
+	if(op_pcm_seek(_opusFile, opusFrame)) {
+		os_log_error(gSFBAudioDecoderLog, "op_pcm_seek() failed");
+		return NO;
+	}
+
+	if(_converter) {
+		[_converter reset];
+		[_resampledBuffer reset];
+		_framePosition = frame;
+	}
+
+	return YES;
+}
+
+/// Appends up to \c frameLength frames at \c OPUS_SAMPLE_RATE to \c buffer
+- (BOOL)readIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength
+{
 	AVAudioFrameCount framesRemaining = frameLength;
 	while(framesRemaining > 0) {
 		// Decode a chunk of samples from the file
-		int framesRead = op_read_float(_opusFile, buffer.floatChannelData[0] + buffer.frameLength, (int)(framesRemaining * buffer.stride), NULL);
+		float *output = buffer.floatChannelData[0] + (buffer.frameLength * buffer.stride);
+		int bufferSize = (int)(framesRemaining * buffer.stride);
+		int framesRead = _downmixesToStereo ? op_read_float_stereo(_opusFile, output, bufferSize) : op_read_float(_opusFile, output, bufferSize, NULL);
 
-		if(framesRead < 0) {
-			os_log_error(gSFBAudioDecoderLog, "Ogg Opus decoding error");
+		if(framesRead < 0)
 			return NO;
-		}
 
 		// 0 frames indicates EOS
 		if(framesRead == 0)
@@ -231,13 +418,50 @@ static 	opus_int64 tell_callback(void *stream)
 	return YES;
 }
 
-- (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
+/// Appends up to \c frameLength frames at the output sample rate to \c buffer
+- (BOOL)resampleIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength error:(NSError **)error
 {
-	NSParameterAssert(frame >= 0);
-	if(op_pcm_seek(_opusFile, frame)) {
-		os_log_error(gSFBAudioDecoderLog, "op_pcm_seek() failed");
-		return NO;
+	while(buffer.frameLength < frameLength) {
+		if(_resampledBuffer.isEmpty) {
+			[_resampledBuffer reset];
+
+			__block BOOL decodeFailed = NO;
+			AVAudioConverterOutputStatus status = [_converter convertToBuffer:_resampledBuffer.buffer error:error withInputFromBlock:^AVAudioBuffer *(AVAudioPacketCount inNumberOfPackets, AVAudioConverterInputStatus *outStatus) {
+				self->_decodeBuffer.frameLength = 0;
+				if(![self readIntoBuffer:self->_decodeBuffer frameLength:MIN(inNumberOfPackets, self->_decodeBuffer.frameCapacity)]) {
+					decodeFailed = YES;
+					*outStatus = AVAudioConverterInputStatus_NoDataNow;
+					return nil;
+				}
+
+				*outStatus = self->_decodeBuffer.frameLength == 0 ? AVAudioConverterInputStatus_EndOfStream : AVAudioConverterInputStatus_HaveData;
+				return self->_decodeBuffer;
+			}];
+
+			if(decodeFailed || status == AVAudioConverterOutputStatus_Error) {
+				os_log_error(gSFBAudioDecoderLog, "Ogg Opus decoding error");
+
+				// The converter supplies its own errors
+				if(decodeFailed && error)
+					*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+													 code:SFBAudioDecoderErrorCodeInputOutput
+							descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid Ogg Opus file.", @"")
+													  url:_inputSource.url
+											failureReason:NSLocalizedString(@"Invalid Ogg Opus audio data", @"")
+									   recoverySuggestion:NSLocalizedString(@"The file may be damaged.", @"")];
+
+				return NO;
+			}
+
+			// EOS
+			if(_resampledBuffer.isEmpty)
+				break;
+		}
+
+		AVAudioFrameCount framesRead = [_resampledBuffer readIntoBuffer:buffer frameLength:(frameLength - buffer.frameLength)];
+		_framePosition += framesRead;
 	}
+
 	return YES;
 }
 
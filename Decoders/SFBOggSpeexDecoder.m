@@ -31,7 +31,7 @@
 @interface SFBOggSpeexDecoder ()
 {
 @private
-	AVAudioPCMBuffer *_buffer;
+	SFBPCMStagingBuffer *_buffer;
 	AVAudioFramePosition _framePosition;
 	AVAudioFramePosition _frameLength;
 
@@ -68,13 +68,31 @@
 	return [NSSet setWithArray:@[@"audio/speex", @"audio/ogg"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// The identification header is the first packet of an Ogg stream
+	if(length >= 27 && !memcmp(bytes, "OggS", 4)) {
+		NSUInteger packetOffset = 27 + bytes[26];
+		if(length >= packetOffset + 8 && !memcmp(bytes + packetOffset, "Speex   ", 8))
+			return SFBAudioDecoderProbeScoreCertain;
+	}
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
+	_framePosition = 0;
 	_frameLength = SFB_UNKNOWN_FRAME_LENGTH;
 	_serialNumber = -1;
+	_eosReached = NO;
+	_oggPacketCount = 0;
 
 	// Initialize Ogg data struct
 	ogg_sync_init(&_syncState);
@@ -269,8 +287,7 @@
 	spx_int32_t speexFrameSize = 0;
 	speex_decoder_ctl(_decoder, SPEEX_GET_FRAME_SIZE, &speexFrameSize);
 
-	_buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:(AVAudioFrameCount)speexFrameSize];
-	_buffer.frameLength = 0;
+	_buffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:(AVAudioFrameCount)speexFrameSize];
 
 	return YES;
 }
@@ -334,8 +351,7 @@
 
 	for(;;) {
 		AVAudioFrameCount framesRemaining = frameLength - framesProcessed;
-		AVAudioFrameCount framesCopied = [buffer appendContentsOfBuffer:_buffer readOffset:0 frameLength:framesRemaining];
-		[_buffer trimAtOffset:0 frameLength:framesCopied];
+		AVAudioFrameCount framesCopied = [_buffer readIntoBuffer:buffer frameLength:framesRemaining];
 
 		framesProcessed += framesCopied;
 
@@ -411,12 +427,12 @@
 							float maxSampleValue = 1u << 15;
 							vDSP_vsdiv(buf, 1, &maxSampleValue, buf, 1, (vDSP_Length)speexFrameSize);
 
-							// Copy the frames from the decoding buffer to the output buffer, skipping over any frames already decoded
+							// Copy the frames from the decoding buffer to the staging buffer
 
-							float * const *floatChannelData = _buffer.floatChannelData;
+							float * const *floatChannelData = _buffer.buffer.floatChannelData;
 
 							const float *input = buf;
-							float *output = floatChannelData[0] + _buffer.frameLength;
+							float *output = floatChannelData[0];
 							memcpy(output, input, (size_t)speexFrameSize * sizeof(float));
 
 							// Process stereo channel, if present
@@ -425,11 +441,11 @@
 								vDSP_vsdiv(buf + speexFrameSize, 1, &maxSampleValue, buf + speexFrameSize, 1, (vDSP_Length)speexFrameSize);
 
 								input = buf + speexFrameSize;
-								output = floatChannelData[1] + _buffer.frameLength;
+								output = floatChannelData[1];
 								memcpy(output, input, (size_t)speexFrameSize * sizeof(float));
 							}
 
-							_buffer.frameLength = (AVAudioFrameCount)speexFrameSize;
+							_buffer.buffer.frameLength = (AVAudioFrameCount)speexFrameSize;
 
 							// Packet processing finished
 							--packetsDesired;
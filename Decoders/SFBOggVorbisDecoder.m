@@ -70,6 +70,8 @@ static long tell_func_callback(void *datasource)
 {
 @private
 	OggVorbis_File _vorbisFile;
+	// Refers to libvorbis's PCM buffers for borrowed decoding
+	AudioBufferList *_borrowedBufferList;
 }
 @end
 
@@ -90,6 +92,21 @@ static long tell_func_callback(void *datasource)
 	return [NSSet setWithObject:@"audio/ogg-vorbis"];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	// The identification header is the first packet of an Ogg stream
+	if(length >= 27 && !memcmp(bytes, "OggS", 4)) {
+		NSUInteger packetOffset = 27 + bytes[26];
+		if(length >= packetOffset + 7 && !memcmp(bytes + packetOffset, "\x01" "vorbis", 7))
+			return SFBAudioDecoderProbeScoreCertain;
+	}
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
@@ -172,11 +189,28 @@ static long tell_func_callback(void *datasource)
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
+	_borrowedBufferList = calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * (size_t)ovInfo->channels));
+	if(!_borrowedBufferList) {
+		if(ov_clear(&_vorbisFile))
+			os_log_error(gSFBAudioDecoderLog, "ov_clear failed");
+
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return NO;
+	}
+
+	_borrowedBufferList->mNumberBuffers = (UInt32)ovInfo->channels;
+	for(UInt32 i = 0; i < _borrowedBufferList->mNumberBuffers; ++i)
+		_borrowedBufferList->mBuffers[i].mNumberChannels = 1;
+
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+	free(_borrowedBufferList);
+	_borrowedBufferList = NULL;
+
 	if(ov_clear(&_vorbisFile))
 		os_log_error(gSFBAudioDecoderLog, "ov_clear failed");
 
@@ -252,6 +286,33 @@ static long tell_func_callback(void *datasource)
 	return YES;
 }
 
+- (BOOL)borrowBufferList:(const AudioBufferList **)bufferList frameLength:(AVAudioFrameCount *)frameLength maximumFrameLength:(AVAudioFrameCount)maximumFrameLength error:(NSError **)error
+{
+	NSParameterAssert(bufferList != NULL);
+	NSParameterAssert(frameLength != NULL);
+	NSParameterAssert(maximumFrameLength > 0);
+
+	// ov_read_float returns pointers to libvorbis's internal buffers, which are lent directly
+	float **pcm_channels = NULL;
+	int bitstream = 0;
+	long framesRead = ov_read_float(&_vorbisFile, &pcm_channels, (int)maximumFrameLength, &bitstream);
+
+	if(framesRead < 0) {
+		os_log_error(gSFBAudioDecoderLog, "Ogg Vorbis decoding error");
+		return NO;
+	}
+
+	for(UInt32 i = 0; i < _borrowedBufferList->mNumberBuffers; ++i) {
+		_borrowedBufferList->mBuffers[i].mData = framesRead > 0 ? pcm_channels[i] : NULL;
+		_borrowedBufferList->mBuffers[i].mDataByteSize = (UInt32)((size_t)framesRead * sizeof(float));
+	}
+
+	*bufferList = _borrowedBufferList;
+	*frameLength = (AVAudioFrameCount)framesRead;
+
+	return YES;
+}
+
 - (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
 {
 	NSParameterAssert(frame >= 0);
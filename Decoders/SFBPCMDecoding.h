@@ -42,6 +42,38 @@ NS_SWIFT_NAME(PCMDecoding) @protocol SFBPCMDecoding <SFBAudioDecoding>
 /// @return \c YES on success, \c NO otherwise
 - (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error NS_SWIFT_NAME(seek(to:));
 
+#pragma mark - Skipping
+
+@optional
+
+/// Skips frames without producing audio
+///
+/// Skipping is equivalent to decoding and discarding \c frameLength frames but is often considerably faster.
+/// \c SFBAudioDecoder implements skipping for all its subclasses, including those that do not support seeking.
+/// Decoders that do not implement this method may be skipped by decoding and discarding audio.
+/// Fewer than \c frameLength frames are skipped if the end of the audio is reached.
+/// @param frameLength The number of frames to skip
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return \c YES on success, \c NO otherwise
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error NS_SWIFT_NAME(skip(_:));
+
+#pragma mark - Borrowed Decoding
+
+@optional
+
+/// Decodes audio into memory owned by the decoder
+///
+/// Decoders whose underlying library produces audio in the processing format lend that audio directly,
+/// avoiding the copy made by \c -decodeIntoBuffer:frameLength:error:.
+/// The lent audio is in the processing format and remains valid only until the next decoding, seeking, skipping, or closing call.
+/// It must not be modified. Fewer than \c maximumFrameLength frames may be lent even if more remain.
+/// @param bufferList On success, set to the lent audio
+/// @param frameLength On success, set to the number of frames in \c bufferList or \c 0 at the end of the audio
+/// @param maximumFrameLength The maximum number of frames to decode, which must be greater than \c 0
+/// @param error An optional pointer to an \c NSError object to receive error information
+/// @return \c YES on success, \c NO otherwise
+- (BOOL)borrowBufferList:(const AudioBufferList * _Nullable * _Nonnull)bufferList frameLength:(AVAudioFrameCount *)frameLength maximumFrameLength:(AVAudioFrameCount)maximumFrameLength error:(NSError **)error NS_REFINED_FOR_SWIFT;
+
 @end
 
 NS_ASSUME_NONNULL_END
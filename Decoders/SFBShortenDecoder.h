@@ -8,7 +8,17 @@
 NS_ASSUME_NONNULL_BEGIN
 
 // An SFBAudioDecoder subclass supporting Shorten
+//
+// Files without an embedded or external seek table are made seekable by a seek index
+// synthesized while decoding, which is cached once it covers the entire file
 @interface SFBShortenDecoder : SFBAudioDecoder
+
+// Whether files without a seek table are scanned in the background when opened to build a complete seek index (default NO)
+@property (class) BOOL prescansForSeekIndex;
+
+// The directory used to cache synthesized seek indexes, or nil to disable caching (defaults to a subdirectory of the user's caches directory)
+@property (class, nullable, copy) NSURL *seekIndexCacheDirectory;
+
 @end
 
 NS_ASSUME_NONNULL_END
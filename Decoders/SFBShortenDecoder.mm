@@ -3,9 +3,13 @@
  * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
  */
 
+#import <os/lock.h>
 #import <os/log.h>
 
 #import <algorithm>
+#import <atomic>
+#import <mutex>
+#import <type_traits>
 #import <vector>
 
 #import "SFBShortenDecoder.h"
@@ -13,6 +17,7 @@
 #import "AVAudioPCMBuffer+SFBBufferUtilities.h"
 #import "ByteStream.h"
 #import "NSError+SFBURLPresentation.h"
+#import "SFBIndexCache.h"
 
 #define MIN_SUPPORTED_VERSION 1
 #define MAX_SUPPORTED_VERSION 3
@@ -59,10 +64,17 @@
 
 #define SEEK_TABLE_REVISION 1
 
+#define SEEK_BUFFER_SIZE  512 /* read buffer size assumed by seek table entries */
 #define SEEK_HEADER_SIZE  12
 #define SEEK_TRAILER_SIZE 12
 #define SEEK_ENTRY_SIZE   80
 
+#define SEEK_INDEX_INTERVAL 256 /* blocks between synthesized seek points */
+
+#define SEEK_INDEX_CACHE_MAGIC       'SHNI'
+#define SEEK_INDEX_CACHE_VERSION     1
+#define SEEK_INDEX_CACHE_HEADER_SIZE 24
+
 #define V2LPCQOFFSET (1 << LPCQUANT)
 
 #define MAX_CHANNELS 8
@@ -94,24 +106,18 @@ namespace {
 	}
 
 	/// Variable-length input using Golomb-Rice coding
+	///
+	/// Bits are consumed from the most significant end of a 64-bit accumulator that is refilled
+	/// eight bytes at a time from a large byte buffer, so the input source is only consulted when
+	/// the byte buffer is exhausted
 	class VariableLengthInput {
 	public:
-		static constexpr uint32_t sMaskTable [] = {
-			0x0,
-			0x1,		0x3,		0x7,		0xf,
-			0x1f,		0x3f,		0x7f,		0xff,
-			0x1ff,		0x3ff,		0x7ff,		0xfff,
-			0x1fff,		0x3fff,		0x7fff,		0xffff,
-			0x1ffff,	0x3ffff,	0x7ffff,	0xfffff,
-			0x1fffff,	0x3fffff,	0x7fffff,	0xffffff,
-			0x1ffffff,	0x3ffffff,	0x7ffffff,	0xfffffff,
-			0x1fffffff,	0x3fffffff,	0x7fffffff,	0xffffffff
-		};
+		/// The default size of the byte buffer
+		static constexpr size_t sDefaultBufferSize = 65536;
 
 		/// Creates a new \c VariableLengthInput object with an internal buffer of the specified size
-		/// @warning Sizes other than \c 512 will break seeking
-		VariableLengthInput(size_t size = 512)
-			: mInputBlock(nil), mSize(size), mBytesAvailable(0), mBitBuffer(0), mBitsAvailable(0)
+		VariableLengthInput(size_t size = sDefaultBufferSize)
+			: mInputSource(nil), mSize(size), mBufferOffset(0), mBytesAvailable(0), mBitBuffer(0), mBitsAvailable(0)
 		{
 			mByteBuffer = new uint8_t [mSize];
 			mByteBufferPosition = mByteBuffer;
@@ -122,54 +128,61 @@ namespace {
 			delete [] mByteBuffer;
 		}
 
-		/// Input callback type
-		using InputBlock = bool(^)(void *buf, size_t len, size_t& read);
+		VariableLengthInput(const VariableLengthInput& rhs) = delete;
+		VariableLengthInput& operator=(const VariableLengthInput& rhs) = delete;
 
-		/// Sets the input callback
-		void SetInputCallback(InputBlock block)
+		/// Sets the input source and resets the reader to its current offset
+		bool SetInputSource(SFBInputSource *inputSource)
 		{
-			mInputBlock = block;
+			mInputSource = inputSource;
+			Reset();
+
+			NSInteger offset;
+			if(![mInputSource getOffset:&offset error:nil])
+				return false;
+			mBufferOffset = offset;
+			return true;
 		}
 
 		/// Reads a single unsigned value from the specified bin
-		bool uvar_get(int32_t& i32, size_t bin)
+		inline bool uvar_get(int32_t& i32, size_t bin)
 		{
-			if(mBitsAvailable == 0) {
-				if(!word_get(mBitBuffer))
+			// Count the leading zeros, which form the unary quotient
+			uint32_t result = 0;
+			for(;;) {
+				if(mBitsAvailable == 0 && !Fill())
 					return false;
-				mBitsAvailable = 32;
-			}
-
-			int32_t result;
-			for(result = 0; !(mBitBuffer & (1L << --mBitsAvailable)); ++result) {
-				if(mBitsAvailable == 0) {
-					if(!word_get(mBitBuffer))
-						return false;
-					mBitsAvailable = 32;
+				if(mBitBuffer) {
+					auto zeros = (unsigned int)__builtin_clzll(mBitBuffer);
+					result += zeros;
+					// Consume the zeros and the terminating one bit
+					mBitBuffer = (mBitBuffer << zeros) << 1;
+					mBitsAvailable -= zeros + 1;
+					break;
 				}
+				// Bits beyond mBitsAvailable are always zero
+				result += mBitsAvailable;
+				mBitBuffer = 0;
+				mBitsAvailable = 0;
 			}
 
-			while(bin != 0) {
-				if(mBitsAvailable >= bin) {
-					result = (result << bin) | (int32_t)((mBitBuffer >> (mBitsAvailable - bin)) & sMaskTable[bin]);
-					mBitsAvailable -= bin;
-					bin = 0;
-				}
-				else {
-					result = (result << mBitsAvailable) | (int32_t)(mBitBuffer & sMaskTable[mBitsAvailable]);
-					bin -= mBitsAvailable;
-					if(!word_get(mBitBuffer))
-						return false;
-					mBitsAvailable = 32;
-				}
+			// Append the binary remainder
+			while(bin > 0) {
+				auto n = std::min(bin, (size_t)32);
+				if(mBitsAvailable < n && !Fill(n))
+					return false;
+				result = (uint32_t)(((uint64_t)result << n) | (mBitBuffer >> (64 - n)));
+				mBitBuffer <<= n;
+				mBitsAvailable -= n;
+				bin -= n;
 			}
 
-			i32 = result;
+			i32 = (int32_t)result;
 			return true;
 		}
 
 		/// Reads a single signed value from the specified bin
-		bool var_get(int32_t& i32, size_t bin)
+		inline bool var_get(int32_t& i32, size_t bin)
 		{
 			int32_t var;
 			if(!uvar_get(var, bin + 1))
@@ -221,61 +234,108 @@ namespace {
 			return (uint32_t)(labs(val) >> nbin) + nbin + 1;
 		}
 
+		/// Returns the position in the input source of the next unread bit
+		int64_t BitPosition() const
+		{
+			return 8 * (int64_t)(mBufferOffset + (mByteBufferPosition - mByteBuffer)) - (int64_t)mBitsAvailable;
+		}
+
+		/// Discards all buffered input
 		void Reset()
 		{
+			mBufferOffset += (mByteBufferPosition - mByteBuffer) + (NSInteger)mBytesAvailable;
 			mByteBufferPosition = mByteBuffer;
 			mBytesAvailable = 0;
+			mBitBuffer = 0;
 			mBitsAvailable = 0;
 		}
 
-		bool Refill()
+		/// Positions the reader at \c byteOffset in the input source with \c bitsAvailable unread bits from \c bitBuffer pending
+		/// @note The unread bits are the low bits of \c bitBuffer, matching the layout of Shorten seek table entries
+		bool SetState(NSInteger byteOffset, uint32_t bitBuffer, uint16_t bitsAvailable)
 		{
-			size_t bytesRead = 0;
-			if(!mInputBlock || !mInputBlock(mByteBuffer, mSize, bytesRead) || bytesRead < 4)
+			if(byteOffset < 0 || bitsAvailable > 32)
 				return false;
-			mBytesAvailable += bytesRead;
+			if(![mInputSource seekToOffset:byteOffset error:nil])
+				return false;
+
 			mByteBufferPosition = mByteBuffer;
+			mBytesAvailable = 0;
+			mBufferOffset = byteOffset;
+
+			mBitsAvailable = bitsAvailable;
+			mBitBuffer = bitsAvailable ? (uint64_t)bitBuffer << (64 - bitsAvailable) : 0;
 			return true;
 		}
 
-		bool SetState(uint16_t byteBufferPosition, uint16_t bytesAvailable, uint32_t bitBuffer, uint16_t bitsAvailable)
+		/// Positions the reader at \c bitPosition in the input source
+		bool SetBitPosition(int64_t bitPosition)
 		{
-			if(byteBufferPosition > mBytesAvailable || bytesAvailable > mBytesAvailable - byteBufferPosition || bitsAvailable > 32)
+			if(bitPosition < 0 || !SetState((NSInteger)(bitPosition / 8), 0, 0))
 				return false;
-			mByteBufferPosition = mByteBuffer + byteBufferPosition;
-			mBytesAvailable = bytesAvailable;
-			mBitBuffer = bitBuffer;
-			mBitsAvailable = bitsAvailable;
+			auto bits = (size_t)(bitPosition % 8);
+			if(bits) {
+				if(!Fill(bits))
+					return false;
+				mBitBuffer <<= bits;
+				mBitsAvailable -= bits;
+			}
 			return true;
 		}
 
 	private:
-		/// Input callback
-		InputBlock mInputBlock;
+		/// Input source
+		SFBInputSource *mInputSource;
 		/// Size of \c mByteBuffer in bytes
 		size_t mSize;
 		/// Byte buffer
 		uint8_t *mByteBuffer;
+		/// Offset in the input source of \c mByteBuffer[0]
+		NSInteger mBufferOffset;
 		/// Current position in \c mByteBuffer
 		uint8_t *mByteBufferPosition;
 		/// Bytes available in \c mByteBuffer
 		size_t mBytesAvailable;
-		/// Bit buffer
-		uint32_t mBitBuffer;
-		/// Bits available in \c mBuffer
+		/// Bit buffer, with unread bits in the most significant positions and zeros below
+		uint64_t mBitBuffer;
+		/// Bits available in \c mBitBuffer
 		size_t mBitsAvailable;
 
-		/// Reads a single \c uint32_t from the byte buffer, refilling if necessary
-		bool word_get(uint32_t& ui32)
+		/// Reads the next block of input into the byte buffer
+		bool Refill()
 		{
-			if(mBytesAvailable < 4 && !Refill())
-				return false;
-
-			ui32 = (uint32_t)((((int32_t)mByteBufferPosition[0]) << 24) | (((int32_t)mByteBufferPosition[1]) << 16) | (((int32_t)mByteBufferPosition[2]) << 8) | ((int32_t)mByteBufferPosition[3]));
+			mBufferOffset += mByteBufferPosition - mByteBuffer;
+			mByteBufferPosition = mByteBuffer;
 
-			mByteBufferPosition += 4;
-			mBytesAvailable -= 4;
+			NSInteger bytesRead;
+			if(![mInputSource readBytes:mByteBuffer length:(NSInteger)mSize bytesRead:&bytesRead error:nil] || bytesRead <= 0)
+				return false;
+			mBytesAvailable = (size_t)bytesRead;
+			return true;
+		}
 
+		/// Moves bytes into the bit buffer until at least \c count bits are available or input is exhausted
+		inline bool Fill(size_t count = 1)
+		{
+			while(mBitsAvailable < count) {
+				if(mBytesAvailable >= 8) {
+					// Load as many whole bytes as fit and clear any bits beyond them
+					uint64_t word = OSReadBigInt64(mByteBufferPosition, 0);
+					auto bytes = (63 - mBitsAvailable) >> 3;
+					auto bits = mBitsAvailable + 8 * bytes;
+					mBitBuffer |= (word >> mBitsAvailable) & ~(~UINT64_C(0) >> bits);
+					mBitsAvailable = bits;
+					mByteBufferPosition += bytes;
+					mBytesAvailable -= bytes;
+				}
+				else if(mBytesAvailable > 0) {
+					mBitBuffer |= (uint64_t)*mByteBufferPosition++ << (56 - mBitsAvailable);
+					mBitsAvailable += 8;
+					--mBytesAvailable;
+				}
+				else if(!Refill())
+					return false;
+			}
 			return true;
 		}
 
@@ -373,6 +433,151 @@ namespace {
 		});
 		return it == begin ? end : --it;
 	}
+
+	/// A seek index synthesized from decoder state captured at regular block intervals
+	///
+	/// Each point holds everything needed to resume decoding at the start of a block: the bit position,
+	/// the bitshift and block size in effect, and for each channel the sample history and running means
+	struct SeekIndex
+	{
+		/// A point in the index
+		struct Point
+		{
+			/// The frame number of the first frame in the block
+			AVAudioFramePosition mFrameNumber;
+			/// The offset in bits of the block in the input source
+			int64_t mBitPosition;
+			/// The bitshift in effect
+			int32_t mBitshift;
+			/// The block size in effect
+			int32_t mBlocksize;
+		};
+
+		/// Discards all points and sets the state layout
+		void Reset(size_t channels, size_t historySize, size_t meanSize)
+		{
+			mChannels = channels;
+			mHistorySize = historySize;
+			mMeanSize = meanSize;
+			mPoints.clear();
+			mState.clear();
+			mComplete = false;
+		}
+
+		/// Returns the number of \c int32_t values of state per point
+		size_t StateSize() const
+		{
+			return mChannels * (mHistorySize + mMeanSize);
+		}
+
+		/// Returns the state for the point at \c index
+		const int32_t * State(size_t index) const
+		{
+			return mState.data() + index * StateSize();
+		}
+
+		/// Returns the index of the last point at or before \c frame or \c SIZE_MAX if none
+		size_t Find(AVAudioFramePosition frame) const
+		{
+			auto it = std::upper_bound(mPoints.cbegin(), mPoints.cend(), frame, [](AVAudioFramePosition value, const Point& point) {
+				return value < point.mFrameNumber;
+			});
+			return it == mPoints.cbegin() ? SIZE_MAX : (size_t)std::distance(mPoints.cbegin(), it) - 1;
+		}
+
+		/// The number of channels
+		size_t mChannels = 0;
+		/// The number of samples of history per channel
+		size_t mHistorySize = 0;
+		/// The number of running means per channel
+		size_t mMeanSize = 0;
+		/// The points, one every \c SEEK_INDEX_INTERVAL blocks
+		std::vector<Point> mPoints;
+		/// The state for each point
+		std::vector<int32_t> mState;
+		/// \c true if the index covers the entire file
+		bool mComplete = false;
+	};
+
+	template <typename T>
+	void AppendLE(NSMutableData *data, T value)
+	{
+		static_assert(std::is_unsigned<T>::value, "Unsigned type required");
+		switch(sizeof(T)) {
+			case 4:	value = (T)OSSwapHostToLittleInt32(value);	break;
+			case 8:	value = (T)OSSwapHostToLittleInt64(value);	break;
+		}
+		[data appendBytes:&value length:sizeof(T)];
+	}
+
+	/// Writes \c index to \c cacheURL
+	bool WriteSeekIndex(const SeekIndex& index, NSURL *cacheURL, NSURL *url)
+	{
+		NSMutableData *data = [NSMutableData dataWithCapacity:SEEK_INDEX_CACHE_HEADER_SIZE + index.mPoints.size() * (24 + 4 * index.StateSize())];
+		AppendLE(data, (uint32_t)index.mChannels);
+		AppendLE(data, (uint32_t)index.mHistorySize);
+		AppendLE(data, (uint32_t)index.mMeanSize);
+		AppendLE(data, (uint32_t)SEEK_INDEX_INTERVAL);
+		AppendLE(data, (uint64_t)index.mPoints.size());
+
+		for(size_t i = 0; i < index.mPoints.size(); ++i) {
+			const auto& point = index.mPoints[i];
+			AppendLE(data, (uint64_t)point.mFrameNumber);
+			AppendLE(data, (uint64_t)point.mBitPosition);
+			AppendLE(data, (uint32_t)point.mBitshift);
+			AppendLE(data, (uint32_t)point.mBlocksize);
+			const int32_t *state = index.State(i);
+			for(size_t j = 0; j < index.StateSize(); ++j)
+				AppendLE(data, (uint32_t)state[j]);
+		}
+
+		NSError *error = nil;
+		if(!SFBWriteIndexCache(cacheURL, url, SEEK_INDEX_CACHE_MAGIC, SEEK_INDEX_CACHE_VERSION, data, &error)) {
+			os_log_error(gSFBAudioDecoderLog, "Error writing Shorten seek index cache: %{public}@", error);
+			return false;
+		}
+
+		return true;
+	}
+
+	/// Reads a complete seek index for \c url from \c cacheURL into \c index, whose layout must already be set
+	bool ReadSeekIndex(SeekIndex& index, NSURL *cacheURL, NSURL *url)
+	{
+		NSData *data = SFBReadIndexCache(cacheURL, url, SEEK_INDEX_CACHE_MAGIC, SEEK_INDEX_CACHE_VERSION);
+		if(data.length < SEEK_INDEX_CACHE_HEADER_SIZE)
+			return false;
+
+		SFB::ByteStream byteStream(data.bytes, data.length);
+		if(byteStream.ReadLE<uint32_t>() != index.mChannels || byteStream.ReadLE<uint32_t>() != index.mHistorySize || byteStream.ReadLE<uint32_t>() != index.mMeanSize || byteStream.ReadLE<uint32_t>() != SEEK_INDEX_INTERVAL)
+			return false;
+
+		auto count = byteStream.ReadLE<uint64_t>();
+		if(count == 0 || count > byteStream.Remaining() / (24 + 4 * index.StateSize()))
+			return false;
+
+		std::vector<SeekIndex::Point> points;
+		std::vector<int32_t> state;
+		points.reserve((size_t)count);
+		state.reserve((size_t)count * index.StateSize());
+		for(uint64_t i = 0; i < count; ++i) {
+			SeekIndex::Point point;
+			point.mFrameNumber = (AVAudioFramePosition)byteStream.ReadLE<uint64_t>();
+			point.mBitPosition = (int64_t)byteStream.ReadLE<uint64_t>();
+			point.mBitshift = (int32_t)byteStream.ReadLE<uint32_t>();
+			point.mBlocksize = (int32_t)byteStream.ReadLE<uint32_t>();
+			if(point.mBitshift < 0 || point.mBitshift > 32 || point.mBlocksize <= 0 || point.mBlocksize > MAX_BLOCKSIZE || (!points.empty() && point.mFrameNumber <= points.back().mFrameNumber))
+				return false;
+			points.push_back(point);
+			for(size_t j = 0; j < index.StateSize(); ++j)
+				state.push_back((int32_t)byteStream.ReadLE<uint32_t>());
+		}
+
+		index.mPoints = std::move(points);
+		index.mState = std::move(state);
+		index.mComplete = true;
+
+		return true;
+	}
 }
 
 @interface SFBShortenDecoder ()
@@ -399,9 +604,17 @@ namespace {
 	bool _eos;
 	std::vector<SeekTableEntry> _seekTableEntries;
 
-	AVAudioPCMBuffer *_frameBuffer;
+	SeekIndex _seekIndex;
+	std::mutex _seekIndexLock;
+	NSURL *_seekIndexCacheURL;
+	dispatch_group_t _prescanGroup;
+	std::atomic_bool _cancelPrescan;
+	BOOL _isPrescanner;
+
+	SFBPCMStagingBuffer *_frameBuffer;
 	AVAudioFramePosition _framePosition;
 	AVAudioFramePosition _frameLength;
+	AVAudioFramePosition _blockFramePosition;
 	uint64_t _blocksDecoded;
 }
 - (BOOL)parseShortenHeaderReturningError:(NSError **)error;
@@ -411,8 +624,20 @@ namespace {
 - (BOOL)scanForSeekTableReturningError:(NSError **)error;
 - (std::vector<SeekTableEntry>)parseExternalSeekTable:(NSURL *)url;
 - (BOOL)seekTableIsValid:(std::vector<SeekTableEntry>)entries startOffset:(NSInteger)startOffset;
+- (void)setupSeekIndex;
+- (void)addSeekIndexPoint;
+- (BOOL)restoreSeekIndexPoint:(size_t)index;
+- (void)seekIndexCompleted;
+- (void)prescanSeekIndex;
+- (BOOL)seekUsingSeekTableToFrame:(AVAudioFramePosition)frame error:(NSError **)error;
+- (BOOL)seekUsingSeekIndexToFrame:(AVAudioFramePosition)frame error:(NSError **)error;
 @end
 
+// The class properties may be set from any thread
+static std::atomic<bool> sPrescansForSeekIndex{false};
+static os_unfair_lock sSeekIndexCacheDirectoryLock = OS_UNFAIR_LOCK_INIT;
+static NSURL *sSeekIndexCacheDirectory = nil;
+
 @implementation SFBShortenDecoder
 
 + (void)load
@@ -430,9 +655,72 @@ namespace {
 	return [NSSet setWithObject:@"audio/x-shorten"];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	if(length >= 4 && !memcmp(bytes, "ajkg", 4))
+		return SFBAudioDecoderProbeScoreCertain;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
++ (BOOL)prescansForSeekIndex
+{
+	return sPrescansForSeekIndex.load();
+}
+
++ (void)setPrescansForSeekIndex:(BOOL)prescansForSeekIndex
+{
+	sPrescansForSeekIndex.store(prescansForSeekIndex);
+}
+
++ (NSURL *)seekIndexCacheDirectory
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		NSURL *cachesDirectory = [[NSFileManager defaultManager] URLForDirectory:NSCachesDirectory inDomain:NSUserDomainMask appropriateForURL:nil create:NO error:nil];
+		NSURL *defaultDirectory = [cachesDirectory URLByAppendingPathComponent:@"org.sbooth.AudioEngine/ShortenSeekIndex" isDirectory:YES];
+		os_unfair_lock_lock(&sSeekIndexCacheDirectoryLock);
+		sSeekIndexCacheDirectory = defaultDirectory;
+		os_unfair_lock_unlock(&sSeekIndexCacheDirectoryLock);
+	});
+
+	os_unfair_lock_lock(&sSeekIndexCacheDirectoryLock);
+	NSURL *seekIndexCacheDirectory = sSeekIndexCacheDirectory;
+	os_unfair_lock_unlock(&sSeekIndexCacheDirectoryLock);
+	return seekIndexCacheDirectory;
+}
+
++ (void)setSeekIndexCacheDirectory:(NSURL *)seekIndexCacheDirectory
+{
+	// Ensure the default is not applied later
+	[self seekIndexCacheDirectory];
+	NSURL *directory = [seekIndexCacheDirectory copy];
+	os_unfair_lock_lock(&sSeekIndexCacheDirectoryLock);
+	sSeekIndexCacheDirectory = directory;
+	os_unfair_lock_unlock(&sSeekIndexCacheDirectoryLock);
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
-	if(![super openReturningError:error] || ![self parseShortenHeaderReturningError:error])
+	if(![super openReturningError:error])
+		return NO;
+
+	// Discard state from a previous input source if the decoder was reopened
+	_framePosition = 0;
+	_blockFramePosition = 0;
+	_blocksDecoded = 0;
+	_eos = false;
+	_seekTableEntries.clear();
+	_seekIndexCacheURL = nil;
+	{
+		std::lock_guard<std::mutex> lock(_seekIndexLock);
+		_seekIndex.Reset(0, 0, 0);
+	}
+
+	if(![self parseShortenHeaderReturningError:error])
 		return NO;
 
 	// Sanity checks
@@ -508,7 +796,7 @@ namespace {
 
 	_sourceFormat = [[AVAudioFormat alloc] initWithStreamDescription:&sourceStreamDescription];
 
-	_frameBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:(AVAudioFrameCount)_blocksize];
+	_frameBuffer = [[SFBPCMStagingBuffer alloc] initWithPCMFormat:_processingFormat frameCapacity:(AVAudioFrameCount)_blocksize];
 
 	// Allocate decoding buffers
 	_buffer = AllocateContiguous2DArray<int32_t>((size_t)_nchan, (size_t)(_blocksize + _nwrap));
@@ -555,11 +843,20 @@ namespace {
 		}
 	}
 
+	if(_seekTableEntries.empty() && _inputSource.supportsSeeking)
+		[self setupSeekIndex];
+
 	return YES;
 }
 
 - (BOOL)closeReturningError:(NSError **)error
 {
+	if(_prescanGroup) {
+		_cancelPrescan = true;
+		dispatch_group_wait(_prescanGroup, DISPATCH_TIME_FOREVER);
+		_prescanGroup = nil;
+	}
+
 	if(_buffer) {
 		free(_buffer);
 		_buffer = nullptr;
@@ -610,8 +907,7 @@ namespace {
 
 	for(;;) {
 		AVAudioFrameCount framesRemaining = frameLength - framesProcessed;
-		AVAudioFrameCount framesCopied = [buffer appendContentsOfBuffer:_frameBuffer readOffset:0 frameLength:framesRemaining];
-		[_frameBuffer trimAtOffset:0 frameLength:framesCopied];
+		AVAudioFrameCount framesCopied = [_frameBuffer readIntoBuffer:buffer frameLength:framesRemaining];
 
 		framesProcessed += framesCopied;
 
@@ -631,7 +927,7 @@ namespace {
 
 - (BOOL)supportsSeeking
 {
-	return !_seekTableEntries.empty();
+	return !_seekTableEntries.empty() || _inputSource.supportsSeeking;
 }
 
 - (BOOL)seekToFrame:(AVAudioFramePosition)frame error:(NSError **)error
@@ -641,6 +937,44 @@ namespace {
 	if(frame >= self.frameLength)
 		return NO;
 
+	if(!_seekTableEntries.empty())
+		return [self seekUsingSeekTableToFrame:frame error:error];
+	return [self seekUsingSeekIndexToFrame:frame error:error];
+}
+
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+
+	if(self.supportsSeeking)
+		return [super skipFrames:frameLength error:error];
+
+	// Without seeking, decode blocks in place but skip copying them out
+	AVAudioFramePosition framesSkipped = 0;
+
+	for(;;) {
+		auto framesToTrim = [_frameBuffer skipFrames:(AVAudioFrameCount)std::min(frameLength - framesSkipped, (AVAudioFramePosition)_frameBuffer.frameLength)];
+
+		framesSkipped += framesToTrim;
+
+		// All requested frames were skipped or EOS reached
+		if(framesSkipped == frameLength || _eos)
+			break;
+
+		// Decode the next _blocksize frames
+		if(![self decodeBlockReturningError:error]) {
+			os_log_error(gSFBAudioDecoderLog, "Error decoding Shorten block");
+			return NO;
+		}
+	}
+
+	_framePosition += framesSkipped;
+
+	return YES;
+}
+
+- (BOOL)seekUsingSeekTableToFrame:(AVAudioFramePosition)frame error:(NSError **)error
+{
 	auto entry = FindSeekTableEntry(_seekTableEntries.cbegin(), _seekTableEntries.cend(), frame);
 	if(entry == _seekTableEntries.end()) {
 		os_log_error(gSFBAudioDecoderLog, "No seek table entry for frame %lld", frame);
@@ -651,11 +985,8 @@ namespace {
 	os_log_debug(gSFBAudioDecoderLog, "Using seek table entry %ld for frame %d to seek to frame %lld", std::distance(_seekTableEntries.cbegin(), entry), entry->mFrameNumber, frame);
 #endif
 
-	if(![_inputSource seekToOffset:entry->mLastBufferReadPosition error:error])
-		return NO;
-
-	_input.Reset();
-	if(!_input.Refill() || !_input.SetState(entry->mByteBufferPosition, entry->mBytesAvailable, entry->mBitBuffer, entry->mBitBufferPosition))
+	// The entry describes a SEEK_BUFFER_SIZE read buffer; only the offset of the next unread byte matters
+	if(!_input.SetState((NSInteger)entry->mLastBufferReadPosition + entry->mByteBufferPosition, entry->mBitBuffer, entry->mBitBufferPosition))
 		return NO;
 
 	_buffer[0][-1] = entry->mCBuf0[0];
@@ -676,7 +1007,8 @@ namespace {
 	_bitshift = entry->mBitshift;
 
 	_framePosition = entry->mFrameNumber;
-	_frameBuffer.frameLength = 0;
+	[_frameBuffer reset];
+	_eos = false;
 
 	AVAudioFrameCount framesToSkip = (AVAudioFrameCount)(frame - entry->mFrameNumber);
 	AVAudioFrameCount framesSkipped = 0;
@@ -686,14 +1018,60 @@ namespace {
 		if(![self decodeBlockReturningError:error])
 			os_log_error(gSFBAudioDecoderLog, "Error decoding Shorten block");
 
-		AVAudioFrameCount framesToTrim = std::min(framesToSkip - framesSkipped, _frameBuffer.frameLength);
-		[_frameBuffer trimAtOffset:0 frameLength:framesToTrim];
+		AVAudioFrameCount framesToTrim = [_frameBuffer skipFrames:framesToSkip - framesSkipped];
+
+		framesSkipped += framesToTrim;
+
+		// All requested frames were skipped or EOS reached
+		if(framesSkipped == framesToSkip || _eos)
+			break;
+	}
+
+	_framePosition += framesSkipped;
+
+	return YES;
+}
+
+- (BOOL)seekUsingSeekIndexToFrame:(AVAudioFramePosition)frame error:(NSError **)error
+{
+	size_t index;
+	AVAudioFramePosition indexFrame;
+	{
+		std::lock_guard<std::mutex> lock(_seekIndexLock);
+		index = _seekIndex.Find(frame);
+		if(index == SIZE_MAX) {
+			os_log_error(gSFBAudioDecoderLog, "No seek index point for frame %lld", frame);
+			return NO;
+		}
+		indexFrame = _seekIndex.mPoints[index].mFrameNumber;
+	}
+
+	// Resume from the index unless decoding is already between the index point and the target
+	if(frame < _framePosition || indexFrame >= _blockFramePosition) {
+#if DEBUG
+		os_log_debug(gSFBAudioDecoderLog, "Using seek index point %zu for frame %lld to seek to frame %lld", index, indexFrame, frame);
+#endif
+		if(![self restoreSeekIndexPoint:index])
+			return NO;
+	}
+
+	auto framesToSkip = frame - _framePosition;
+	AVAudioFramePosition framesSkipped = 0;
+
+	for(;;) {
+		auto framesToTrim = [_frameBuffer skipFrames:(AVAudioFrameCount)std::min(framesToSkip - framesSkipped, (AVAudioFramePosition)_frameBuffer.frameLength)];
 
 		framesSkipped += framesToTrim;
 
 		// All requested frames were skipped or EOS reached
 		if(framesSkipped == framesToSkip || _eos)
 			break;
+
+		// Decode the next _blocksize frames
+		if(![self decodeBlockReturningError:error]) {
+			os_log_error(gSFBAudioDecoderLog, "Error decoding Shorten block");
+			return NO;
+		}
 	}
 
 	_framePosition += framesSkipped;
@@ -734,14 +1112,17 @@ namespace {
 	// Default nmean
 	_nmean = _version < 2 ? DEFAULT_V0NMEAN : DEFAULT_V2NMEAN;
 
-	// Set up variable length reading callback
-	_input.SetInputCallback(^bool(void *buf, size_t len, size_t &read) {
-		NSInteger bytesRead;
-		if(![self->_inputSource readBytes:buf length:(NSInteger)len bytesRead:&bytesRead error:nil])
-			return false;
-		read = (size_t)bytesRead;
-		return true;
-	});
+	// Set up variable length reading
+	if(!_input.SetInputSource(_inputSource)) {
+		if(error)
+			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
+											 code:SFBAudioDecoderErrorCodeInputOutput
+					descriptionFormatStringForURL:NSLocalizedString(@"The file “%@” is not a valid Shorten file.", @"")
+											  url:_inputSource.url
+									failureReason:NSLocalizedString(@"Not a valid Shorten file", @"")
+							   recoverySuggestion:NSLocalizedString(@"The file's extension may not match the file's type.", @"")];
+		return NO;
+	}
 
 	// Read internal file type
 	uint32_t ftype;
@@ -1110,6 +1491,9 @@ namespace {
 
 - (BOOL)decodeBlockReturningError:(NSError **)error
 {
+	if(_blocksDecoded % SEEK_INDEX_INTERVAL == 0 && _seekTableEntries.empty() && _inputSource.supportsSeeking)
+		[self addSeekIndexPoint];
+
 	int chan = 0;
 	for(;;) {
 		int32_t cmd;
@@ -1126,6 +1510,8 @@ namespace {
 
 		if(cmd == FN_QUIT) {
 			_eos = true;
+			if(_seekTableEntries.empty() && _inputSource.supportsSeeking)
+				[self seekIndexCompleted];
 			return YES;
 		}
 
@@ -1325,60 +1711,62 @@ namespace {
 				}
 
 				if(chan == _nchan - 1) {
+					[_frameBuffer reset];
 					switch(_internal_ftype) {
 						case TYPE_U8:
 						{
-							auto abl = _frameBuffer.audioBufferList;
+							auto abl = _frameBuffer.buffer.audioBufferList;
 							for(auto channel = 0; channel < _nchan; ++channel) {
 								auto channel_buf = (uint8_t *)abl->mBuffers[channel].mData;
 								for(auto sample = 0; sample < _blocksize; ++sample) {
 									channel_buf[sample] = (uint8_t)clip(_buffer[channel][sample], 0, UINT8_MAX);
 								}
 							}
-							_frameBuffer.frameLength = (AVAudioFrameCount)_blocksize;
+							_frameBuffer.buffer.frameLength = (AVAudioFrameCount)_blocksize;
 							break;
 						}
 						case TYPE_S8:
 						{
-							auto abl = _frameBuffer.audioBufferList;
+							auto abl = _frameBuffer.buffer.audioBufferList;
 							for(auto channel = 0; channel < _nchan; ++channel) {
 								auto channel_buf = (int8_t *)abl->mBuffers[channel].mData;
 								for(auto sample = 0; sample < _blocksize; ++sample) {
 									channel_buf[sample] = (int8_t)clip(_buffer[channel][sample], INT8_MIN, INT8_MAX);
 								}
 							}
-							_frameBuffer.frameLength = (AVAudioFrameCount)_blocksize;
+							_frameBuffer.buffer.frameLength = (AVAudioFrameCount)_blocksize;
 							break;
 						}
 						case TYPE_U16HL:
 						case TYPE_U16LH:
 						{
-							auto abl = _frameBuffer.audioBufferList;
+							auto abl = _frameBuffer.buffer.audioBufferList;
 							for(auto channel = 0; channel < _nchan; ++channel) {
 								auto channel_buf = (uint16_t *)abl->mBuffers[channel].mData;
 								for(auto sample = 0; sample < _blocksize; ++sample) {
 									channel_buf[sample] = (uint16_t)clip(_buffer[channel][sample], 0, UINT16_MAX);
 								}
 							}
-							_frameBuffer.frameLength = (AVAudioFrameCount)_blocksize;
+							_frameBuffer.buffer.frameLength = (AVAudioFrameCount)_blocksize;
 							break;
 						}
 						case TYPE_S16HL:
 						case TYPE_S16LH:
 						{
-							auto abl = _frameBuffer.audioBufferList;
+							auto abl = _frameBuffer.buffer.audioBufferList;
 							for(auto channel = 0; channel < _nchan; ++channel) {
 								auto channel_buf = (int16_t *)abl->mBuffers[channel].mData;
 								for(auto sample = 0; sample < _blocksize; ++sample) {
 									channel_buf[sample] = (int16_t)clip(_buffer[channel][sample], INT16_MIN, INT16_MAX);
 								}
 							}
-							_frameBuffer.frameLength = (AVAudioFrameCount)_blocksize;
+							_frameBuffer.buffer.frameLength = (AVAudioFrameCount)_blocksize;
 							break;
 						}
 					}
 
 					++_blocksDecoded;
+					_blockFramePosition += _frameBuffer.frameLength;
 					return YES;
 				}
 				chan = (chan + 1) % _nchan;
@@ -1468,12 +1856,21 @@ namespace {
 	if(!_inputSource.supportsSeeking)
 		return YES;
 
-	NSInteger startOffset;
-	if(![_inputSource getOffset:&startOffset error:error])
+	NSInteger inputOffset;
+	if(![_inputSource getOffset:&inputOffset error:error])
 		return NO;
 
 	NSInteger fileLength;
-	if(![_inputSource getLength:&fileLength error:error] || ![_inputSource seekToOffset:(fileLength - SEEK_TRAILER_SIZE) error:error])
+	if(![_inputSource getLength:&fileLength error:error])
+		return NO;
+
+	// Seek tables record the offset reached by a reader consuming 32-bit words in SEEK_BUFFER_SIZE reads
+	// following the magic number and version
+	auto wordsConsumed = (_input.BitPosition() - 8 * 5 + 31) / 32;
+	auto buffersRead = (4 * wordsConsumed + SEEK_BUFFER_SIZE - 1) / SEEK_BUFFER_SIZE;
+	auto startOffset = std::min((NSInteger)(5 + SEEK_BUFFER_SIZE * buffersRead), fileLength);
+
+	if(![_inputSource seekToOffset:(fileLength - SEEK_TRAILER_SIZE) error:error])
 		return NO;
 
 	SeekTableTrailer trailer;
@@ -1512,7 +1909,7 @@ namespace {
 	// A corrupt seek table is an error, however YES is returned to try and permit decoding to continue
 	if(memcmp("SEEK", header.mSignature, 4)) {
 		os_log_error(gSFBAudioDecoderLog, "Unexpected seek table header signature: %{public}.4s", header.mSignature);
-		if(![_inputSource seekToOffset:startOffset error:error])
+		if(![_inputSource seekToOffset:inputOffset error:error])
 			return NO;
 		return YES;
 	}
@@ -1531,7 +1928,7 @@ namespace {
 	}
 
 	// Reset file marker
-	if(![_inputSource seekToOffset:startOffset error:error])
+	if(![_inputSource seekToOffset:inputOffset error:error])
 		return NO;
 
 	if(!entries.empty() && [self seekTableIsValid:entries startOffset:startOffset])
@@ -1614,4 +2011,151 @@ namespace {
 	return YES;
 }
 
+- (void)setupSeekIndex
+{
+	{
+		std::lock_guard<std::mutex> lock(_seekIndexLock);
+		_seekIndex.Reset((size_t)_nchan, (size_t)_nwrap, (size_t)std::max(1, _nmean));
+	}
+
+	[self addSeekIndexPoint];
+
+	// The prescanner only needs the index it builds itself
+	if(_isPrescanner)
+		return;
+
+	_seekIndexCacheURL = SFBIndexCacheURL([SFBShortenDecoder seekIndexCacheDirectory], _inputSource.url, @"shnidx");
+	if(_seekIndexCacheURL) {
+		SeekIndex cached;
+		cached.Reset(_seekIndex.mChannels, _seekIndex.mHistorySize, _seekIndex.mMeanSize);
+		if(ReadSeekIndex(cached, _seekIndexCacheURL, _inputSource.url)) {
+			std::lock_guard<std::mutex> lock(_seekIndexLock);
+			// The first point is fully determined by the header so it must match
+			if(cached.mPoints[0].mBitPosition == _seekIndex.mPoints[0].mBitPosition && std::equal(_seekIndex.mState.cbegin(), _seekIndex.mState.cend(), cached.mState.cbegin())) {
+				_seekIndex = std::move(cached);
+				return;
+			}
+			os_log_info(gSFBAudioDecoderLog, "Ignoring mismatched Shorten seek index cache for %{public}@", _inputSource.url);
+		}
+	}
+
+	if(SFBShortenDecoder.prescansForSeekIndex)
+		[self prescanSeekIndex];
+}
+
+- (void)addSeekIndexPoint
+{
+	std::lock_guard<std::mutex> lock(_seekIndexLock);
+
+	// Points are only added in order while decoding sequentially from a known point
+	if(_seekIndex.mComplete || _seekIndex.mPoints.size() * SEEK_INDEX_INTERVAL != _blocksDecoded)
+		return;
+
+	_seekIndex.mPoints.push_back({ _blockFramePosition, _input.BitPosition(), _bitshift, _blocksize });
+
+	for(auto chan = 0; chan < _nchan; ++chan)
+		_seekIndex.mState.insert(_seekIndex.mState.end(), _buffer[chan] - _nwrap, _buffer[chan]);
+	for(auto chan = 0; chan < _nchan; ++chan)
+		_seekIndex.mState.insert(_seekIndex.mState.end(), _offset[chan], _offset[chan] + _seekIndex.mMeanSize);
+}
+
+- (BOOL)restoreSeekIndexPoint:(size_t)index
+{
+	SeekIndex::Point point;
+	std::vector<int32_t> state;
+	{
+		std::lock_guard<std::mutex> lock(_seekIndexLock);
+		point = _seekIndex.mPoints[index];
+		state.assign(_seekIndex.State(index), _seekIndex.State(index) + _seekIndex.StateSize());
+	}
+
+	if(!_input.SetBitPosition(point.mBitPosition))
+		return NO;
+
+	auto iter = state.cbegin();
+	for(auto chan = 0; chan < _nchan; ++chan) {
+		std::copy(iter, iter + _nwrap, _buffer[chan] - _nwrap);
+		iter += _nwrap;
+	}
+	auto meanSize = std::max(1, _nmean);
+	for(auto chan = 0; chan < _nchan; ++chan) {
+		std::copy(iter, iter + meanSize, _offset[chan]);
+		iter += meanSize;
+	}
+
+	_bitshift = point.mBitshift;
+	_blocksize = point.mBlocksize;
+
+	_blocksDecoded = index * SEEK_INDEX_INTERVAL;
+	_blockFramePosition = point.mFrameNumber;
+	_framePosition = point.mFrameNumber;
+	[_frameBuffer reset];
+	_eos = false;
+
+	return YES;
+}
+
+- (void)seekIndexCompleted
+{
+	std::lock_guard<std::mutex> lock(_seekIndexLock);
+
+	// The index is complete only if it holds a point for every interval
+	auto expectedPoints = std::max((uint64_t)1, (_blocksDecoded + SEEK_INDEX_INTERVAL - 1) / SEEK_INDEX_INTERVAL);
+	if(_seekIndex.mComplete || _seekIndex.mPoints.size() != expectedPoints)
+		return;
+
+	_seekIndex.mComplete = true;
+	if(_seekIndexCacheURL)
+		WriteSeekIndex(_seekIndex, _seekIndexCacheURL, _inputSource.url);
+}
+
+- (void)prescanSeekIndex
+{
+	NSURL *url = _inputSource.url;
+	if(!url)
+		return;
+
+	_cancelPrescan = false;
+	_prescanGroup = dispatch_group_create();
+	dispatch_group_async(_prescanGroup, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+		NSError *error = nil;
+		SFBInputSource *inputSource = [SFBInputSource inputSourceForURL:url flags:0 error:&error];
+		if(!inputSource) {
+			os_log_error(gSFBAudioDecoderLog, "Error creating input source for Shorten seek index prescan: %{public}@", error);
+			return;
+		}
+
+		SFBShortenDecoder *prescanner = [[SFBShortenDecoder alloc] initWithInputSource:inputSource error:&error];
+		if(!prescanner) {
+			os_log_error(gSFBAudioDecoderLog, "Error creating decoder for Shorten seek index prescan: %{public}@", error);
+			return;
+		}
+
+		prescanner->_isPrescanner = YES;
+		if(![prescanner openReturningError:&error]) {
+			os_log_error(gSFBAudioDecoderLog, "Error opening Shorten file for seek index prescan: %{public}@", error);
+			return;
+		}
+
+		while(!prescanner->_eos && !self->_cancelPrescan) {
+			if(![prescanner decodeBlockReturningError:&error]) {
+				os_log_error(gSFBAudioDecoderLog, "Error decoding Shorten block during seek index prescan: %{public}@", error);
+				break;
+			}
+		}
+
+		if(prescanner->_seekIndex.mComplete) {
+			std::lock_guard<std::mutex> lock(self->_seekIndexLock);
+			// Points are deterministic so the prescanned index is a superset of any index built while decoding
+			if(!self->_seekIndex.mComplete) {
+				self->_seekIndex = std::move(prescanner->_seekIndex);
+				if(self->_seekIndexCacheURL)
+					WriteSeekIndex(self->_seekIndex, self->_seekIndexCacheURL, url);
+			}
+		}
+
+		[prescanner closeReturningError:nil];
+	});
+}
+
 @end
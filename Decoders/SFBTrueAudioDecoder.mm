@@ -5,7 +5,9 @@
 
 #import <os/log.h>
 
+#import <algorithm>
 #import <memory>
+#import <vector>
 
 #include <tta++/libtta.h>
 
@@ -15,6 +17,22 @@
 
 namespace {
 
+	/// The size of the buffer used to discard samples following a seek, in frames
+	constexpr AVAudioFrameCount kSkipBufferFrameCapacity = 4096;
+
+	/// Returns the number of samples in a standard TTA frame, as computed by libtta
+	TTAuint32 TTAFrameLength(TTAuint32 sampleRate)
+	{
+		return (256 * sampleRate) / 245;
+	}
+
+	/// Returns the smallest time in seconds that \c tta_decoder::set_position maps to \c frame
+	TTAuint32 TTASecondsForFrame(TTAuint32 frame)
+	{
+		// set_position() selects frame (245 * seconds) / 256
+		return (TTAuint32)((256 * (uint64_t)frame + 244) / 245);
+	}
+
 	struct TTACallbacks : TTA_io_callback
 	{
 		SFBAudioDecoder *mDecoder;
@@ -48,7 +66,9 @@ namespace {
 	std::unique_ptr<TTACallbacks> _callbacks;
 	AVAudioFramePosition _framePosition;
 	AVAudioFramePosition _frameLength;
-	TTAuint32 _framesToSkip;
+	TTAuint32 _ttaFrameLength;
+	AVAudioFramePosition _framesToSkip;
+	std::vector<TTAuint8> _skipBuffer;
 }
 @end
 
@@ -69,6 +89,17 @@ namespace {
 	return [NSSet setWithObject:@"audio/x-tta"];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	if(length >= 4 && !memcmp(bytes, "TTA1", 4))
+		return SFBAudioDecoderProbeScoreCertain;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
@@ -163,7 +194,10 @@ namespace {
 
 	_processingFormat = [[AVAudioFormat alloc] initWithStreamDescription:&processingStreamDescription channelLayout:channelLayout];
 
+	_framePosition = 0;
 	_frameLength = streamInfo.samples;
+	_ttaFrameLength = TTAFrameLength(streamInfo.sps);
+	_framesToSkip = 0;
 
 	// Set up the source format
 	AudioStreamBasicDescription sourceStreamDescription{};
@@ -183,6 +217,8 @@ namespace {
 {
 	_decoder.reset();
 	_callbacks.reset();
+	_skipBuffer.clear();
+	_skipBuffer.shrink_to_fit();
 
 	return [super closeReturningError:error];
 }
@@ -217,28 +253,22 @@ namespace {
 	if(frameLength > buffer.frameCapacity)
 		frameLength = buffer.frameCapacity;
 
-	AVAudioFrameCount framesRead = 0;
-	bool eos = false;
+	UInt32 bytesPerFrame = _processingFormat.streamDescription->mBytesPerFrame;
+	auto output = static_cast<TTAuint8 *>(buffer.audioBufferList->mBuffers[0].mData);
 
-	try {
-		while(_framesToSkip && !eos) {
-			if(_framesToSkip >= frameLength) {
-				framesRead = (AVAudioFrameCount)_decoder->process_stream((TTAuint8 *)buffer.audioBufferList->mBuffers[0].mData, frameLength);
-				_framesToSkip -= framesRead;
-			}
-			else {
-				framesRead = (AVAudioFrameCount)_decoder->process_stream((TTAuint8 *)buffer.audioBufferList->mBuffers[0].mData, _framesToSkip);
-				_framesToSkip = 0;
-			}
-
-			if(framesRead == 0)
-				eos = true;
-		}
+	AVAudioFrameCount framesProcessed = 0;
 
-		if(!eos) {
-			framesRead = (AVAudioFrameCount)_decoder->process_stream((TTAuint8 *)buffer.audioBufferList->mBuffers[0].mData, frameLength);
-			if(framesRead == 0)
-				eos = true;
+	try {
+		if(_framesToSkip > 0 && ![self skipPendingFrames])
+			return YES;
+
+		// process_stream() stops at TTA frame boundaries
+		while(framesProcessed < frameLength) {
+			auto framesRead = _decoder->process_stream(output + (framesProcessed * bytesPerFrame), (frameLength - framesProcessed) * bytesPerFrame);
+			// EOS
+			if(framesRead <= 0)
+				break;
+			framesProcessed += (AVAudioFrameCount)framesRead;
 		}
 	}
 	catch(const tta::tta_exception& e) {
@@ -246,11 +276,8 @@ namespace {
 		return NO;
 	}
 
-	if(eos)
-		return YES;
-
-	buffer.frameLength = framesRead;
-	_framePosition += framesRead;
+	buffer.frameLength = framesProcessed;
+	_framePosition += framesProcessed;
 
 	return YES;
 }
@@ -259,11 +286,22 @@ namespace {
 {
 	NSParameterAssert(frame >= 0);
 
-	TTAuint32 seconds = (TTAuint32)(frame / _processingFormat.sampleRate);
+	// The position of the decoder, which lags _framePosition until pending frames are skipped
+	AVAudioFramePosition decoderFramePosition = _framePosition - _framesToSkip;
+
+	// When seeking forward within the current TTA frame, or if the file has no seek table, skip from the current position
+	if(frame >= decoderFramePosition && (frame / _ttaFrameLength == decoderFramePosition / _ttaFrameLength || !_decoder->seek_allowed)) {
+		_framesToSkip = frame - decoderFramePosition;
+		_framePosition = frame;
+		return YES;
+	}
+
+	// Use the seek table to position the decoder at the start of the TTA frame containing the target
+	auto ttaFrame = (TTAuint32)(frame / _ttaFrameLength);
 	TTAuint32 frame_start = 0;
 
 	try {
-		_decoder->set_position(seconds, &frame_start);
+		_decoder->set_position(TTASecondsForFrame(ttaFrame), &frame_start);
 	}
 	catch(const tta::tta_exception& e) {
 		os_log_error(gSFBAudioDecoderLog, "True Audio seek error: %d", e.code());
@@ -272,8 +310,46 @@ namespace {
 
 	_framePosition = frame;
 
-	// We need to skip some samples from start of the frame if required
-	_framesToSkip = UInt32((seconds - frame_start) * _processingFormat.sampleRate + 0.5);
+	// The samples before the target are decoded and discarded on the next read
+	_framesToSkip = frame - ((AVAudioFramePosition)ttaFrame * _ttaFrameLength);
+
+	return YES;
+}
+
+- (BOOL)skipFrames:(AVAudioFramePosition)frameLength error:(NSError **)error
+{
+	NSParameterAssert(frameLength >= 0);
+
+	AVAudioFramePosition frame = std::min(_framePosition + frameLength, _frameLength);
+
+	// The seek table can't position the decoder past the last TTA frame
+	if(frame == _frameLength) {
+		_framesToSkip += frame - _framePosition;
+		_framePosition = frame;
+		return YES;
+	}
+
+	return [self seekToFrame:frame error:error];
+}
+
+/// Decodes and discards the frames between the decoder's position and \c _framePosition
+/// @return \c YES if the pending frames were skipped, \c NO if the end of the stream was reached
+- (BOOL)skipPendingFrames
+{
+	UInt32 bytesPerFrame = _processingFormat.streamDescription->mBytesPerFrame;
+	if(_skipBuffer.empty())
+		_skipBuffer.resize(kSkipBufferFrameCapacity * bytesPerFrame);
+
+	while(_framesToSkip > 0) {
+		auto framesToDiscard = (AVAudioFrameCount)std::min(_framesToSkip, (AVAudioFramePosition)kSkipBufferFrameCapacity);
+		auto framesDiscarded = _decoder->process_stream(_skipBuffer.data(), framesToDiscard * bytesPerFrame);
+		// EOS
+		if(framesDiscarded <= 0) {
+			_framesToSkip = 0;
+			return NO;
+		}
+		_framesToSkip -= framesDiscarded;
+	}
 
 	return YES;
 }
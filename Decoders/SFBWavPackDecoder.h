@@ -8,6 +8,8 @@
 NS_ASSUME_NONNULL_BEGIN
 
 // An SFBAudioDecoder subclass supporting WavPack
+//
+// For hybrid files a correction file with the extension .wvc next to the input is used for lossless decoding
 @interface SFBWavPackDecoder : SFBAudioDecoder
 @end
 
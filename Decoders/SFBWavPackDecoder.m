@@ -10,51 +10,183 @@
 #import "SFBWavPackDecoder.h"
 
 #import "NSError+SFBURLPresentation.h"
+#import "SFBSampleFormatKernels.h"
 
 #define BUFFER_SIZE_FRAMES 2048
 
 static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b) { return a < b ? a : b; }
 
+// The size of the read-ahead buffer for each stream
+#define STREAM_BUFFER_SIZE_BYTES 65536
+
+// A buffered reader between WavPack and an input source supporting read-ahead and true push back
+@interface SFBWavPackStreamReader : NSObject
+{
+@package
+	SFBInputSource *_inputSource;
+	uint8_t *_buffer;
+	// The number of valid bytes in _buffer
+	NSInteger _bufferLength;
+	// The offset of the next byte to return from _buffer
+	NSInteger _bufferOffset;
+	// The input source offset following the last byte in _buffer
+	NSInteger _inputSourceOffset;
+}
+- (instancetype)initWithInputSource:(SFBInputSource *)inputSource;
+- (int32_t)readBytes:(void *)data length:(int32_t)length;
+- (BOOL)seekToOffset:(NSInteger)offset;
+- (int)pushBackByte:(int)c;
+@property (nonatomic, readonly) NSInteger offset;
+@end
+
+@implementation SFBWavPackStreamReader
+
+- (instancetype)initWithInputSource:(SFBInputSource *)inputSource
+{
+	NSParameterAssert(inputSource != nil);
+
+	if((self = [super init])) {
+		_buffer = malloc(STREAM_BUFFER_SIZE_BYTES);
+		if(!_buffer)
+			return nil;
+		_inputSource = inputSource;
+		if(![_inputSource getOffset:&_inputSourceOffset error:nil])
+			_inputSourceOffset = 0;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_buffer);
+}
+
+- (NSInteger)offset
+{
+	return _inputSourceOffset - (_bufferLength - _bufferOffset);
+}
+
+- (int32_t)readBytes:(void *)data length:(int32_t)length
+{
+	uint8_t *dest = data;
+	int32_t bytesRemaining = length;
+
+	while(bytesRemaining > 0) {
+		// Return buffered data first
+		NSInteger bytesBuffered = _bufferLength - _bufferOffset;
+		if(bytesBuffered > 0) {
+			NSInteger bytesToCopy = MIN(bytesBuffered, (NSInteger)bytesRemaining);
+			memcpy(dest, _buffer + _bufferOffset, (size_t)bytesToCopy);
+			_bufferOffset += bytesToCopy;
+			dest += bytesToCopy;
+			bytesRemaining -= (int32_t)bytesToCopy;
+			continue;
+		}
+
+		// Large reads bypass the buffer
+		NSInteger bytesRead;
+		if(bytesRemaining >= STREAM_BUFFER_SIZE_BYTES) {
+			_bufferLength = 0;
+			_bufferOffset = 0;
+			if(![_inputSource readBytes:dest length:bytesRemaining bytesRead:&bytesRead error:nil] || bytesRead == 0)
+				break;
+			_inputSourceOffset += bytesRead;
+			dest += bytesRead;
+			bytesRemaining -= (int32_t)bytesRead;
+			continue;
+		}
+
+		// Refill the buffer, reading ahead of the request.
+		// The final byte of the previous contents is retained so it may be pushed back.
+		NSInteger retained = _bufferLength > 0 ? 1 : 0;
+		if(retained)
+			_buffer[0] = _buffer[_bufferLength - 1];
+		_bufferLength = retained;
+		_bufferOffset = retained;
+
+		if(![_inputSource readBytes:(_buffer + retained) length:(STREAM_BUFFER_SIZE_BYTES - retained) bytesRead:&bytesRead error:nil] || bytesRead == 0)
+			break;
+		_bufferLength += bytesRead;
+		_inputSourceOffset += bytesRead;
+	}
+
+	return length - bytesRemaining;
+}
+
+- (BOOL)seekToOffset:(NSInteger)offset
+{
+	// Seeks within the buffer don't touch the input source
+	NSInteger bufferStartOffset = _inputSourceOffset - _bufferLength;
+	if(offset >= bufferStartOffset && offset <= _inputSourceOffset) {
+		_bufferOffset = offset - bufferStartOffset;
+		return YES;
+	}
+
+	if(!_inputSource.supportsSeeking) {
+		// Forward seeks in non-seekable input are performed by reading
+		NSInteger currentOffset = self.offset;
+		if(offset < currentOffset)
+			return NO;
+		uint8_t discard [4096];
+		while(currentOffset < offset) {
+			int32_t bytesRead = [self readBytes:discard length:(int32_t)MIN((NSInteger)sizeof discard, offset - currentOffset)];
+			if(bytesRead == 0)
+				return NO;
+			currentOffset += bytesRead;
+		}
+		return YES;
+	}
+
+	if(![_inputSource seekToOffset:offset error:nil])
+		return NO;
+
+	_bufferLength = 0;
+	_bufferOffset = 0;
+	_inputSourceOffset = offset;
+
+	return YES;
+}
+
+- (int)pushBackByte:(int)c
+{
+	// Only the most recently read byte may be pushed back, which is all WavPack requires
+	if(_bufferOffset == 0)
+		return EOF;
+	_buffer[--_bufferOffset] = (uint8_t)c;
+	return c;
+}
+
+@end
+
 static int32_t read_bytes_callback(void *id, void *data, int32_t bcount)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
-
-	NSInteger bytesRead;
-	if(![decoder->_inputSource readBytes:data length:bcount bytesRead:&bytesRead error:nil])
-		return -1;
-	return (int32_t)bytesRead;
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
+	return [reader readBytes:data length:bcount];
 }
 
 static int64_t get_pos_callback(void *id)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
-
-	NSInteger offset;
-	if(![decoder->_inputSource getOffset:&offset error:nil])
-		return 0;
-	return offset;
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
+	return reader.offset;
 }
 
 static int set_pos_abs_callback(void *id, int64_t pos)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
-	return ![decoder->_inputSource seekToOffset:pos error:nil];
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
+	return ![reader seekToOffset:pos];
 }
 
 static int set_pos_rel_callback(void *id, int64_t delta, int mode)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
-
-	if(!decoder->_inputSource.supportsSeeking)
-		return -1;
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
 
 	// Adjust offset as required
 	NSInteger offset = delta;
@@ -62,53 +194,37 @@ static int set_pos_rel_callback(void *id, int64_t delta, int mode)
 		case SEEK_SET:
 			// offset remains unchanged
 			break;
-		case SEEK_CUR: {
-			NSInteger inputSourceOffset;
-			if([decoder->_inputSource getOffset:&inputSourceOffset error:nil])
-				offset += inputSourceOffset;
+		case SEEK_CUR:
+			offset += reader.offset;
 			break;
-		}
 		case SEEK_END: {
 			NSInteger inputSourceLength;
-			if([decoder->_inputSource getLength:&inputSourceLength error:nil])
-				offset += inputSourceLength;
+			if(![reader->_inputSource getLength:&inputSourceLength error:nil])
+				return -1;
+			offset += inputSourceLength;
 			break;
 		}
 	}
 
-	return ![decoder->_inputSource seekToOffset:offset error:nil];
+	return ![reader seekToOffset:offset];
 }
 
-// FIXME: How does one emulate ungetc when the data is non-seekable?
-// A small read buffer in SFBWavPackDecoder would work but this function
-// only seems to be called once per file (when opening) so it may not be worthwhile
 static int push_back_byte_callback(void *id, int c)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
-
-	if(!decoder->_inputSource.supportsSeeking)
-		return EOF;
-
-	NSInteger offset;
-	if(![decoder->_inputSource getOffset:&offset error:nil] || offset < 1)
-		return EOF;
-
-	if(![decoder->_inputSource seekToOffset:(offset - 1) error:nil])
-		return EOF;
-
-	return c;
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
+	return [reader pushBackByte:c];
 }
 
 static int64_t get_length_callback(void *id)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
 
 	NSInteger length;
-	if(![decoder->_inputSource getLength:&length error:nil])
+	if(![reader->_inputSource getLength:&length error:nil])
 		return -1;
 	return length;
 }
@@ -117,14 +233,18 @@ static int can_seek_callback(void *id)
 {
 	NSCParameterAssert(id != NULL);
 
-	SFBWavPackDecoder *decoder = (__bridge SFBWavPackDecoder *)id;
-	return (int)decoder->_inputSource.supportsSeeking;
+	SFBWavPackStreamReader *reader = (__bridge SFBWavPackStreamReader *)id;
+	return (int)reader->_inputSource.supportsSeeking;
 }
 
 @interface SFBWavPackDecoder ()
 {
 @private
 	WavpackStreamReader64 _streamReader;
+	SFBWavPackStreamReader *_reader;
+	// The correction file for hybrid lossless audio, if present
+	SFBInputSource *_correctionInputSource;
+	SFBWavPackStreamReader *_correctionReader;
 	WavpackContext *_wpc;
 	int32_t *_buffer;
 	AVAudioFramePosition _framePosition;
@@ -149,11 +269,24 @@ static int can_seek_callback(void *id)
 	return [NSSet setWithArray:@[@"audio/wavpack", @"audio/x-wavpack"]];
 }
 
++ (SFBAudioDecoderProbeScore)probeScoreForPrefix:(NSData *)prefix
+{
+	const uint8_t *bytes = prefix.bytes;
+	NSUInteger length = prefix.length;
+
+	if(length >= 4 && !memcmp(bytes, "wvpk", 4))
+		return SFBAudioDecoderProbeScoreCertain;
+
+	return SFBAudioDecoderProbeScoreNone;
+}
+
 - (BOOL)openReturningError:(NSError **)error
 {
 	if(![super openReturningError:error])
 		return NO;
 
+	_framePosition = 0;
+
 	_streamReader.read_bytes = read_bytes_callback;
 	_streamReader.get_pos = get_pos_callback;
 	_streamReader.set_pos_abs = set_pos_abs_callback;
@@ -162,11 +295,38 @@ static int can_seek_callback(void *id)
 	_streamReader.get_length = get_length_callback;
 	_streamReader.can_seek = can_seek_callback;
 
+	_reader = [[SFBWavPackStreamReader alloc] initWithInputSource:_inputSource];
+	if(!_reader) {
+		if(error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return NO;
+	}
+
+	// Hybrid lossless files store the correction data in a separate file alongside the main file.
+	// WavPack reads a correction block for each main block so both streams are read ahead in step.
+	NSURL *correctionURL = [_inputSource.url.URLByDeletingPathExtension URLByAppendingPathExtension:@"wvc"];
+	if(_inputSource.url.isFileURL && [correctionURL checkResourceIsReachableAndReturnError:nil]) {
+		NSError *correctionError = nil;
+		_correctionInputSource = [SFBInputSource inputSourceForURL:correctionURL flags:0 error:&correctionError];
+		if(!_correctionInputSource || ![_correctionInputSource openReturningError:&correctionError]) {
+			os_log_info(gSFBAudioDecoderLog, "Unable to open WavPack correction file %{public}@: %{public}@", correctionURL, correctionError);
+			_correctionInputSource = nil;
+		}
+		else {
+			_correctionReader = [[SFBWavPackStreamReader alloc] initWithInputSource:_correctionInputSource];
+			if(!_correctionReader)
+				[self closeCorrectionInputSource];
+		}
+	}
+
 	char errorBuf [80];
 
 	// Setup converter
-	_wpc = WavpackOpenFileInputEx64(&_streamReader, (__bridge void *)self, NULL, errorBuf, OPEN_WVC | OPEN_NORMALIZE/* | OPEN_DSD_NATIVE*/, 0);
+	_wpc = WavpackOpenFileInputEx64(&_streamReader, (__bridge void *)_reader, (__bridge void *)_correctionReader, errorBuf, OPEN_WVC | OPEN_NORMALIZE/* | OPEN_DSD_NATIVE*/, 0);
 	if(!_wpc) {
+		[self closeCorrectionInputSource];
+		_reader = nil;
+
 		if(error)
 			*error = [NSError SFB_errorWithDomain:SFBAudioDecoderErrorDomain
 											 code:SFBAudioDecoderErrorCodeInputOutput
@@ -238,6 +398,9 @@ static int can_seek_callback(void *id)
 	_buffer = malloc(sizeof(int32_t) * (size_t)BUFFER_SIZE_FRAMES * (size_t)WavpackGetNumChannels(_wpc));
 	if(!_buffer) {
 		WavpackCloseFile(_wpc);
+		_wpc = NULL;
+		[self closeCorrectionInputSource];
+		_reader = nil;
 		if(error)
 			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
 
@@ -259,9 +422,23 @@ static int can_seek_callback(void *id)
 		_wpc = NULL;
 	}
 
+	[self closeCorrectionInputSource];
+	_reader = nil;
+
 	return [super closeReturningError:error];
 }
 
+- (void)closeCorrectionInputSource
+{
+	_correctionReader = nil;
+	if(_correctionInputSource.isOpen) {
+		NSError *error = nil;
+		if(![_correctionInputSource closeReturningError:&error])
+			os_log_info(gSFBAudioDecoderLog, "Error closing WavPack correction file: %{public}@", error);
+	}
+	_correctionInputSource = nil;
+}
+
 - (BOOL)isOpen
 {
 	return _wpc != NULL;
@@ -306,73 +483,39 @@ static int can_seek_callback(void *id)
 		int mode = WavpackGetMode(_wpc);
 //		int qmode = WavpackGetQualifyMode(_wpc);
 
+		AVAudioChannelCount channelCount = buffer.format.channelCount;
+
 		// Floating point files require no special handling other than deinterleaving
 		if(mode & MODE_FLOAT) {
-			float * const *floatChannelData = buffer.floatChannelData;
-			AVAudioChannelCount channelCount = buffer.format.channelCount;
-			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-				const float *input = (float *)_buffer + channel;
-				float *output = floatChannelData[channel] + buffer.frameLength;
-				for(uint32_t sample = 0; sample < samplesRead; ++sample) {
-					*output++ = *input;
-					input += channelCount;
-				}
-			}
-
-			buffer.frameLength += samplesRead;
+			float *output [channelCount];
+			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+				output[channel] = buffer.floatChannelData[channel] + buffer.frameLength;
+			SFBDeinterleaveFloat32((const float *)_buffer, output, channelCount, samplesRead);
 		}
 		// Lossless files will be handed off as integers
 		else if(mode & MODE_LOSSLESS) {
 			// WavPack hands us 32-bit signed integers with the samples low-aligned
-			int shift = 8 * (4 - WavpackGetBytesPerSample(_wpc));
-
-			int32_t * const *int32ChannelData = buffer.int32ChannelData;
-			AVAudioChannelCount channelCount = buffer.format.channelCount;
+			unsigned int shift = 8 * (4 - (unsigned int)WavpackGetBytesPerSample(_wpc));
 
 			// Deinterleave the 32-bit samples, shifting to high alignment
-			if(shift) {
-				for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-					const int32_t *input = _buffer + channel;
-					int32_t *output = int32ChannelData[channel] + buffer.frameLength;
-					for(uint32_t sample = 0; sample < samplesRead; ++sample) {
-						*output++ = (int32_t)((uint32_t)*input << shift);
-						input += channelCount;
-					}
-				}
-			}
-			// Just deinterleave the 32-bit samples
-			else {
-				for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-					const int32_t *input = _buffer + channel;
-					int32_t *output = int32ChannelData[channel] + buffer.frameLength;
-					for(uint32_t sample = 0; sample < samplesRead; ++sample) {
-						*output++ = *input;
-						input += channelCount;
-					}
-				}
-			}
-
-			buffer.frameLength += samplesRead;
+			int32_t *output [channelCount];
+			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+				output[channel] = buffer.int32ChannelData[channel] + buffer.frameLength;
+			SFBDeinterleaveInt32(_buffer, output, channelCount, samplesRead, shift);
 		}
 		// Convert lossy files to float
 		else {
 			float scaleFactor = ((uint32_t)1 << ((WavpackGetBytesPerSample(_wpc) * 8) - 1));
 
 			// Deinterleave the 32-bit samples and convert to float
-			float * const *floatChannelData = buffer.floatChannelData;
-			AVAudioChannelCount channelCount = buffer.format.channelCount;
-			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel) {
-				const int32_t *input = _buffer + channel;
-				float *output = floatChannelData[channel] + buffer.frameLength;
-				for(uint32_t sample = 0; sample < samplesRead; ++sample) {
-					*output++ = *input / scaleFactor;
-					input += channelCount;
-				}
-			}
-
-			buffer.frameLength += samplesRead;
+			float *output [channelCount];
+			for(AVAudioChannelCount channel = 0; channel < channelCount; ++channel)
+				output[channel] = buffer.floatChannelData[channel] + buffer.frameLength;
+			SFBDeinterleaveInt32ToFloat32(_buffer, output, channelCount, samplesRead, 1.f / scaleFactor);
 		}
 
+		buffer.frameLength += samplesRead;
+
 		framesRemaining -= samplesRead;
 		_framePosition += samplesRead;
 	}
@@ -17,4 +17,37 @@ NS_ASSUME_NONNULL_BEGIN
 - (AVAudioFrameCount)trimAtOffset:(AVAudioFrameCount)offset frameLength:(AVAudioFrameCount)frameLength NS_SWIFT_NAME(trim(at:length:));
 @end
 
+/// A buffer for staging decoded audio that is consumed in pieces
+///
+/// Frames are consumed by advancing a read offset instead of moving the remaining frames,
+/// so the cost of consuming a block is proportional to the frames read regardless of how it is divided.
+/// Once all frames are consumed the buffer is emptied so it may be refilled from the start.
+@interface SFBPCMStagingBuffer : NSObject
++ (instancetype)new NS_UNAVAILABLE;
+- (instancetype)init NS_UNAVAILABLE;
+- (nullable instancetype)initWithPCMFormat:(AVAudioFormat *)format frameCapacity:(AVAudioFrameCount)frameCapacity NS_DESIGNATED_INITIALIZER;
+
+/// The underlying buffer; unconsumed frames begin at \c readOffset
+///
+/// To refill the staging buffer call \c reset and write to the underlying buffer
+@property (nonatomic, readonly) AVAudioPCMBuffer *buffer;
+/// The offset of the first unconsumed frame in \c buffer
+@property (nonatomic, readonly) AVAudioFrameCount readOffset;
+/// The number of unconsumed frames
+@property (nonatomic, readonly) AVAudioFrameCount frameLength;
+/// \c YES if all frames have been consumed
+@property (nonatomic, readonly) BOOL isEmpty;
+
+/// Discards any unconsumed frames
+- (void)reset;
+/// Appends up to \c frameLength unconsumed frames to \c buffer and returns the number of frames consumed
+- (AVAudioFrameCount)readIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength;
+/// Consumes up to \c frameLength frames without copying and returns the number of frames consumed
+- (AVAudioFrameCount)skipFrames:(AVAudioFrameCount)frameLength;
+/// Consumes up to \c frameLength frames by setting \c bufferList to refer to them in place and returns the number of frames consumed
+///
+/// \c bufferList remains valid until the staging buffer is next modified
+- (AVAudioFrameCount)borrowBufferList:(const AudioBufferList * _Nonnull * _Nonnull)bufferList frameLength:(AVAudioFrameCount)frameLength;
+@end
+
 NS_ASSUME_NONNULL_END
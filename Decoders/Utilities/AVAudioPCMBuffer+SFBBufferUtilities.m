@@ -74,3 +74,106 @@ static inline AVAudioFrameCount SFB_min(AVAudioFrameCount a, AVAudioFrameCount b
 
 @end
 
+@interface SFBPCMStagingBuffer ()
+{
+@private
+	AVAudioPCMBuffer *_buffer;
+	AVAudioFrameCount _readOffset;
+	// Refers to frames lent by -borrowBufferList:frameLength:
+	AudioBufferList *_borrowedBufferList;
+}
+@end
+
+@implementation SFBPCMStagingBuffer
+
+- (instancetype)initWithPCMFormat:(AVAudioFormat *)format frameCapacity:(AVAudioFrameCount)frameCapacity
+{
+	NSParameterAssert(format != nil);
+
+	if((self = [super init])) {
+		_buffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:format frameCapacity:frameCapacity];
+		if(!_buffer)
+			return nil;
+		_buffer.frameLength = 0;
+
+		UInt32 numberBuffers = _buffer.audioBufferList->mNumberBuffers;
+		_borrowedBufferList = calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * numberBuffers));
+		if(!_borrowedBufferList)
+			return nil;
+		_borrowedBufferList->mNumberBuffers = numberBuffers;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_borrowedBufferList);
+}
+
+- (AVAudioPCMBuffer *)buffer
+{
+	return _buffer;
+}
+
+- (AVAudioFrameCount)readOffset
+{
+	return _readOffset;
+}
+
+- (AVAudioFrameCount)frameLength
+{
+	return _buffer.frameLength - _readOffset;
+}
+
+- (BOOL)isEmpty
+{
+	return _readOffset == _buffer.frameLength;
+}
+
+- (void)reset
+{
+	_readOffset = 0;
+	_buffer.frameLength = 0;
+}
+
+- (AVAudioFrameCount)readIntoBuffer:(AVAudioPCMBuffer *)buffer frameLength:(AVAudioFrameCount)frameLength
+{
+	NSParameterAssert(buffer != nil);
+
+	AVAudioFrameCount framesRead = [buffer appendContentsOfBuffer:_buffer readOffset:_readOffset frameLength:frameLength];
+	return [self advanceReadOffset:framesRead];
+}
+
+- (AVAudioFrameCount)skipFrames:(AVAudioFrameCount)frameLength
+{
+	return [self advanceReadOffset:SFB_min(frameLength, self.frameLength)];
+}
+
+- (AVAudioFrameCount)borrowBufferList:(const AudioBufferList **)bufferList frameLength:(AVAudioFrameCount)frameLength
+{
+	NSParameterAssert(bufferList != NULL);
+
+	AVAudioFrameCount framesBorrowed = SFB_min(frameLength, self.frameLength);
+
+	// Resetting an emptied buffer only changes its frame length so the lent frames remain intact
+	UInt32 bytesPerFrame = _buffer.format.streamDescription->mBytesPerFrame;
+	const AudioBufferList *abl = _buffer.audioBufferList;
+	for(UInt32 i = 0; i < abl->mNumberBuffers; ++i) {
+		_borrowedBufferList->mBuffers[i].mNumberChannels = abl->mBuffers[i].mNumberChannels;
+		_borrowedBufferList->mBuffers[i].mData = (unsigned char *)abl->mBuffers[i].mData + (_readOffset * bytesPerFrame);
+		_borrowedBufferList->mBuffers[i].mDataByteSize = framesBorrowed * bytesPerFrame;
+	}
+
+	*bufferList = _borrowedBufferList;
+	return [self advanceReadOffset:framesBorrowed];
+}
+
+- (AVAudioFrameCount)advanceReadOffset:(AVAudioFrameCount)frameLength
+{
+	_readOffset += frameLength;
+	if(_readOffset == _buffer.frameLength)
+		[self reset];
+	return frameLength;
+}
+
+@end
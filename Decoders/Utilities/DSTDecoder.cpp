@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "DSTDecoder.h"
+
+// The DST bitstream syntax and decoding process follow ISO/IEC 14496-3:2005 subpart 10
+// (the section numbers below refer to that document)
+
+namespace {
+
+	constexpr unsigned int kMaxChannels 			= 6;
+	constexpr unsigned int kMaxElements 			= 2 * kMaxChannels;
+	constexpr unsigned int kMaxTableLength 			= 128;
+	constexpr unsigned int kFilterStatusBytes 		= 16;
+
+	// Prediction coefficients for coded filter coefficients (10.12)
+	const int8_t sFilterCoefficientPrediction [3][3] = {
+		{  -8 },
+		{ -16,  8 },
+		{  -9, -5, 6 },
+	};
+
+	// Prediction coefficients for coded probability tables (10.13)
+	const int8_t sProbabilityTablePrediction [3][3] = {
+		{  -8 },
+		{ -16,  8 },
+		{ -24, 24, -8 },
+	};
+
+	// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
+	const uint8_t sBitReverseTable256 [256] =
+	{
+#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
+#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
+		R6(0), R6(2), R6(1), R6(3)
+#   undef R6
+#   undef R4
+#   undef R2
+	};
+
+	inline unsigned int Log2(unsigned int x)
+	{
+		return 31 - (unsigned int)__builtin_clz(x);
+	}
+
+	// An MSB-first bit reader that returns zeros past the end of input
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t *buf, size_t len)
+			: mBuffer(buf), mLengthBits((int64_t)len * 8), mPosition(0)
+		{}
+
+		inline uint32_t ReadBit()
+		{
+			uint32_t bit = 0;
+			if(mPosition < mLengthBits)
+				bit = (mBuffer[mPosition >> 3] >> (7 - (mPosition & 7))) & 1;
+			++mPosition;
+			return bit;
+		}
+
+		// Reads up to 32 bits
+		inline uint32_t Read(unsigned int count)
+		{
+			uint32_t value = 0;
+			while(count) {
+				auto bitOffset = (unsigned int)(mPosition & 7);
+				auto available = 8 - bitOffset;
+				auto take = std::min(count, available);
+				uint32_t bits = mPosition < mLengthBits ? mBuffer[mPosition >> 3] : 0;
+				bits = (bits >> (available - take)) & ((1u << take) - 1);
+				value = (value << take) | bits;
+				mPosition += take;
+				count -= take;
+			}
+			return value;
+		}
+
+		inline int32_t ReadSigned(unsigned int count)
+		{
+			auto value = Read(count);
+			return (int32_t)(value << (32 - count)) >> (32 - count);
+		}
+
+		inline int64_t Remaining() const
+		{
+			return mLengthBits - mPosition;
+		}
+
+	private:
+		const uint8_t *mBuffer;
+		int64_t mLengthBits;
+		int64_t mPosition;
+	};
+
+	// A Rice code: a unary prefix of zero bits terminated by a one bit, k low-order bits,
+	// and a sign bit for non-zero values
+	bool ReadSignedRice(BitReader& br, unsigned int k, int& value)
+	{
+		// Coefficients are at most nine bits so a longer prefix indicates a corrupt frame
+		uint32_t q = 0;
+		while(!br.ReadBit()) {
+			if(++q > (1u << 10) || br.Remaining() < 0)
+				return false;
+		}
+
+		auto v = (int)((q << k) | br.Read(k));
+		if(v && br.ReadBit())
+			v = -v;
+
+		value = v;
+		return true;
+	}
+
+	// The arithmetic decoder (10.11)
+	struct ArithmeticDecoder
+	{
+		void Init(BitReader& br)
+		{
+			mA = 4095;
+			mC = br.Read(12);
+			mOverread = 0;
+		}
+
+		inline uint32_t Decode(BitReader& br, unsigned int p)
+		{
+			uint32_t k = (mA >> 8) | ((mA >> 7) & 1);
+			uint32_t q = k * p;
+			uint32_t aq = mA - q;
+
+			uint32_t bit = mC < aq;
+			if(bit)
+				mA = aq;
+			else {
+				mA = q;
+				mC -= aq;
+			}
+
+			if(mA < 2048) {
+				auto n = 11 - Log2(mA);
+				mA <<= n;
+				if(br.Remaining() < n)
+					++mOverread;
+				mC = (mC << n) | br.Read(n);
+			}
+
+			return bit;
+		}
+
+		uint32_t mA;
+		uint32_t mC;
+		unsigned int mOverread;
+	};
+
+	// Filter coefficient sets or probability tables
+	struct Table
+	{
+		unsigned int mElements;
+		unsigned int mLength [kMaxElements];
+		int mCoefficients [kMaxElements][kMaxTableLength];
+	};
+
+	// Channel to element mapping (10.7, 10.8, 10.9)
+	bool ReadMapping(BitReader& br, Table& table, unsigned int map [kMaxChannels], unsigned int channelCount)
+	{
+		table.mElements = 1;
+		map[0] = 0;
+
+		// Same mapping for all channels
+		if(br.ReadBit()) {
+			std::fill_n(map, kMaxChannels, 0);
+			return true;
+		}
+
+		for(unsigned int channel = 1; channel < channelCount; ++channel) {
+			map[channel] = br.Read(Log2(table.mElements) + 1);
+			if(map[channel] == table.mElements) {
+				if(++table.mElements >= kMaxElements)
+					return false;
+			}
+			else if(map[channel] > table.mElements)
+				return false;
+		}
+
+		return true;
+	}
+
+	void ReadUncodedCoefficients(BitReader& br, int *coefficients, unsigned int count, unsigned int coefficientBits, bool isSigned, int offset)
+	{
+		for(unsigned int i = 0; i < count; ++i)
+			coefficients[i] = (isSigned ? br.ReadSigned(coefficientBits) : (int)br.Read(coefficientBits)) + offset;
+	}
+
+	// Filter coefficient sets (10.12) and probability tables (10.13)
+	bool ReadTable(BitReader& br, Table& table, const int8_t prediction [3][3], unsigned int lengthBits, unsigned int coefficientBits, bool isSigned, int offset)
+	{
+		for(unsigned int element = 0; element < table.mElements; ++element) {
+			auto length = br.Read(lengthBits) + 1;
+			table.mLength[element] = length;
+			int *coefficients = table.mCoefficients[element];
+
+			// A probability table with a single entry is implicitly 128 and has no further data
+			if(offset == 1 && length == 1) {
+				coefficients[0] = 128;
+				continue;
+			}
+
+			// Uncoded
+			if(!br.ReadBit()) {
+				ReadUncodedCoefficients(br, coefficients, length, coefficientBits, isSigned, offset);
+				continue;
+			}
+
+			auto method = br.Read(2);
+			if(method == 3)
+				return false;
+
+			auto order = std::min(method + 1, length);
+			ReadUncodedCoefficients(br, coefficients, order, coefficientBits, isSigned, offset);
+
+			auto riceParameter = br.Read(3);
+			const int64_t minimum = isSigned ? -(1 << (coefficientBits - 1)) : offset;
+			const int64_t maximum = isSigned ? (1 << (coefficientBits - 1)) - 1 : offset + (1 << coefficientBits) - 1;
+			for(auto i = order; i < length; ++i) {
+				int64_t x = 0;
+				for(unsigned int j = 0; j <= method; ++j)
+					x += prediction[method][j] * (int64_t)coefficients[i - j - 1];
+
+				int residual;
+				if(!ReadSignedRice(br, riceParameter, residual))
+					return false;
+
+				int64_t c = residual;
+				if(x >= 0)
+					c -= (x + 4) / 8;
+				else
+					c += (-x + 3) / 8;
+
+				// Reconstructed coefficients must be representable in coefficientBits
+				if(c < minimum || c > maximum)
+					return false;
+
+				coefficients[i] = (int)c;
+			}
+		}
+
+		return true;
+	}
+
+	bool BuildFilters(int16_t filters [kMaxElements][kFilterStatusBytes][256], const Table& filterSets)
+	{
+		for(unsigned int element = 0; element < filterSets.mElements; ++element) {
+			auto length = (int)filterSets.mLength[element];
+			const int *coefficients = filterSets.mCoefficients[element];
+
+			for(int i = 0; i < (int)kFilterStatusBytes; ++i) {
+				auto taps = std::min(std::max(length - i * 8, 0), 8);
+				for(int status = 0; status < 256; ++status) {
+					int value = 0;
+					for(int tap = 0; tap < taps; ++tap)
+						value += (((status >> tap) & 1) * 2 - 1) * coefficients[i * 8 + tap];
+					if((int16_t)value != value)
+						return false;
+					filters[element][i][status] = (int16_t)value;
+				}
+			}
+		}
+
+		return true;
+	}
+
+}
+
+struct SFB::DSTDecoder::Tables
+{
+	Table mFilterSets;
+	Table mProbabilityTables;
+	// Each filter is evaluated as 16 lookups, one per eight taps, indexed by the prediction status
+	int16_t mFilters [kMaxElements][kFilterStatusBytes][256];
+};
+
+SFB::DSTDecoder::DSTDecoder(unsigned int channelCount, unsigned int sampleRate)
+	: mChannelCount(std::min(channelCount, kMaxChannels)), mSamplesPerFrame(588 * (sampleRate / 44100)), mTables(new Tables)
+{}
+
+SFB::DSTDecoder::~DSTDecoder() = default;
+
+bool SFB::DSTDecoder::DecodeFrame(const uint8_t *src, size_t srcLength, uint8_t *dst)
+{
+	if(!src || srcLength < 2 || !dst || mSamplesPerFrame == 0)
+		return false;
+
+	const auto channelCount = mChannelCount;
+	const auto bytesPerChannel = FrameBytesPerChannel();
+
+	BitReader br(src, srcLength);
+
+	// Plain DSD (10.3): the frame contains interleaved channel bytes
+	if(!br.ReadBit()) {
+		br.ReadBit();
+		if(br.Read(6))
+			return false;
+
+		const uint8_t *input = src + 1;
+		auto bytesAvailable = std::min((srcLength - 1) / channelCount, bytesPerChannel);
+		for(unsigned int channel = 0; channel < channelCount; ++channel) {
+			uint8_t *output = dst + channel * bytesPerChannel;
+			for(size_t i = 0; i < bytesAvailable; ++i)
+				output[i] = input[i * channelCount + channel];
+			std::memset(output + bytesAvailable, 0x69, bytesPerChannel - bytesAvailable);
+		}
+
+		return true;
+	}
+
+	// Segmentation (10.4, 10.5, 10.6)
+	// Only a single segment per channel, shared by the filters and probability tables, is supported
+	if(!br.ReadBit() || !br.ReadBit() || !br.ReadBit())
+		return false;
+
+	// Mapping (10.7, 10.8, 10.9)
+	auto& tables = *mTables;
+	unsigned int filterMap [kMaxChannels];
+	unsigned int probabilityMap [kMaxChannels];
+
+	auto sameMapping = br.ReadBit();
+	if(!ReadMapping(br, tables.mFilterSets, filterMap, channelCount))
+		return false;
+
+	if(sameMapping) {
+		tables.mProbabilityTables.mElements = tables.mFilterSets.mElements;
+		std::copy_n(filterMap, kMaxChannels, probabilityMap);
+	}
+	else if(!ReadMapping(br, tables.mProbabilityTables, probabilityMap, channelCount))
+		return false;
+
+	// Half probability (10.10)
+	bool halfProbability [kMaxChannels];
+	for(unsigned int channel = 0; channel < channelCount; ++channel)
+		halfProbability[channel] = br.ReadBit();
+
+	// Filter coefficient sets (10.12)
+	if(!ReadTable(br, tables.mFilterSets, sFilterCoefficientPrediction, 7, 9, true, 0))
+		return false;
+
+	// Probability tables (10.13)
+	if(!ReadTable(br, tables.mProbabilityTables, sProbabilityTablePrediction, 6, 7, false, 1))
+		return false;
+
+	if(!BuildFilters(tables.mFilters, tables.mFilterSets))
+		return false;
+
+	// Arithmetic coded data (10.11)
+	if(br.ReadBit())
+		return false;
+
+	ArithmeticDecoder ac;
+	ac.Init(br);
+
+	// The first decoded bit is not part of the audio
+	ac.Decode(br, (sBitReverseTable256[tables.mFilterSets.mCoefficients[0][0] & 127] >> 1) + 1);
+
+	// The prediction status holds the 128 most recent samples for each channel, most recent in the LSB
+	uint64_t status [kMaxChannels][2];
+	for(unsigned int channel = 0; channel < channelCount; ++channel)
+		status[channel][0] = status[channel][1] = 0xAAAAAAAAAAAAAAAAull;
+
+	std::memset(dst, 0, FrameBytes());
+
+	for(unsigned int i = 0; i < mSamplesPerFrame; ++i) {
+		for(unsigned int channel = 0; channel < channelCount; ++channel) {
+			const auto filterElement = filterMap[channel];
+			const int16_t (*filter)[256] = tables.mFilters[filterElement];
+			const uint64_t lo = status[channel][0];
+			const uint64_t hi = status[channel][1];
+
+			int sum = 0;
+			for(unsigned int j = 0; j < 8; ++j)
+				sum += filter[j][(lo >> (j * 8)) & 0xff];
+			for(unsigned int j = 0; j < 8; ++j)
+				sum += filter[8 + j][(hi >> (j * 8)) & 0xff];
+			const auto predict = (int16_t)sum;
+
+			unsigned int probability = 128;
+			if(!halfProbability[channel] || i >= tables.mFilterSets.mLength[filterElement]) {
+				const auto probabilityElement = probabilityMap[channel];
+				unsigned int index = (unsigned int)std::abs((int)predict) >> 3;
+				probability = (unsigned int)tables.mProbabilityTables.mCoefficients[probabilityElement][std::min(index, tables.mProbabilityTables.mLength[probabilityElement] - 1)];
+			}
+
+			if(ac.mOverread > 16)
+				return false;
+
+			auto residual = ac.Decode(br, probability);
+			uint64_t bit = (((uint16_t)predict >> 15) ^ residual) & 1;
+
+			dst[channel * bytesPerChannel + (i >> 3)] |= (uint8_t)(bit << (7 - (i & 7)));
+
+			status[channel][1] = (hi << 1) | (lo >> 63);
+			status[channel][0] = (lo << 1) | bit;
+		}
+	}
+
+	return true;
+}
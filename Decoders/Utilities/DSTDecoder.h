@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/*! @file DSTDecoder.h @brief A decoder for DST (Direct Stream Transfer) compressed DSD audio */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	/*!
+	 * @brief A decoder for DST frames as specified in ISO/IEC 14496-3 subpart 10
+	 *
+	 * DST frames are independent of each other so multiple frames may be decoded concurrently,
+	 * provided each thread uses a separate \c DSTDecoder object.
+	 *
+	 * Decoded frames are non-interleaved: the channel bytes for the first channel are followed
+	 * by the channel bytes for the second channel, and so on. Within a byte the first sample is
+	 * the most significant bit.
+	 */
+	class DSTDecoder
+	{
+	public:
+		// ========================================
+		/*! @name Creation and Destruction */
+		//@{
+
+		/*! @brief A \c std::unique_ptr for \c DSTDecoder objects */
+		using unique_ptr = std::unique_ptr<DSTDecoder>;
+
+		/*!
+		 * @brief Create a new \c DSTDecoder
+		 * @param channelCount The number of channels, from \c 1 to \c 6
+		 * @param sampleRate The DSD sample rate, which must be a multiple of 44,100 Hz
+		 */
+		DSTDecoder(unsigned int channelCount, unsigned int sampleRate);
+
+		/*! @brief Destroy the \c DSTDecoder and release all associated resources. */
+		~DSTDecoder();
+
+		/*! @cond */
+
+		/*! @internal This class is non-copyable */
+		DSTDecoder(const DSTDecoder& rhs) = delete;
+
+		/*! @internal This class is non-assignable */
+		DSTDecoder& operator=(const DSTDecoder& rhs) = delete;
+
+		/*! @endcond */
+
+		//@}
+
+
+		// ========================================
+		/*! @name Decoding */
+		//@{
+
+		/*! @brief Returns the number of channels */
+		inline unsigned int ChannelCount() const 				{ return mChannelCount; }
+
+		/*! @brief Returns the number of bytes per channel in a decoded frame */
+		inline size_t FrameBytesPerChannel() const 				{ return mSamplesPerFrame / 8; }
+
+		/*! @brief Returns the number of bytes in a decoded frame */
+		inline size_t FrameBytes() const 						{ return FrameBytesPerChannel() * mChannelCount; }
+
+		/*!
+		 * @brief Decode a single DST frame
+		 * @param src The DST frame data
+		 * @param srcLength The number of bytes in \c src
+		 * @param dst A buffer of at least \c FrameBytes() bytes to receive the decoded DSD audio
+		 * @return \c true on success, \c false on error
+		 */
+		bool DecodeFrame(const uint8_t *src, size_t srcLength, uint8_t *dst);
+
+		//@}
+
+	private:
+
+		struct Tables;
+
+		/*! @brief The number of channels */
+		unsigned int mChannelCount;
+		/*! @brief The number of samples per channel in a frame */
+		unsigned int mSamplesPerFrame;
+		/*! @brief Working storage for filter sets, probability tables, and lookup tables */
+		std::unique_ptr<Tables> mTables;
+	};
+
+}
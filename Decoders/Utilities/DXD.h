@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2018 - 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+/*! @file DXD.h @brief DSD to PCM conversion using dsd2pcm */
+
+/*! @brief \c SFBAudioEngine's encompassing namespace */
+namespace SFB {
+
+	struct dsd2pcm_ctx;
+
+	/*!
+	 * @brief A single-channel DSD to PCM converter using dsd2pcm
+	 *
+	 * Each DSD byte (eight one bit samples) is converted to one PCM sample using a 96-tap
+	 * lowpass filter evaluated with lookup tables. The output sample rate is 1/8 the DSD sample rate.
+	 */
+	class DXD
+	{
+	public:
+		/*! @brief Create a new \c DXD with the filter state set to DSD silence */
+		DXD();
+
+		/*! @brief Create a new \c DXD with the same filter state as \c x */
+		DXD(DXD const& x);
+
+		/*! @brief Destroy the \c DXD and release all associated resources */
+		~DXD();
+
+		/*! @brief Swap the filter state of \c a and \c b */
+		friend void Swap(DXD& a, DXD& b)
+		{
+			std::swap(a.handle, b.handle);
+		}
+
+		/*! @brief Replace the filter state with that of \c x */
+		DXD& operator=(DXD x);
+
+		/*! @brief Reset the filter state to DSD silence */
+		void Reset();
+
+		/*!
+		 * @brief Convert DSD to PCM
+		 * @param samples The number of DSD bytes to convert
+		 * @param src The DSD input
+		 * @param src_stride The distance between consecutive bytes in \c src
+		 * @param lsbitfirst \c true if the first DSD sample is the least significant bit of each byte
+		 * @param dst The PCM output, which must have space for \c samples values
+		 * @param dst_stride The distance between consecutive values in \c dst
+		 */
+		void Translate(size_t samples, const unsigned char *src, ptrdiff_t src_stride, bool lsbitfirst, float *dst, ptrdiff_t dst_stride);
+
+	private:
+		/*! @brief The dsd2pcm context */
+		dsd2pcm_ctx *handle;
+	};
+
+}
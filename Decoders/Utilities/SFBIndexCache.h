@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Files caching the seek or frame index of an audio file
+//
+// A cache file consists of a 24-byte little-endian header followed by a format-specific payload.
+// The header contains a magic number, a version, and the size and modification time of the audio file,
+// so a cache is ignored once the audio file changes.
+
+/// Returns the cache file in \c directory for \c url with the path extension \c pathExtension, or \c nil if \c url can't be cached
+FOUNDATION_EXTERN NSURL * _Nullable SFBIndexCacheURL(NSURL * _Nullable directory, NSURL * _Nullable url, NSString *pathExtension);
+
+/// Writes \c payload for \c url to \c cacheURL, creating the containing directory if necessary
+FOUNDATION_EXTERN BOOL SFBWriteIndexCache(NSURL *cacheURL, NSURL *url, uint32_t magic, uint32_t version, NSData *payload, NSError **error);
+
+/// Returns the payload of \c cacheURL or \c nil if it does not exist, has the wrong magic number or version, or is stale for \c url
+FOUNDATION_EXTERN NSData * _Nullable SFBReadIndexCache(NSURL *cacheURL, NSURL *url, uint32_t magic, uint32_t version);
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#import "SFBIndexCache.h"
+
+#define INDEX_CACHE_HEADER_SIZE 24
+
+/// Returns the size and modification time of \c url, used to detect stale caches
+static BOOL SFBGetFileSizeAndModificationTime(NSURL *url, uint64_t *fileSize, int64_t *modificationTime)
+{
+	NSDictionary *values = [url resourceValuesForKeys:@[NSURLFileSizeKey, NSURLContentModificationDateKey] error:nil];
+	NSNumber *size = values[NSURLFileSizeKey];
+	NSDate *date = values[NSURLContentModificationDateKey];
+	if(!size || !date)
+		return NO;
+	*fileSize = size.unsignedLongLongValue;
+	*modificationTime = (int64_t)(date.timeIntervalSinceReferenceDate * 1000000);
+	return YES;
+}
+
+NSURL * SFBIndexCacheURL(NSURL *directory, NSURL *url, NSString *pathExtension)
+{
+	NSCParameterAssert(pathExtension != nil);
+
+	if(!directory || !url.isFileURL)
+		return nil;
+
+	// FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for(const char *c = url.URLByStandardizingPath.path.fileSystemRepresentation; c && *c; ++c) {
+		hash ^= (uint8_t)*c;
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"%016llx.%@", hash, pathExtension] isDirectory:NO];
+}
+
+BOOL SFBWriteIndexCache(NSURL *cacheURL, NSURL *url, uint32_t magic, uint32_t version, NSData *payload, NSError **error)
+{
+	NSCParameterAssert(cacheURL != nil);
+	NSCParameterAssert(url != nil);
+	NSCParameterAssert(payload != nil);
+
+	uint64_t fileSize;
+	int64_t modificationTime;
+	if(!SFBGetFileSizeAndModificationTime(url, &fileSize, &modificationTime)) {
+		if(error)
+			*error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{ NSURLErrorKey: url }];
+		return NO;
+	}
+
+	uint8_t header [INDEX_CACHE_HEADER_SIZE];
+	OSWriteLittleInt32(header, 0, magic);
+	OSWriteLittleInt32(header, 4, version);
+	OSWriteLittleInt64(header, 8, fileSize);
+	OSWriteLittleInt64(header, 16, (uint64_t)modificationTime);
+
+	NSMutableData *data = [NSMutableData dataWithCapacity:INDEX_CACHE_HEADER_SIZE + payload.length];
+	[data appendBytes:header length:sizeof header];
+	[data appendData:payload];
+
+	return [[NSFileManager defaultManager] createDirectoryAtURL:cacheURL.URLByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:error] && [data writeToURL:cacheURL options:NSDataWritingAtomic error:error];
+}
+
+NSData * SFBReadIndexCache(NSURL *cacheURL, NSURL *url, uint32_t magic, uint32_t version)
+{
+	NSCParameterAssert(cacheURL != nil);
+	NSCParameterAssert(url != nil);
+
+	NSData *data = [NSData dataWithContentsOfURL:cacheURL options:NSDataReadingMappedIfSafe error:nil];
+	if(data.length < INDEX_CACHE_HEADER_SIZE)
+		return nil;
+
+	uint64_t fileSize;
+	int64_t modificationTime;
+	if(!SFBGetFileSizeAndModificationTime(url, &fileSize, &modificationTime))
+		return nil;
+
+	const uint8_t *bytes = data.bytes;
+	if(OSReadLittleInt32(bytes, 0) != magic || OSReadLittleInt32(bytes, 4) != version)
+		return nil;
+	if(OSReadLittleInt64(bytes, 8) != fileSize || (int64_t)OSReadLittleInt64(bytes, 16) != modificationTime)
+		return nil;
+
+	return [data subdataWithRange:NSMakeRange(INDEX_CACHE_HEADER_SIZE, data.length - INDEX_CACHE_HEADER_SIZE)];
+}
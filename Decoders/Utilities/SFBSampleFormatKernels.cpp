@@ -0,0 +1,970 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define SFB_KERNELS_X86 1
+#	include <immintrin.h>
+#elif defined(__ARM_NEON)
+#	define SFB_KERNELS_NEON 1
+#	include <arm_neon.h>
+#endif
+
+#include "SFBSampleFormatKernels.h"
+
+namespace {
+
+	// The largest float less than 2^31
+	const float kMaxInt32Float = 2147483520.f;
+	const float kMinInt32Float = -2147483648.f;
+
+	// Bit reversal lookup table from http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
+	const uint8_t sBitReverseTable256 [256] =
+	{
+#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
+#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
+		R6(0), R6(2), R6(1), R6(3)
+#	undef R6
+#	undef R4
+#	undef R2
+	};
+
+	/*! @brief The kernels for one instruction set */
+	struct KernelTable
+	{
+		SFBSampleFormatKernelsISA mISA;
+
+		void (*mDeinterleaveFloat32)(const float *, float * const *, size_t, size_t);
+		void (*mInterleaveFloat32)(const float * const *, float *, size_t, size_t);
+		void (*mDeinterleaveInt32)(const int32_t *, int32_t * const *, size_t, size_t, unsigned int);
+		void (*mDeinterleaveInt32ToFloat32)(const int32_t *, float * const *, size_t, size_t, float);
+		void (*mConvertInt32ToFloat32)(const int32_t *, float *, size_t, float);
+		void (*mConvertFloat32ToInt32)(const float *, int32_t *, size_t, float);
+		void (*mShiftInt32)(const int32_t *, int32_t *, size_t, unsigned int);
+		void (*mNarrowInt32ToInt16)(const int32_t *, int16_t *, size_t, unsigned int);
+		void (*mNarrowInt32ToInt8)(const int32_t *, int8_t *, size_t, unsigned int);
+		void (*mWidenInt16ToInt32)(const int16_t *, int32_t *, size_t, unsigned int);
+		void (*mPackInt32ToInt24)(const int32_t *, uint8_t *, size_t, unsigned int);
+		void (*mUnpackInt24ToInt32)(const uint8_t *, int32_t *, size_t);
+		void (*mPackDoP)(const uint8_t *, ptrdiff_t, uint8_t *, size_t, uint8_t *, bool);
+	};
+
+#pragma mark Scalar
+
+	/*
+	 * The scalar kernels also handle the samples remaining after the vector loops.
+	 * Shifts are performed on unsigned values to avoid undefined behavior.
+	 */
+	namespace scalar {
+
+		inline int32_t Shift(int32_t sample, unsigned int shift)
+		{
+			return (int32_t)((uint32_t)sample << shift);
+		}
+
+		inline int32_t ClipAndRound(float sample)
+		{
+			if(sample < kMinInt32Float)
+				sample = kMinInt32Float;
+			else if(sample > kMaxInt32Float)
+				sample = kMaxInt32Float;
+			return (int32_t)lrintf(sample);
+		}
+
+		void DeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames, size_t start)
+		{
+			for(size_t channel = 0; channel < channels; ++channel) {
+				const float *input = src + start * channels + channel;
+				float *output = dst[channel];
+				for(size_t i = start; i < frames; ++i, input += channels)
+					output[i] = *input;
+			}
+		}
+
+		void InterleaveFloat32(const float * const *src, float *dst, size_t channels, size_t frames, size_t start)
+		{
+			for(size_t channel = 0; channel < channels; ++channel) {
+				const float *input = src[channel];
+				float *output = dst + start * channels + channel;
+				for(size_t i = start; i < frames; ++i, output += channels)
+					*output = input[i];
+			}
+		}
+
+		void DeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift, size_t start)
+		{
+			for(size_t channel = 0; channel < channels; ++channel) {
+				const int32_t *input = src + start * channels + channel;
+				int32_t *output = dst[channel];
+				for(size_t i = start; i < frames; ++i, input += channels)
+					output[i] = Shift(*input, shift);
+			}
+		}
+
+		void DeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale, size_t start)
+		{
+			for(size_t channel = 0; channel < channels; ++channel) {
+				const int32_t *input = src + start * channels + channel;
+				float *output = dst[channel];
+				for(size_t i = start; i < frames; ++i, input += channels)
+					output[i] = (float)*input * scale;
+			}
+		}
+
+		void ConvertInt32ToFloat32(const int32_t *src, float *dst, size_t count, float scale)
+		{
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = (float)src[i] * scale;
+		}
+
+		void ConvertFloat32ToInt32(const float *src, int32_t *dst, size_t count, float scale)
+		{
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = ClipAndRound(src[i] * scale);
+		}
+
+		void ShiftInt32(const int32_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			if(shift == 0) {
+				if(src != dst)
+					std::memmove(dst, src, count * sizeof(int32_t));
+				return;
+			}
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = Shift(src[i], shift);
+		}
+
+		void NarrowInt32ToInt16(const int32_t *src, int16_t *dst, size_t count, unsigned int shift)
+		{
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = (int16_t)Shift(src[i], shift);
+		}
+
+		void NarrowInt32ToInt8(const int32_t *src, int8_t *dst, size_t count, unsigned int shift)
+		{
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = (int8_t)Shift(src[i], shift);
+		}
+
+		void WidenInt16ToInt32(const int16_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = Shift(src[i], shift);
+		}
+
+		void PackInt32ToInt24(const int32_t *src, uint8_t *dst, size_t count, unsigned int shift)
+		{
+			for(size_t i = 0; i < count; ++i) {
+				uint32_t sample = (uint32_t)src[i] << shift;
+				*dst++ = (uint8_t)sample;
+				*dst++ = (uint8_t)(sample >> 8);
+				*dst++ = (uint8_t)(sample >> 16);
+			}
+		}
+
+		void UnpackInt24ToInt32(const uint8_t *src, int32_t *dst, size_t count)
+		{
+			for(size_t i = 0; i < count; ++i, src += 3)
+				dst[i] = (int32_t)(((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 24)) >> 8;
+		}
+
+		void PackDoP(const uint8_t *src, ptrdiff_t stride, uint8_t *dst, size_t frames, uint8_t *marker, bool reverseBits)
+		{
+			uint8_t m = *marker;
+			for(size_t i = 0; i < frames; ++i) {
+				*dst++ = m;
+				*dst++ = reverseBits ? sBitReverseTable256[*src] : *src;
+				src += stride;
+				*dst++ = reverseBits ? sBitReverseTable256[*src] : *src;
+				src += stride;
+				m = m == (uint8_t)0x05 ? (uint8_t)0xfa : (uint8_t)0x05;
+			}
+			*marker = m;
+		}
+
+		void DeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames)
+		{
+			DeinterleaveFloat32(src, dst, channels, frames, 0);
+		}
+
+		void InterleaveFloat32(const float * const *src, float *dst, size_t channels, size_t frames)
+		{
+			InterleaveFloat32(src, dst, channels, frames, 0);
+		}
+
+		void DeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift)
+		{
+			DeinterleaveInt32(src, dst, channels, frames, shift, 0);
+		}
+
+		void DeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale)
+		{
+			DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, 0);
+		}
+
+		const KernelTable kKernels = {
+			SFBSampleFormatKernelsISAScalar,
+			DeinterleaveFloat32,
+			InterleaveFloat32,
+			DeinterleaveInt32,
+			DeinterleaveInt32ToFloat32,
+			ConvertInt32ToFloat32,
+			ConvertFloat32ToInt32,
+			ShiftInt32,
+			NarrowInt32ToInt16,
+			NarrowInt32ToInt8,
+			WidenInt16ToInt32,
+			PackInt32ToInt24,
+			UnpackInt24ToInt32,
+			PackDoP,
+		};
+
+	}
+
+#if SFB_KERNELS_X86
+
+#pragma mark SSE2
+
+	/*
+	 * Only the stereo case is vectorized for interleaving since it accounts for nearly all audio;
+	 * other channel counts use the scalar kernels.
+	 */
+	namespace sse2 {
+
+		void DeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveFloat32(src, dst, channels, frames, 0);
+				return;
+			}
+
+			float *left = dst[0];
+			float *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				__m128 a = _mm_loadu_ps(src + 2 * i);
+				__m128 b = _mm_loadu_ps(src + 2 * i + 4);
+				_mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+			scalar::DeinterleaveFloat32(src, dst, channels, frames, i);
+		}
+
+		void InterleaveFloat32(const float * const *src, float *dst, size_t channels, size_t frames)
+		{
+			if(channels != 2) {
+				scalar::InterleaveFloat32(src, dst, channels, frames, 0);
+				return;
+			}
+
+			const float *left = src[0];
+			const float *right = src[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				__m128 l = _mm_loadu_ps(left + i);
+				__m128 r = _mm_loadu_ps(right + i);
+				_mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(l, r));
+				_mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(l, r));
+			}
+			scalar::InterleaveFloat32(src, dst, channels, frames, i);
+		}
+
+		void DeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveInt32(src, dst, channels, frames, shift, 0);
+				return;
+			}
+
+			const __m128i count = _mm_cvtsi32_si128((int)shift);
+			int32_t *left = dst[0];
+			int32_t *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				__m128 a = _mm_castsi128_ps(_mm_sll_epi32(_mm_loadu_si128((const __m128i *)(src + 2 * i)), count));
+				__m128 b = _mm_castsi128_ps(_mm_sll_epi32(_mm_loadu_si128((const __m128i *)(src + 2 * i + 4)), count));
+				_mm_storeu_si128((__m128i *)(left + i), _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+				_mm_storeu_si128((__m128i *)(right + i), _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+			}
+			scalar::DeinterleaveInt32(src, dst, channels, frames, shift, i);
+		}
+
+		void DeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, 0);
+				return;
+			}
+
+			const __m128 s = _mm_set1_ps(scale);
+			float *left = dst[0];
+			float *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				__m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + 2 * i))), s);
+				__m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + 2 * i + 4))), s);
+				_mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+			scalar::DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, i);
+		}
+
+		void ConvertInt32ToFloat32(const int32_t *src, float *dst, size_t count, float scale)
+		{
+			const __m128 s = _mm_set1_ps(scale);
+			size_t i = 0;
+			for(; i + 4 <= count; i += 4)
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i))), s));
+			scalar::ConvertInt32ToFloat32(src + i, dst + i, count - i, scale);
+		}
+
+		void ConvertFloat32ToInt32(const float *src, int32_t *dst, size_t count, float scale)
+		{
+			const __m128 s = _mm_set1_ps(scale);
+			const __m128 lo = _mm_set1_ps(kMinInt32Float);
+			const __m128 hi = _mm_set1_ps(kMaxInt32Float);
+			size_t i = 0;
+			for(; i + 4 <= count; i += 4) {
+				__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), s), lo), hi);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_cvtps_epi32(v));
+			}
+			scalar::ConvertFloat32ToInt32(src + i, dst + i, count - i, scale);
+		}
+
+		void ShiftInt32(const int32_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			if(shift == 0) {
+				scalar::ShiftInt32(src, dst, count, 0);
+				return;
+			}
+
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 4 <= count; i += 4)
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(src + i)), c));
+			scalar::ShiftInt32(src + i, dst + i, count - i, shift);
+		}
+
+		// Keeps the low 16 bits of each 32-bit lane, sign extended, so the saturating pack is exact
+		inline __m128i NarrowToInt16(__m128i v, __m128i shift)
+		{
+			return _mm_srai_epi32(_mm_slli_epi32(_mm_sll_epi32(v, shift), 16), 16);
+		}
+
+		// Keeps the low 8 bits of each 32-bit lane, sign extended, so the saturating packs are exact
+		inline __m128i NarrowToInt8(__m128i v, __m128i shift)
+		{
+			return _mm_srai_epi32(_mm_slli_epi32(_mm_sll_epi32(v, shift), 24), 24);
+		}
+
+		void NarrowInt32ToInt16(const int32_t *src, int16_t *dst, size_t count, unsigned int shift)
+		{
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				__m128i a = NarrowToInt16(_mm_loadu_si128((const __m128i *)(src + i)), c);
+				__m128i b = NarrowToInt16(_mm_loadu_si128((const __m128i *)(src + i + 4)), c);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+			}
+			scalar::NarrowInt32ToInt16(src + i, dst + i, count - i, shift);
+		}
+
+		void NarrowInt32ToInt8(const int32_t *src, int8_t *dst, size_t count, unsigned int shift)
+		{
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 16 <= count; i += 16) {
+				__m128i a = NarrowToInt8(_mm_loadu_si128((const __m128i *)(src + i)), c);
+				__m128i b = NarrowToInt8(_mm_loadu_si128((const __m128i *)(src + i + 4)), c);
+				__m128i d = NarrowToInt8(_mm_loadu_si128((const __m128i *)(src + i + 8)), c);
+				__m128i e = NarrowToInt8(_mm_loadu_si128((const __m128i *)(src + i + 12)), c);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(d, e)));
+			}
+			scalar::NarrowInt32ToInt8(src + i, dst + i, count - i, shift);
+		}
+
+		void WidenInt16ToInt32(const int16_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+				__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_sll_epi32(lo, c));
+				_mm_storeu_si128((__m128i *)(dst + i + 4), _mm_sll_epi32(hi, c));
+			}
+			scalar::WidenInt16ToInt32(src + i, dst + i, count - i, shift);
+		}
+
+		const KernelTable kKernels = {
+			SFBSampleFormatKernelsISASSE2,
+			DeinterleaveFloat32,
+			InterleaveFloat32,
+			DeinterleaveInt32,
+			DeinterleaveInt32ToFloat32,
+			ConvertInt32ToFloat32,
+			ConvertFloat32ToInt32,
+			ShiftInt32,
+			NarrowInt32ToInt16,
+			NarrowInt32ToInt8,
+			WidenInt16ToInt32,
+			scalar::PackInt32ToInt24,
+			scalar::UnpackInt24ToInt32,
+			scalar::PackDoP,
+		};
+
+	}
+
+#pragma mark AVX2
+
+	/*
+	 * The AVX2 kernels are compiled for AVX2 individually so the rest of the file
+	 * may be built for the baseline architecture.
+	 */
+#define SFB_AVX2 __attribute__((target("avx2")))
+
+	namespace avx2 {
+
+		SFB_AVX2 void DeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveFloat32(src, dst, channels, frames, 0);
+				return;
+			}
+
+			// The in-lane shuffle leaves the 64-bit halves in the order 0 2 1 3
+			float *left = dst[0];
+			float *right = dst[1];
+			size_t i = 0;
+			for(; i + 8 <= frames; i += 8) {
+				__m256 a = _mm256_loadu_ps(src + 2 * i);
+				__m256 b = _mm256_loadu_ps(src + 2 * i + 8);
+				__m256d l = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				__m256d r = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+				_mm256_storeu_ps(left + i, _mm256_castpd_ps(_mm256_permute4x64_pd(l, _MM_SHUFFLE(3, 1, 2, 0))));
+				_mm256_storeu_ps(right + i, _mm256_castpd_ps(_mm256_permute4x64_pd(r, _MM_SHUFFLE(3, 1, 2, 0))));
+			}
+			scalar::DeinterleaveFloat32(src, dst, channels, frames, i);
+		}
+
+		SFB_AVX2 void DeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveInt32(src, dst, channels, frames, shift, 0);
+				return;
+			}
+
+			const __m128i count = _mm_cvtsi32_si128((int)shift);
+			const __m256i permutation = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+			int32_t *left = dst[0];
+			int32_t *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				__m256i v = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(src + 2 * i)), count);
+				v = _mm256_permutevar8x32_epi32(v, permutation);
+				_mm_storeu_si128((__m128i *)(left + i), _mm256_castsi256_si128(v));
+				_mm_storeu_si128((__m128i *)(right + i), _mm256_extracti128_si256(v, 1));
+			}
+			scalar::DeinterleaveInt32(src, dst, channels, frames, shift, i);
+		}
+
+		SFB_AVX2 void DeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, 0);
+				return;
+			}
+
+			const __m256 s = _mm256_set1_ps(scale);
+			const __m256i permutation = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+			float *left = dst[0];
+			float *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				__m256i v = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)(src + 2 * i)), permutation);
+				__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(v), s);
+				_mm_storeu_ps(left + i, _mm256_castps256_ps128(f));
+				_mm_storeu_ps(right + i, _mm256_extractf128_ps(f, 1));
+			}
+			scalar::DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, i);
+		}
+
+		SFB_AVX2 void ConvertInt32ToFloat32(const int32_t *src, float *dst, size_t count, float scale)
+		{
+			const __m256 s = _mm256_set1_ps(scale);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8)
+				_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(src + i))), s));
+			scalar::ConvertInt32ToFloat32(src + i, dst + i, count - i, scale);
+		}
+
+		SFB_AVX2 void ConvertFloat32ToInt32(const float *src, int32_t *dst, size_t count, float scale)
+		{
+			const __m256 s = _mm256_set1_ps(scale);
+			const __m256 lo = _mm256_set1_ps(kMinInt32Float);
+			const __m256 hi = _mm256_set1_ps(kMaxInt32Float);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), s), lo), hi);
+				_mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtps_epi32(v));
+			}
+			scalar::ConvertFloat32ToInt32(src + i, dst + i, count - i, scale);
+		}
+
+		SFB_AVX2 void ShiftInt32(const int32_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			if(shift == 0) {
+				scalar::ShiftInt32(src, dst, count, 0);
+				return;
+			}
+
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8)
+				_mm256_storeu_si256((__m256i *)(dst + i), _mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(src + i)), c));
+			scalar::ShiftInt32(src + i, dst + i, count - i, shift);
+		}
+
+		SFB_AVX2 void NarrowInt32ToInt16(const int32_t *src, int16_t *dst, size_t count, unsigned int shift)
+		{
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 16 <= count; i += 16) {
+				__m256i a = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(src + i)), c), 16), 16);
+				__m256i b = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(src + i + 8)), c), 16), 16);
+				// The pack operates within 128-bit lanes
+				__m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+				_mm256_storeu_si256((__m256i *)(dst + i), v);
+			}
+			sse2::NarrowInt32ToInt16(src + i, dst + i, count - i, shift);
+		}
+
+		SFB_AVX2 void WidenInt16ToInt32(const int16_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+				_mm256_storeu_si256((__m256i *)(dst + i), _mm256_sll_epi32(v, c));
+			}
+			scalar::WidenInt16ToInt32(src + i, dst + i, count - i, shift);
+		}
+
+		/*
+		 * The 24-bit kernels move four samples at a time through 16-byte registers and
+		 * access four bytes beyond the twelve that are used, so the vector loops stop
+		 * while at least two samples remain.
+		 */
+
+		SFB_AVX2 void PackInt32ToInt24(const int32_t *src, uint8_t *dst, size_t count, unsigned int shift)
+		{
+			const __m128i c = _mm_cvtsi32_si128((int)shift);
+			const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			size_t i = 0;
+			for(; i + 6 <= count; i += 4) {
+				__m128i v = _mm_sll_epi32(_mm_loadu_si128((const __m128i *)(src + i)), c);
+				_mm_storeu_si128((__m128i *)(dst + 3 * i), _mm_shuffle_epi8(v, mask));
+			}
+			scalar::PackInt32ToInt24(src + i, dst + 3 * i, count - i, shift);
+		}
+
+		SFB_AVX2 void UnpackInt24ToInt32(const uint8_t *src, int32_t *dst, size_t count)
+		{
+			const __m256i mask = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+												  -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+			size_t i = 0;
+			for(; i + 10 <= count; i += 8) {
+				__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + 3 * i))),
+													_mm_loadu_si128((const __m128i *)(src + 3 * i + 12)), 1);
+				_mm256_storeu_si256((__m256i *)(dst + i), _mm256_srai_epi32(_mm256_shuffle_epi8(v, mask), 8));
+			}
+			scalar::UnpackInt24ToInt32(src + 3 * i, dst + i, count - i);
+		}
+
+		const KernelTable kKernels = {
+			SFBSampleFormatKernelsISAAVX2,
+			DeinterleaveFloat32,
+			sse2::InterleaveFloat32,
+			DeinterleaveInt32,
+			DeinterleaveInt32ToFloat32,
+			ConvertInt32ToFloat32,
+			ConvertFloat32ToInt32,
+			ShiftInt32,
+			NarrowInt32ToInt16,
+			sse2::NarrowInt32ToInt8,
+			WidenInt16ToInt32,
+			PackInt32ToInt24,
+			UnpackInt24ToInt32,
+			scalar::PackDoP,
+		};
+
+	}
+
+#undef SFB_AVX2
+
+#endif /* SFB_KERNELS_X86 */
+
+#if SFB_KERNELS_NEON
+
+#pragma mark NEON
+
+	namespace neon {
+
+		void DeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveFloat32(src, dst, channels, frames, 0);
+				return;
+			}
+
+			float *left = dst[0];
+			float *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				float32x4x2_t v = vld2q_f32(src + 2 * i);
+				vst1q_f32(left + i, v.val[0]);
+				vst1q_f32(right + i, v.val[1]);
+			}
+			scalar::DeinterleaveFloat32(src, dst, channels, frames, i);
+		}
+
+		void InterleaveFloat32(const float * const *src, float *dst, size_t channels, size_t frames)
+		{
+			if(channels != 2) {
+				scalar::InterleaveFloat32(src, dst, channels, frames, 0);
+				return;
+			}
+
+			const float *left = src[0];
+			const float *right = src[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				float32x4x2_t v = { { vld1q_f32(left + i), vld1q_f32(right + i) } };
+				vst2q_f32(dst + 2 * i, v);
+			}
+			scalar::InterleaveFloat32(src, dst, channels, frames, i);
+		}
+
+		void DeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveInt32(src, dst, channels, frames, shift, 0);
+				return;
+			}
+
+			const int32x4_t count = vdupq_n_s32((int32_t)shift);
+			int32_t *left = dst[0];
+			int32_t *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				int32x4x2_t v = vld2q_s32(src + 2 * i);
+				vst1q_s32(left + i, vshlq_s32(v.val[0], count));
+				vst1q_s32(right + i, vshlq_s32(v.val[1], count));
+			}
+			scalar::DeinterleaveInt32(src, dst, channels, frames, shift, i);
+		}
+
+		void DeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale)
+		{
+			if(channels != 2) {
+				scalar::DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, 0);
+				return;
+			}
+
+			float *left = dst[0];
+			float *right = dst[1];
+			size_t i = 0;
+			for(; i + 4 <= frames; i += 4) {
+				int32x4x2_t v = vld2q_s32(src + 2 * i);
+				vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(v.val[0]), scale));
+				vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(v.val[1]), scale));
+			}
+			scalar::DeinterleaveInt32ToFloat32(src, dst, channels, frames, scale, i);
+		}
+
+		void ConvertInt32ToFloat32(const int32_t *src, float *dst, size_t count, float scale)
+		{
+			size_t i = 0;
+			for(; i + 4 <= count; i += 4)
+				vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)), scale));
+			scalar::ConvertInt32ToFloat32(src + i, dst + i, count - i, scale);
+		}
+
+		void ConvertFloat32ToInt32(const float *src, int32_t *dst, size_t count, float scale)
+		{
+#if defined(__aarch64__)
+			const float32x4_t lo = vdupq_n_f32(kMinInt32Float);
+			const float32x4_t hi = vdupq_n_f32(kMaxInt32Float);
+			size_t i = 0;
+			for(; i + 4 <= count; i += 4) {
+				float32x4_t v = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(src + i), scale), lo), hi);
+				vst1q_s32(dst + i, vcvtnq_s32_f32(v));
+			}
+			scalar::ConvertFloat32ToInt32(src + i, dst + i, count - i, scale);
+#else
+			// 32-bit ARM lacks a round-to-nearest conversion
+			scalar::ConvertFloat32ToInt32(src, dst, count, scale);
+#endif
+		}
+
+		void ShiftInt32(const int32_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			if(shift == 0) {
+				scalar::ShiftInt32(src, dst, count, 0);
+				return;
+			}
+
+			const int32x4_t c = vdupq_n_s32((int32_t)shift);
+			size_t i = 0;
+			for(; i + 4 <= count; i += 4)
+				vst1q_s32(dst + i, vshlq_s32(vld1q_s32(src + i), c));
+			scalar::ShiftInt32(src + i, dst + i, count - i, shift);
+		}
+
+		void NarrowInt32ToInt16(const int32_t *src, int16_t *dst, size_t count, unsigned int shift)
+		{
+			const int32x4_t c = vdupq_n_s32((int32_t)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				int16x4_t a = vmovn_s32(vshlq_s32(vld1q_s32(src + i), c));
+				int16x4_t b = vmovn_s32(vshlq_s32(vld1q_s32(src + i + 4), c));
+				vst1q_s16(dst + i, vcombine_s16(a, b));
+			}
+			scalar::NarrowInt32ToInt16(src + i, dst + i, count - i, shift);
+		}
+
+		void NarrowInt32ToInt8(const int32_t *src, int8_t *dst, size_t count, unsigned int shift)
+		{
+			const int32x4_t c = vdupq_n_s32((int32_t)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				int16x4_t a = vmovn_s32(vshlq_s32(vld1q_s32(src + i), c));
+				int16x4_t b = vmovn_s32(vshlq_s32(vld1q_s32(src + i + 4), c));
+				vst1_s8(dst + i, vmovn_s16(vcombine_s16(a, b)));
+			}
+			scalar::NarrowInt32ToInt8(src + i, dst + i, count - i, shift);
+		}
+
+		void WidenInt16ToInt32(const int16_t *src, int32_t *dst, size_t count, unsigned int shift)
+		{
+			const int32x4_t c = vdupq_n_s32((int32_t)shift);
+			size_t i = 0;
+			for(; i + 8 <= count; i += 8) {
+				int16x8_t v = vld1q_s16(src + i);
+				vst1q_s32(dst + i, vshlq_s32(vmovl_s16(vget_low_s16(v)), c));
+				vst1q_s32(dst + i + 4, vshlq_s32(vmovl_s16(vget_high_s16(v)), c));
+			}
+			scalar::WidenInt16ToInt32(src + i, dst + i, count - i, shift);
+		}
+
+		void PackInt32ToInt24(const int32_t *src, uint8_t *dst, size_t count, unsigned int shift)
+		{
+			const int32x4_t c = vdupq_n_s32((int32_t)shift);
+			int32_t shifted [16];
+			size_t i = 0;
+			for(; i + 16 <= count; i += 16) {
+				const int32_t *input = src + i;
+				if(shift) {
+					vst1q_s32(shifted, vshlq_s32(vld1q_s32(input), c));
+					vst1q_s32(shifted + 4, vshlq_s32(vld1q_s32(input + 4), c));
+					vst1q_s32(shifted + 8, vshlq_s32(vld1q_s32(input + 8), c));
+					vst1q_s32(shifted + 12, vshlq_s32(vld1q_s32(input + 12), c));
+					input = shifted;
+				}
+				// Byte 3 of each little-endian sample is dropped
+				uint8x16x4_t v = vld4q_u8((const uint8_t *)input);
+				uint8x16x3_t packed = { { v.val[0], v.val[1], v.val[2] } };
+				vst3q_u8(dst + 3 * i, packed);
+			}
+			scalar::PackInt32ToInt24(src + i, dst + 3 * i, count - i, shift);
+		}
+
+		void UnpackInt24ToInt32(const uint8_t *src, int32_t *dst, size_t count)
+		{
+			size_t i = 0;
+			for(; i + 16 <= count; i += 16) {
+				uint8x16x3_t v = vld3q_u8(src + 3 * i);
+				uint8x16x4_t unpacked = { { vdupq_n_u8(0), v.val[0], v.val[1], v.val[2] } };
+				vst4q_u8((uint8_t *)(dst + i), unpacked);
+				for(size_t j = 0; j < 16; j += 4)
+					vst1q_s32(dst + i + j, vshrq_n_s32(vld1q_s32(dst + i + j), 8));
+			}
+			scalar::UnpackInt24ToInt32(src + 3 * i, dst + i, count - i);
+		}
+
+		void PackDoP(const uint8_t *src, ptrdiff_t stride, uint8_t *dst, size_t frames, uint8_t *marker, bool reverseBits)
+		{
+			if(stride != 1) {
+				scalar::PackDoP(src, stride, dst, frames, marker, reverseBits);
+				return;
+			}
+
+			// Sixteen frames leave the marker unchanged
+			const uint8_t other = *marker == (uint8_t)0x05 ? (uint8_t)0xfa : (uint8_t)0x05;
+			const uint8x8_t pair = vreinterpret_u8_u16(vdup_n_u16((uint16_t)(*marker | (other << 8))));
+			const uint8x16_t markers = vcombine_u8(pair, pair);
+
+			size_t i = 0;
+			for(; i + 16 <= frames; i += 16) {
+				uint8x16x2_t v = vld2q_u8(src + 2 * i);
+#if defined(__aarch64__)
+				if(reverseBits) {
+					v.val[0] = vrbitq_u8(v.val[0]);
+					v.val[1] = vrbitq_u8(v.val[1]);
+				}
+#else
+				if(reverseBits)
+					break;
+#endif
+				uint8x16x3_t dop = { { markers, v.val[0], v.val[1] } };
+				vst3q_u8(dst + 3 * i, dop);
+			}
+			scalar::PackDoP(src + 2 * i, stride, dst + 3 * i, frames - i, marker, reverseBits);
+		}
+
+		const KernelTable kKernels = {
+			SFBSampleFormatKernelsISANEON,
+			DeinterleaveFloat32,
+			InterleaveFloat32,
+			DeinterleaveInt32,
+			DeinterleaveInt32ToFloat32,
+			ConvertInt32ToFloat32,
+			ConvertFloat32ToInt32,
+			ShiftInt32,
+			NarrowInt32ToInt16,
+			NarrowInt32ToInt8,
+			WidenInt16ToInt32,
+			PackInt32ToInt24,
+			UnpackInt24ToInt32,
+			PackDoP,
+		};
+
+	}
+
+#endif /* SFB_KERNELS_NEON */
+
+#pragma mark Dispatch
+
+	const KernelTable * KernelsForISA(SFBSampleFormatKernelsISA isa)
+	{
+		switch(isa) {
+			case SFBSampleFormatKernelsISAScalar:
+				return &scalar::kKernels;
+#if SFB_KERNELS_X86
+			case SFBSampleFormatKernelsISASSE2:
+				return &sse2::kKernels;
+			case SFBSampleFormatKernelsISAAVX2:
+				return __builtin_cpu_supports("avx2") ? &avx2::kKernels : nullptr;
+#endif
+#if SFB_KERNELS_NEON
+			case SFBSampleFormatKernelsISANEON:
+				return &neon::kKernels;
+#endif
+			default:
+				return nullptr;
+		}
+	}
+
+	const KernelTable * BestKernels()
+	{
+#if SFB_KERNELS_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2"))
+			return &avx2::kKernels;
+		return &sse2::kKernels;
+#elif SFB_KERNELS_NEON
+		return &neon::kKernels;
+#else
+		return &scalar::kKernels;
+#endif
+	}
+
+	// Initialized before main() so the kernels may be used from any thread
+	const KernelTable *sKernels = BestKernels();
+
+}
+
+SFBSampleFormatKernelsISA SFBSampleFormatKernelsGetISA()
+{
+	return sKernels->mISA;
+}
+
+bool SFBSampleFormatKernelsSetISA(SFBSampleFormatKernelsISA isa)
+{
+	auto kernels = KernelsForISA(isa);
+	if(!kernels)
+		return false;
+	sKernels = kernels;
+	return true;
+}
+
+void SFBDeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames)
+{
+	sKernels->mDeinterleaveFloat32(src, dst, channels, frames);
+}
+
+void SFBInterleaveFloat32(const float * const *src, float *dst, size_t channels, size_t frames)
+{
+	sKernels->mInterleaveFloat32(src, dst, channels, frames);
+}
+
+void SFBDeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift)
+{
+	sKernels->mDeinterleaveInt32(src, dst, channels, frames, shift);
+}
+
+void SFBDeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale)
+{
+	sKernels->mDeinterleaveInt32ToFloat32(src, dst, channels, frames, scale);
+}
+
+void SFBConvertInt32ToFloat32(const int32_t *src, float *dst, size_t count, float scale)
+{
+	sKernels->mConvertInt32ToFloat32(src, dst, count, scale);
+}
+
+void SFBConvertFloat32ToInt32(const float *src, int32_t *dst, size_t count, float scale)
+{
+	sKernels->mConvertFloat32ToInt32(src, dst, count, scale);
+}
+
+void SFBShiftInt32(const int32_t *src, int32_t *dst, size_t count, unsigned int shift)
+{
+	sKernels->mShiftInt32(src, dst, count, shift);
+}
+
+void SFBNarrowInt32ToInt16(const int32_t *src, int16_t *dst, size_t count, unsigned int shift)
+{
+	sKernels->mNarrowInt32ToInt16(src, dst, count, shift);
+}
+
+void SFBNarrowInt32ToInt8(const int32_t *src, int8_t *dst, size_t count, unsigned int shift)
+{
+	sKernels->mNarrowInt32ToInt8(src, dst, count, shift);
+}
+
+void SFBWidenInt16ToInt32(const int16_t *src, int32_t *dst, size_t count, unsigned int shift)
+{
+	sKernels->mWidenInt16ToInt32(src, dst, count, shift);
+}
+
+void SFBPackInt32ToInt24(const int32_t *src, uint8_t *dst, size_t count, unsigned int shift)
+{
+	sKernels->mPackInt32ToInt24(src, dst, count, shift);
+}
+
+void SFBUnpackInt24ToInt32(const uint8_t *src, int32_t *dst, size_t count)
+{
+	sKernels->mUnpackInt24ToInt32(src, dst, count);
+}
+
+void SFBPackDoP(const uint8_t *src, ptrdiff_t stride, uint8_t *dst, size_t frames, uint8_t *marker, bool reverseBits)
+{
+	sKernels->mPackDoP(src, stride, dst, frames, marker, reverseBits);
+}
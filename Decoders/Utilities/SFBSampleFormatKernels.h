@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2020 Stephen F. Booth <me@sbooth.org>
+ * See https://github.com/sbooth/SFBAudioEngine/blob/master/LICENSE.txt for license information
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*! @file SFBSampleFormatKernels.h @brief Vectorized sample format conversion */
+
+/*
+ * The kernels are selected at runtime for the best instruction set supported by the processor:
+ * SSE2 or AVX2 on x86_64 and NEON on arm64, with a scalar fallback. All kernels produce
+ * identical results regardless of the instruction set used.
+ *
+ * Integer samples are in host byte order unless noted otherwise. A shift moves samples
+ * toward the high-order bits, for example to convert low-aligned samples to high alignment.
+ * Narrowing conversions keep the low-order bits of the shifted value.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @brief Instruction sets available for sample format kernels */
+typedef enum SFBSampleFormatKernelsISA {
+	/*! @brief Portable C */
+	SFBSampleFormatKernelsISAScalar		= 0,
+	/*! @brief x86 SSE2 */
+	SFBSampleFormatKernelsISASSE2		= 1,
+	/*! @brief x86 AVX2 */
+	SFBSampleFormatKernelsISAAVX2		= 2,
+	/*! @brief ARM NEON */
+	SFBSampleFormatKernelsISANEON		= 3,
+} SFBSampleFormatKernelsISA;
+
+/*! @brief Returns the instruction set used by the kernels */
+SFBSampleFormatKernelsISA SFBSampleFormatKernelsGetISA(void);
+
+/*!
+ * @brief Selects the instruction set used by the kernels
+ *
+ * This is intended for testing and benchmarking and is not thread safe.
+ * @return \c true if \c isa is supported by the processor, \c false otherwise
+ */
+bool SFBSampleFormatKernelsSetISA(SFBSampleFormatKernelsISA isa);
+
+#pragma mark Interleaving
+
+/*! @brief Deinterleaves \c frames frames of \c channels channels from \c src into the buffers in \c dst */
+void SFBDeinterleaveFloat32(const float *src, float * const *dst, size_t channels, size_t frames);
+
+/*! @brief Interleaves \c frames frames of \c channels channels from the buffers in \c src into \c dst */
+void SFBInterleaveFloat32(const float * const *src, float *dst, size_t channels, size_t frames);
+
+/*! @brief Deinterleaves and shifts \c frames frames of \c channels channels from \c src into the buffers in \c dst */
+void SFBDeinterleaveInt32(const int32_t *src, int32_t * const *dst, size_t channels, size_t frames, unsigned int shift);
+
+/*! @brief Deinterleaves \c frames frames of \c channels channels from \c src into the buffers in \c dst, multiplying by \c scale */
+void SFBDeinterleaveInt32ToFloat32(const int32_t *src, float * const *dst, size_t channels, size_t frames, float scale);
+
+#pragma mark Integer and Floating Point Conversion
+
+/*! @brief Converts \c count samples from \c src to \c dst, multiplying by \c scale */
+void SFBConvertInt32ToFloat32(const int32_t *src, float *dst, size_t count, float scale);
+
+/*! @brief Converts \c count samples from \c src to \c dst, multiplying by \c scale and clipping to the range of \c int32_t */
+void SFBConvertFloat32ToInt32(const float *src, int32_t *dst, size_t count, float scale);
+
+#pragma mark Narrowing and Widening
+
+/*! @brief Shifts \c count samples from \c src into \c dst */
+void SFBShiftInt32(const int32_t *src, int32_t *dst, size_t count, unsigned int shift);
+
+/*! @brief Shifts and narrows \c count samples from \c src into \c dst */
+void SFBNarrowInt32ToInt16(const int32_t *src, int16_t *dst, size_t count, unsigned int shift);
+
+/*! @brief Shifts and narrows \c count samples from \c src into \c dst */
+void SFBNarrowInt32ToInt8(const int32_t *src, int8_t *dst, size_t count, unsigned int shift);
+
+/*! @brief Widens and shifts \c count samples from \c src into \c dst */
+void SFBWidenInt16ToInt32(const int16_t *src, int32_t *dst, size_t count, unsigned int shift);
+
+/*! @brief Shifts and packs \c count samples from \c src into \c dst as 24-bit little-endian values */
+void SFBPackInt32ToInt24(const int32_t *src, uint8_t *dst, size_t count, unsigned int shift);
+
+/*! @brief Unpacks and sign-extends \c count 24-bit little-endian values from \c src into \c dst */
+void SFBUnpackInt24ToInt32(const uint8_t *src, int32_t *dst, size_t count);
+
+#pragma mark DSD over PCM
+
+/*!
+ * @brief Packs DSD bytes into DoP frames
+ *
+ * Each output frame consists of the DoP marker followed by two bytes from \c src. The marker
+ * alternates between \c 0x05 and \c 0xfa starting with \c *marker, which receives the next marker.
+ * @param src The DSD input
+ * @param stride The distance between consecutive bytes in \c src
+ * @param dst The DoP output, which must have space for \c 3 * \c frames bytes
+ * @param frames The number of DoP frames to produce
+ * @param marker The initial marker, which receives the next marker
+ * @param reverseBits Whether the bit order of the DSD bytes should be reversed
+ */
+void SFBPackDoP(const uint8_t *src, ptrdiff_t stride, uint8_t *dst, size_t frames, uint8_t *marker, bool reverseBits);
+
+#ifdef __cplusplus
+}
+#endif
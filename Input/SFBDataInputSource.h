@@ -14,6 +14,13 @@ NS_ASSUME_NONNULL_BEGIN
 - (instancetype)initWithData:(NSData *)data NS_DESIGNATED_INITIALIZER;
 - (nullable instancetype)initWithBytes:(const void *)bytes length:(NSInteger)length;
 - (instancetype)initWithBytesNoCopy:(void *)bytes length:(NSInteger)length freeWhenDone:(BOOL)freeWhenDone;
+
+/// Returns a pointer to the bytes at the current read position and advances the read position
+/// @note The returned pointer is valid until the input source is closed
+/// @param length The maximum number of bytes to read
+/// @param bytesRead The number of bytes actually available at the returned pointer
+/// @return A pointer to the bytes at the current read position or \c NULL if the input source is not open
+- (nullable const void *)readBytesNoCopyWithLength:(NSInteger)length bytesRead:(NSInteger *)bytesRead;
 @end
 
 NS_ASSUME_NONNULL_END
@@ -80,6 +80,26 @@
 	return YES;
 }
 
+- (const void *)readBytesNoCopyWithLength:(NSInteger)length bytesRead:(NSInteger *)bytesRead
+{
+	NSParameterAssert(length > 0);
+	NSParameterAssert(bytesRead != NULL);
+
+	if(!_data)
+		return NULL;
+
+	NSUInteger count = (NSUInteger)length;
+	NSUInteger remaining = _data.length - _pos;
+	if(count > remaining)
+		count = remaining;
+
+	const void *bytes = (const uint8_t *)_data.bytes + _pos;
+	_pos += count;
+	*bytesRead = (NSInteger)count;
+
+	return bytes;
+}
+
 - (BOOL)getOffset:(NSInteger *)offset error:(NSError **)error
 {
 	NSParameterAssert(offset != NULL);
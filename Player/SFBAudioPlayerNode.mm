@@ -79,6 +79,22 @@ namespace {
 
 #pragma mark - Decoder State
 
+	/// Returns \c true if audio in \c lhs may be used as audio in \c rhs without conversion
+	bool FormatsAreEquivalent(AVAudioFormat *lhs, AVAudioFormat *rhs)
+	{
+		const AudioStreamBasicDescription *a = lhs.streamDescription;
+		const AudioStreamBasicDescription *b = rhs.streamDescription;
+
+		if(a->mFormatID != b->mFormatID || a->mFormatFlags != b->mFormatFlags || a->mSampleRate != b->mSampleRate || a->mBytesPerPacket != b->mBytesPerPacket || a->mFramesPerPacket != b->mFramesPerPacket || a->mBytesPerFrame != b->mBytesPerFrame || a->mChannelsPerFrame != b->mChannelsPerFrame || a->mBitsPerChannel != b->mBitsPerChannel)
+			return false;
+
+		// Mono and stereo audio doesn't require a channel layout
+		if(a->mChannelsPerFrame <= 2)
+			return true;
+
+		return lhs.channelLayout == rhs.channelLayout || [lhs.channelLayout isEqual:rhs.channelLayout];
+	}
+
 	/// State data for tracking/syncing decoding progress
 	struct DecoderStateData {
 		using atomic_ptr = std::atomic<DecoderStateData *>;
@@ -115,6 +131,8 @@ namespace {
 		id <SFBPCMDecoding> 	mDecoder;
 		/// Converts audio from the decoder's processing format to another PCM variant at the same sample rate
 		AVAudioConverter 		*mConverter;
+		/// \c true if the decoder lends audio that needs no conversion
+		bool 					mWritesBorrowedAudio;
 	private:
 		/// Buffer used internally for buffering during conversion
 		AVAudioPCMBuffer 		*mDecodeBuffer;
@@ -123,13 +141,15 @@ namespace {
 
 	public:
 		DecoderStateData(id <SFBPCMDecoding> decoder, AVAudioFormat *format, AVAudioFrameCount frameCapacity = kDefaultBufferSize)
-			: mSequenceNumber(sSequenceNumber++), mFlags(0), mFramesDecoded(0), mFramesConverted(0), mFramesRendered(0), mFrameLength(decoder.frameLength), mFrameToSeek(kInvalidFramePosition), mDecoder(decoder), mConverter(nil), mDecodeBuffer(nil)
+			: mSequenceNumber(sSequenceNumber++), mFlags(0), mFramesDecoded(0), mFramesConverted(0), mFramesRendered(0), mFrameLength(decoder.frameLength), mFrameToSeek(kInvalidFramePosition), mDecoder(decoder), mConverter(nil), mWritesBorrowedAudio(false), mDecodeBuffer(nil)
 		{
 			mConverter = [[AVAudioConverter alloc] initFromFormat:mDecoder.processingFormat toFormat:format];
 			// The logic in this class assumes no SRC is performed by mConverter
 			assert(mConverter.inputFormat.sampleRate == mConverter.outputFormat.sampleRate);
 			mDecodeBuffer = [[AVAudioPCMBuffer alloc] initWithPCMFormat:mConverter.inputFormat frameCapacity:frameCapacity];
 
+			mWritesBorrowedAudio = [mDecoder respondsToSelector:@selector(borrowBufferList:frameLength:maximumFrameLength:error:)] && FormatsAreEquivalent(mConverter.inputFormat, mConverter.outputFormat);
+
 			AVAudioFramePosition framePosition = decoder.framePosition;
 			if(framePosition != 0) {
 				mFramesDecoded.store(framePosition);
@@ -185,6 +205,37 @@ namespace {
 			return true;
 		}
 
+		/// Writes up to \c frameLength frames lent by the decoder directly to \c ringBuffer
+		/// @note Only valid if \c mWritesBorrowedAudio is \c true
+		bool DecodeAudio(SFB::Audio::RingBuffer& ringBuffer, AVAudioFrameCount frameLength, NSError **error = nullptr)
+		{
+			if(!(mFlags.load() & eDecodingStartedFlag))
+				mFlags.fetch_or(eDecodingStartedFlag);
+
+			AVAudioFrameCount framesWritten = 0;
+			while(framesWritten < frameLength) {
+				const AudioBufferList *bufferList = nullptr;
+				AVAudioFrameCount framesDecoded = 0;
+				if(![mDecoder borrowBufferList:&bufferList frameLength:&framesDecoded maximumFrameLength:(frameLength - framesWritten) error:error])
+					return false;
+
+				this->mFramesDecoded.fetch_add(framesDecoded);
+
+				if(framesDecoded == 0) {
+					mFlags.fetch_or(eDecodingCompleteFlag);
+					break;
+				}
+
+				if(ringBuffer.Write(bufferList, framesDecoded) != framesDecoded)
+					os_log_error(_audioPlayerNodeLog, "SFB::Audio::RingBuffer::Write() failed");
+
+				mFramesConverted.fetch_add(framesDecoded);
+				framesWritten += framesDecoded;
+			}
+
+			return true;
+		}
+
 		/// Seeks to the frame specified by \c mFrameToSeek
 		bool PerformSeek()
 		{
@@ -1067,15 +1118,22 @@ namespace {
 							});
 					}
 
-					// Decode audio into the buffer, converting to the bus format in the process
 					NSError *error;
-					if(!decoderState->DecodeAudio(buffer, &error))
-						os_log_error(_audioPlayerNodeLog, "Error decoding audio: %{public}@", error);
-
-					// Write the decoded audio to the ring buffer for rendering
-					auto framesWritten = _audioRingBuffer.Write(buffer.audioBufferList, buffer.frameLength);
-					if(framesWritten != buffer.frameLength)
-						os_log_error(_audioPlayerNodeLog, "SFB::Audio::RingBuffer::Write() failed");
+					if(decoderState->mWritesBorrowedAudio) {
+						// Audio already in the bus format is written to the ring buffer without an intermediate copy
+						if(!decoderState->DecodeAudio(_audioRingBuffer, kRingBufferChunkSize, &error))
+							os_log_error(_audioPlayerNodeLog, "Error decoding audio: %{public}@", error);
+					}
+					else {
+						// Decode audio into the buffer, converting to the bus format in the process
+						if(!decoderState->DecodeAudio(buffer, &error))
+							os_log_error(_audioPlayerNodeLog, "Error decoding audio: %{public}@", error);
+
+						// Write the decoded audio to the ring buffer for rendering
+						auto framesWritten = _audioRingBuffer.Write(buffer.audioBufferList, buffer.frameLength);
+						if(framesWritten != buffer.frameLength)
+							os_log_error(_audioPlayerNodeLog, "SFB::Audio::RingBuffer::Write() failed");
+					}
 
 					if(decoderState->mFlags.load() & DecoderStateData::eDecodingCompleteFlag) {
 						// Some formats (MP3) may not know the exact number of frames in advance
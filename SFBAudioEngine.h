@@ -16,11 +16,13 @@ FOUNDATION_EXPORT const unsigned char SFBAudioEngineVersionString [];
 #import <SFBAudioEngine/SFBAudioDecoding.h>
 #import <SFBAudioEngine/SFBPCMDecoding.h>
 #import <SFBAudioEngine/SFBAudioDecoder.h>
+#import <SFBAudioEngine/SFBAudioDecoderPool.h>
 #import <SFBAudioEngine/SFBDSDDecoding.h>
 #import <SFBAudioEngine/SFBDSDDecoder.h>
 #import <SFBAudioEngine/SFBDSDPCMDecoder.h>
 #import <SFBAudioEngine/SFBDoPDecoder.h>
 #import <SFBAudioEngine/SFBLoopableRegionDecoder.h>
+#import <SFBAudioEngine/SFBCachedPCMDecoder.h>
 
 #if TARGET_OS_OSX
 
@@ -38,6 +40,7 @@ FOUNDATION_EXPORT const unsigned char SFBAudioEngineVersionString [];
 #import <SFBAudioEngine/SFBAudioMetadata.h>
 #import <SFBAudioEngine/SFBAudioFile.h>
 
+#import <SFBAudioEngine/SFBDSDAnalyzer.h>
 #import <SFBAudioEngine/SFBReplayGainAnalyzer.h>
 
 #import <SFBAudioEngine/SFBAudioExporter.h>